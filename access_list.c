@@ -36,7 +36,7 @@ static pthread_mutex_t acl_lock = PTHREAD_MUTEX_INITIALIZER;
 /* Returns     : none                                                         */
 /*                                                                            */
 /*FUNC-************************************************************************/
-static void lock_acl(void)
+void lock_acl(void)
 {
   pthread_mutex_lock(&acl_lock);
 }
@@ -52,88 +52,438 @@ static void lock_acl(void)
 /* Returns     : none                                                         */
 /*                                                                            */
 /*FUNC-************************************************************************/
-static void unlock_acl(void)
+void unlock_acl(void)
 {
   pthread_mutex_unlock(&acl_lock);
 }
 
 
 /*FUNC+************************************************************************/
-/* Function    : acl_sweeper                                                  */
+/* Function    : acl_tick                                                     */
+/*                                                                            */
+/* Description : Get current ACL expiry tick.                                 */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : tick                     - Monotonic tick.                   */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static inline unsigned long acl_tick(void)
+{
+  return(get_mono_usecs() / (ACL_TICK_MS * 1000));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : init_src_dest_whitelist                                      */
 /*                                                                            */
-/* Description : ACL sweeper processing loop.                                 */
+/* Description : Initialize source-destination whitelist tables.              */
 /*                                                                            */
 /* Params      : none                                                         */
 /*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int init_src_dest_whitelist(void)
+{
+  int ret;
+
+  tw_init(&dnswld.acl.sd.expiry, acl_tick());
+
+  ret = rhash_init(&dnswld.acl.sd.pairs);
+  if (!ret)
+  {
+    ret = rhash_init(&dnswld.acl.sd.srcs);
+  }
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : find_src_dest_acl                                            */
+/*                                                                            */
+/* Description : Find ACL entry of a source-destination pair. ACL must be     */
+/*               locked.                                                      */
+/*                                                                            */
+/* Params      : src (IN)                 - Source IP.                        */
+/*               dst (IN)                 - Destination IP.                   */
+/*                                                                            */
+/* Returns     : entry                    - ACL entry otherwise NULL.         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+src_dest_cb *find_src_dest_acl(unsigned int src, unsigned int dst)
+{
+  return((src_dest_cb *)rhash_find(&dnswld.acl.sd.pairs,
+                                   ACL_PAIR_KEY(src, dst)));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : arm_acl                                                      */
+/*                                                                            */
+/* Description : (Re)arm an entry's timer. ACL must be locked.                */
+/*                                                                            */
+/* Params      : sd_cb (IN/OUT)           - ACL entry.                        */
+/*               at (IN)                  - Wall clock time to fire at.       */
+/*                                                                            */
 /* Returns     : none                                                         */
 /*                                                                            */
 /*FUNC-************************************************************************/
-void *acl_sweeper(void *param)
+static void arm_acl(src_dest_cb *sd_cb, time_t at)
 {
-  llist *acl;
-  src_dest_cb *runner;
-  src_dest_cb *prev;
-  src_dest_cb *tmp;
-  time_t cur_time;
-  double delta_time;
-  int i;
+  unsigned long expires;
+  time_t now;
 
-  is_sweeper_started = TRUE;
+  tw_del(&dnswld.acl.sd.expiry, &sd_cb->timer);
 
-  PUTS_OSYS(LOG_DEBUG, "ACL sweeper thread: Started");
+  /****************************************************************************/
+  /* Expiry is kept in wall clock time; map what is left of it to ticks.      */
+  /****************************************************************************/
+  now = time(NULL);
+  expires = acl_tick();
+  if (at > now)
+  {
+    expires += (unsigned long)(at - now) * 1000 / ACL_TICK_MS;
+  }
 
-  while (dnswld.proc.is_running)
+  sd_cb->timer.data = sd_cb;
+  tw_add(&dnswld.acl.sd.expiry, &sd_cb->timer, expires);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : link_acl                                                     */
+/*                                                                            */
+/* Description : Add entry to the pair table, its source index, the list of   */
+/*               all entries and the expiry wheel. ACL must be locked.        */
+/*                                                                            */
+/* Params      : sd_cb (IN)               - ACL entry.                        */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int link_acl(src_dest_cb *sd_cb)
+{
+  src_dest_acl *acl = &dnswld.acl.sd;
+  src_acl_cb *s_cb;
+  int ret;
+
+  s_cb = (src_acl_cb *)rhash_find(&acl->srcs, sd_cb->src);
+  if (!s_cb)
   {
-    for (i = 0; i < ACCESS_LIST_HASH_SIZE; i++)
+    s_cb = (src_acl_cb *)calloc(1, sizeof(src_acl_cb));
+    if (!s_cb)
     {
-      lock_acl();
+      return(RET_MEMORY_ERROR);
+    }
+
+    s_cb->src = sd_cb->src;
+    ret = rhash_insert(&acl->srcs, sd_cb->src, s_cb);
+    if (ret)
+    {
+      free(s_cb);
+      return(ret);
+    }
+  }
+
+  ret = rhash_insert(&acl->pairs, ACL_PAIR_KEY(sd_cb->src, sd_cb->dst),
+                     sd_cb);
+  if (ret)
+  {
+    if (!s_cb->n_dst)
+    {
+      rhash_remove(&acl->srcs, s_cb->src);
+      free(s_cb);
+    }
+    return(ret);
+  }
+
+  sd_cb->src_prev = NULL;
+  sd_cb->src_next = s_cb->head;
+  if (s_cb->head)
+  {
+    s_cb->head->src_prev = sd_cb;
+  }
+  s_cb->head = sd_cb;
+  s_cb->n_dst++;
+
+  sd_cb->next = NULL;
+  sd_cb->prev = acl->tail;
+  if (acl->tail)
+  {
+    acl->tail->next = sd_cb;
+  }
+  else
+  {
+    acl->head = sd_cb;
+  }
+  acl->tail = sd_cb;
+
+  arm_acl(sd_cb, sd_cb->expiry);
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : unlink_acl                                                   */
+/*                                                                            */
+/* Description : Remove entry from the pair table, its source index, the list */
+/*               of all entries and the expiry wheel. ACL must be locked.     */
+/*                                                                            */
+/* Params      : sd_cb (IN)               - ACL entry.                        */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void unlink_acl(src_dest_cb *sd_cb)
+{
+  src_dest_acl *acl = &dnswld.acl.sd;
+  src_acl_cb *s_cb;
+
+  rhash_remove(&acl->pairs, ACL_PAIR_KEY(sd_cb->src, sd_cb->dst));
+  tw_del(&acl->expiry, &sd_cb->timer);
+
+  s_cb = (src_acl_cb *)rhash_find(&acl->srcs, sd_cb->src);
+  if (s_cb)
+  {
+    if (sd_cb->src_prev)
+    {
+      sd_cb->src_prev->src_next = sd_cb->src_next;
+    }
+    else
+    {
+      s_cb->head = sd_cb->src_next;
+    }
+
+    if (sd_cb->src_next)
+    {
+      sd_cb->src_next->src_prev = sd_cb->src_prev;
+    }
+
+    if (--s_cb->n_dst == 0)
+    {
+      rhash_remove(&acl->srcs, s_cb->src);
+      free(s_cb);
+    }
+  }
+
+  if (sd_cb->prev)
+  {
+    sd_cb->prev->next = sd_cb->next;
+  }
+  else
+  {
+    acl->head = sd_cb->next;
+  }
+
+  if (sd_cb->next)
+  {
+    sd_cb->next->prev = sd_cb->prev;
+  }
+  else
+  {
+    acl->tail = sd_cb->prev;
+  }
+
+  sd_cb->prev = sd_cb->next = NULL;
+  sd_cb->src_prev = sd_cb->src_next = NULL;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : post_acl_fw_cmd                                              */
+/*                                                                            */
+/* Description : Queue firewall command for an ACL entry.                     */
+/*                                                                            */
+/* Params      : sd_cb (IN)               - ACL entry.                        */
+/*               op (IN)                  - FW_CMD_* command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int post_acl_fw_cmd(src_dest_cb *sd_cb, int op)
+{
+  fw_cmd cmd;
+  int ret;
 
-      acl = &dnswld.acl.ll.h[i];
+  cmd.op = op;
+  cmd.s_ip = sd_cb->src;
+  cmd.d_ip = sd_cb->dst;
+  cmd.action = FW_ACCEPT_RULE;
+  cmd.created_at = sd_cb->created_at;
+  cmd.expiry = (op == FW_CMD_REFRESH) ? sd_cb->expiry : sd_cb->fw_expiry;
+  cmd.dom_id = sd_cb->dom_id;
+
+  ret = post_fw_cmd(&cmd);
+
+  /****************************************************************************/
+  /* A delete must not be lost. Callers are off the DNS path, so when it      */
+  /* can't be queued the rule is deleted in place. Only adds report back to   */
+  /* the ACL, so this doesn't take the ACL lock again.                        */
+  /****************************************************************************/
+  if (((ret == RET_QUEUE_FULL) || (ret == RET_FW_NOT_STARTED)) &&
+      (op != FW_CMD_ADD))
+  {
+    ret = run_fw_cmd(&cmd);
+  }
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : set_acl_fw_status                                            */
+/*                                                                            */
+/* Description : Record the result of programming an entry's firewall rule.   */
+/*               Called by the firewall thread. The entry must still be the   */
+/*               one the rule was made for.                                   */
+/*                                                                            */
+/* Params      : src (IN)                 - Source IP.                        */
+/*               dst (IN)                 - Destination IP.                   */
+/*               created_at (IN)          - Creation timestamp of the rule.   */
+/*               status (IN)              - ACL status.                       */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void set_acl_fw_status(unsigned int src, unsigned int dst,
+                       unsigned int created_at, int status)
+{
+  src_dest_cb *sd_cb;
+
+  lock_acl();
+
+  sd_cb = find_src_dest_acl(src, dst);
+  if ((sd_cb) && ((unsigned int)sd_cb->created_at == created_at))
+  {
+    sd_cb->last_status = status;
+  }
 
-      for (runner = acl->head, prev = NULL; runner; )
+  unlock_acl();
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : extend_acl                                                   */
+/*                                                                            */
+/* Description : Push an entry's expiry a full age from now and refresh its   */
+/*               rule, for backends whose rules time out in the kernel. ACL   */
+/*               must be locked.                                              */
+/*                                                                            */
+/* Params      : sd_cb (IN/OUT)           - ACL entry.                        */
+/*               now (IN)                 - Current time.                     */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void extend_acl(src_dest_cb *sd_cb, time_t now)
+{
+  sd_cb->expiry = now + sd_cb->age;
+  arm_acl(sd_cb, sd_cb->expiry);
+
+  STATS_INC(n_acl_refreshes);
+
+  if (!dnswld.proc.disable_fw)
+  {
+    post_acl_fw_cmd(sd_cb, FW_CMD_REFRESH);
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : expire_acl                                                   */
+/*                                                                            */
+/* Description : Delete an expired ACL entry and its firewall rule. Called    */
+/*               by the expiry wheel with the ACL locked. When expiring on    */
+/*               idleness an entry with open flows is extended instead, and   */
+/*               one that saw no flow within the grace window is reclaimed    */
+/*               before its expiry.                                           */
+/*                                                                            */
+/* Params      : node (IN)                - Timer node of the entry.          */
+/*               arg (IN)                 - Unused.                           */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void expire_acl(tw_node *node, void *arg)
+{
+  src_dest_cb *sd_cb = (src_dest_cb *)node->data;
+  time_t now = time(NULL);
+  int op = FW_CMD_EXPIRE;
+
+  if (dnswld.acl.ct_grace)
+  {
+    if (sd_cb->n_flows > 0)
+    {
+      extend_acl(sd_cb, now);
+      return;
+    }
+
+    if (sd_cb->expiry > now)
+    {
+      if (sd_cb->last_active)
       {
-        cur_time = time(NULL);
-        delta_time = difftime(cur_time, runner->created_at);
-        if (delta_time > (double)runner->age)
-        {
-          PUTS_OSYS(LOG_DEBUG, " Deleting ACL src: [%d.%d.%d.%d], dst: [%d.%d.%d.%d], age: %f",
-                (runner->src >> 24) & 0xFF,
-                (runner->src >> 16) & 0xFF,
-                (runner->src >> 8) & 0xFF,
-                runner->src & 0xFF,
-                (runner->dst >> 24) & 0xFF,
-                (runner->dst >> 16) & 0xFF,
-                (runner->dst >> 8) & 0xFF,
-                runner->dst & 0xFF,
-                delta_time);
-
-          if (!prev)
-          {
-            acl->head = runner->next;
-          }
-          else
-          {
-            prev->next = runner->next;
-          }
-
-          tmp = runner;
-          runner = runner->next;
-          del_fw_rule(tmp->src, tmp->dst, FW_ACCEPT_RULE, tmp->created_at,
-                      tmp->expiry);
-
-          free(tmp);
-        }
-        else
-        {
-          prev = runner;
-          runner = runner->next;
-        }
+        arm_acl(sd_cb, sd_cb->expiry);
+        return;
       }
 
-      unlock_acl();
+      /************************************************************************/
+      /* The rule has not timed out in the kernel yet.                        */
+      /************************************************************************/
+      STATS_INC(n_acl_reclaimed);
+      op = FW_CMD_DEL;
     }
+  }
+
+  PUTS_OSYS(LOG_DEBUG, " Deleting ACL src: [%d.%d.%d.%d], dst: [%d.%d.%d.%d], age: %lu",
+            (sd_cb->src >> 24) & 0xFF,
+            (sd_cb->src >> 16) & 0xFF,
+            (sd_cb->src >> 8) & 0xFF,
+            sd_cb->src & 0xFF,
+            (sd_cb->dst >> 24) & 0xFF,
+            (sd_cb->dst >> 16) & 0xFF,
+            (sd_cb->dst >> 8) & 0xFF,
+            sd_cb->dst & 0xFF,
+            sd_cb->age);
+
+  unlink_acl(sd_cb);
+  post_acl_fw_cmd(sd_cb, op);
+
+  free(sd_cb);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : acl_sweeper                                                  */
+/*                                                                            */
+/* Description : ACL sweeper processing loop. Every tick only the entries     */
+/*               expiring on it are visited.                                  */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void *acl_sweeper(void *param)
+{
+  struct timespec ts;
+
+  is_sweeper_started = TRUE;
+
+  PUTS_OSYS(LOG_DEBUG, "ACL sweeper thread: Started");
+
+  ts.tv_sec = 0;
+  ts.tv_nsec = ACL_TICK_MS * 1000000L;
 
-    sleep(5);
+  while (dnswld.proc.is_running)
+  {
+    nanosleep(&ts, NULL);
+
+    lock_acl();
+    tw_advance(&dnswld.acl.sd.expiry, acl_tick(), expire_acl, NULL);
+    unlock_acl();
   }
 
   PUTS_OSYS(LOG_DEBUG, "ACL sweeper thread: Done");
@@ -209,17 +559,12 @@ int add_src_dest_to_whitelist(void *src_addr, dns_question *qs, int n_qs)
 {
   src_dest_cb *sd_cb;
   src_dest_cb *runner;
-  src_dest_cb *prev;
-  llist *acl;
   dns_question *q;
   unsigned int s_ip;
   unsigned int d_ip;
-  in_addr_t addr;
   int found;
-  int idx;
   int i;
   int ii;
-  int result;
   int ret;
 
   /****************************************************************************/
@@ -240,8 +585,7 @@ int add_src_dest_to_whitelist(void *src_addr, dns_question *qs, int n_qs)
       /* Convert to int for better handling. Needs further enhancements.      */
       /************************************************************************/
       s_ip = ntohl(*((unsigned int *)(&((struct sockaddr_in*)src_addr)->sin_addr)));
-      addr = inet_addr(q->ans.recs[ii]);
-      d_ip = ntohl(*((unsigned int *)&addr));
+      d_ip = ntohl(q->ans.recs[ii]);
 
       PUTS_OSYS(LOG_DEBUG, " Adding src_ip: [%d.%d.%d.%d], dst_ip: [%d.%d.%d.%d]",
                 (s_ip >> 24) & 0xFF,
@@ -267,111 +611,68 @@ int add_src_dest_to_whitelist(void *src_addr, dns_question *qs, int n_qs)
       sd_cb->age = dnswld.proc.wl_age;
       sd_cb->created_at = time(NULL);
       sd_cb->expiry = sd_cb->created_at + dnswld.proc.wl_age;
-
-      idx = s_ip % ACCESS_LIST_HASH_SIZE;
+      sd_cb->fw_expiry = sd_cb->expiry;
+      sd_cb->dom_id = q->dom_id;
 
       lock_acl();
 
-      acl = &dnswld.acl.ll.h[idx];
-
-      PUTS_OSYS(LOG_DEBUG, " idx: [%d]", idx);
-
       /************************************************************************/
-      /* Insert ACL entry to the list.                                        */
+      /* Insert ACL entry, or take a reference on the existing one.           */
       /************************************************************************/
-      if (acl->head)
+      runner = find_src_dest_acl(s_ip, d_ip);
+      if (runner)
+      {
+        runner->ref_count++;
+        PUTS_OSYS(LOG_DEBUG, "  Found existing acl entry. Ref count: %d",
+                  runner->ref_count);
+        found = TRUE;
+      }
+      else
       {
-        for (runner = acl->head, prev = NULL; runner;
-             prev = runner, runner = runner->next)
+        ret = link_acl(sd_cb);
+        if (ret)
         {
-          result = 1;
-          if (s_ip < runner->src)
-          {
-            result = -1;
-            break;
-          }
-          else if (s_ip == runner->src)
-          {
-            result = 0;
-            if (d_ip == runner->dst)
-            {
-              break;
-            }
-          }
+          PUTS_OSYS(LOG_ERR, " Failed to add ACL entry.");
+          unlock_acl();
+          free(sd_cb);
+          goto EXIT;
         }
 
-        if ((!result) && (runner) && (d_ip == runner->dst))
-        {
-          runner->ref_count++;
-          PUTS_OSYS(LOG_DEBUG, "  Found existing acl entry. Ref count: %d",
-                    runner->ref_count);
-          found = TRUE;
-        }
-        else if (!prev)
-        {
-          PUTS_OSYS(LOG_DEBUG, " Adding before [%d.%d.%d.%d], dst_ip: [%d.%d.%d.%d]",
-                    (runner->src >> 24) & 0xFF,
-                    (runner->src >> 16) & 0xFF,
-                    (runner->src >> 8) & 0xFF,
-                     runner->src & 0xFF,
-                    (runner->dst >> 24) & 0xFF,
-                    (runner->dst >> 16) & 0xFF,
-                    (runner->dst >> 8) & 0xFF,
-                     runner->dst & 0xFF);
-
-          sd_cb->next = runner;
-          acl->head = sd_cb;
-        }
-        else
+        /**********************************************************************/
+        /* Reclaim early unless a flow shows up within the grace window.      */
+        /**********************************************************************/
+        if ((dnswld.acl.ct_grace) &&
+            (dnswld.acl.ct_grace < dnswld.proc.wl_age))
         {
-          PUTS_OSYS(LOG_DEBUG, " Adding after [%d.%d.%d.%d], dst_ip: [%d.%d.%d.%d]",
-                    (prev->src >> 24) & 0xFF,
-                    (prev->src >> 16) & 0xFF,
-                    (prev->src >> 8) & 0xFF,
-                    prev->src & 0xFF,
-                    (prev->dst >> 24) & 0xFF,
-                    (prev->dst >> 16) & 0xFF,
-                    (prev->dst >> 8) & 0xFF,
-                    prev->dst & 0xFF);
-
-          ((src_dest_cb *)prev)->next = sd_cb;
+          arm_acl(sd_cb, sd_cb->created_at + dnswld.acl.ct_grace);
         }
       }
-      else
+
+      if (found)
       {
-        PUTS_OSYS(LOG_DEBUG, " Adding first entry");
-        acl->head = sd_cb;
+        free(sd_cb);
+        sd_cb = runner;
       }
 
       if (((!found) && (!dnswld.proc.disable_fw)) ||
-          ((found) && (runner->last_status == ACL_ADD_ALLOW_RULE_ERR)))
+          ((found) && (sd_cb->last_status == ACL_ADD_ALLOW_RULE_ERR)))
       {
-        PUTS_OSYS(LOG_DEBUG, " Adding FW Pass rule");
+        PUTS_OSYS(LOG_DEBUG, " Queueing FW Pass rule");
         /**********************************************************************/
-        /* Add allow firewall rule for src and dest.                          */
+        /* Queue allow firewall rule for src and dest. The firewall thread    */
+        /* reports failures back to last_status, so the next query for the    */
+        /* pair retries.                                                      */
         /**********************************************************************/
-        ret = add_fw_rule(s_ip, d_ip, FW_ACCEPT_RULE, sd_cb->created_at,
-                          sd_cb->expiry);
+        sd_cb->last_status = ACL_OK;
+        ret = post_acl_fw_cmd(sd_cb, FW_CMD_ADD);
         if (ret)
         {
-          PUTS_OSYS(LOG_CRIT, " Error adding FW Pass rule. Marking ACL entry");
-          if (found)
-          {
-            runner->last_status = ACL_ADD_ALLOW_RULE_ERR;
-          }
-          else
-          {
-            sd_cb->last_status = ACL_ADD_ALLOW_RULE_ERR;
-          }
+          PUTS_OSYS(LOG_CRIT, " Error queueing FW Pass rule. Marking ACL entry");
+          sd_cb->last_status = ACL_ADD_ALLOW_RULE_ERR;
         }
       }
 
       unlock_acl();
-
-      if (found)
-      {
-        free(sd_cb);
-      }
     }
   }
 
@@ -397,78 +698,143 @@ int add_src_dest_to_whitelist(void *src_addr, dns_question *qs, int n_qs)
 int del_src_dest_whitelist(unsigned int src, unsigned int dst)
 {
   src_dest_cb *runner;
-  src_dest_cb *prev;
-  src_dest_cb *tmp;
-  llist *acl;
-  int is_match;
-  int idx;
+  src_acl_cb *s_cb;
   int ret = RET_DATA_NOT_FOUND;
 
-  idx = src % ACCESS_LIST_HASH_SIZE;
-
   lock_acl();
 
-  acl = &dnswld.acl.ll.h[idx];
+  /****************************************************************************/
+  /* One pair, or every destination of the source.                            */
+  /****************************************************************************/
+  if (dst)
+  {
+    runner = find_src_dest_acl(src, dst);
+  }
+  else
+  {
+    s_cb = (src_acl_cb *)rhash_find(&dnswld.acl.sd.srcs, src);
+    runner = s_cb ? s_cb->head : NULL;
+  }
 
-  for (runner = acl->head, prev = NULL; runner; )
+  while (runner)
   {
-    is_match = FALSE;
-    if (src == runner->src)
-    {
-      if (dst)
-      {
-        if (dst == runner->dst)
-        {
-          is_match = TRUE;
-        }
-      }
-      else
-      {
-        is_match = TRUE;
-      }
-    }
-    else if (src > runner->src)
+    PUTS_OSYS(LOG_DEBUG, " ACL found.");
+
+    unlink_acl(runner);
+    post_acl_fw_cmd(runner, FW_CMD_DEL);
+    free(runner);
+
+    ret = RET_OK;
+
+    if (dst)
     {
       break;
     }
 
-    if (is_match)
-    {
-      PUTS_OSYS(LOG_DEBUG, " ACL found.");
+    s_cb = (src_acl_cb *)rhash_find(&dnswld.acl.sd.srcs, src);
+    runner = s_cb ? s_cb->head : NULL;
+  }
 
-      if (!prev)
-      {
-        acl->head = runner->next;
-      }
-      else
-      {
-        prev->next = runner->next;
-      }
+  unlock_acl();
 
-      tmp = runner;
-      runner = runner->next;
-      del_fw_rule(tmp->src, tmp->dst, FW_ACCEPT_RULE, tmp->created_at,
-                  tmp->expiry);
+  return(ret);
+}
 
-      free(tmp);
+/*FUNC+************************************************************************/
+/* Function    : note_acl_flow                                                */
+/*                                                                            */
+/* Description : Account a flow event of a whitelisted pair. An entry in use  */
+/*               is extended once it is past half its age, so a busy pair     */
+/*               costs a rule refresh at most twice per age. A flow listed by */
+/*               a re-sync dump is only counted.                              */
+/*                                                                            */
+/* Params      : src (IN)                 - Source IP.                        */
+/*               dst (IN)                 - Destination IP.                   */
+/*               event (IN)               - ACL_FLOW_* event.                 */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void note_acl_flow(unsigned int src, unsigned int dst, int event)
+{
+  src_dest_cb *sd_cb;
+  time_t now;
+  int is_first;
 
-      ret = RET_OK;
+  lock_acl();
 
-      if (dst)
-      {
-        break;
-      }
-    }
-    else
+  sd_cb = find_src_dest_acl(src, dst);
+  if (!sd_cb)
+  {
+    goto EXIT;
+  }
+
+  if (event == ACL_FLOW_DUMP)
+  {
+    sd_cb->n_dump_flows++;
+    goto EXIT;
+  }
+
+  if (event == ACL_FLOW_NEW)
+  {
+    sd_cb->n_flows++;
+  }
+  else if ((event == ACL_FLOW_END) && (sd_cb->n_flows > 0))
+  {
+    sd_cb->n_flows--;
+  }
+
+  now = time(NULL);
+  is_first = !sd_cb->last_active;
+  sd_cb->last_active = now;
+
+  if (sd_cb->expiry - now <= (time_t)(sd_cb->age / 2))
+  {
+    extend_acl(sd_cb, now);
+  }
+  else if (is_first)
+  {
+    /**************************************************************************/
+    /* In use: leave the grace window and run to expiry.                      */
+    /**************************************************************************/
+    arm_acl(sd_cb, sd_cb->expiry);
+  }
+
+  EXIT:
+
+  unlock_acl();
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : sync_acl_flows                                               */
+/*                                                                            */
+/* Description : End a conntrack re-sync dump. Flow counts are replaced by    */
+/*               the flows it listed, dropping those whose end event was      */
+/*               lost.                                                        */
+/*                                                                            */
+/* Params      : is_complete (IN)         - FALSE if the dump failed; counts  */
+/*                                          are then left as they were.       */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void sync_acl_flows(int is_complete)
+{
+  src_dest_cb *runner;
+
+  lock_acl();
+
+  for (runner = dnswld.acl.sd.head; runner; runner = runner->next)
+  {
+    if (is_complete)
     {
-      prev = runner;
-      runner = runner->next;
+      runner->n_flows = runner->n_dump_flows;
     }
+    runner->n_dump_flows = 0;
   }
 
   unlock_acl();
-
-  return(ret);
 }
 
 
@@ -485,255 +851,131 @@ int del_src_dest_whitelist(unsigned int src, unsigned int dst)
 void clean_src_dest_whitelist(void)
 {
   src_dest_cb *runner;
-  src_dest_cb *prev;
-  llist *acl;
-  int i;
 
   lock_acl();
 
-  for (i = 0; i < ACCESS_LIST_HASH_SIZE; i++)
+  while ((runner = dnswld.acl.sd.head))
   {
-    acl = &dnswld.acl.ll.h[i];
-
-    for (runner = acl->head; runner; )
-    {
-      prev = runner;
-      runner = runner->next;
-
-      del_fw_rule(prev->src, prev->dst, FW_ACCEPT_RULE, prev->created_at,
-                  prev->expiry);
-      free(prev);
-    }
+    unlink_acl(runner);
+    post_acl_fw_cmd(runner, FW_CMD_DEL);
+    free(runner);
   }
 
+  rhash_free(&dnswld.acl.sd.pairs);
+  rhash_free(&dnswld.acl.sd.srcs);
+
   unlock_acl();
 }
 
 
 /*FUNC+************************************************************************/
-/* Function    : create_whitelist_from_fw_rules                               */
+/* Function    : restore_acl_entry                                            */
 /*                                                                            */
-/* Description : Create whitelist from existing firewall rules.               */
+/* Description : Re-create the ACL entry of a grant left by an earlier run,   */
+/*               or delete the grant if it has expired since.                 */
 /*                                                                            */
-/* Params      : none                                                         */
+/* Params      : cmd (IN)                 - Installed grant.                  */
+/*               arg (IN)                 - Unused.                           */
 /*                                                                            */
 /* Returns     : RET_OK                   - Success otherwise error.          */
 /*                                                                            */
 /*FUNC-************************************************************************/
-int create_whitelist_from_fw_rules(void)
+static int restore_acl_entry(fw_cmd *cmd, void *arg)
 {
   src_dest_cb *sd_cb;
   src_dest_cb *runner;
-  src_dest_cb *prev;
-  llist *acl;
-  FILE *in = NULL;
-  char cmd[1024];
-  char *line;
-  char *token;
-  char *saveptr;
-  char src[IP4_STR_MAX_LEN];
-  char dest[IP4_STR_MAX_LEN];
-  unsigned int s_ip;
-  unsigned int d_ip;
-  in_addr_t addr;
-  time_t created_time;
-  time_t cur_time;
   double delta_time;
-  int found;
-  int result;
-  int idx;
-  int i;
   int ret;
 
-  PUTS_OSYS(LOG_DEBUG, "Re-creating whitelist from firewall rules.");
-
-  /****************************************************************************/
-  /* Dump whitelist firewall rules.                                           */
-  /****************************************************************************/
-  snprintf(cmd, sizeof(cmd), "%s -n -L | grep %s > %s",
-           dnswld.fw.iptables_path, FW_RULE_TAG, DNSWLD_FW_DUMP);
-
-  PUTS_OSYS(LOG_DEBUG, " cmd: [%s]", cmd);
-  ret = system(cmd);
-  if (ret < 0)
+  PUTS_OSYS(LOG_DEBUG, " src:    [%d.%d.%d.%d]",
+            (cmd->s_ip >> 24) & 0xFF,
+            (cmd->s_ip >> 16) & 0xFF,
+            (cmd->s_ip >> 8) & 0xFF,
+            cmd->s_ip & 0xFF);
+  PUTS_OSYS(LOG_DEBUG, " dest:   [%d.%d.%d.%d]",
+            (cmd->d_ip >> 24) & 0xFF,
+            (cmd->d_ip >> 16) & 0xFF,
+            (cmd->d_ip >> 8) & 0xFF,
+            cmd->d_ip & 0xFF);
+  PUTS_OSYS(LOG_DEBUG, " created_time: [%u]", cmd->created_at);
+
+  delta_time = difftime((time_t)cmd->created_at + dnswld.proc.wl_age,
+                        time(NULL));
+  if (delta_time <= 0)
   {
-    PUTS_OSYS(LOG_DEBUG, "Error dumping whitelist firewall rules.");
-    ret = RET_SYS_ERROR;
-    goto EXIT;
+    PUTS_OSYS(LOG_DEBUG, " Whitelist firewall already expired. Deleting ...");
+    del_fw_rule(cmd->s_ip, cmd->d_ip, FW_ACCEPT_RULE, cmd->created_at,
+                cmd->created_at + dnswld.proc.wl_age);
+    return(RET_OK);
   }
 
+  PUTS_OSYS(LOG_DEBUG, " Adding src_ip: [%d.%d.%d.%d], dst_ip: [%d.%d.%d.%d], "
+            "age: [%f]",
+            (cmd->s_ip >> 24) & 0xFF,
+            (cmd->s_ip >> 16) & 0xFF,
+            (cmd->s_ip >> 8) & 0xFF,
+            cmd->s_ip & 0xFF,
+            (cmd->d_ip >> 24) & 0xFF,
+            (cmd->d_ip >> 16) & 0xFF,
+            (cmd->d_ip >> 8) & 0xFF,
+            cmd->d_ip & 0xFF,
+            delta_time);
+
   /****************************************************************************/
-  /* Parse the dump file and extract ACL information to build the whitelist.  */
+  /* A grant in several chains is listed once per chain.                      */
   /****************************************************************************/
-  in = fopen(DNSWLD_FW_DUMP, "r");
-  if (!in)
+  runner = find_src_dest_acl(cmd->s_ip, cmd->d_ip);
+  if (runner)
   {
-    PUTS_OSYS(LOG_ERR, "Failed to whitelist firewall rules dump file [%s].",
-              DNSWLD_FW_DUMP);
-    ret = RET_FILE_OPEN_ERROR;
+    runner->ref_count++;
+    PUTS_OSYS(LOG_DEBUG, "  Found existing acl entry. Ref count: %d",
+              runner->ref_count);
+    ret = RET_OK;
     goto EXIT;
   }
 
-  while ((line = fgets(cmd, sizeof(cmd), in)))
+  sd_cb = (src_dest_cb *)malloc(sizeof(src_dest_cb));
+  if (!sd_cb)
   {
-    trim_str(line);
-    PUTS_OSYS(LOG_DEBUG, " line: [%s]", cmd);
-
-    for (token = strtok_r(line, " ", &saveptr), i = 0; token != NULL;
-         token = strtok_r(NULL, " ", &saveptr), i++)
-    {
-      switch (i)
-      {
-        case 3:
-          strncpy(src, token, sizeof(src) - 1);
-          break;
-
-        case 4:
-          strncpy(dest, token, sizeof(dest) - 1);
-          break;
-
-        case 8:
-          *((unsigned int *)&created_time) = (unsigned int)strtoul(token, NULL, 10);
-          break;
-      }
-    }
-
-    PUTS_OSYS(LOG_DEBUG, " src:    [%s]", src);
-    PUTS_OSYS(LOG_DEBUG, " dest:   [%s]", dest);
-    PUTS_OSYS(LOG_DEBUG, " created_time: [%u]", created_time);
-
-    addr = inet_addr(src);
-    s_ip = ntohl(*((unsigned int *)&addr));
-    addr = inet_addr(dest);
-    d_ip = ntohl(*((unsigned int *)&addr));
-
-    cur_time = time(NULL);
-    delta_time = difftime(created_time + dnswld.proc.wl_age, cur_time);
-    if (delta_time <= 0)
-    {
-      PUTS_OSYS(LOG_DEBUG, " Whitelist firewall already expired. Deleting ...");
-      del_fw_rule(s_ip, d_ip, FW_ACCEPT_RULE, created_time,
-                  created_time + dnswld.proc.wl_age);
-      continue;
-    }
-
-    PUTS_OSYS(LOG_DEBUG, " Adding src_ip: [%d.%d.%d.%d], dst_ip: [%d.%d.%d.%d], "
-              "age: [%f]",
-              (s_ip >> 24) & 0xFF,
-              (s_ip >> 16) & 0xFF,
-              (s_ip >> 8) & 0xFF,
-              s_ip & 0xFF,
-              (d_ip >> 24) & 0xFF,
-              (d_ip >> 16) & 0xFF,
-              (d_ip >> 8) & 0xFF,
-              d_ip & 0xFF,
-              delta_time);
-
-    sd_cb = (src_dest_cb *)malloc(sizeof(src_dest_cb));
-    if (!sd_cb)
-    {
-      PUTS_OSYS(LOG_DEBUG, " Failed to allocate memory for src-dest cb");
-      ret = RET_MEMORY_ERROR;
-      goto EXIT;
-    }
-
-    memset(sd_cb, 0, sizeof(src_dest_cb));
-    sd_cb->src = s_ip;
-    sd_cb->dst = d_ip;
-    sd_cb->age = dnswld.proc.wl_age;
-    sd_cb->created_at = created_time;
-    sd_cb->expiry = created_time + dnswld.proc.wl_age;
-
-    idx = s_ip % ACCESS_LIST_HASH_SIZE;
-
-    acl = &dnswld.acl.ll.h[idx];
-
-    PUTS_OSYS(LOG_DEBUG, " idx: [%d]", idx);
-
-    found = FALSE;
-
-    /**************************************************************************/
-    /* Insert ACL entry to the list.                                          */
-    /**************************************************************************/
-    if (acl->head)
-    {
-      for (runner = acl->head, prev = NULL; runner;
-           prev = runner, runner = runner->next)
-      {
-        result = 1;
-        if (s_ip < runner->src)
-        {
-          result = -1;
-          break;
-        }
-        else if (s_ip == runner->src)
-        {
-          result = 0;
-          if (d_ip == runner->dst)
-          {
-            break;
-          }
-        }
-      }
-
-      if ((!result) && (runner) && (d_ip == runner->dst))
-      {
-        runner->ref_count++;
-        PUTS_OSYS(LOG_DEBUG, "  Found existing acl entry. Ref count: %d",
-                  runner->ref_count);
-        found = TRUE;
-      }
-      else if (!prev)
-      {
-        PUTS_OSYS(LOG_DEBUG, " Adding before [%d.%d.%d.%d], dst_ip: [%d.%d.%d.%d]",
-                  (runner->src >> 24) & 0xFF,
-                  (runner->src >> 16) & 0xFF,
-                  (runner->src >> 8) & 0xFF,
-                  runner->src & 0xFF,
-                  (runner->dst >> 24) & 0xFF,
-                  (runner->dst >> 16) & 0xFF,
-                  (runner->dst >> 8) & 0xFF,
-                  runner->dst & 0xFF);
-
-        sd_cb->next = runner;
-        acl->head = sd_cb;
-      }
-      else
-      {
-        PUTS_OSYS(LOG_DEBUG, " Adding after [%d.%d.%d.%d], dst_ip: [%d.%d.%d.%d]",
-                  (prev->src >> 24) & 0xFF,
-                  (prev->src >> 16) & 0xFF,
-                  (prev->src >> 8) & 0xFF,
-                  prev->src & 0xFF,
-                  (prev->dst >> 24) & 0xFF,
-                  (prev->dst >> 16) & 0xFF,
-                  (prev->dst >> 8) & 0xFF,
-                  prev->dst & 0xFF);
-
-        ((src_dest_cb *)prev)->next = sd_cb;
-      }
-    }
-    else
-    {
-      PUTS_OSYS(LOG_DEBUG, " Adding first entry");
-      acl->head = sd_cb;
-    }
-
-    if (found)
-    {
-      free(sd_cb);
-    }
+    PUTS_OSYS(LOG_DEBUG, " Failed to allocate memory for src-dest cb");
+    ret = RET_MEMORY_ERROR;
+    goto EXIT;
   }
 
-  ret = RET_OK;
-
-  EXIT:
+  memset(sd_cb, 0, sizeof(src_dest_cb));
+  sd_cb->src = cmd->s_ip;
+  sd_cb->dst = cmd->d_ip;
+  sd_cb->age = dnswld.proc.wl_age;
+  sd_cb->created_at = cmd->created_at;
+  sd_cb->expiry = cmd->created_at + dnswld.proc.wl_age;
+  sd_cb->fw_expiry = sd_cb->expiry;
+  sd_cb->dom_id = cmd->dom_id;
 
-  if (in)
+  ret = link_acl(sd_cb);
+  if (ret)
   {
-    fclose(in);
+    free(sd_cb);
   }
 
+  EXIT:
+
   return(ret);
 }
 
+
+/*FUNC+************************************************************************/
+/* Function    : create_whitelist_from_fw_rules                               */
+/*                                                                            */
+/* Description : Create whitelist from existing firewall rules.               */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int create_whitelist_from_fw_rules(void)
+{
+  PUTS_OSYS(LOG_DEBUG, "Re-creating whitelist from firewall rules.");
+
+  return(list_fw_rules(restore_acl_entry, NULL));
+}
@@ -16,7 +16,8 @@
 /******************************************************************************/
 #include <time.h>
 
-#include <llist.h>
+#include <rhash.h>
+#include <twheel.h>
 
 
 /******************************************************************************/
@@ -30,45 +31,100 @@
 #define ACL_DEL_BLOCK_RULE_ERR                    5
 
 /******************************************************************************/
-/* Constants.                                                                 */
+/* ACL expiry tick.                                                           */
 /******************************************************************************/
-#define ACCESS_LIST_HASH_SIZE                     12
+#define ACL_TICK_MS                               100
+
+/******************************************************************************/
+/* ACL hash keys.                                                             */
+/******************************************************************************/
+#define ACL_PAIR_KEY(s,d)                         (((unsigned long long)(s) << 32) | (d))
+
+/******************************************************************************/
+/* Flow events of a pair, reported by the conntrack watcher.                  */
+/******************************************************************************/
+#define ACL_FLOW_NEW                              0
+#define ACL_FLOW_UPDATE                           1
+#define ACL_FLOW_END                              2
+#define ACL_FLOW_DUMP                             3
 
 /******************************************************************************/
 /* Source/dest ACL entry.                                                     */
-/* - For enhancement: Balance tree or dijkstra for faster lookup.             */
+/* - prev/next keep all entries in insertion order for walks and paging.      */
+/* - src_prev/src_next chain the entries of the same source.                  */
+/* - timer holds the entry on the expiry wheel.                               */
+/* - fw_expiry is the expiry the rule was added with. Rules are deleted by    */
+/*   it, as expiry moves when flows keep the entry alive.                     */
+/* - n_flows and last_active track the pair's connections when expiring on    */
+/*   idleness (conntrack_grace); last_active is 0 until the first one.        */
+/*   n_dump_flows counts them during a conntrack dump that re-syncs n_flows.  */
 /******************************************************************************/
 typedef struct _src_dest_cb
 {
+  struct _src_dest_cb *prev;
   struct _src_dest_cb *next;
+  struct _src_dest_cb *src_prev;
+  struct _src_dest_cb *src_next;
+  tw_node timer;
   unsigned int src;
   unsigned int dst;
   int ref_count;
   unsigned long age;
   time_t created_at;
   time_t expiry;
+  time_t fw_expiry;
+  time_t last_active;
+  int n_flows;
+  int n_dump_flows;
   int last_status;
+  int dom_id;
 } src_dest_cb;
 
 
+/******************************************************************************/
+/* Per-source index entry. Heads the entries of one source.                   */
+/******************************************************************************/
+typedef struct _src_acl_cb
+{
+  unsigned int src;
+  int n_dst;
+  src_dest_cb *head;
+} src_acl_cb;
+
+
 /******************************************************************************/
 /* Source-dest ACL.                                                           */
+/* - pairs maps (src, dst) to its entry.                                      */
+/* - srcs maps src to its per-source index entry.                             */
+/* - expiry orders entries by expiry in ACL_TICK_MS ticks.                    */
 /******************************************************************************/
 typedef struct _src_dest_acl
 {
-  llist h[ACCESS_LIST_HASH_SIZE];
+  rhash pairs;
+  rhash srcs;
+  twheel expiry;
+  src_dest_cb *head;
+  src_dest_cb *tail;
 } src_dest_acl;
 
 
 /******************************************************************************/
 /* Forwards decls.                                                            */
 /******************************************************************************/
+extern void lock_acl(void);
+extern void unlock_acl(void);
+extern int init_src_dest_whitelist(void);
+extern src_dest_cb *find_src_dest_acl(unsigned int src, unsigned int dst);
 extern int create_start_acl_sweeper(void);
 extern void wait_acl_sweeper(void);
 extern int add_src_dest_to_whitelist(void *src_addr, dns_question *qs,
                                      int n_qs);
 extern int del_src_dest_whitelist(unsigned int src, unsigned int dst);
+extern void note_acl_flow(unsigned int src, unsigned int dst, int event);
+extern void sync_acl_flows(int is_complete);
 extern void clean_src_dest_whitelist(void);
+extern void set_acl_fw_status(unsigned int src, unsigned int dst,
+                              unsigned int created_at, int status);
 extern int create_whitelist_from_fw_rules(void);
 
 #endif
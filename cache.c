@@ -0,0 +1,355 @@
+/*FILE+************************************************************************/
+/* Filename    : cache.c                                                      */
+/*                                                                            */
+/* Description : Answer cache of whitelisted names. Positive upstream answers */
+/*               are kept for their TTL so repeated queries are answered      */
+/*               without an upstream round trip. Size is fixed at start-up    */
+/*               and entries are recycled with the CLOCK algorithm.           */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <response.h>
+
+
+/******************************************************************************/
+/* Cache lock. Shared by all DNS workers.                                     */
+/******************************************************************************/
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*FUNC+************************************************************************/
+/* Function    : find_entry                                                   */
+/*                                                                            */
+/* Description : Find entry of a name. Cache must be locked.                  */
+/*                                                                            */
+/* Params      : name (IN)                - Name.                             */
+/*               hash (IN)                - Hash of name.                     */
+/*                                                                            */
+/* Returns     : entry                    - Entry otherwise NULL.             */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static cache_entry *find_entry(char *name, unsigned int hash)
+{
+  cache_entry *entry;
+  int idx;
+
+  for (idx = dnswld.cache.buckets[hash & (dnswld.cache.n_buckets - 1)];
+       idx != CACHE_NIL; idx = entry->next)
+  {
+    entry = &dnswld.cache.entries[idx];
+    if ((entry->hash == hash) && (!strcasecmp(entry->name, name)))
+    {
+      return(entry);
+    }
+  }
+
+  return(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : find_entry_enc                                               */
+/*                                                                            */
+/* Description : Find entry of a question's name. Cache must be locked.       */
+/*                                                                            */
+/* Params      : q (IN)                   - Question.                         */
+/*                                                                            */
+/* Returns     : entry                    - Entry otherwise NULL.             */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static cache_entry *find_entry_enc(dns_question *q)
+{
+  cache_entry *entry;
+  int off = q->name - q->msg;
+  int idx;
+
+  for (idx = dnswld.cache.buckets[q->hash & (dnswld.cache.n_buckets - 1)];
+       idx != CACHE_NIL; idx = entry->next)
+  {
+    entry = &dnswld.cache.entries[idx];
+    if ((entry->hash == q->hash) &&
+        (dns_name_equal(q->msg, off + DNS_MAX_ENC_NAME_LEN, off,
+                        entry->name)))
+    {
+      return(entry);
+    }
+  }
+
+  return(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : unlink_entry                                                 */
+/*                                                                            */
+/* Description : Remove entry from its bucket. Cache must be locked.          */
+/*                                                                            */
+/* Params      : idx (IN)                 - Entry index.                      */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void unlink_entry(int idx)
+{
+  cache_entry *entry = &dnswld.cache.entries[idx];
+  int *pp;
+
+  for (pp = &dnswld.cache.buckets[entry->hash & (dnswld.cache.n_buckets - 1)];
+       *pp != CACHE_NIL; pp = &dnswld.cache.entries[*pp].next)
+  {
+    if (*pp == idx)
+    {
+      *pp = entry->next;
+      break;
+    }
+  }
+
+  entry->in_use = FALSE;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : get_free_entry                                               */
+/*                                                                            */
+/* Description : Get an entry to fill. Unused entries go first; once the      */
+/*               cache is full the CLOCK hand picks the first expired or not  */
+/*               recently used entry. Cache must be locked.                   */
+/*                                                                            */
+/* Params      : now (IN)                 - Current time in usecs.            */
+/*                                                                            */
+/* Returns     : idx                      - Entry index.                      */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int get_free_entry(unsigned long now)
+{
+  cache_entry *entry;
+  int idx;
+
+  if (dnswld.cache.n_used < dnswld.cache.size)
+  {
+    return(dnswld.cache.n_used++);
+  }
+
+  while (TRUE)
+  {
+    idx = dnswld.cache.hand;
+    entry = &dnswld.cache.entries[idx];
+    dnswld.cache.hand = (dnswld.cache.hand + 1) % dnswld.cache.size;
+
+    if ((!entry->in_use) || (entry->expiry <= now) || (!entry->is_ref))
+    {
+      if (entry->in_use)
+      {
+        unlink_entry(idx);
+      }
+
+      return(idx);
+    }
+
+    entry->is_ref = FALSE;
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : init_cache                                                   */
+/*                                                                            */
+/* Description : Allocate the answer cache. A size of 0 disables it.          */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int init_cache(void)
+{
+  int i;
+  int ret;
+
+  if (!dnswld.cache.size)
+  {
+    return(RET_OK);
+  }
+
+  /****************************************************************************/
+  /* Power of two buckets, at least one per entry.                            */
+  /****************************************************************************/
+  for (dnswld.cache.n_buckets = 1;
+       dnswld.cache.n_buckets < dnswld.cache.size;
+       dnswld.cache.n_buckets <<= 1);
+
+  dnswld.cache.buckets = (int *)malloc(dnswld.cache.n_buckets * sizeof(int));
+  dnswld.cache.entries = (cache_entry *)calloc(dnswld.cache.size,
+                                               sizeof(cache_entry));
+  if ((!dnswld.cache.buckets) || (!dnswld.cache.entries))
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to allocate answer cache!");
+    ret = RET_MEMORY_ERROR;
+    goto EXIT;
+  }
+
+  for (i = 0; i < dnswld.cache.n_buckets; i++)
+  {
+    dnswld.cache.buckets[i] = CACHE_NIL;
+  }
+
+  dnswld.cache.n_used = 0;
+  dnswld.cache.hand = 0;
+
+  ret = RET_OK;
+
+  EXIT:
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : clean_cache                                                  */
+/*                                                                            */
+/* Description : Free the answer cache.                                       */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void clean_cache(void)
+{
+  if (dnswld.cache.buckets)
+  {
+    free(dnswld.cache.buckets);
+    dnswld.cache.buckets = NULL;
+  }
+
+  if (dnswld.cache.entries)
+  {
+    free(dnswld.cache.entries);
+    dnswld.cache.entries = NULL;
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : cache_lookup                                                 */
+/*                                                                            */
+/* Description : Look up the cached A records of a name, with their answer    */
+/*               section template.                                            */
+/*                                                                            */
+/* Params      : q (IN/OUT)               - Question, answered on a hit.      */
+/*                                                                            */
+/* Returns     : TRUE                     - Hit otherwise FALSE.              */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int cache_lookup(dns_question *q)
+{
+  dns_answer *ans = &q->ans;
+  cache_entry *entry;
+  int is_hit = FALSE;
+
+  if (!dnswld.cache.entries)
+  {
+    return(FALSE);
+  }
+
+  pthread_mutex_lock(&cache_lock);
+
+  entry = find_entry_enc(q);
+  if ((entry) && (entry->expiry > get_mono_usecs()))
+  {
+    entry->is_ref = TRUE;
+    ans->n_rec = entry->n_rec;
+    memcpy(ans->recs, entry->recs, entry->n_rec * sizeof(in_addr_t));
+    ans->tmpl_len = entry->tmpl_len;
+    memcpy(ans->tmpl, entry->tmpl, entry->tmpl_len);
+    is_hit = TRUE;
+  }
+
+  pthread_mutex_unlock(&cache_lock);
+
+  if (is_hit)
+  {
+    STATS_INC(n_cache_hits);
+  }
+  else
+  {
+    STATS_INC(n_cache_misses);
+  }
+
+  return(is_hit);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : cache_add                                                    */
+/*                                                                            */
+/* Description : Add or refresh the A records of a name and encode their      */
+/*               answer section template. Empty answers and zero TTLs are     */
+/*               not cached.                                                  */
+/*                                                                            */
+/* Params      : name (IN)                - Name.                             */
+/*               n_rec (IN)               - Number of records.                */
+/*               recs (IN)                - Records.                          */
+/*               ttl (IN)                 - TTL in secs.                      */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void cache_add(char *name, int n_rec, in_addr_t *recs, unsigned int ttl)
+{
+  unsigned char tmpl[DNS_ANS_TMPLZ];
+  cache_entry *entry;
+  unsigned long now;
+  unsigned int hash;
+  int tmpl_len;
+  int idx;
+
+  if ((!dnswld.cache.entries) || (n_rec <= 0) || (!ttl))
+  {
+    return;
+  }
+
+  if (n_rec > DNS_MAX_ANS_RR_NUM)
+  {
+    n_rec = DNS_MAX_ANS_RR_NUM;
+  }
+
+  /****************************************************************************/
+  /* Owner names point at the first question, right after the header.         */
+  /****************************************************************************/
+  encode_a_answers(tmpl, sizeof(tmpl), sizeof(dns_header), recs, n_rec,
+                   &tmpl_len);
+
+  hash = hash_name(name);
+  now = get_mono_usecs();
+
+  pthread_mutex_lock(&cache_lock);
+
+  entry = find_entry(name, hash);
+  if (!entry)
+  {
+    idx = get_free_entry(now);
+    entry = &dnswld.cache.entries[idx];
+
+    memset(entry, 0, sizeof(*entry));
+    strncpy(entry->name, name, sizeof(entry->name) - 1);
+    entry->hash = hash;
+    entry->in_use = TRUE;
+    entry->is_ref = TRUE;
+    entry->next = dnswld.cache.buckets[hash & (dnswld.cache.n_buckets - 1)];
+    dnswld.cache.buckets[hash & (dnswld.cache.n_buckets - 1)] = idx;
+  }
+
+  entry->n_rec = n_rec;
+  memcpy(entry->recs, recs, n_rec * sizeof(in_addr_t));
+  entry->tmpl_len = tmpl_len;
+  memcpy(entry->tmpl, tmpl, tmpl_len);
+  entry->expiry = now + (ttl * 1000000UL);
+
+  pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,73 @@
+/*INC+*************************************************************************/
+/* Filename    : cache.h                                                      */
+/*                                                                            */
+/* Description : Answer cache of whitelisted names header file.               */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*INC+*************************************************************************/
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+/******************************************************************************/
+/* Includes.                                                                  */
+/******************************************************************************/
+#include <netinet/in.h>
+
+#include <dns.h>
+#include <data_dict.h>
+
+/******************************************************************************/
+/* Constants.                                                                 */
+/******************************************************************************/
+#define DEF_CACHE_SIZE                            1024
+#define MAX_CACHE_SIZE                            1048576
+#define CACHE_NIL                                 -1
+
+/******************************************************************************/
+/* Cache entry. A records in network byte order.                              */
+/* - is_ref is the CLOCK reference bit, set on every hit.                     */
+/* - tmpl is the encoded answer section, rebuilt whenever the records are     */
+/*   set. Owner names point at the first question of the reply.               */
+/******************************************************************************/
+typedef struct _cache_entry
+{
+  int next;
+  int in_use;
+  int is_ref;
+  unsigned int hash;
+  unsigned long expiry;
+  int n_rec;
+  in_addr_t recs[DNS_MAX_ANS_RR_NUM];
+  int tmpl_len;
+  unsigned char tmpl[DNS_ANS_TMPLZ];
+  char name[DNS_MAX_NAME_LEN + 1];
+} cache_entry;
+
+
+/******************************************************************************/
+/* Cache CB. Entries are chained per bucket by index.                         */
+/******************************************************************************/
+typedef struct _cache_cb
+{
+  int size;
+  int n_buckets;
+  int n_used;
+  int hand;
+  int *buckets;
+  cache_entry *entries;
+} cache_cb;
+
+
+/******************************************************************************/
+/* Forwards decls.                                                            */
+/******************************************************************************/
+extern int init_cache(void);
+extern void clean_cache(void);
+extern int cache_lookup(dns_question *q);
+extern void cache_add(char *name, int n_rec, in_addr_t *recs,
+                      unsigned int ttl);
+
+#endif
@@ -13,6 +13,8 @@
 #include <network.h>
 #include <cmd.h>
 
+#include <errno.h>
+
 
 int proc_cmd_status(char *pkt_ptr, int sock, struct sockaddr_in *s_addr)
 {
@@ -73,8 +75,6 @@ int proc_get_wl_ip(char *pkt_ptr, int buf_len, int sock,
   get_wl_ip_acl_obj *wl_obj;
   src_dest_acl_obj *acl_obj;
   src_dest_cb *runner;
-  int overrun;
-  int idx;
   int ret;
 
   PUTS_OSYS(LOG_DEBUG, "Processing get whitelist IP");
@@ -84,39 +84,29 @@ int proc_get_wl_ip(char *pkt_ptr, int buf_len, int sock,
 
   key = (get_wl_ip_key_obj *)hdr;
 
+  /****************************************************************************/
+  /* DNS workers update the ACL concurrently.                                 */
+  /****************************************************************************/
+  lock_acl();
+
+  /****************************************************************************/
+  /* Resume after the last entry of the previous page. A key that has expired */
+  /* meanwhile ends the walk.                                                 */
+  /****************************************************************************/
   if (!key->src)
   {
-    idx = 0;
-    runner = NULL;
+    runner = dnswld.acl.sd.head;
   }
   else
   {
-    idx = key->src % ACCESS_LIST_HASH_SIZE;
-    PUTS_OSYS(LOG_DEBUG, "idx: [%d]", idx);
-    runner = (src_dest_cb *)dnswld.acl.ll.h[idx].head;
-
-    for (; runner; runner = runner->next)
-    {
-      if (runner->src < key->src)
-      {
-        break;
-      }
-      else if ((runner->src == key->src) &&
-               (runner->dst == key->dst))
-      {
-        PUTS_OSYS(LOG_DEBUG, "next src-dst found.");
-        runner = runner->next;
-        break;
-      }
-    }
-
-    if (!runner)
+    runner = find_src_dest_acl(key->src, key->dst);
+    if (runner)
     {
-      idx++;
+      PUTS_OSYS(LOG_DEBUG, "next src-dst found.");
+      runner = runner->next;
     }
   }
 
-  overrun = FALSE;
   hdr = (cmd_hdr *)pkt_ptr;
   hdr->type = CMD_RESPONSE;
   hdr++;
@@ -125,36 +115,25 @@ int proc_get_wl_ip(char *pkt_ptr, int buf_len, int sock,
   wl_obj->n_acl = 0;
   acl_obj = (src_dest_acl_obj *)(wl_obj + 1);
 
-  for (; idx < ACCESS_LIST_HASH_SIZE; idx++)
+  for (; runner; runner = runner->next)
   {
-    if (!runner)
-    {
-      runner = (src_dest_cb *)dnswld.acl.ll.h[idx].head;
-    }
+    acl_obj->src = runner->src;
+    acl_obj->dst = runner->dst;
+    acl_obj->age = runner->age;
+    acl_obj->created_at = (unsigned int)runner->created_at;
+    acl_obj->expiry = (unsigned int)runner->expiry;
 
-    for (; runner; runner = runner->next)
-    {
-      acl_obj->src = runner->src;
-      acl_obj->dst = runner->dst;
-      acl_obj->age = runner->age;
-      acl_obj->created_at = (unsigned int)runner->created_at;
-
-      wl_obj->n_acl++;
-      acl_obj++;
-
-      if ((((char *)acl_obj - pkt_ptr) + sizeof(src_dest_acl_obj)) > buf_len)
-      {
-        overrun = TRUE;
-        break;
-      }
-    }
+    wl_obj->n_acl++;
+    acl_obj++;
 
-    if (overrun)
+    if ((((char *)acl_obj - pkt_ptr) + sizeof(src_dest_acl_obj)) > buf_len)
     {
       break;
     }
   }
 
+  unlock_acl();
+
   ret = sendto(sock, pkt_ptr, ((char *)acl_obj - pkt_ptr), 0,
                (struct sockaddr *)s_addr, sizeof(struct sockaddr_in));
   PUTS_OSYS(LOG_DEBUG, " -> n_acl: [%d]", wl_obj->n_acl);
@@ -211,6 +190,72 @@ int proc_del_wl_ip(char *pkt_ptr, int buf_len, int sock,
 }
 
 
+/*FUNC+************************************************************************/
+/* Function    : proc_get_stats                                               */
+/*                                                                            */
+/* Description : Process get statistics command.                              */
+/*                                                                            */
+/* Params      : pkt_ptr (IN/OUT)         - Command buffer.                   */
+/*               sock (IN)                - Command socket.                   */
+/*               s_addr (IN)              - Requestor address.                */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int proc_get_stats(char *pkt_ptr, int sock, struct sockaddr_in *s_addr)
+{
+  cmd_hdr *hdr = (cmd_hdr *)pkt_ptr;
+  stats_obj *obj;
+  int ret;
+
+  PUTS_OSYS(LOG_DEBUG, "Processing get statistics");
+
+  hdr->type = CMD_RESPONSE;
+
+  obj = (stats_obj *)(pkt_ptr + sizeof(cmd_hdr));
+  obj->uptime = (unsigned long)(time(NULL) - dnswld.stats.started_at);
+  obj->n_queries = dnswld.stats.n_queries;
+  obj->n_responses = dnswld.stats.n_responses;
+  obj->n_dropped = dnswld.stats.n_dropped;
+  obj->n_wakeups = dnswld.stats.n_wakeups;
+  obj->n_events = dnswld.stats.n_events;
+  obj->n_workers = dnswld.stats.n_workers;
+  obj->batch_size = dnswld.stats.batch_size;
+  obj->n_rx_batches = dnswld.stats.n_rx_batches;
+  obj->n_tx_batches = dnswld.stats.n_tx_batches;
+  obj->n_parked = dnswld.stats.n_parked;
+  obj->n_upstream_sent = dnswld.stats.n_upstream_sent;
+  obj->n_upstream_timeouts = dnswld.stats.n_upstream_timeouts;
+  obj->n_lookups = dnswld.stats.n_lookups;
+  obj->n_coalesced = dnswld.stats.n_coalesced;
+  obj->n_cache_hits = dnswld.stats.n_cache_hits;
+  obj->n_cache_misses = dnswld.stats.n_cache_misses;
+  obj->n_tmpl_replies = dnswld.stats.n_tmpl_replies;
+  obj->n_fw_cmds = dnswld.stats.n_fw_cmds;
+  obj->n_fw_batches = dnswld.stats.n_fw_batches;
+  obj->n_fw_errors = dnswld.stats.n_fw_errors;
+  obj->n_fw_queue_full = dnswld.stats.n_fw_queue_full;
+  obj->n_fw_coalesced = dnswld.stats.n_fw_coalesced;
+  obj->n_ct_events = dnswld.stats.n_ct_events;
+  obj->n_ct_overruns = dnswld.stats.n_ct_overruns;
+  obj->n_ct_resyncs = dnswld.stats.n_ct_resyncs;
+  obj->n_acl_refreshes = dnswld.stats.n_acl_refreshes;
+  obj->n_acl_reclaimed = dnswld.stats.n_acl_reclaimed;
+  obj->n_reconciles = dnswld.stats.n_reconciles;
+  obj->n_reconcile_fixes = dnswld.stats.n_reconcile_fixes;
+  obj->reconcile_usecs = dnswld.stats.reconcile_usecs;
+  memcpy(obj->lat_hist, dnswld.stats.lat_hist, sizeof(obj->lat_hist));
+  obj++;
+
+  sendto(sock, pkt_ptr, ((char *)obj - pkt_ptr), 0,
+         (struct sockaddr *)s_addr, sizeof(struct sockaddr_in));
+
+  ret = RET_OK;
+
+  return(ret);
+}
+
+
 /*FUNC+************************************************************************/
 /* Function    : cmd_reader                                                   */
 /*                                                                            */
@@ -238,8 +283,13 @@ int cmd_reader(void *param)
   pkt_ptr = dnswld.proc.cmd_buf;
   len = recvfrom(listener->sock, pkt_ptr, sizeof(dnswld.proc.cmd_buf),
                  MSG_DONTWAIT, (struct sockaddr*)&s_addr, &s_size);
+  if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+  {
+    return(RET_SOCK_WOULD_BLOCK);
+  }
+
   PUTS_OSYS(LOG_DEBUG, "Command header len: [%d]", len);
-  if (len < sizeof(cmd_hdr))
+  if (len < (int)sizeof(cmd_hdr))
   {
     PUTS_OSYS(LOG_INFO, "Command header too short: [%d]. Discarding.", len);
     ret = RET_SOCK_READ_ERROR;
@@ -281,6 +331,10 @@ int cmd_reader(void *param)
                      listener->sock, &s_addr);
       break;
 
+    case CMD_GET_STATS:
+      proc_get_stats(dnswld.proc.cmd_buf, listener->sock, &s_addr);
+      break;
+
     default:
       PUTS_OSYS(LOG_INFO, "Invalid command ID: [%d]. Discarding.",
                 hdr->cmd_id);
@@ -32,6 +32,7 @@
 #define CMD_GET_WHITELIST_DOMAIN                  4
 #define CMD_GET_WHITELIST_IP                      5
 #define CMD_DEL_WHITELIST_IP                      6
+#define CMD_GET_STATS                             7
 
 /******************************************************************************/
 /* Command Types.                                                             */
@@ -71,6 +72,7 @@ typedef struct _src_dest_acl_obj
   unsigned int dst;
   unsigned long age;
   unsigned int created_at;
+  unsigned int expiry;
 } src_dest_acl_obj;
 
 
@@ -93,4 +95,41 @@ typedef struct _get_wl_ip_acl_obj
   unsigned int n_acl;
 } get_wl_ip_acl_obj;
 
+
+typedef struct _stats_obj
+{
+  unsigned long uptime;
+  unsigned long n_queries;
+  unsigned long n_responses;
+  unsigned long n_dropped;
+  unsigned long n_wakeups;
+  unsigned long n_events;
+  unsigned long n_workers;
+  unsigned long batch_size;
+  unsigned long n_rx_batches;
+  unsigned long n_tx_batches;
+  unsigned long n_parked;
+  unsigned long n_upstream_sent;
+  unsigned long n_upstream_timeouts;
+  unsigned long n_lookups;
+  unsigned long n_coalesced;
+  unsigned long n_cache_hits;
+  unsigned long n_cache_misses;
+  unsigned long n_tmpl_replies;
+  unsigned long n_fw_cmds;
+  unsigned long n_fw_batches;
+  unsigned long n_fw_errors;
+  unsigned long n_fw_queue_full;
+  unsigned long n_fw_coalesced;
+  unsigned long n_ct_events;
+  unsigned long n_ct_overruns;
+  unsigned long n_ct_resyncs;
+  unsigned long n_acl_refreshes;
+  unsigned long n_acl_reclaimed;
+  unsigned long n_reconciles;
+  unsigned long n_reconcile_fixes;
+  unsigned long reconcile_usecs;
+  unsigned long lat_hist[STATS_LAT_BUCKETS];
+} stats_obj;
+
 #endif
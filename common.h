@@ -32,10 +32,14 @@
 #include <llist.h>
 #include <logging.h>
 #include <util.h>
+#include <stats.h>
+#include <evloop.h>
 
 #include <dns.h>
 
 #include <data_dict.h>
+#include <resolver.h>
+#include <cache.h>
 #include <request.h>
 #include <access_list.h>
 
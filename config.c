@@ -10,11 +10,15 @@
 
 #include <common.h>
 #include <unistd.h>
+#include <net/if.h>
 
 #include <ret_codes.h>
 #include <dnswldcb.h>
 #include <util.h>
 #include <config.h>
+#include <fw.h>
+#include <conntrack.h>
+#include <reconcile.h>
 
 
 /*FUNC+************************************************************************/
@@ -217,6 +221,7 @@ int process_config(void)
   char line[1024];
   char *ptr;
   char *key;
+  char *end;
   int line_num;
   int ret;
 
@@ -278,6 +283,241 @@ int process_config(void)
     {
       strncpy(dnswld.fw.iptables_path, ptr, FILENAME_MAX_LEN - 1);
     }
+    else if (!strcasecmp(key, CFG_BATCH_SIZE))
+    {
+      dnswld.proc.batch_size = atoi(ptr);
+      if ((dnswld.proc.batch_size < 1) ||
+          (dnswld.proc.batch_size > MAX_BATCH_SIZE))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid batch size at line: [%d]", line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_WORKERS))
+    {
+      dnswld.proc.n_workers = atoi(ptr);
+      if ((dnswld.proc.n_workers < 0) ||
+          (dnswld.proc.n_workers > MAX_WORKERS))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid number of workers at line: [%d]",
+                  line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_UPSTREAM))
+    {
+      ret = add_upstream_servers(ptr);
+      if (ret)
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid upstream server at line: [%d]",
+                  line_num);
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_UPSTREAM_TIMEOUT))
+    {
+      dnswld.rslv.timeout_ms = atoi(ptr);
+      if (dnswld.rslv.timeout_ms < RSLV_TICK_MS)
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid upstream timeout at line: [%d]",
+                  line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_UPSTREAM_RETRIES))
+    {
+      dnswld.rslv.retries = atoi(ptr);
+      if (dnswld.rslv.retries < 0)
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid upstream retries at line: [%d]",
+                  line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_CACHE_SIZE))
+    {
+      dnswld.cache.size = atoi(ptr);
+      if ((dnswld.cache.size < 0) || (dnswld.cache.size > MAX_CACHE_SIZE))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid cache size at line: [%d]", line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_FW_BACKEND))
+    {
+      dnswld.fw.backend = find_fw_backend(ptr);
+      if (dnswld.fw.backend < 0)
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid firewall backend at line: [%d]",
+                  line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if ((!strcasecmp(key, CFG_IPSET_NAME)) ||
+             (!strcasecmp(key, CFG_NFT_SET)))
+    {
+      if ((!*ptr) || (strlen(ptr) >= FW_SET_NAME_MAX_LEN))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid set name at line: [%d]", line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+      strcpy(dnswld.fw.set_name, ptr);
+    }
+    else if (!strcasecmp(key, CFG_NFT_TABLE))
+    {
+      if ((!*ptr) || (strlen(ptr) >= FW_SET_NAME_MAX_LEN))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid nft table name at line: [%d]", line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+      strcpy(dnswld.fw.table_name, ptr);
+    }
+    else if (!strcasecmp(key, CFG_RESTORE_PATH))
+    {
+      strncpy(dnswld.fw.restore_path, ptr, FILENAME_MAX_LEN - 1);
+    }
+    else if (!strcasecmp(key, CFG_FW_RULE_LAYOUT))
+    {
+      if (!strcasecmp(ptr, "flat"))
+      {
+        dnswld.fw.layout = FW_LAYOUT_FLAT;
+      }
+      else if (!strcasecmp(ptr, "client"))
+      {
+        dnswld.fw.layout = FW_LAYOUT_CLIENT;
+      }
+      else if (!strcasecmp(ptr, "domain"))
+      {
+        dnswld.fw.layout = FW_LAYOUT_DOMAIN;
+      }
+      else
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid firewall rule layout at line: [%d]",
+                  line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_FW_LATENCY_US))
+    {
+      dnswld.fw.latency_us = atoi(ptr);
+      if ((dnswld.fw.latency_us < 0) ||
+          (dnswld.fw.latency_us > MAX_FW_LATENCY_US))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid firewall latency at line: [%d]",
+                  line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_FW_FLUSH_MS))
+    {
+      dnswld.fw.flush_ms = atoi(ptr);
+      if ((dnswld.fw.flush_ms < 0) || (dnswld.fw.flush_ms > MAX_FW_FLUSH_MS))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid firewall flush window at line: [%d]",
+                  line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_FW_COALESCE_MS))
+    {
+      dnswld.fw.coalesce_ms = atoi(ptr);
+      if ((dnswld.fw.coalesce_ms < 0) ||
+          (dnswld.fw.coalesce_ms > MAX_FW_COALESCE_MS))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid firewall coalesce window at line: [%d]",
+                  line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_BPF_DEV))
+    {
+      if ((!*ptr) || (strlen(ptr) >= IFNAMSIZ))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid bpf device at line: [%d]", line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+      strcpy(dnswld.fw.bpf_dev, ptr);
+    }
+    else if (!strcasecmp(key, CFG_BPF_MARK))
+    {
+      dnswld.fw.bpf_mark = (unsigned int)strtoul(ptr, &end, 0);
+      if ((end == ptr) || (*end) || (!dnswld.fw.bpf_mark))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid bpf mark at line: [%d]", line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_BPF_MAP_SIZE))
+    {
+      dnswld.fw.bpf_map_size = atoi(ptr);
+      if ((dnswld.fw.bpf_map_size <= 0) ||
+          (dnswld.fw.bpf_map_size > MAX_BPF_MAP_SIZE))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid bpf map size at line: [%d]", line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_BPF_PIN_PATH))
+    {
+      strncpy(dnswld.fw.bpf_pin_path, ptr, FILENAME_MAX_LEN - 1);
+    }
+    else if (!strcasecmp(key, CFG_CT_GRACE))
+    {
+      dnswld.acl.ct_grace = atoi(ptr);
+      if ((dnswld.acl.ct_grace < 0) || (dnswld.acl.ct_grace > MAX_CT_GRACE))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid conntrack grace at line: [%d]",
+                  line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_FW_RECONCILE_SECS))
+    {
+      dnswld.fw.reconcile_secs = atoi(ptr);
+      if ((dnswld.fw.reconcile_secs < 0) ||
+          (dnswld.fw.reconcile_secs > MAX_FW_RECONCILE_SECS))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid reconcile interval at line: [%d]",
+                  line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+    }
+    else if (!strcasecmp(key, CFG_EDNS_MAX_PAYLOAD))
+    {
+      /************************************************************************/
+      /* Packet buffers hold the largest reply. 0 turns EDNS0 off.            */
+      /************************************************************************/
+      dnswld.proc.edns_payload = atoi(ptr);
+      if ((dnswld.proc.edns_payload) &&
+          ((dnswld.proc.edns_payload < DNS_PAYLOADZ) ||
+           (dnswld.proc.edns_payload > MAX_EDNS_PAYLOAD)))
+      {
+        PUTS_OSYS(LOG_INFO, "Invalid EDNS payload size at line: [%d]",
+                  line_num);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+
+      dnswld.proc.pkt_bufz = dnswld.proc.edns_payload ?
+                             dnswld.proc.edns_payload : DNS_PAYLOADZ;
+    }
     else
     {
       PUTS_OSYS(LOG_INFO, "Invalid keyword at line: [%d]", line_num);
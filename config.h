@@ -18,6 +18,28 @@
 #define CFG_WHITELIST                             "whitelist"
 #define CFG_CHAINS                                "chains"
 #define CFG_IPTABLES_PATH                         "iptables_path"
+#define CFG_BATCH_SIZE                            "batch_size"
+#define CFG_WORKERS                               "workers"
+#define CFG_UPSTREAM                              "upstream"
+#define CFG_UPSTREAM_TIMEOUT                      "upstream_timeout"
+#define CFG_UPSTREAM_RETRIES                      "upstream_retries"
+#define CFG_CACHE_SIZE                            "cache_size"
+#define CFG_FW_BACKEND                            "fw_backend"
+#define CFG_IPSET_NAME                            "ipset_name"
+#define CFG_NFT_TABLE                             "nft_table"
+#define CFG_NFT_SET                               "nft_set"
+#define CFG_RESTORE_PATH                          "iptables_restore_path"
+#define CFG_FW_FLUSH_MS                           "fw_flush_ms"
+#define CFG_FW_COALESCE_MS                        "fw_coalesce_ms"
+#define CFG_FW_LATENCY_US                         "fw_latency_us"
+#define CFG_FW_RULE_LAYOUT                        "fw_rule_layout"
+#define CFG_BPF_DEV                               "bpf_dev"
+#define CFG_BPF_MARK                              "bpf_mark"
+#define CFG_BPF_MAP_SIZE                          "bpf_map_size"
+#define CFG_BPF_PIN_PATH                          "bpf_pin_path"
+#define CFG_CT_GRACE                              "conntrack_grace"
+#define CFG_FW_RECONCILE_SECS                     "fw_reconcile_secs"
+#define CFG_EDNS_MAX_PAYLOAD                      "edns_max_payload"
 
 /******************************************************************************/
 /* Forwards decls.                                                            */
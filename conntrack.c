@@ -0,0 +1,379 @@
+/*FILE+************************************************************************/
+/* Filename    : conntrack.c                                                  */
+/*                                                                            */
+/* Description : Conntrack event watcher. Listens to connection create and    */
+/*               destroy events over netlink and reports the flows of         */
+/*               whitelisted pairs to the ACL, which then expires grants on   */
+/*               idleness instead of age.                                     */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <nl.h>
+#include <conntrack.h>
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
+
+
+/******************************************************************************/
+/* Watcher pthread and its event socket.                                      */
+/******************************************************************************/
+static int is_ct_started = FALSE;
+static pthread_t ct_thread;
+static nl_sock ct_nl = {-1, 0, 0};
+
+/******************************************************************************/
+/* Re-sync dump request.                                                      */
+/******************************************************************************/
+static nl_buf ct_buf;
+
+
+/*FUNC+************************************************************************/
+/* Function    : ct_subscribe                                                 */
+/*                                                                            */
+/* Description : Open the event socket and join the conntrack create and      */
+/*               destroy groups. Updates are not needed to count flows.       */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ct_subscribe(void)
+{
+  int groups[] = {NFNLGRP_CONNTRACK_NEW, NFNLGRP_CONNTRACK_DESTROY};
+  int bufz = CT_RCVBUFZ;
+  int i;
+  int ret;
+
+  ret = nl_open(&ct_nl);
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  if (setsockopt(ct_nl.fd, SOL_SOCKET, SO_RCVBUFFORCE, &bufz,
+                 sizeof(bufz)) < 0)
+  {
+    setsockopt(ct_nl.fd, SOL_SOCKET, SO_RCVBUF, &bufz, sizeof(bufz));
+  }
+
+  for (i = 0; i < sizeof(groups) / sizeof(groups[0]); i++)
+  {
+    if (setsockopt(ct_nl.fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &groups[i],
+                   sizeof(groups[i])) < 0)
+    {
+      PUTS_OSYS(LOG_ERR, "Failed to join conntrack events: [%s]",
+                strerror(errno));
+      ret = RET_SOCK_OPEN_ERROR;
+      goto EXIT;
+    }
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  if (ret)
+  {
+    nl_close(&ct_nl);
+  }
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ct_flow_pair                                                 */
+/*                                                                            */
+/* Description : Get the original direction addresses of an IPv4 conntrack    */
+/*               message, i.e. client to server before NAT.                   */
+/*                                                                            */
+/* Params      : nlh (IN)                 - Conntrack message.                */
+/*               s_ip (OUT)               - Source IP, host order.            */
+/*               d_ip (OUT)               - Destination IP, host order.       */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ct_flow_pair(struct nlmsghdr *nlh, unsigned int *s_ip,
+                        unsigned int *d_ip)
+{
+  struct nfgenmsg *nfg = (struct nfgenmsg *)NLMSG_DATA(nlh);
+  struct nlattr *tuple;
+  struct nlattr *ip;
+  struct nlattr *src;
+  struct nlattr *dst;
+
+  if ((NFNL_SUBSYS_ID(nlh->nlmsg_type) != NFNL_SUBSYS_CTNETLINK) ||
+      (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct nfgenmsg))) ||
+      (nfg->nfgen_family != AF_INET))
+  {
+    return(RET_DATA_NOT_FOUND);
+  }
+
+  tuple = nl_find_attr((char *)nfg + NLMSG_ALIGN(sizeof(struct nfgenmsg)),
+                       nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct nfgenmsg)),
+                       CTA_TUPLE_ORIG);
+  ip = tuple ? nl_find_attr(NL_ATTR_DATA(tuple), NL_ATTR_LEN(tuple),
+                            CTA_TUPLE_IP) : NULL;
+  if (!ip)
+  {
+    return(RET_DATA_NOT_FOUND);
+  }
+
+  src = nl_find_attr(NL_ATTR_DATA(ip), NL_ATTR_LEN(ip), CTA_IP_V4_SRC);
+  dst = nl_find_attr(NL_ATTR_DATA(ip), NL_ATTR_LEN(ip), CTA_IP_V4_DST);
+  if ((!src) || (!dst) || (NL_ATTR_LEN(src) != sizeof(*s_ip)) ||
+      (NL_ATTR_LEN(dst) != sizeof(*d_ip)))
+  {
+    return(RET_DATA_NOT_FOUND);
+  }
+
+  memcpy(s_ip, NL_ATTR_DATA(src), sizeof(*s_ip));
+  memcpy(d_ip, NL_ATTR_DATA(dst), sizeof(*d_ip));
+  *s_ip = ntohl(*s_ip);
+  *d_ip = ntohl(*d_ip);
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ct_handle_event                                              */
+/*                                                                            */
+/* Description : Report an IPv4 conntrack event to the ACL.                   */
+/*                                                                            */
+/* Params      : nlh (IN)                 - Event message.                    */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void ct_handle_event(struct nlmsghdr *nlh)
+{
+  unsigned int s_ip;
+  unsigned int d_ip;
+  int event;
+
+  switch (NFNL_MSG_TYPE(nlh->nlmsg_type))
+  {
+    case IPCTNL_MSG_CT_NEW:
+      event = (nlh->nlmsg_flags & (NLM_F_CREATE | NLM_F_EXCL)) ?
+              ACL_FLOW_NEW : ACL_FLOW_UPDATE;
+      break;
+
+    case IPCTNL_MSG_CT_DELETE:
+      event = ACL_FLOW_END;
+      break;
+
+    default:
+      return;
+  }
+
+  if (ct_flow_pair(nlh, &s_ip, &d_ip))
+  {
+    return;
+  }
+
+  STATS_INC(n_ct_events);
+  note_acl_flow(s_ip, d_ip, event);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ct_count_flow                                                */
+/*                                                                            */
+/* Description : Dump callback. Count a listed flow on its pair's entry.      */
+/*                                                                            */
+/* Params      : nlh (IN)                 - Conntrack entry message.          */
+/*               arg (IN)                 - Unused.                           */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void ct_count_flow(struct nlmsghdr *nlh, void *arg)
+{
+  unsigned int s_ip;
+  unsigned int d_ip;
+
+  if (!ct_flow_pair(nlh, &s_ip, &d_ip))
+  {
+    note_acl_flow(s_ip, d_ip, ACL_FLOW_DUMP);
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ct_resync                                                    */
+/*                                                                            */
+/* Description : Re-sync flow counts from a dump of the conntrack table after */
+/*               events were lost. A lost end event would otherwise keep its  */
+/*               grant alive for good. Events queued meanwhile are applied on */
+/*               top, so a flow opened during the dump may count twice until  */
+/*               the next re-sync.                                            */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void ct_resync(void)
+{
+  nl_sock ns = {-1, 0, 0};
+  int ret;
+
+  ret = nl_open(&ns);
+  if (ret)
+  {
+    return;
+  }
+
+  nl_reset(&ct_buf);
+  nl_msg_start(&ns, &ct_buf, (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_GET,
+               NLM_F_DUMP, AF_INET, 0);
+  nl_msg_end(&ct_buf);
+
+  ret = nl_dump(&ns, &ct_buf, ct_count_flow, NULL);
+  if (ret)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to dump conntrack table: [%s]",
+              strerror(-ret));
+  }
+  else
+  {
+    STATS_INC(n_ct_resyncs);
+  }
+
+  sync_acl_flows(!ret);
+  nl_close(&ns);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ct_watcher                                                   */
+/*                                                                            */
+/* Description : Conntrack watcher processing loop. The socket's receive      */
+/*               timeout lets the running flag be re-checked.                 */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void *ct_watcher(void *param)
+{
+  static char buf[CT_MSGZ];
+  struct nlmsghdr *nlh;
+  time_t resync_at = 0;
+  time_t now;
+  int is_resync_due = FALSE;
+  int len;
+
+  PUTS_OSYS(LOG_DEBUG, "Conntrack watcher thread: Started");
+
+  while (dnswld.proc.is_running)
+  {
+    now = time(NULL);
+    if ((is_resync_due) && (now >= resync_at))
+    {
+      ct_resync();
+      is_resync_due = FALSE;
+      resync_at = now + CT_RESYNC_SECS;
+    }
+
+    len = recv(ct_nl.fd, buf, sizeof(buf), 0);
+    if (len < 0)
+    {
+      /************************************************************************/
+      /* Lost events leave flow counts off until they are re-synced.          */
+      /************************************************************************/
+      if (errno == ENOBUFS)
+      {
+        STATS_INC(n_ct_overruns);
+        is_resync_due = TRUE;
+      }
+      continue;
+    }
+
+    for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len))
+    {
+      ct_handle_event(nlh);
+    }
+  }
+
+  PUTS_OSYS(LOG_DEBUG, "Conntrack watcher thread: Done");
+
+  return(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : create_start_ct_watcher                                      */
+/*                                                                            */
+/* Description : Subscribe to conntrack events and start the watcher thread.  */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int create_start_ct_watcher(void)
+{
+  int ret;
+
+  ret = ct_subscribe();
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  ret = pthread_create(&ct_thread, NULL, ct_watcher, NULL);
+  if (ret)
+  {
+    PUTS_OSYS(LOG_DEBUG, "Failed to create conntrack watcher pthread!");
+    nl_close(&ct_nl);
+    ret = RET_SYS_ERROR;
+    goto EXIT;
+  }
+
+  is_ct_started = TRUE;
+
+  PUTS_OSYS(LOG_INFO, "Idle grants reclaimed after %d secs.",
+            dnswld.acl.ct_grace);
+
+  ret = RET_OK;
+
+  EXIT:
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : wait_ct_watcher                                              */
+/*                                                                            */
+/* Description : Wait for conntrack watcher to end and close its socket.      */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void wait_ct_watcher(void)
+{
+  if (is_ct_started)
+  {
+    pthread_join(ct_thread, NULL);
+    nl_close(&ct_nl);
+    is_ct_started = FALSE;
+  }
+}
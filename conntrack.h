@@ -0,0 +1,32 @@
+/*INC+*************************************************************************/
+/* Filename    : conntrack.h                                                  */
+/*                                                                            */
+/* Description : Conntrack event watcher header file.                         */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*INC+*************************************************************************/
+
+#ifndef _CONNTRACK_H
+#define _CONNTRACK_H
+
+/******************************************************************************/
+/* Constants.                                                                 */
+/* - Events arrive in bursts; a small socket buffer overruns and events are   */
+/*   lost.                                                                    */
+/* - Flow counts are re-synced from a dump after events are lost, at most     */
+/*   once per CT_RESYNC_SECS as overruns come in bursts too.                  */
+/******************************************************************************/
+#define CT_RCVBUFZ                                (4 * 1024 * 1024)
+#define CT_MSGZ                                   65536
+#define CT_RESYNC_SECS                            10
+#define MAX_CT_GRACE                              3600
+
+/******************************************************************************/
+/* Forwards decls.                                                            */
+/******************************************************************************/
+extern int create_start_ct_watcher(void);
+extern void wait_ct_watcher(void);
+
+#endif
@@ -1,235 +1,435 @@
 /*FILE+************************************************************************/
 /* Filename    : data_dict.c                                                  */
 /*                                                                            */
-/* Description : DNS data dictionary implementation.                          */
+/* Description : DNS data dictionary implementation. Names are compiled into  */
+/*               a flat hash index of reversed wire-format keys, so a lookup  */
+/*               costs one probe per query label.                             */
 /*                                                                            */
 /* Revisions   : 05/21/14  Sho                                                */
 /*                         - Creation.                                        */
+/*               10/17/26  Sho                                                */
+/*                         - Replace name tree with flat name index.          */
 /*                                                                            */
 /*FILE-************************************************************************/
 
 #include <common.h>
 
+#include <pthread.h>
+
+
+/******************************************************************************/
+/* FNV-1a 64 constants and ASCII case folding.                                */
+/******************************************************************************/
+#define FNV64_BASIS                               0xcbf29ce484222325ULL
+#define FNV64_PRIME                               0x100000001b3ULL
+
+#define LOWER(c)                                  ((((c) >= 'A') && ((c) <= 'Z')) ? ((c) | 0x20) : (c))
+
+/******************************************************************************/
+/* Name indexes are read by every DNS worker and may be updated at runtime.   */
+/******************************************************************************/
+static pthread_rwlock_t dict_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+
+/*FUNC+************************************************************************/
+/* Function    : hash_label                                                   */
+/*                                                                            */
+/* Description : Extend a key hash with one label.                            */
+/*                                                                            */
+/* Params      : hash (IN)                - Hash of the key so far.           */
+/*               label (IN)               - Label.                            */
+/*               len (IN)                 - Label length.                     */
+/*                                                                            */
+/* Returns     : hash                     - Extended hash.                    */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static inline unsigned long long hash_label(unsigned long long hash,
+                                            char *label, int len)
+{
+  int i;
+
+  hash = (hash ^ (unsigned char)len) * FNV64_PRIME;
+  for (i = 0; i < len; i++)
+  {
+    hash = (hash ^ (unsigned char)LOWER(label[i])) * FNV64_PRIME;
+  }
+
+  return(hash);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : probe_slot                                                   */
+/*                                                                            */
+/* Description : Find the slot of a hash, or the free slot it would take.     */
+/*                                                                            */
+/* Params      : index (IN)               - Name index.                       */
+/*               hash (IN)                - Key hash.                         */
+/*                                                                            */
+/* Returns     : slot                     - Slot.                             */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static inline name_slot *probe_slot(name_index *index,
+                                    unsigned long long hash)
+{
+  name_slot *slot;
+  unsigned int mask = index->n_slots - 1;
+  unsigned int i;
+
+  for (i = (unsigned int)hash & mask; ; i = (i + 1) & mask)
+  {
+    slot = &index->slots[i];
+    if ((!slot->flags) || (slot->hash == hash))
+    {
+      return(slot);
+    }
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : key_matches                                                  */
+/*                                                                            */
+/* Description : Confirm a hashed hit against the stored key.                 */
+/*                                                                            */
+/* Params      : index (IN)               - Name index.                       */
+/*               slot (IN)                - Slot hit.                         */
+/*               q (IN)                   - Question.                         */
+/*               labels (IN)              - Labels of question name.          */
+/*               n_labels (IN)            - Number of labels in the key,      */
+/*                                          counted from the TLD.             */
+/*                                                                            */
+/* Returns     : TRUE                     - Match otherwise FALSE.            */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int key_matches(name_index *index, name_slot *slot, dns_question *q,
+                       unsigned char **labels, int n_labels)
+{
+  unsigned char *key = (unsigned char *)&index->arena[slot->key_off];
+  unsigned char *end = key + slot->key_len;
+  unsigned char *label;
+  int len;
+  int i;
+
+  for (i = q->n_label - 1; i >= q->n_label - n_labels; i--)
+  {
+    label = labels[i];
+    len = *label++;
+
+    if ((key >= end) || (*key++ != len) || (key + len > end))
+    {
+      return(FALSE);
+    }
+
+    while (len--)
+    {
+      if (*key++ != LOWER(*label))
+      {
+        return(FALSE);
+      }
+      label++;
+    }
+  }
+
+  return(key == end);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : grow_index                                                   */
+/*                                                                            */
+/* Description : Double the slot array and re-insert the used slots. Stored   */
+/*               hashes are reused; keys are not touched.                     */
+/*                                                                            */
+/* Params      : index (IN/OUT)           - Name index.                       */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int grow_index(name_index *index)
+{
+  name_index grown = *index;
+  name_slot *slot;
+  unsigned int i;
+
+  grown.n_slots = index->n_slots << 1;
+  grown.slots = (name_slot *)calloc(grown.n_slots, sizeof(name_slot));
+  if (!grown.slots)
+  {
+    return(RET_MEMORY_ERROR);
+  }
+
+  for (i = 0; i < index->n_slots; i++)
+  {
+    if (index->slots[i].flags)
+    {
+      slot = probe_slot(&grown, index->slots[i].hash);
+      *slot = index->slots[i];
+    }
+  }
+
+  free(index->slots);
+  *index = grown;
+
+  return(RET_OK);
+}
+
 
 /*FUNC+************************************************************************/
 /* Function    : add_name_to_dictionary                                       */
 /*                                                                            */
-/* Description : Add DNS name to dictionary.                                  */
+/* Description : Add DNS name to dictionary. A "*" label makes the entry a    */
+/*               wildcard for every name below the labels on its right.       */
 /*                                                                            */
 /* Params      : name (IN)                - DNS name (dotted format).         */
-/*               root (IN/OUT)            - Root of name tree.                */
+/*               index (IN/OUT)           - Name index.                       */
 /*                                                                            */
 /* Returns     : RET_OK                   - Success otherwise error.          */
 /*                                                                            */
 /*FUNC-************************************************************************/
-int add_name_to_dictionary(char *name, dnt_node *root)
+int add_name_to_dictionary(char *name, name_index *index)
 {
-  dnt_node *parent_node;
-  dnt_node *new_node;
-  dnt_node *prev_node;
-  dnt_node *runner;
   char labels[DNS_MAX_NUM_LABELS][DNS_MAX_LABEL_LEN + 1];
-  char *label;
-  int cmp_ret;
+  unsigned long long hash = FNV64_BASIS;
+  name_slot *slot;
+  char *arena;
+  char *key;
+  int flags = NAME_EXACT;
   int n_labels;
+  int key_len;
+  int len;
+  int i;
+  int ii;
   int ret;
 
   n_labels = dns_name_to_labels(name, labels);
   if (n_labels <= 0)
   {
-    ret = RET_GEN_ERROR;
-    goto EXIT;
+    return(RET_GEN_ERROR);
   }
 
   dump_labels(labels, n_labels);
 
-  n_labels--;
-  parent_node = root;
+  pthread_rwlock_wrlock(&dict_lock);
 
-  while (n_labels >= 0)
+  /****************************************************************************/
+  /* Only the labels right of the last wildcard make up the key.              */
+  /****************************************************************************/
+  for (i = n_labels - 1; i >= 0; i--)
   {
-    label = labels[n_labels];
-    PUTS_OSYS(LOG_DEBUG, " label: [%s]", label);
-
-    /**************************************************************************/
-    /* Create new node for the label.                                         */
-    /**************************************************************************/
-    new_node = (dnt_node *)malloc(sizeof(dnt_node));
-    if (!new_node)
+    if (!strcmp(labels[i], WILDCARD_LABEL))
     {
-      PUTS_OSYS(LOG_ERR, "Failed to allocate memory for label.");
-      ret = RET_MEMORY_ERROR;
-      goto EXIT;
+      flags = NAME_WILDCARD;
+      break;
     }
+  }
+
+  /****************************************************************************/
+  /* Make room in the arena and the slot array.                               */
+  /****************************************************************************/
+  key_len = 0;
+  for (ii = n_labels - 1; ii > i; ii--)
+  {
+    key_len += 1 + strlen(labels[ii]);
+  }
 
-    memset(new_node, 0, sizeof(dnt_node));
-    strcpy(new_node->name, label);
-    if (!strcmp(label, WILDCARD_NODE_NAME))
+  if (index->arena_len + key_len > index->arena_size)
+  {
+    arena = (char *)realloc(index->arena, (index->arena_size + key_len) * 2);
+    if (!arena)
     {
-      new_node->type = NODE_WILDCARD_TYPE;
+      PUTS_OSYS(LOG_ERR, "Failed to allocate memory for name.");
+      ret = RET_MEMORY_ERROR;
+      goto EXIT;
     }
 
-    PUTS_OSYS(LOG_DEBUG, "  Parent node: [%s]", parent_node->name);
+    index->arena = arena;
+    index->arena_size = (index->arena_size + key_len) * 2;
+  }
 
-    if (!parent_node->h_child)
+  if ((index->n_used + 1) * 2 > index->n_slots)
+  {
+    ret = grow_index(index);
+    if (ret)
     {
-      /************************************************************************/
-      /* First node.                                                          */
-      /************************************************************************/
-      PUTS_OSYS(LOG_DEBUG, "  Adding first child node: [%s]", new_node->name);
-      parent_node->h_child = parent_node->t_child = new_node;
-      parent_node = new_node;
+      PUTS_OSYS(LOG_ERR, "Failed to allocate memory for name.");
+      goto EXIT;
     }
-    else
-    {
-      /************************************************************************/
-      /* Find the position for the new node.                                  */
-      /************************************************************************/
-      for (runner = parent_node->h_child, prev_node = NULL; runner;
-           prev_node = runner, runner = runner->next)
-      {
-        cmp_ret = strcasecmp(new_node->name, runner->name);
-        if (cmp_ret <= 0)
-        {
-          break;
-        }
-      }
+  }
 
-      if (!cmp_ret)
-      {
-        PUTS_OSYS(LOG_DEBUG, "  Found existing child node: [%s]",
-                  new_node->name);
-        parent_node = runner;
-      }
-      else if (!prev_node)
-      {
-        PUTS_OSYS(LOG_DEBUG, "  Adding [%s] before [%s]",
-                  new_node->name, runner->name);
-        new_node->next = runner;
-        parent_node->h_child = new_node;
-        parent_node = new_node;
-      }
-      else
-      {
-        PUTS_OSYS(LOG_DEBUG, "  Adding [%s] after [%s]",
-                  new_node->name, prev_node->name);
-        new_node->next = prev_node->next;
-        prev_node->next = new_node;
-        parent_node = new_node;
-      }
+  /****************************************************************************/
+  /* Encode key, TLD first.                                                   */
+  /****************************************************************************/
+  key = &index->arena[index->arena_len];
+  for (ii = n_labels - 1; ii > i; ii--)
+  {
+    len = strlen(labels[ii]);
+    hash = hash_label(hash, labels[ii], len);
+
+    *key++ = len;
+    for (len = 0; labels[ii][len]; len++)
+    {
+      *key++ = LOWER(labels[ii][len]);
     }
+  }
 
-    n_labels--;
+  slot = probe_slot(index, hash);
+  if (slot->flags)
+  {
+    PUTS_OSYS(LOG_DEBUG, " Existing key. Adding flags: [%d]", flags);
+    slot->flags |= flags;
+    ret = RET_OK;
+    goto EXIT;
   }
 
+  slot->hash = hash;
+  slot->key_off = index->arena_len;
+  slot->key_len = key_len;
+  slot->flags = flags;
+  slot->id = index->n_used;
+
+  index->arena_len += key_len;
+  index->n_used++;
+
+  PUTS_OSYS(LOG_DEBUG, " Added key len: [%d] flags: [%d]", key_len, flags);
+
   ret = RET_OK;
 
   EXIT:
 
-  if (ret)
-  {
-  }
+  pthread_rwlock_unlock(&dict_lock);
 
   return(ret);
 }
 
 
 /*FUNC+************************************************************************/
-/* Function    : find_name                                                    */
+/* Function    : find_name_id                                                 */
 /*                                                                            */
-/* Description : Find DNS name from dictionary.                               */
+/* Description : Find DNS name from dictionary. The query hash is extended    */
+/*               one label at a time from the TLD; each proper suffix is      */
+/*               probed for a wildcard and the whole name for an exact entry. */
 /*                                                                            */
 /* Params      : q (IN)                   - DNS name (question structure)     */
-/*               root (IN/OUT)            - Root of name tree.                */
+/*               index (IN)               - Name index.                       */
 /*                                                                            */
-/* Returns     : TRUE                     - Found otherwise FALSE.            */
+/* Returns     : id                       - Id of the matching entry,         */
+/*                                          otherwise -1.                     */
 /*                                                                            */
 /*FUNC-************************************************************************/
-int find_name(dns_question *q, dnt_node *root)
+int find_name_id(dns_question *q, name_index *index)
 {
-  dnt_node *parent_node;
-  dnt_node *runner;
-  char *label;
-  int cmp_ret;
-  int n_labels = q->n_label;
-  int ret;
+  unsigned long long hash = FNV64_BASIS;
+  unsigned char *labels[DNS_MAX_NUM_LABELS];
+  unsigned char *label;
+  name_slot *slot;
+  int n_labels;
+  int ret = -1;
 
-  n_labels--;
-  parent_node = root;
+  if (q->n_label <= 0)
+  {
+    return(-1);
+  }
 
-  while (n_labels >= 0)
+  /****************************************************************************/
+  /* Keys are walked from the TLD, so locate the labels in the name first.    */
+  /****************************************************************************/
+  for (label = DNS_LABEL(q->msg, q->name), n_labels = 0; *label;
+       label = DNS_LABEL(q->msg, label + *label + 1))
   {
-    label = q->labels[n_labels];
-    PUTS_OSYS(LOG_DEBUG, " label[%d]: [%s]", n_labels, label);
+    labels[n_labels++] = label;
+  }
 
-    for (runner = parent_node->h_child; runner; runner = runner->next)
+  pthread_rwlock_rdlock(&dict_lock);
+
+  for (n_labels = 0; ; n_labels++)
+  {
+    slot = probe_slot(index, hash);
+    if (slot->flags)
     {
-      PUTS_OSYS(LOG_DEBUG, " runner->name: [%s]", runner->name);
-      if (runner->type == NODE_WILDCARD_TYPE)
+      if ((n_labels < q->n_label) && (slot->flags & NAME_WILDCARD) &&
+          (key_matches(index, slot, q, labels, n_labels)))
       {
-        PUTS_OSYS(LOG_DEBUG, " wildcard node. matched!");
-        goto WILDCARD;
+        PUTS_OSYS(LOG_DEBUG, " wildcard matched at label[%d]!",
+                  q->n_label - n_labels);
+        ret = slot->id;
+        break;
       }
 
-      cmp_ret = strcasecmp(label, runner->name);
-      if (cmp_ret == 0)
+      if ((n_labels == q->n_label) && (slot->flags & NAME_EXACT) &&
+          (key_matches(index, slot, q, labels, n_labels)))
       {
-        parent_node = runner;
+        ret = slot->id;
         break;
       }
-      else if (cmp_ret < 0)
-      {
-        ret = FALSE;
-        goto EXIT;
-      }
     }
 
-    if (!runner)
+    if (n_labels == q->n_label)
     {
-      ret = FALSE;
-      goto EXIT;
+      break;
     }
 
-    n_labels--;
+    label = labels[q->n_label - n_labels - 1];
+    hash = hash_label(hash, (char *)label + 1, *label);
   }
 
-  WILDCARD:
-
-  ret = TRUE;
-
-  EXIT:
+  pthread_rwlock_unlock(&dict_lock);
 
   return(ret);
 }
 
 
 /*FUNC+************************************************************************/
-/* Function    : create_name_tree                                             */
+/* Function    : find_name                                                    */
 /*                                                                            */
-/* Description : Create and initialize name tree.                             */
+/* Description : Find DNS name from dictionary.                               */
 /*                                                                            */
-/* Params      : root (OUT)               - Name tree root node.              */
+/* Params      : q (IN)                   - DNS name (question structure)     */
+/*               index (IN)               - Name index.                       */
 /*                                                                            */
 /* Returns     : TRUE                     - Found otherwise FALSE.            */
 /*                                                                            */
 /*FUNC-************************************************************************/
-int create_name_tree(dnt_node **root)
+int find_name(dns_question *q, name_index *index)
+{
+  return((find_name_id(q, index) >= 0) ? TRUE : FALSE);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : create_name_index                                            */
+/*                                                                            */
+/* Description : Create and initialize an empty name index.                   */
+/*                                                                            */
+/* Params      : index (OUT)              - Name index.                       */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int create_name_index(name_index **index)
 {
-  dnt_node *node;
+  name_index *idx;
   int ret;
 
-  node = (dnt_node *)malloc(sizeof(dnt_node));
-  if (!node)
+  idx = (name_index *)calloc(1, sizeof(name_index));
+  if (!idx)
   {
-    PUTS_OSYS(LOG_ERR, "Name node malloc error.");
+    PUTS_OSYS(LOG_ERR, "Name index malloc error.");
     ret = RET_MEMORY_ERROR;
     goto EXIT;
   }
 
-  memset(node, 0, sizeof(*node));
-  strcpy(node->name, ROOT_NODE_NAME);
+  idx->n_slots = NAME_INDEX_MIN_SLOTS;
+  idx->slots = (name_slot *)calloc(idx->n_slots, sizeof(name_slot));
+  if (!idx->slots)
+  {
+    PUTS_OSYS(LOG_ERR, "Name index malloc error.");
+    free(idx);
+    ret = RET_MEMORY_ERROR;
+    goto EXIT;
+  }
 
-  *root = node;
+  *index = idx;
 
   ret = RET_OK;
 
@@ -240,21 +440,22 @@ int create_name_tree(dnt_node **root)
 
 
 /*FUNC+************************************************************************/
-/* Function    : destroy_name_tree                                            */
+/* Function    : destroy_name_index                                           */
 /*                                                                            */
-/* Description : Destroy name tree.                                           */
+/* Description : Destroy name index.                                          */
 /*                                                                            */
-/* Params      : root (OUT)               - Name tree root node.              */
+/* Params      : index (IN/OUT)           - Name index.                       */
 /*                                                                            */
-/* Returns     : TRUE                     - Found otherwise FALSE.            */
+/* Returns     : none                                                         */
 /*                                                                            */
 /*FUNC-************************************************************************/
-void destroy_name_tree(dnt_node **root)
+void destroy_name_index(name_index **index)
 {
-  if (*root)
+  if (*index)
   {
-    free(*root);
-    *root = NULL;
+    free((*index)->slots);
+    free((*index)->arena);
+    free(*index);
+    *index = NULL;
   }
 }
-
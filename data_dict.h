@@ -14,6 +14,8 @@
 /******************************************************************************/
 /* Includes.                                                                  */
 /******************************************************************************/
+#include <netinet/in.h>
+
 #include <dns.h>
 
 /******************************************************************************/
@@ -22,45 +24,81 @@
 #define WHITELIST_NAMES                           1
 #define BLACKLIST_NAMES                           2
 
-#define NODE_REG_TYPE                             0
-#define NODE_WILDCARD_TYPE                        1
+/******************************************************************************/
+/* Name index slot flags.                                                     */
+/******************************************************************************/
+#define NAME_EXACT                                0x01
+#define NAME_WILDCARD                             0x02
+
+#define WILDCARD_LABEL                            "*"
+#define NAME_INDEX_MIN_SLOTS                      64
+
+/******************************************************************************/
+/* Name index slot. The key is the name with its labels in reverse order      */
+/* (TLD first), each as length + lowercase octets, e.g. "\3org\7example". A   */
+/* wildcard entry "*.example.org" is keyed by its suffix "example.org".       */
+/* - hash is FNV-1a 64 of the key. It can be extended one label at a time, so */
+/*   every suffix of a query is probed for the cost of hashing it once.       */
+/* - key_off is the offset of the key in the arena; flags 0 is a free slot.   */
+/* - id numbers the keys from 0 in the order they were added. Firewall        */
+/*   backends use it to group grants by whitelist entry.                      */
+/******************************************************************************/
+typedef struct _name_slot
+{
+  unsigned long long hash;
+  unsigned int key_off;
+  unsigned short key_len;
+  unsigned short flags;
+  unsigned int id;
+} name_slot;
 
-#define ROOT_NODE_NAME                            "root"
-#define WILDCARD_NODE_NAME                        "*"
 
 /******************************************************************************/
-/* DNS name tree.                                                             */
+/* Name index. Open addressing with linear probing over one slot array, keys  */
+/* packed in one arena.                                                       */
 /******************************************************************************/
-typedef struct _dnt_node
+typedef struct _name_index
 {
-  struct _dnt_node *h_child;
-  struct _dnt_node *t_child;
-  struct _dnt_node *next;
-  char name[DNS_MAX_LABEL_LEN + 1];
-  int type;
-} dnt_node;
+  name_slot *slots;
+  unsigned int n_slots;
+  unsigned int n_used;
+  char *arena;
+  unsigned int arena_len;
+  unsigned int arena_size;
+} name_index;
 
 
 /******************************************************************************/
-/* DNS answer. We set a limit of 10 records for now.                          */
+/* DNS answer. A records in network byte order, as they go on the wire.       */
+/* - tmpl is the encoded answer section of a cached name, tmpl_len bytes.     */
+/*   Answers without one are encoded record by record.                        */
 /******************************************************************************/
 typedef struct _dns_answer
 {
   int n_rec;
-  char recs[DNS_MAX_ANS_RR_NUM][DNS_MAX_ANS_RR_LEN];
+  in_addr_t recs[DNS_MAX_ANS_RR_NUM];
+  int tmpl_len;
+  unsigned char tmpl[DNS_ANS_TMPLZ];
 } dns_answer;
 
 
 /******************************************************************************/
-/* DNS question.                                                              */
+/* DNS question. A view of the question in the message it was parsed from,    */
+/* which must outlive it.                                                     */
+/* - name points to the encoded name in msg. Labels are walked from it with   */
+/*   DNS_LABEL(), which follows compression pointers; nothing is copied.      */
+/* - hash is hash_name() of the dotted name, folded while parsing.            */
 /******************************************************************************/
 typedef struct _dns_question
 {
-  int n_label;
-  char labels[DNS_MAX_NUM_LABELS][DNS_MAX_LABEL_LEN + 1];
-  char name[DNS_MAX_NAME_LEN + 1];
+  unsigned char *msg;
+  unsigned char *name;
+  unsigned int hash;
+  unsigned char n_label;
   short q_type;
   short q_class;
+  int is_whitelisted;
+  int dom_id;
   dns_answer ans;
 } dns_question;
 
@@ -68,9 +106,10 @@ typedef struct _dns_question
 /******************************************************************************/
 /* Forwards decls.                                                            */
 /******************************************************************************/
-extern int add_name_to_dictionary(char *name, dnt_node *root);
-extern int find_name(dns_question *q, dnt_node *root);
-extern int create_name_tree(dnt_node **root);
-extern void destroy_name_tree(dnt_node **root);
+extern int add_name_to_dictionary(char *name, name_index *index);
+extern int find_name(dns_question *q, name_index *index);
+extern int find_name_id(dns_question *q, name_index *index);
+extern int create_name_index(name_index **index);
+extern void destroy_name_index(name_index **index);
 
 #endif
@@ -16,13 +16,23 @@
 /******************************************************************************/
 #define DNS_PAYLOADZ                              512
 #define DNS_MAX_NAME_LEN                          253
+#define DNS_MAX_ENC_NAME_LEN                      255
 #define DNS_MAX_LABEL_LEN                         63
 #define DNS_MAX_NUM_LABELS                        127
 #define DNS_MAX_ANS_RR_NUM                        5
-#define DNS_MAX_ANS_RR_LEN                        255
+#define DNS_MAX_QUESTIONS                         4
 
 #define DNS_MAX_DEFAULT_TTL                       0
 
+/******************************************************************************/
+/* EDNS0 (RFC 6891). Payload sizes are the UDP sizes advertised in OPT RRs.   */
+/* - 1232 bytes avoids IP fragmentation on common paths.                      */
+/******************************************************************************/
+#define DEF_EDNS_PAYLOAD                          1232
+#define MAX_EDNS_PAYLOAD                          4096
+#define DNS_OPT_RR_LEN                            11
+#define DNS_EXT_RCODE_BADVERS                     1
+
 /******************************************************************************/
 /* DNS header bit flags.                                                      */
 /******************************************************************************/
@@ -51,9 +61,28 @@
 #define DNS_RR_TYPE_SOA                           6
 #define DNS_RR_TYPE_PTR                           12
 #define DNS_RR_TYPE_MX                            15
+#define DNS_RR_TYPE_OPT                           41
 
 #define DNS_RR_TYPE_A_LEN                         4
 
+/******************************************************************************/
+/* Answer RR of an A record, owner name compressed to a pointer: pointer +    */
+/* type, class, TTL, rdlength + rdata.                                        */
+/******************************************************************************/
+#define DNS_A_RR_LEN                              (2 + 10 + DNS_RR_TYPE_A_LEN)
+#define DNS_ANS_TMPLZ                             (DNS_MAX_ANS_RR_NUM * DNS_A_RR_LEN)
+
+/******************************************************************************/
+/* Name compression pointers.                                                 */
+/* - DNS_LABEL() steps over the pointer at p, if any. Names validated by the  */
+/*   question parser never point at another pointer.                          */
+/******************************************************************************/
+#define DNS_PTR_MASK                              0xC0
+#define DNS_IS_PTR(c)                             (((c) & DNS_PTR_MASK) == DNS_PTR_MASK)
+#define DNS_PTR_OFF(p)                            ((((p)[0] & ~DNS_PTR_MASK) << 8) | (p)[1])
+#define DNS_PTR_TO(off)                           ((DNS_PTR_MASK << 8) | (off))
+#define DNS_LABEL(msg,p)                          (DNS_IS_PTR(*(p)) ? (msg) + DNS_PTR_OFF(p) : (p))
+
 /******************************************************************************/
 /* DNS RR class.                                                              */
 /******************************************************************************/
@@ -71,5 +100,16 @@ typedef struct _dns_header {
   unsigned short addrec_count;
 } dns_header;
 
+
+/******************************************************************************/
+/* EDNS0 state of a query, from its OPT RR.                                   */
+/******************************************************************************/
+typedef struct _dns_edns
+{
+  int is_present;
+  unsigned short udp_size;
+  unsigned char version;
+} dns_edns;
+
 #endif
 
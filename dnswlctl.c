@@ -67,7 +67,7 @@ void show_usage(void)
 {
   fprintf(stdout, "%s <command> [options]\n", prog_name);
   fprintf(stdout,"Parameters:\n");
-  fprintf(stdout,"  command: status|start|stop|show|del\n");
+  fprintf(stdout,"  command: status|start|stop|show|del|stats\n");
   fprintf(stdout,"  -A: All\n");
   fprintf(stdout,"  -d: Domain\n");
   fprintf(stdout,"  -S <ip>: Source IP\n");
@@ -95,6 +95,7 @@ static int get_cmd_id(int argc, char **argv)
                      {"stop", CMD_STOP},
                      {"show", CMD_GET_WHITELIST_IP},
                      {"del", CMD_DEL_WHITELIST_IP},
+                     {"stats", CMD_GET_STATS},
                      {NULL, CMD_NONE}};
   cmd_info *ptr;
 
@@ -568,8 +569,11 @@ int show_whitelist_ip(void)
 
       snprintf(acl_id, sizeof(acl_id), "[%d]", ctr);
 
-      delta_time = difftime(cur_time, (time_t)acl_obj->created_at);
-      secs_left = acl_obj->age - (int)delta_time;
+      /************************************************************************/
+      /* Expiry moves when grants expire on idleness.                         */
+      /************************************************************************/
+      delta_time = difftime((time_t)acl_obj->expiry, cur_time);
+      secs_left = (int)delta_time;
 
       fprintf(stdout, "%-5s %-16s %-16s %-5d %lu\n",
               acl_id, src_ip, dst_ip, secs_left, acl_obj->age);
@@ -693,6 +697,148 @@ int del_whitelist_ip(void)
 }
 
 
+/*FUNC+************************************************************************/
+/* Function    : get_percentile                                               */
+/*                                                                            */
+/* Description : Get percentile from log2 latency histogram.                  */
+/*                                                                            */
+/* Params      : hist (IN)                - Latency histogram.                */
+/*               pct (IN)                 - Percentile (0-100).               */
+/*                                                                            */
+/* Returns     : usecs                    - Upper bound of the bucket holding */
+/*                                          the percentile.                   */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static unsigned long get_percentile(unsigned long *hist, double pct)
+{
+  unsigned long total = 0;
+  unsigned long sum = 0;
+  int i;
+
+  for (i = 0; i < STATS_LAT_BUCKETS; i++)
+  {
+    total += hist[i];
+  }
+
+  if (!total)
+  {
+    return(0);
+  }
+
+  for (i = 0; i < STATS_LAT_BUCKETS; i++)
+  {
+    sum += hist[i];
+    if ((double)sum >= ((double)total * pct / 100.0))
+    {
+      break;
+    }
+  }
+
+  return(1UL << i);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : show_stats                                                   */
+/*                                                                            */
+/* Description : Show daemon statistics.                                      */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int show_stats(void)
+{
+  cmd_hdr cmd;
+  cmd_hdr *hdr;
+  stats_obj *st;
+  char buf[1024];
+  int buf_len;
+  int ret;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = CMD_REQUEST;
+  cmd.cmd_id = CMD_GET_STATS;
+
+  buf_len = sizeof(buf);
+
+  ret = send_req((char *)&cmd, sizeof(cmd), buf, &buf_len);
+  if (ret)
+  {
+    fprintf(stdout, "Daemon is down.\n");
+    goto EXIT;
+  }
+
+  hdr = (cmd_hdr *)buf;
+  st = (stats_obj *)(hdr + 1);
+
+  if ((hdr->type != CMD_RESPONSE) || (hdr->cmd_id != CMD_GET_STATS) ||
+      (buf_len < (int)(sizeof(cmd_hdr) + sizeof(stats_obj))))
+  {
+    fprintf(stdout, " Unexpected response. Skipping.\n");
+    ret = RET_INVALID_PARAM;
+    goto EXIT;
+  }
+
+  fprintf(stdout, "Statistics\n");
+  fprintf(stdout, "==========\n");
+  fprintf(stdout, "Uptime            : %lu secs\n", st->uptime);
+  fprintf(stdout, "Queries           : %lu (%.1f/sec)\n", st->n_queries,
+          st->uptime ? (double)st->n_queries / st->uptime : 0.0);
+  fprintf(stdout, "Responses         : %lu\n", st->n_responses);
+  fprintf(stdout, "Dropped           : %lu\n", st->n_dropped);
+  fprintf(stdout, "Loop wakeups      : %lu\n", st->n_wakeups);
+  fprintf(stdout, "Loop events       : %lu (%.2f/wakeup)\n", st->n_events,
+          st->n_wakeups ? (double)st->n_events / st->n_wakeups : 0.0);
+  fprintf(stdout, "Worker threads    : %lu\n", st->n_workers);
+  fprintf(stdout, "Batch size        : %lu\n", st->batch_size);
+  fprintf(stdout, "RX batches        : %lu (%.2f pkts/batch)\n",
+          st->n_rx_batches,
+          st->n_rx_batches ? (double)st->n_queries / st->n_rx_batches : 0.0);
+  fprintf(stdout, "TX batches        : %lu (%.2f pkts/batch)\n",
+          st->n_tx_batches,
+          st->n_tx_batches ? (double)st->n_responses / st->n_tx_batches : 0.0);
+  fprintf(stdout, "Parked queries    : %lu\n", st->n_parked);
+  fprintf(stdout, "Upstream sent     : %lu\n", st->n_upstream_sent);
+  fprintf(stdout, "Upstream timeouts : %lu\n", st->n_upstream_timeouts);
+  fprintf(stdout, "Upstream lookups  : %lu\n", st->n_lookups);
+  fprintf(stdout, "Coalesced         : %lu (%.1f%% of parked questions)\n",
+          st->n_coalesced, (st->n_lookups + st->n_coalesced) ?
+          100.0 * st->n_coalesced / (st->n_lookups + st->n_coalesced) : 0.0);
+  fprintf(stdout, "Cache hits        : %lu (%.1f%%)\n", st->n_cache_hits,
+          (st->n_cache_hits + st->n_cache_misses) ?
+          100.0 * st->n_cache_hits / (st->n_cache_hits + st->n_cache_misses) :
+          0.0);
+  fprintf(stdout, "Cache misses      : %lu\n", st->n_cache_misses);
+  fprintf(stdout, "Template replies  : %lu\n", st->n_tmpl_replies);
+  fprintf(stdout, "Firewall commands : %lu (%lu failed)\n", st->n_fw_cmds,
+          st->n_fw_errors);
+  fprintf(stdout, "Firewall batches  : %lu (%.2f cmds/batch)\n",
+          st->n_fw_batches,
+          st->n_fw_batches ? (double)st->n_fw_cmds / st->n_fw_batches : 0.0);
+  fprintf(stdout, "FW queue full     : %lu\n", st->n_fw_queue_full);
+  fprintf(stdout, "FW cmds coalesced : %lu\n", st->n_fw_coalesced);
+  fprintf(stdout, "Conntrack events  : %lu (%lu overruns, %lu re-syncs)\n",
+          st->n_ct_events, st->n_ct_overruns, st->n_ct_resyncs);
+  fprintf(stdout, "Grants extended   : %lu\n", st->n_acl_refreshes);
+  fprintf(stdout, "Grants reclaimed  : %lu\n", st->n_acl_reclaimed);
+  fprintf(stdout, "FW reconciles     : %lu (%lu fixed, last %lu usecs)\n",
+          st->n_reconciles, st->n_reconcile_fixes, st->reconcile_usecs);
+  fprintf(stdout, "Latency p50       : <= %lu usecs\n",
+          get_percentile(st->lat_hist, 50.0));
+  fprintf(stdout, "Latency p99       : <= %lu usecs\n",
+          get_percentile(st->lat_hist, 99.0));
+  fprintf(stdout, "\n");
+
+  ret = RET_OK;
+
+  EXIT:
+
+  return(ret);
+}
+
+
 /*FUNC+************************************************************************/
 /* Function    : main                                                         */
 /*                                                                            */
@@ -756,6 +902,10 @@ int main(int argc, char **argv)
       del_whitelist_ip();
       break;
 
+    case CMD_GET_STATS:
+      show_stats();
+      break;
+
     default:
       fprintf(stdout, "Unsupported command.\n");
       break;
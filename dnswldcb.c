@@ -10,6 +10,7 @@
 
 #include <common.h>
 #include <dnswldcb.h>
+#include <fw.h>
 
 
 /******************************************************************************/
@@ -41,6 +42,11 @@ void init_dnswld(void)
 
   dnswld.proc.wl_age = DEF_WHITELIST_AGE;
 
+  /****************************************************************************/
+  /* Event loop is created later.                                             */
+  /****************************************************************************/
+  dnswld.evloop.epfd = -1;
+
   /****************************************************************************/
   /* Configuration file.                                                      */
   /****************************************************************************/
@@ -49,7 +55,16 @@ void init_dnswld(void)
   /****************************************************************************/
   /* Packet buffers.                                                          */
   /****************************************************************************/
-  dnswld.proc.pkt_bufz = DNS_PAYLOADZ;
+  dnswld.proc.edns_payload = DEF_EDNS_PAYLOAD;
+  dnswld.proc.pkt_bufz = DEF_EDNS_PAYLOAD;
+  dnswld.proc.batch_size = DEF_BATCH_SIZE;
+
+  /****************************************************************************/
+  /* Upstream resolver. Servers come from config or resolv.conf.              */
+  /****************************************************************************/
+  dnswld.rslv.timeout_ms = DEF_RSLV_TIMEOUT_MS;
+  dnswld.rslv.retries = DEF_RSLV_RETRIES;
+  dnswld.cache.size = DEF_CACHE_SIZE;
 
   /****************************************************************************/
   /* Default logging settings.                                                */
@@ -63,6 +78,15 @@ void init_dnswld(void)
   strcpy(dnswld.fw.chains[0], "FORWARD");
   dnswld.fw.n_chains = 1;
   strcpy(dnswld.fw.iptables_path, "/sbin/iptables");
+  dnswld.fw.backend = FW_BACKEND_IPTABLES;
+  strcpy(dnswld.fw.set_name, DEF_IPSET_NAME);
+  strcpy(dnswld.fw.table_name, DEF_NFT_TABLE);
+  strcpy(dnswld.fw.restore_path, DEF_RESTORE_PATH);
+  dnswld.fw.flush_ms = -1;
+  dnswld.fw.coalesce_ms = DEF_FW_COALESCE_MS;
+  dnswld.fw.layout = FW_LAYOUT_FLAT;
+  dnswld.fw.bpf_mark = DEF_BPF_MARK;
+  dnswld.fw.bpf_map_size = DEF_BPF_MAP_SIZE;
 
   /****************************************************************************/
   /* Command channel settings.                                                */
@@ -72,10 +96,93 @@ void init_dnswld(void)
 }
 
 
+/*FUNC+************************************************************************/
+/* Function    : init_pkt_ring                                                */
+/*                                                                            */
+/* Description : Allocate packet ring and pre-wire the mmsghdr vectors.       */
+/*                                                                            */
+/* Params      : ring (OUT)               - Packet ring.                      */
+/*               n_slots (IN)             - Number of slots (batch size).     */
+/*               bufz (IN)                - Size of each slot buffer.         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int init_pkt_ring(pkt_ring *ring, int n_slots, int bufz)
+{
+  pkt_slot *slot;
+  struct msghdr *hdr;
+  int i;
+
+  memset(ring, 0, sizeof(*ring));
+  ring->n_slots = n_slots;
+  ring->bufz = bufz;
+
+  ring->bufs = (char *)malloc(n_slots * bufz);
+  ring->slots = (pkt_slot *)calloc(n_slots, sizeof(pkt_slot));
+  ring->r_msgs = (struct mmsghdr *)calloc(n_slots, sizeof(struct mmsghdr));
+  ring->r_iovs = (struct iovec *)calloc(n_slots, sizeof(struct iovec));
+  ring->s_msgs = (struct mmsghdr *)calloc(n_slots, sizeof(struct mmsghdr));
+  ring->s_iovs = (struct iovec *)calloc(n_slots, sizeof(struct iovec));
+
+  if ((!ring->bufs) || (!ring->slots) || (!ring->r_msgs) || (!ring->r_iovs) ||
+      (!ring->s_msgs) || (!ring->s_iovs))
+  {
+    PUTS_OSYS(LOG_INFO, "Failed to allocate packet ring.");
+    clean_pkt_ring(ring);
+    return(RET_MEMORY_ERROR);
+  }
+
+  /****************************************************************************/
+  /* Receive vectors never change. Send vectors are filled per batch.         */
+  /****************************************************************************/
+  for (i = 0; i < n_slots; i++)
+  {
+    slot = &ring->slots[i];
+    slot->buf = &ring->bufs[i * bufz];
+
+    ring->r_iovs[i].iov_base = slot->buf;
+    ring->r_iovs[i].iov_len = bufz;
+
+    hdr = &ring->r_msgs[i].msg_hdr;
+    hdr->msg_name = &slot->addr;
+    hdr->msg_namelen = sizeof(slot->addr);
+    hdr->msg_iov = &ring->r_iovs[i];
+    hdr->msg_iovlen = 1;
+  }
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : clean_pkt_ring                                               */
+/*                                                                            */
+/* Description : Free packet ring.                                            */
+/*                                                                            */
+/* Params      : ring (IN/OUT)            - Packet ring.                      */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void clean_pkt_ring(pkt_ring *ring)
+{
+  free(ring->bufs);
+  free(ring->slots);
+  free(ring->r_msgs);
+  free(ring->r_iovs);
+  free(ring->s_msgs);
+  free(ring->s_iovs);
+
+  memset(ring, 0, sizeof(*ring));
+}
+
+
 /*FUNC+************************************************************************/
 /* Function    : init_dns_bufs                                                */
 /*                                                                            */
-/* Description : Allocate DNS processing buffers.                             */
+/* Description : Allocate DNS processing buffers. Each worker gets its own    */
+/*               packet ring and question scratch area.                       */
 /*                                                                            */
 /* Params      : none                                                         */
 /*                                                                            */
@@ -84,16 +191,47 @@ void init_dnswld(void)
 /*FUNC-************************************************************************/
 int init_dns_bufs(void)
 {
-  int ret = RET_OK;
+  worker_cb *worker;
+  int n_workers;
+  int i;
+  int ret;
 
-  dnswld.proc.pkt_buf = (char *)malloc(dnswld.proc.pkt_bufz);
-  if (!dnswld.proc.pkt_buf)
+  n_workers = dnswld.proc.n_workers ? dnswld.proc.n_workers : 1;
+
+  dnswld.stats.batch_size = dnswld.proc.batch_size;
+  dnswld.stats.n_workers = dnswld.proc.n_workers;
+
+  dnswld.workers = (worker_cb *)calloc(n_workers, sizeof(worker_cb));
+  if (!dnswld.workers)
   {
-    PUTS_OSYS(LOG_INFO, "Failed to allocate packet buffer.");
-    ret = RET_MEMORY_ERROR;
+    PUTS_OSYS(LOG_INFO, "Failed to allocate workers.");
+    return(RET_MEMORY_ERROR);
+  }
+
+  for (i = 0; i < n_workers; i++)
+  {
+    worker = &dnswld.workers[i];
+    worker->id = i;
+    worker->listener.sock = -1;
+    worker->evloop.epfd = -1;
+
+    ret = init_pkt_ring(&worker->ring, dnswld.proc.batch_size,
+                        dnswld.proc.pkt_bufz);
+    if (ret)
+    {
+      return(ret);
+    }
+
+    worker->qs = (dns_question *)malloc(sizeof(dns_question) *
+                                        DNS_MAX_QUESTIONS);
+    if (!worker->qs)
+    {
+      PUTS_OSYS(LOG_INFO, "Failed to allocate question scratch.");
+      return(RET_MEMORY_ERROR);
+    }
   }
 
-  return(ret);
+  return(RET_OK);
 }
 
 
@@ -109,10 +247,24 @@ int init_dns_bufs(void)
 /*FUNC-************************************************************************/
 void clean_dns_bufs(void)
 {
-  if (dnswld.proc.pkt_buf)
+  int n_workers;
+  int i;
+
+  if (!dnswld.workers)
   {
-    free(dnswld.proc.pkt_buf);
+    return;
   }
+
+  n_workers = dnswld.proc.n_workers ? dnswld.proc.n_workers : 1;
+
+  for (i = 0; i < n_workers; i++)
+  {
+    clean_pkt_ring(&dnswld.workers[i].ring);
+    free(dnswld.workers[i].qs);
+  }
+
+  free(dnswld.workers);
+  dnswld.workers = NULL;
 }
 
 
@@ -131,18 +283,18 @@ int init_data_stores(void)
   int ret;
 
   /****************************************************************************/
-  /* Create whitelist name tree root.                                         */
+  /* Create whitelist name index.                                             */
   /****************************************************************************/
-  ret = create_name_tree(&dnswld.ds.whitelist);
+  ret = create_name_index(&dnswld.ds.whitelist);
   if (ret)
   {
     return(ret);
   }
 
   /****************************************************************************/
-  /* Create blacklist name tree root.                                         */
+  /* Create blacklist name index.                                             */
   /****************************************************************************/
-  ret = create_name_tree(&dnswld.ds.blacklist);
+  ret = create_name_index(&dnswld.ds.blacklist);
 
   return(RET_OK);
 }
@@ -162,12 +314,12 @@ void clean_ds_stores(void)
 {
   if (dnswld.ds.whitelist)
   {
-    destroy_name_tree(&dnswld.ds.whitelist);
+    destroy_name_index(&dnswld.ds.whitelist);
   }
 
   if (dnswld.ds.blacklist)
   {
-    destroy_name_tree(&dnswld.ds.blacklist);
+    destroy_name_index(&dnswld.ds.blacklist);
   }
 }
 
@@ -18,6 +18,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include <pthread.h>
+
 /******************************************************************************/
 /* Constants.                                                                 */
 /******************************************************************************/
@@ -34,11 +36,15 @@
 
 #define FW_CHAIN_MAX_LEN                          50
 #define FW_CHAIN_MAX_NUM                          5
+#define FW_SET_NAME_MAX_LEN                       32
 
 #define DEF_DNSWLD_PORT                           53
 #define DEF_DNSWLD_IP4                            "0.0.0.0"
 #define DEF_WHITELIST_AGE                         300
 #define DEF_CONFIG_FILE                           "/etc/dnswld.cfg"
+#define DEF_BATCH_SIZE                            32
+#define MAX_BATCH_SIZE                            256
+#define MAX_WORKERS                               64
 
 
 /******************************************************************************/
@@ -58,9 +64,58 @@ typedef struct _listeners_cb
   char addr4_str[IP4_STR_MAX_LEN];
   char if_name[IF_NAME_MAX_LEN];
   SOCK_READER sock_reader;
+  ev_source ev;
+  struct _worker_cb *worker;
 } listeners_cb;
 
 
+/******************************************************************************/
+/* Packet slot. Holds one datagram and, once processed, its reply in place.   */
+/******************************************************************************/
+typedef struct _pkt_slot
+{
+  char *buf;
+  int len;
+  int reply_len;
+  struct sockaddr_in addr;
+} pkt_slot;
+
+
+/******************************************************************************/
+/* Packet ring. Slots for one recvmmsg()/sendmmsg() batch.                    */
+/******************************************************************************/
+typedef struct _pkt_ring
+{
+  int n_slots;
+  int bufz;
+  char *bufs;
+  pkt_slot *slots;
+  struct mmsghdr *r_msgs;
+  struct iovec *r_iovs;
+  struct mmsghdr *s_msgs;
+  struct iovec *s_iovs;
+} pkt_ring;
+
+
+/******************************************************************************/
+/* DNS worker CB. Everything a DNS listener touches per query is owned by its */
+/* worker so workers never share packet or scratch memory.                    */
+/* - With no worker threads configured, a single worker CB is serviced by the */
+/*   main thread and has no socket or event loop of its own.                  */
+/******************************************************************************/
+typedef struct _worker_cb
+{
+  int id;
+  int is_started;
+  pthread_t thread;
+  evloop_cb evloop;
+  listeners_cb listener;
+  pkt_ring ring;
+  dns_question *qs;
+  rslv_ctx rslv;
+} worker_cb;
+
+
 /******************************************************************************/
 /* Logging CB.                                                                */
 /******************************************************************************/
@@ -81,8 +136,10 @@ typedef struct _process_cb
   pid_t pid;
   int is_daemon;
   int is_running;
-  char *pkt_buf;
   int pkt_bufz;
+  int edns_payload;
+  int batch_size;
+  int n_workers;
   int wl_age;
   int disable_fw;
   int disable_cmd_channel;
@@ -97,17 +154,19 @@ typedef struct _process_cb
 /******************************************************************************/
 typedef struct _data_store
 {
-  dnt_node *whitelist;
-  dnt_node *blacklist;
+  name_index *whitelist;
+  name_index *blacklist;
 } data_store;
 
 
 /******************************************************************************/
-/* ACL CB.                                                                    */
+/* ACL CB. A non-zero ct_grace expires grants on idleness, as reported by     */
+/* conntrack events, instead of age.                                          */
 /******************************************************************************/
 typedef struct _acl_cb
 {
-  src_dest_acl ll;
+  src_dest_acl sd;
+  int ct_grace;
 } acl_cb;
 
 
@@ -119,6 +178,19 @@ typedef struct _fw_cb
   int n_chains;
   char chains[FW_CHAIN_MAX_NUM][FW_CHAIN_MAX_LEN];
   char iptables_path[FILENAME_MAX_LEN];
+  int backend;
+  char set_name[FW_SET_NAME_MAX_LEN];
+  char table_name[FW_SET_NAME_MAX_LEN];
+  char restore_path[FILENAME_MAX_LEN];
+  int flush_ms;
+  int coalesce_ms;
+  int latency_us;
+  int layout;
+  char bpf_dev[FW_SET_NAME_MAX_LEN];
+  unsigned int bpf_mark;
+  int bpf_map_size;
+  char bpf_pin_path[FILENAME_MAX_LEN];
+  int reconcile_secs;
 } fw_cb;
 
 
@@ -133,6 +205,11 @@ typedef struct _dnswld_cb
   data_store ds;
   acl_cb acl;
   fw_cb fw;
+  evloop_cb evloop;
+  stats_cb stats;
+  worker_cb *workers;
+  rslv_cfg rslv;
+  cache_cb cache;
 } dnswld_cb;
 
 
@@ -148,6 +225,8 @@ extern char prog_name[PROC_NAME_MAX_LEN];
 extern void init_dnswld(void);
 extern int init_dns_bufs(void);
 extern void clean_dns_bufs(void);
+extern int init_pkt_ring(pkt_ring *ring, int n_slots, int bufz);
+extern void clean_pkt_ring(pkt_ring *ring);
 extern int init_data_stores(void);
 extern void clean_ds_stores(void);
 
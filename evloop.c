@@ -0,0 +1,285 @@
+/*FILE+************************************************************************/
+/* Filename    : evloop.c                                                     */
+/*                                                                            */
+/* Description : Edge-triggered epoll event loop.                             */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+
+#include <errno.h>
+#include <sys/epoll.h>
+
+
+/*FUNC+************************************************************************/
+/* Function    : mark_ready                                                   */
+/*                                                                            */
+/* Description : Put event source at the tail of the ready list.              */
+/*                                                                            */
+/* Params      : loop (IN/OUT)            - Event loop.                       */
+/*               src (IN/OUT)             - Event source.                     */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void mark_ready(evloop_cb *loop, ev_source *src)
+{
+  if (src->is_ready)
+  {
+    return;
+  }
+
+  src->is_ready = TRUE;
+  src->ready_next = NULL;
+  loop->n_ready++;
+
+  if (loop->ready_tail)
+  {
+    loop->ready_tail->ready_next = src;
+  }
+  else
+  {
+    loop->ready_head = src;
+  }
+
+  loop->ready_tail = src;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : create_event_loop                                            */
+/*                                                                            */
+/* Description : Create event loop.                                           */
+/*                                                                            */
+/* Params      : loop (OUT)               - Event loop.                       */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int create_event_loop(evloop_cb *loop)
+{
+  memset(loop, 0, sizeof(*loop));
+
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epfd < 0)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to create epoll instance: [%s].",
+              strerror(errno));
+    return(RET_SYS_ERROR);
+  }
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : clean_event_loop                                             */
+/*                                                                            */
+/* Description : Clean-up event loop. Registered sources are not closed.      */
+/*                                                                            */
+/* Params      : loop (IN/OUT)            - Event loop.                       */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void clean_event_loop(evloop_cb *loop)
+{
+  if (loop->epfd >= 0)
+  {
+    close(loop->epfd);
+  }
+
+  memset(loop, 0, sizeof(*loop));
+  loop->epfd = -1;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : add_event_source                                             */
+/*                                                                            */
+/* Description : Register descriptor to event loop. Can be called at runtime. */
+/*                                                                            */
+/* Params      : loop (IN/OUT)            - Event loop.                       */
+/*               src (OUT)                - Event source placeholder.         */
+/*               fd (IN)                  - Descriptor (non-blocking).        */
+/*               handler (IN)             - Event handler.                    */
+/*               ctx (IN)                 - Handler context.                  */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int add_event_source(evloop_cb *loop, ev_source *src, int fd,
+                     EV_HANDLER handler, void *ctx)
+{
+  struct epoll_event ev;
+  int ret;
+
+  memset(src, 0, sizeof(*src));
+  src->fd = fd;
+  src->handler = handler;
+  src->ctx = ctx;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.ptr = src;
+
+  ret = epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+  if (ret < 0)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to register descriptor [%d]: [%s].", fd,
+              strerror(errno));
+    return(RET_SYS_ERROR);
+  }
+
+  loop->n_sources++;
+
+  /****************************************************************************/
+  /* Data may already be queued before registration. With edge-triggered      */
+  /* notification that would never be reported, so poll it once.              */
+  /****************************************************************************/
+  mark_ready(loop, src);
+
+  PUTS_OSYS(LOG_DEBUG, "Event source registered: [%d].", fd);
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : del_event_source                                             */
+/*                                                                            */
+/* Description : Unregister descriptor from event loop.                       */
+/*                                                                            */
+/* Params      : loop (IN/OUT)            - Event loop.                       */
+/*               src (IN/OUT)             - Event source.                     */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int del_event_source(evloop_cb *loop, ev_source *src)
+{
+  ev_source *runner;
+  ev_source *prev;
+
+  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+
+  if (src->is_ready)
+  {
+    for (runner = loop->ready_head, prev = NULL; runner;
+         prev = runner, runner = runner->ready_next)
+    {
+      if (runner == src)
+      {
+        if (prev)
+        {
+          prev->ready_next = runner->ready_next;
+        }
+        else
+        {
+          loop->ready_head = runner->ready_next;
+        }
+
+        if (loop->ready_tail == runner)
+        {
+          loop->ready_tail = prev;
+        }
+
+        loop->n_ready--;
+        break;
+      }
+    }
+
+    src->is_ready = FALSE;
+  }
+
+  loop->n_sources--;
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : run_event_loop                                               */
+/*                                                                            */
+/* Description : Wait for events and dispatch ready sources once. Sources     */
+/*               that exhaust their budget stay on the ready list and are     */
+/*               serviced on the next call without blocking.                  */
+/*                                                                            */
+/* Params      : loop (IN/OUT)            - Event loop.                       */
+/*               timeout_ms (IN)          - Max wait time in msecs.           */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int run_event_loop(evloop_cb *loop, int timeout_ms)
+{
+  struct epoll_event events[EVLOOP_MAX_EVENTS];
+  ev_source *src;
+  int n_events;
+  int n_ready;
+  int budget;
+  int i;
+  int ret;
+
+  n_events = epoll_wait(loop->epfd, events, EVLOOP_MAX_EVENTS,
+                        loop->ready_head ? 0 : timeout_ms);
+  if (n_events < 0)
+  {
+    if (errno == EINTR)
+    {
+      return(RET_OK);
+    }
+
+    PUTS_OSYS(LOG_ERR, "epoll_wait error: [%s].", strerror(errno));
+    return(RET_SYS_ERROR);
+  }
+
+  if (n_events)
+  {
+    STATS_INC(n_wakeups);
+    STATS_ADD(n_events, n_events);
+  }
+
+  for (i = 0; i < n_events; i++)
+  {
+    mark_ready(loop, (ev_source *)events[i].data.ptr);
+  }
+
+  /****************************************************************************/
+  /* Service every source that is ready at this point. Sources re-queued      */
+  /* below go to the tail and are left for the next round. Each source is     */
+  /* taken off the list before its handler runs, so the handler may delete    */
+  /* any other.                                                               */
+  /****************************************************************************/
+  for (n_ready = loop->n_ready; (n_ready > 0) && (loop->ready_head); n_ready--)
+  {
+    src = loop->ready_head;
+    loop->ready_head = src->ready_next;
+    if (!loop->ready_head)
+    {
+      loop->ready_tail = NULL;
+    }
+    loop->n_ready--;
+    src->is_ready = FALSE;
+
+    for (budget = EVLOOP_BUDGET; budget > 0; budget--)
+    {
+      ret = src->handler(src->ctx);
+      if (ret == RET_SOCK_WOULD_BLOCK)
+      {
+        break;
+      }
+    }
+
+    if (!budget)
+    {
+      mark_ready(loop, src);
+    }
+  }
+
+  return(RET_OK);
+}
@@ -0,0 +1,67 @@
+/*INC+*************************************************************************/
+/* Filename    : evloop.h                                                     */
+/*                                                                            */
+/* Description : Event loop (epoll reactor) header file.                      */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*INC+*************************************************************************/
+
+#ifndef _EVLOOP_H
+#define _EVLOOP_H
+
+/******************************************************************************/
+/* Constants.                                                                 */
+/* - EVLOOP_BUDGET bounds the number of handler calls per source per wakeup   */
+/*   so a flooded socket cannot starve the others.                            */
+/******************************************************************************/
+#define EVLOOP_MAX_EVENTS                         64
+#define EVLOOP_TIMEOUT_MS                         1000
+#define EVLOOP_BUDGET                             64
+
+/******************************************************************************/
+/* Event handler callback. Handles one unit of work (e.g. one datagram) and   */
+/* returns RET_SOCK_WOULD_BLOCK once the descriptor is drained.               */
+/******************************************************************************/
+typedef int (*EV_HANDLER)(void *ctx);
+
+/******************************************************************************/
+/* Event source. Owned by the caller and must outlive its registration. A     */
+/* handler may delete any source; one that deletes its own must then return   */
+/* RET_SOCK_WOULD_BLOCK.                                                      */
+/******************************************************************************/
+typedef struct _ev_source
+{
+  struct _ev_source *ready_next;
+  int fd;
+  int is_ready;
+  EV_HANDLER handler;
+  void *ctx;
+} ev_source;
+
+
+/******************************************************************************/
+/* Event loop CB.                                                             */
+/******************************************************************************/
+typedef struct _evloop_cb
+{
+  int epfd;
+  int n_sources;
+  int n_ready;
+  ev_source *ready_head;
+  ev_source *ready_tail;
+} evloop_cb;
+
+
+/******************************************************************************/
+/* Forwards decls.                                                            */
+/******************************************************************************/
+extern int create_event_loop(evloop_cb *loop);
+extern void clean_event_loop(evloop_cb *loop);
+extern int add_event_source(evloop_cb *loop, ev_source *src, int fd,
+                            EV_HANDLER handler, void *ctx);
+extern int del_event_source(evloop_cb *loop, ev_source *src);
+extern int run_event_loop(evloop_cb *loop, int timeout_ms);
+
+#endif
@@ -5,6 +5,8 @@
 /*                                                                            */
 /* Revisions   : 06/07/14  Sho                                                */
 /*                         - Creation.                                        */
+/*               10/17/26  Sho                                                */
+/*                         - Dispatch through backend operations.             */
 /*                                                                            */
 /*FILE-************************************************************************/
 
@@ -12,11 +14,80 @@
 #include <dnswldcb.h>
 #include <fw.h>
 
+#include <pthread.h>
+
+
+/******************************************************************************/
+/* Firewall command queue. A ring of FW_QUEUE_SIZE commands consumed by the   */
+/* firewall thread.                                                           */
+/******************************************************************************/
+static pthread_mutex_t fw_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fw_cond = PTHREAD_COND_INITIALIZER;
+static fw_cmd fw_queue[FW_QUEUE_SIZE];
+static int fw_head;
+static int fw_count;
+
+/******************************************************************************/
+/* Commands queued and run since start, for fw_sync.                          */
+/******************************************************************************/
+static pthread_cond_t fw_done_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long fw_n_posted;
+static unsigned long fw_n_done;
+static int is_fw_stopping = FALSE;
+static int is_fw_started = FALSE;
+static pthread_t fw_thread;
+
+/******************************************************************************/
+/* Firewall backends, indexed by FW_BACKEND_*, and the one in use.            */
+/******************************************************************************/
+static fw_ops *fw_backends[FW_BACKEND_NUM] =
+{
+  &ipt_fw_ops,
+  &ipset_fw_ops,
+  &nft_fw_ops,
+  &restore_fw_ops,
+  &mem_fw_ops,
+  &bpf_fw_ops
+};
+static fw_ops *fw_be = &ipt_fw_ops;
+
+
+/*FUNC+************************************************************************/
+/* Function    : exec_fw_cmds                                                 */
+/*                                                                            */
+/* Description : Program commands with the backend, in one bulk call if it    */
+/*               has one.                                                     */
+/*                                                                            */
+/* Params      : cmds (IN)                - Firewall commands.                */
+/*               n (IN)                   - Number of commands.               */
+/*               status (OUT)             - RET_OK or error per command.      */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void exec_fw_cmds(fw_cmd *cmds, int n, int *status)
+{
+  int i;
+
+  if (fw_be->bulk)
+  {
+    fw_be->bulk(cmds, n, status);
+    return;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    status[i] = ((cmds[i].op == FW_CMD_ADD) ||
+                 (cmds[i].op == FW_CMD_REFRESH)) ? fw_be->add(&cmds[i]) :
+                                                   fw_be->del(&cmds[i]);
+  }
+}
+
 
 /*FUNC+************************************************************************/
 /* Function    : add_fw_rule                                                  */
 /*                                                                            */
-/* Description : Add rule to iptables for given source and dest.              */
+/* Description : Add rule to the firewall for given source and dest.          */
 /*                                                                            */
 /* Params      : s_ip (IN)                - Source IP.                        */
 /*               d_ip (IN)                - Destination IP.                   */
@@ -30,118 +101,554 @@
 int add_fw_rule(unsigned int s_ip, unsigned int d_ip, int action,
                 unsigned created_at, unsigned int expiry)
 {
-  char cmd[1024];
-  char tt_str[31] = {0};
-  char *action_str;
+  fw_cmd cmd = {FW_CMD_ADD, s_ip, d_ip, action, created_at, expiry, -1};
+  int status;
+
+  exec_fw_cmds(&cmd, 1, &status);
+
+  return(status);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : del_fw_rule                                                  */
+/*                                                                            */
+/* Description : Delete rule from the firewall for given source and dest.     */
+/*                                                                            */
+/* Params      : s_ip (IN)                - Source IP.                        */
+/*               d_ip (IN)                - Destination IP.                   */
+/*               created_at (IN)          - Creation timestamp.               */
+/*               expiry (IN)              - Expiry timestamp.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int del_fw_rule(unsigned int s_ip, unsigned int d_ip, int action,
+                unsigned int created_at, unsigned int expiry)
+{
+  fw_cmd cmd = {FW_CMD_DEL, s_ip, d_ip, action, created_at, expiry, -1};
+  int status;
+
+  exec_fw_cmds(&cmd, 1, &status);
+
+  return(status);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : list_fw_rules                                                */
+/*                                                                            */
+/* Description : Report grants installed by an earlier run, if the backend    */
+/*               keeps them.                                                  */
+/*                                                                            */
+/* Params      : fn (IN)                  - Callback per grant.               */
+/*               arg (IN)                 - Callback argument.                */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int list_fw_rules(fw_list_fn fn, void *arg)
+{
+  if (!fw_be->list)
+  {
+    return(RET_OK);
+  }
+
+  return(fw_be->list(fn, arg));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : fw_list_copies                                               */
+/*                                                                            */
+/* Description : Number of times list_fw_rules reports each grant: once per   */
+/*               chain for iptables rules in the flat layout.                 */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : n                        - Copies, 0 if the backend cannot   */
+/*                                          list its grants.                  */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int fw_list_copies(void)
+{
+  if (!fw_be->list)
+  {
+    return(0);
+  }
+
+  if (((fw_be == &ipt_fw_ops) || (fw_be == &restore_fw_ops)) &&
+      (dnswld.fw.layout == FW_LAYOUT_FLAT))
+  {
+    return(dnswld.fw.n_chains);
+  }
+
+  return(1);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : find_fw_backend                                              */
+/*                                                                            */
+/* Description : Look up a firewall backend by name.                          */
+/*                                                                            */
+/* Params      : name (IN)                - Backend name.                     */
+/*                                                                            */
+/* Returns     : backend                  - FW_BACKEND_* or -1 if unknown.    */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int find_fw_backend(char *name)
+{
   int i;
-  int ret;
 
-  action_str = (action == FW_ACCEPT_RULE) ? "ACCEPT" : "DROP";
-  ctime_r((time_t *)&expiry, tt_str);
-  if (strlen(tt_str))
+  for (i = 0; i < FW_BACKEND_NUM; i++)
   {
-    tt_str[strlen(tt_str) -1] = '\0';
+    if (!strcasecmp(name, fw_backends[i]->name))
+    {
+      return(i);
+    }
   }
 
+  return(-1);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : init_fw                                                      */
+/*                                                                            */
+/* Description : Set up the configured firewall backend.                      */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int init_fw(void)
+{
+  fw_be = fw_backends[dnswld.fw.backend];
+
+  PUTS_OSYS(LOG_INFO, "Firewall backend: [%s]", fw_be->name);
+
   /****************************************************************************/
-  /* Add the rule for each chain.                                             */
+  /* Only batching backends wait for a flush window unless configured.        */
   /****************************************************************************/
-  for (i = 0; i < dnswld.fw.n_chains; i++)
-  {
-    snprintf(cmd, sizeof(cmd),
-             "%s -A %s -s %d.%d.%d.%d -d %d.%d.%d.%d -j %s "
-		     "-m comment --comment \"%s - %u - Exp:%s\"",
-             dnswld.fw.iptables_path, dnswld.fw.chains[i],
-             (s_ip >> 24) & 0xFF,
-             (s_ip >> 16) & 0xFF,
-             (s_ip >> 8) & 0xFF,
-             s_ip & 0xFF,
-             (d_ip >> 24) & 0xFF,
-             (d_ip >> 16) & 0xFF,
-             (d_ip >> 8) & 0xFF,
-             d_ip & 0xFF,
-             action_str,
-             FW_RULE_TAG,
-             created_at,
-             tt_str);
-
-    PUTS_OSYS(LOG_DEBUG, " cmd: [%s]", cmd);
-    ret = system(cmd);
-    if (ret < 0)
+  if (dnswld.fw.flush_ms < 0)
+  {
+    dnswld.fw.flush_ms = (dnswld.fw.backend == FW_BACKEND_RESTORE) ?
+                         DEF_FW_FLUSH_MS : 0;
+  }
+
+  if (!fw_be->init)
+  {
+    return(RET_OK);
+  }
+
+  return(fw_be->init());
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : clean_fw                                                     */
+/*                                                                            */
+/* Description : Release firewall backend resources.                          */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void clean_fw(void)
+{
+  if (fw_be->shutdown)
+  {
+    fw_be->shutdown();
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : run_fw_cmds                                                  */
+/*                                                                            */
+/* Description : Execute firewall commands in the calling thread, in order,   */
+/*               and report add results back to the ACL entries.              */
+/*                                                                            */
+/* Params      : cmds (IN)                - Firewall commands.                */
+/*               n (IN)                   - Number of commands, up to         */
+/*                                          FW_BATCH_MAX.                     */
+/*                                                                            */
+/* Returns     : count                    - Number of commands that failed.   */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int run_fw_cmds(fw_cmd *cmds, int n)
+{
+  int status[FW_BATCH_MAX];
+  fw_cmd *cmd;
+  int n_err = 0;
+  int i;
+
+  exec_fw_cmds(cmds, n, status);
+
+  for (i = 0, cmd = cmds; i < n; i++, cmd++)
+  {
+    /**************************************************************************/
+    /* Report result back to the ACL entry.                                   */
+    /**************************************************************************/
+    if (cmd->op == FW_CMD_ADD)
+    {
+      set_acl_fw_status(cmd->s_ip, cmd->d_ip, cmd->created_at,
+                        status[i] ? ACL_ADD_ALLOW_RULE_ERR : ACL_OK);
+    }
+
+    if (status[i])
     {
-      ret = RET_SYS_ERROR;
-      goto EXIT;
+      n_err++;
     }
   }
 
+  STATS_INC(n_fw_batches);
+  STATS_ADD(n_fw_cmds, n);
+  STATS_ADD(n_fw_errors, n_err);
+
+  return(n_err);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : run_fw_cmd                                                   */
+/*                                                                            */
+/* Description : Execute one firewall command in the calling thread.          */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int run_fw_cmd(fw_cmd *cmd)
+{
+  return(run_fw_cmds(cmd, 1) ? RET_SYS_ERROR : RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : post_fw_cmd                                                  */
+/*                                                                            */
+/* Description : Queue firewall command to the firewall thread. Never waits.  */
+/*               Without the thread the command is not run: callers may hold  */
+/*               the ACL lock, which running an add would take again.         */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success.                          */
+/*               RET_QUEUE_FULL           - Queue full, command not queued.   */
+/*               RET_FW_NOT_STARTED       - No firewall thread, not queued.   */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int post_fw_cmd(fw_cmd *cmd)
+{
+  int ret;
+
+  if (!is_fw_started)
+  {
+    return(RET_FW_NOT_STARTED);
+  }
+
+  pthread_mutex_lock(&fw_lock);
+
+  if (fw_count == FW_QUEUE_SIZE)
+  {
+    STATS_INC(n_fw_queue_full);
+    ret = RET_QUEUE_FULL;
+    goto EXIT;
+  }
+
+  fw_queue[(fw_head + fw_count) % FW_QUEUE_SIZE] = *cmd;
+  fw_count++;
+  fw_n_posted++;
+
+  /****************************************************************************/
+  /* Wake the thread when it goes idle -> busy or a batch fills up.           */
+  /****************************************************************************/
+  if ((fw_count == 1) || (fw_count == FW_BATCH_MAX))
+  {
+    pthread_cond_signal(&fw_cond);
+  }
+
   ret = RET_OK;
 
   EXIT:
 
+  pthread_mutex_unlock(&fw_lock);
+
   return(ret);
 }
 
 
 /*FUNC+************************************************************************/
-/* Function    : del_fw_rule                                                  */
+/* Function    : fw_same_grant                                                */
 /*                                                                            */
-/* Description : Delete rule from iptables for given source and dest.         */
+/* Description : Whether two commands are for the same grant of a pair.       */
 /*                                                                            */
-/* Params      : s_ip (IN)                - Source IP.                        */
-/*               d_ip (IN)                - Destination IP.                   */
-/*               created_at (IN)          - Creation timestamp.               */
-/*               expiry (IN)              - Expiry timestamp.                 */
+/* Params      : a (IN)                   - Firewall command.                 */
+/*               b (IN)                   - Firewall command.                 */
 /*                                                                            */
-/* Returns     : RET_OK                   - Success otherwise error.          */
+/* Returns     : TRUE                     - Same pair and creation time.      */
+/*               FALSE                    - Otherwise.                        */
 /*                                                                            */
 /*FUNC-************************************************************************/
-int del_fw_rule(unsigned int s_ip, unsigned int d_ip, int action,
-                unsigned int created_at, unsigned int expiry)
+static inline int fw_same_grant(fw_cmd *a, fw_cmd *b)
+{
+  return((a->s_ip == b->s_ip) && (a->d_ip == b->d_ip) &&
+         (a->created_at == b->created_at));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : coalesce_fw_cmds                                             */
+/*                                                                            */
+/* Description : Drop the commands of a batch that cancel out or are          */
+/*               superseded by a later one for the same pair, keeping the     */
+/*               order of the rest:                                           */
+/*               - an add and a delete of the same grant, and any refresh in  */
+/*                 between, as the rule would not outlive the batch.          */
+/*               - a refresh followed by another refresh or a delete of the   */
+/*                 same grant.                                                */
+/*               - a delete followed by an add of the pair, for backends      */
+/*                 whose add replaces the pair's grant (memory, bpf). Should  */
+/*                 that add cancel with a later delete, the delete is kept    */
+/*                 for the earlier grant.                                     */
+/*                                                                            */
+/* Params      : cmds (IN/OUT)            - Firewall commands.                */
+/*               n (IN)                   - Number of commands.               */
+/*                                                                            */
+/* Returns     : n                        - Number of commands left.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int coalesce_fw_cmds(fw_cmd *cmds, int n)
 {
-  char cmd[1024];
-  char tt_str[31] = {0};
-  char *action_str;
+  char is_dropped[FW_BATCH_MAX];
+  char is_replacing[FW_BATCH_MAX];
+  fw_cmd *cmd;
+  fw_cmd *prev;
+  int is_replace;
   int i;
-  int ret;
+  int j;
+  int k;
+
+  is_replace = ((fw_be == &mem_fw_ops) || (fw_be == &bpf_fw_ops));
+  memset(is_dropped, 0, n);
+  memset(is_replacing, 0, n);
 
-  action_str = (action == FW_ACCEPT_RULE) ? "ACCEPT" : "DROP";
-  ctime_r((time_t *)&expiry, tt_str);
-  if (strlen(tt_str))
+  for (i = 1; i < n; i++)
   {
-    tt_str[strlen(tt_str) -1] = '\0';
+    cmd = &cmds[i];
+
+    for (j = i - 1; j >= 0; j--)
+    {
+      prev = &cmds[j];
+      if ((is_dropped[j]) || (prev->s_ip != cmd->s_ip) ||
+          (prev->d_ip != cmd->d_ip))
+      {
+        continue;
+      }
+
+      switch (cmd->op)
+      {
+        case FW_CMD_DEL:
+        case FW_CMD_EXPIRE:
+          if ((prev->op == FW_CMD_REFRESH) && (fw_same_grant(prev, cmd)))
+          {
+            is_dropped[j] = TRUE;
+            continue;
+          }
+
+          if ((prev->op == FW_CMD_ADD) && (fw_same_grant(prev, cmd)))
+          {
+            is_dropped[j] = TRUE;
+            is_dropped[i] = !is_replacing[j];
+          }
+          break;
+
+        case FW_CMD_REFRESH:
+          if ((prev->op == FW_CMD_REFRESH) && (fw_same_grant(prev, cmd)))
+          {
+            is_dropped[j] = TRUE;
+          }
+          break;
+
+        case FW_CMD_ADD:
+          if ((is_replace) && ((prev->op == FW_CMD_DEL) ||
+                               (prev->op == FW_CMD_EXPIRE)))
+          {
+            is_dropped[j] = TRUE;
+            is_replacing[i] = TRUE;
+          }
+          break;
+      }
+
+      /************************************************************************/
+      /* Only the pair's latest command left can combine.                     */
+      /************************************************************************/
+      break;
+    }
   }
 
-  /****************************************************************************/
-  /* Add the rule for each chain.                                             */
-  /****************************************************************************/
-  for (i = 0; i < dnswld.fw.n_chains; i++)
-  {
-    snprintf(cmd, sizeof(cmd),
-             "%s -D %s -s %d.%d.%d.%d -d %d.%d.%d.%d -j %s "
-             "-m comment --comment \"%s - %u - Exp:%s\"",
-             dnswld.fw.iptables_path, dnswld.fw.chains[i],
-             (s_ip >> 24) & 0xFF,
-             (s_ip >> 16) & 0xFF,
-             (s_ip >> 8) & 0xFF,
-             s_ip & 0xFF,
-             (d_ip >> 24) & 0xFF,
-             (d_ip >> 16) & 0xFF,
-             (d_ip >> 8) & 0xFF,
-             d_ip & 0xFF,
-             action_str,
-             FW_RULE_TAG,
-             created_at,
-             tt_str);
-
-    PUTS_OSYS(LOG_DEBUG, " cmd: [%s]", cmd);
-    ret = system(cmd);
-    if (ret < 0)
+  for (i = 0, k = 0; i < n; i++)
+  {
+    if (!is_dropped[i])
     {
-      ret = RET_SYS_ERROR;
-      goto EXIT;
+      cmds[k++] = cmds[i];
     }
   }
 
+  STATS_ADD(n_fw_coalesced, n - k);
+
+  return(k);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : fw_sync                                                      */
+/*                                                                            */
+/* Description : Wait until the commands queued so far have been run, so the  */
+/*               firewall reflects them. Commands queued meanwhile are not    */
+/*               waited for.                                                  */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void fw_sync(void)
+{
+  unsigned long target;
+
+  pthread_mutex_lock(&fw_lock);
+
+  target = fw_n_posted;
+  while ((is_fw_started) && (fw_n_done < target))
+  {
+    pthread_cond_wait(&fw_done_cond, &fw_lock);
+  }
+
+  pthread_mutex_unlock(&fw_lock);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : fw_worker                                                    */
+/*                                                                            */
+/* Description : Firewall thread processing loop. Commands are run in post    */
+/*               order, as many as are queued at a time less those that       */
+/*               cancel out; on stop the queue is drained first.              */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void *fw_worker(void *param)
+{
+  fw_cmd cmds[FW_BATCH_MAX];
+  struct timespec deadline;
+  int window_ms;
+  int n_taken;
+  int n;
+
+  PUTS_OSYS(LOG_DEBUG, "Firewall thread: Started");
+
+  pthread_mutex_lock(&fw_lock);
+
+  for (;;)
+  {
+    while ((!fw_count) && (!is_fw_stopping))
+    {
+      pthread_cond_wait(&fw_cond, &fw_lock);
+    }
+
+    if (!fw_count)
+    {
+      break;
+    }
+
+    /**************************************************************************/
+    /* Hold the batch open for the flush window so a burst is committed at    */
+    /* once, and for the coalesce window so changes that cancel out within    */
+    /* it never reach the backend.                                            */
+    /**************************************************************************/
+    window_ms = (dnswld.fw.flush_ms > dnswld.fw.coalesce_ms) ?
+                dnswld.fw.flush_ms : dnswld.fw.coalesce_ms;
+    if ((window_ms > 0) && (fw_count < FW_BATCH_MAX))
+    {
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += (window_ms % 1000) * 1000000L;
+      deadline.tv_sec += window_ms / 1000 + deadline.tv_nsec / 1000000000L;
+      deadline.tv_nsec %= 1000000000L;
+
+      while ((fw_count < FW_BATCH_MAX) && (!is_fw_stopping))
+      {
+        if (pthread_cond_timedwait(&fw_cond, &fw_lock, &deadline))
+        {
+          break;
+        }
+      }
+    }
+
+    for (n = 0; (fw_count) && (n < FW_BATCH_MAX); n++)
+    {
+      cmds[n] = fw_queue[fw_head];
+      fw_head = (fw_head + 1) % FW_QUEUE_SIZE;
+      fw_count--;
+    }
+
+    pthread_mutex_unlock(&fw_lock);
+
+    n_taken = n;
+    n = coalesce_fw_cmds(cmds, n);
+    if (n)
+    {
+      run_fw_cmds(cmds, n);
+    }
+
+    pthread_mutex_lock(&fw_lock);
+
+    fw_n_done += n_taken;
+    pthread_cond_broadcast(&fw_done_cond);
+  }
+
+  pthread_mutex_unlock(&fw_lock);
+
+  PUTS_OSYS(LOG_DEBUG, "Firewall thread: Done");
+
+  return(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : create_start_fw_worker                                       */
+/*                                                                            */
+/* Description : Create and start firewall thread.                            */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int create_start_fw_worker(void)
+{
+  int ret;
+
+  is_fw_stopping = FALSE;
+
+  ret = pthread_create(&fw_thread, NULL, fw_worker, NULL);
+  if (ret)
+  {
+    PUTS_OSYS(LOG_DEBUG, "Failed to create firewall pthread!");
+    ret = RET_SYS_ERROR;
+    goto EXIT;
+  }
+
+  is_fw_started = TRUE;
+
   ret = RET_OK;
 
   EXIT:
@@ -149,3 +656,27 @@ int del_fw_rule(unsigned int s_ip, unsigned int d_ip, int action,
   return(ret);
 }
 
+
+/*FUNC+************************************************************************/
+/* Function    : stop_fw_worker                                               */
+/*                                                                            */
+/* Description : Stop firewall thread once queued commands are done.          */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void stop_fw_worker(void)
+{
+  if (is_fw_started)
+  {
+    pthread_mutex_lock(&fw_lock);
+    is_fw_stopping = TRUE;
+    pthread_cond_broadcast(&fw_cond);
+    pthread_mutex_unlock(&fw_lock);
+
+    pthread_join(fw_thread, NULL);
+    is_fw_started = FALSE;
+  }
+}
@@ -15,11 +15,153 @@
 /* Contants.                                                                  */
 /******************************************************************************/
 #define FW_RULE_TAG                               "DNSWLD"
+#define FW_EXPIRY_TAG                             "Exp:"
+#define FW_EXPIRY_FMT                             "%a %b %d %H:%M:%S %Y"
 #define FW_ACCEPT_RULE                            0
 #define FW_DROP_RULE                              1
 
 #define DNSWLD_FW_DUMP                            "/tmp/dnswldfw.dump"
 
+/******************************************************************************/
+/* Firewall backends.                                                         */
+/* - iptables: one rule per grant and chain, added with iptables.             */
+/* - ipset: one rule per chain matching a set; grants are set members with    */
+/*   kernel timeouts.                                                         */
+/* - nft: grants are elements of an nftables set with kernel timeouts, added  */
+/*   in batch transactions. Rules referencing the set are the admin's.        */
+/* - iptables-restore: iptables rules, committed in batches with one          */
+/*   iptables-restore run.                                                    */
+/* - memory: no firewall. Grants are recorded in memory, with an optional     */
+/*   delay per call, to load-test the control plane without root.             */
+/* - bpf: grants are entries of a BPF LRU hash map keyed on (src, dst), each  */
+/*   written with one bpf() call. A tc classifier on bpf_dev marks packets    */
+/*   of a granted pair; without a device only the map is kept.                */
+/******************************************************************************/
+#define FW_BACKEND_IPTABLES                       0
+#define FW_BACKEND_IPSET                          1
+#define FW_BACKEND_NFT                            2
+#define FW_BACKEND_RESTORE                        3
+#define FW_BACKEND_MEMORY                         4
+#define FW_BACKEND_BPF                            5
+#define FW_BACKEND_NUM                            6
+
+/******************************************************************************/
+/* Rule layouts.                                                              */
+/* - flat: each chain holds one rule per grant (iptables) or one rule         */
+/*   matching a set of (src, dst) pairs (ipset).                              */
+/* - client (iptables): each chain holds one rule per client jumping to the   */
+/*   client's chain, which holds its grants. A packet is matched against the  */
+/*   client rules and then only its own client's grants.                      */
+/* - domain (ipset): each whitelist entry has a set of its destinations and a */
+/*   set of the clients granted it, and each chain one rule matching both.    */
+/******************************************************************************/
+#define FW_LAYOUT_FLAT                            0
+#define FW_LAYOUT_CLIENT                          1
+#define FW_LAYOUT_DOMAIN                          2
+#define FW_CLIENT_CHAIN_FMT                       "DWLC-%08X"
+
+#define IPSET_TYPE                                "hash:net,net"
+#define IPSET_DOMAIN_TYPE                         "hash:ip"
+#define DEF_IPSET_NAME                            "dnswld"
+#define DEF_NFT_TABLE                             "dnswld"
+#define DEF_RESTORE_PATH                          "/sbin/iptables-restore"
+
+/******************************************************************************/
+/* Flush window. Batching backends wait this long after the first queued      */
+/* command, or until FW_BATCH_MAX are queued, before committing.              */
+/******************************************************************************/
+#define DEF_FW_FLUSH_MS                           100
+#define MAX_FW_FLUSH_MS                           10000
+
+/******************************************************************************/
+/* Coalesce window. Every backend holds a batch open at least this long so    */
+/* commands that cancel out within it are dropped.                            */
+/******************************************************************************/
+#define DEF_FW_COALESCE_MS                        10
+#define MAX_FW_COALESCE_MS                        10000
+
+#define MAX_FW_LATENCY_US                         1000000
+
+/******************************************************************************/
+/* bpf backend. The map key is the (src, dst) pair in network byte order and  */
+/* the value the grant's creation and expiry times. The classifier is added   */
+/* to the device's clsact ingress hook at BPF_TC_PRIO.                        */
+/******************************************************************************/
+#define DEF_BPF_MARK                              0x444E53
+#define DEF_BPF_MAP_SIZE                          65536
+#define MAX_BPF_MAP_SIZE                          16777216
+#define BPF_TC_PRIO                               49152
+#define BPF_TC_HANDLE                             1
+#define BPF_OBJ_NAME                              "dnswld"
+#define BPF_LOG_BUFZ                              65536
+
+/******************************************************************************/
+/* Firewall command queue.                                                    */
+/* - Rules are programmed by the firewall thread. DNS workers only post       */
+/*   commands and never wait; a post to a full queue fails.                   */
+/* - The thread takes up to FW_BATCH_MAX commands per pass so batching        */
+/*   backends can commit them together.                                       */
+/* - FW_CMD_EXPIRE is a delete due to age. Backends with kernel timeouts      */
+/*   skip it.                                                                 */
+/* - FW_CMD_REFRESH moves an installed grant's expiry later. Only backends    */
+/*   with kernel timeouts act on it.                                          */
+/* - Commands of a pass that cancel out, e.g. an add and a delete of the same */
+/*   grant, are dropped before they reach the backend.                        */
+/******************************************************************************/
+#define FW_QUEUE_SIZE                             4096
+#define FW_BATCH_MAX                              256
+
+#define FW_CMD_ADD                                0
+#define FW_CMD_DEL                                1
+#define FW_CMD_EXPIRE                             2
+#define FW_CMD_REFRESH                            3
+
+/******************************************************************************/
+/* Firewall command. dom_id is the whitelist entry the grant came from, or -1 */
+/* if not known (e.g. restored at start-up).                                  */
+/******************************************************************************/
+typedef struct _fw_cmd
+{
+  int op;
+  unsigned int s_ip;
+  unsigned int d_ip;
+  int action;
+  unsigned int created_at;
+  unsigned int expiry;
+  int dom_id;
+} fw_cmd;
+
+
+/******************************************************************************/
+/* Installed grant callback for fw_ops list. An error stops the listing and   */
+/* is returned by it.                                                         */
+/******************************************************************************/
+typedef int (*fw_list_fn)(fw_cmd *cmd, void *arg);
+
+
+/******************************************************************************/
+/* Firewall backend operations.                                               */
+/* - add/del program one command. add gets FW_CMD_ADD and FW_CMD_REFRESH,     */
+/*   del the rest. A backend whose grants time out in the kernel returns      */
+/*   RET_OK for FW_CMD_EXPIRE, and one whose grants do not for                */
+/*   FW_CMD_REFRESH.                                                          */
+/* - bulk programs a batch and sets status per command. If NULL, add/del are  */
+/*   called per command.                                                      */
+/* - list reports grants still installed from an earlier run so the           */
+/*   whitelist can be rebuilt. NULL if the backend starts empty.              */
+/* - init/shutdown may be NULL.                                               */
+/******************************************************************************/
+typedef struct _fw_ops
+{
+  char *name;
+  int (*init)(void);
+  int (*add)(fw_cmd *cmd);
+  int (*del)(fw_cmd *cmd);
+  void (*bulk)(fw_cmd *cmds, int n, int *status);
+  int (*list)(fw_list_fn fn, void *arg);
+  void (*shutdown)(void);
+} fw_ops;
+
 /******************************************************************************/
 /* Forward decls.                                                             */
 /******************************************************************************/
@@ -27,4 +169,44 @@ extern int add_fw_rule(unsigned int s_ip, unsigned int d_ip, int action,
                        unsigned int created_at, unsigned int tt);
 extern int del_fw_rule(unsigned int s_ip, unsigned int d_ip, int action,
                        unsigned int created_at, unsigned int tt);
+extern int list_fw_rules(fw_list_fn fn, void *arg);
+extern int fw_list_copies(void);
+extern int find_fw_backend(char *name);
+extern int init_fw(void);
+extern void clean_fw(void);
+extern int run_fw_cmds(fw_cmd *cmds, int n);
+extern int run_fw_cmd(fw_cmd *cmd);
+extern int post_fw_cmd(fw_cmd *cmd);
+extern void fw_sync(void);
+extern int create_start_fw_worker(void);
+extern void stop_fw_worker(void);
+extern int format_fw_rule(char *buf, int size, char *op, char *chain,
+                          unsigned int s_ip, unsigned int d_ip, int action,
+                          unsigned int created_at, unsigned int expiry);
+extern int format_fw_jump(char *buf, int size, char *op, char *chain,
+                          unsigned int s_ip);
+extern void lock_ipt_fw(void);
+extern void unlock_ipt_fw(void);
+extern int ipt_client_grants(unsigned int s_ip);
+extern int ipt_set_client_grants(unsigned int s_ip, int n);
+extern int ipt_fw_apply(fw_cmd *cmd);
+extern int ipt_fw_init(void);
+extern void ipt_fw_shutdown(void);
+extern int ipt_fw_add(fw_cmd *cmd);
+extern int ipt_fw_del(fw_cmd *cmd);
+extern int ipt_fw_list(fw_list_fn fn, void *arg);
+
+union bpf_attr;
+extern int (*bpf_fw_sys)(int cmd, union bpf_attr *attr);
+
+struct utsname;
+extern int (*nft_fw_uname)(struct utsname *uts);
+
+extern fw_ops ipt_fw_ops;
+extern fw_ops ipset_fw_ops;
+extern fw_ops nft_fw_ops;
+extern fw_ops restore_fw_ops;
+extern fw_ops mem_fw_ops;
+extern fw_ops bpf_fw_ops;
+
 #endif
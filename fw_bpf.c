@@ -0,0 +1,754 @@
+/*FILE+************************************************************************/
+/* Filename    : fw_bpf.c                                                     */
+/*                                                                            */
+/* Description : BPF firewall backend. Grants are entries of an LRU hash map  */
+/*               keyed on (src, dst), each written with one bpf() call. If    */
+/*               bpf_dev is set, a tc classifier on the device's ingress      */
+/*               looks up every IPv4 packet in the map and marks the packets  */
+/*               of granted pairs with bpf_mark, for the admin's ruleset to   */
+/*               accept. Without a device only the map is kept, so grants can */
+/*               be checked in it from userspace.                             */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <fw.h>
+#include <nl.h>
+
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_cls.h>
+#include <linux/pkt_sched.h>
+
+
+/******************************************************************************/
+/* Map entry. Addresses are in network byte order so the classifier can look  */
+/* up the packet's addresses as they are.                                     */
+/******************************************************************************/
+typedef struct _bpf_key
+{
+  unsigned int s_ip;
+  unsigned int d_ip;
+} bpf_key;
+
+typedef struct _bpf_grant
+{
+  unsigned int created_at;
+  unsigned int expiry;
+} bpf_grant;
+
+
+/******************************************************************************/
+/* Instruction encoding.                                                      */
+/******************************************************************************/
+#define BPFI_INSN(c, d, s, o, i)                  \
+  ((struct bpf_insn){.code = (c), .dst_reg = (d), .src_reg = (s), \
+                     .off = (o), .imm = (i)})
+#define BPFI_MOV64_REG(d, s)                      BPFI_INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define BPFI_MOV64_IMM(d, i)                      BPFI_INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define BPFI_MOV32_IMM(d, i)                      BPFI_INSN(BPF_ALU | BPF_MOV | BPF_K, d, 0, 0, i)
+#define BPFI_ADD64_IMM(d, i)                      BPFI_INSN(BPF_ALU64 | BPF_ADD | BPF_K, d, 0, 0, i)
+#define BPFI_LDX_W(d, s, o)                       BPFI_INSN(BPF_LDX | BPF_MEM | BPF_W, d, s, o, 0)
+#define BPFI_STX_W(d, s, o)                       BPFI_INSN(BPF_STX | BPF_MEM | BPF_W, d, s, o, 0)
+#define BPFI_JNE_IMM(d, i, o)                     BPFI_INSN(BPF_JMP | BPF_JNE | BPF_K, d, 0, o, i)
+#define BPFI_JEQ_IMM(d, i, o)                     BPFI_INSN(BPF_JMP | BPF_JEQ | BPF_K, d, 0, o, i)
+#define BPFI_LD_MAP_FD(d, fd)                     \
+  BPFI_INSN(BPF_LD | BPF_DW | BPF_IMM, d, BPF_PSEUDO_MAP_FD, 0, fd), \
+  BPFI_INSN(0, 0, 0, 0, 0)
+#define BPFI_CALL(f)                              BPFI_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define BPFI_EXIT()                               BPFI_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+
+/******************************************************************************/
+/* Map, classifier and device, and operation counts.                          */
+/******************************************************************************/
+static int bpf_map_fd = -1;
+static int bpf_prog_fd = -1;
+static int bpf_ifindex;
+static unsigned long bpf_n_adds;
+static unsigned long bpf_n_dels;
+static unsigned long bpf_n_missing;
+
+
+/*FUNC+************************************************************************/
+/* Function    : bpf_sys                                                      */
+/*                                                                            */
+/* Description : Issue a bpf() call.                                          */
+/*                                                                            */
+/* Params      : cmd (IN)                 - BPF command.                      */
+/*               attr (IN/OUT)            - Command attributes.               */
+/*                                                                            */
+/* Returns     : >= 0                     - Success.                          */
+/*               -1                       - Error, errno set.                 */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int bpf_sys(int cmd, union bpf_attr *attr)
+{
+  return((int)syscall(__NR_bpf, cmd, attr, sizeof(*attr)));
+}
+
+
+/******************************************************************************/
+/* All map and program calls go through bpf_fw_sys. Tests swap in a map kept  */
+/* in userspace, so the map-update path is checked without CAP_BPF.           */
+/******************************************************************************/
+int (*bpf_fw_sys)(int cmd, union bpf_attr *attr) = bpf_sys;
+
+
+/*FUNC+************************************************************************/
+/* Function    : bpf_open_map                                                 */
+/*                                                                            */
+/* Description : Reuse the map pinned at bpf_pin_path, or create the map and  */
+/*               pin it there if set. Grants in a reused map are kept so the  */
+/*               whitelist can be rebuilt from them.                          */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int bpf_open_map(void)
+{
+  union bpf_attr attr;
+  struct bpf_map_info info;
+  int ret;
+
+  if (dnswld.fw.bpf_pin_path[0])
+  {
+    memset(&attr, 0, sizeof(attr));
+    attr.pathname = (unsigned long)dnswld.fw.bpf_pin_path;
+    bpf_map_fd = bpf_fw_sys(BPF_OBJ_GET, &attr);
+    if (bpf_map_fd >= 0)
+    {
+      memset(&info, 0, sizeof(info));
+      memset(&attr, 0, sizeof(attr));
+      attr.info.bpf_fd = bpf_map_fd;
+      attr.info.info_len = sizeof(info);
+      attr.info.info = (unsigned long)&info;
+
+      if ((bpf_fw_sys(BPF_OBJ_GET_INFO_BY_FD, &attr) < 0) ||
+          (info.type != BPF_MAP_TYPE_LRU_HASH) ||
+          (info.key_size != sizeof(bpf_key)) ||
+          (info.value_size != sizeof(bpf_grant)))
+      {
+        PUTS_OSYS(LOG_ERR, "Pinned object [%s] is not a grant map.",
+                  dnswld.fw.bpf_pin_path);
+        ret = RET_INVALID_CONFIG;
+        goto EXIT;
+      }
+
+      PUTS_OSYS(LOG_INFO, "Reusing BPF map [%s] of %u entries.",
+                dnswld.fw.bpf_pin_path, info.max_entries);
+      ret = RET_OK;
+      goto EXIT;
+    }
+
+    if (errno != ENOENT)
+    {
+      PUTS_OSYS(LOG_ERR, "Failed to open BPF map [%s]: [%s]",
+                dnswld.fw.bpf_pin_path, strerror(errno));
+      ret = RET_SYS_ERROR;
+      goto EXIT;
+    }
+  }
+
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type = BPF_MAP_TYPE_LRU_HASH;
+  attr.key_size = sizeof(bpf_key);
+  attr.value_size = sizeof(bpf_grant);
+  attr.max_entries = dnswld.fw.bpf_map_size;
+  strncpy(attr.map_name, BPF_OBJ_NAME, sizeof(attr.map_name) - 1);
+
+  bpf_map_fd = bpf_fw_sys(BPF_MAP_CREATE, &attr);
+  if (bpf_map_fd < 0)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to create BPF map: [%s]", strerror(errno));
+    ret = RET_SYS_ERROR;
+    goto EXIT;
+  }
+
+  if (dnswld.fw.bpf_pin_path[0])
+  {
+    memset(&attr, 0, sizeof(attr));
+    attr.pathname = (unsigned long)dnswld.fw.bpf_pin_path;
+    attr.bpf_fd = bpf_map_fd;
+    if (bpf_fw_sys(BPF_OBJ_PIN, &attr) < 0)
+    {
+      PUTS_OSYS(LOG_ERR, "Failed to pin BPF map at [%s]: [%s]",
+                dnswld.fw.bpf_pin_path, strerror(errno));
+      ret = RET_SYS_ERROR;
+      goto EXIT;
+    }
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  if ((ret) && (bpf_map_fd >= 0))
+  {
+    close(bpf_map_fd);
+    bpf_map_fd = -1;
+  }
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : bpf_load_prog                                                */
+/*                                                                            */
+/* Description : Load the classifier. It runs in direct action mode, always   */
+/*               passes the packet and only sets its mark when the packet's   */
+/*               (src, dst) is in the map.                                    */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int bpf_load_prog(void)
+{
+  struct bpf_insn insns[] =
+  {
+    BPFI_MOV64_REG(BPF_REG_6, BPF_REG_1),
+
+    /**************************************************************************/
+    /* IPv4 only.                                                             */
+    /**************************************************************************/
+    BPFI_LDX_W(BPF_REG_2, BPF_REG_6, offsetof(struct __sk_buff, protocol)),
+    BPFI_JNE_IMM(BPF_REG_2, htons(ETH_P_IP), 15),
+
+    /**************************************************************************/
+    /* Copy saddr and daddr, adjacent in the IP header, as the key.           */
+    /**************************************************************************/
+    BPFI_MOV64_REG(BPF_REG_1, BPF_REG_6),
+    BPFI_MOV64_IMM(BPF_REG_2, ETH_HLEN + offsetof(struct iphdr, saddr)),
+    BPFI_MOV64_REG(BPF_REG_3, BPF_REG_10),
+    BPFI_ADD64_IMM(BPF_REG_3, -(int)sizeof(bpf_key)),
+    BPFI_MOV64_IMM(BPF_REG_4, sizeof(bpf_key)),
+    BPFI_CALL(BPF_FUNC_skb_load_bytes),
+    BPFI_JNE_IMM(BPF_REG_0, 0, 8),
+
+    BPFI_LD_MAP_FD(BPF_REG_1, bpf_map_fd),
+    BPFI_MOV64_REG(BPF_REG_2, BPF_REG_10),
+    BPFI_ADD64_IMM(BPF_REG_2, -(int)sizeof(bpf_key)),
+    BPFI_CALL(BPF_FUNC_map_lookup_elem),
+    BPFI_JEQ_IMM(BPF_REG_0, 0, 2),
+
+    BPFI_MOV32_IMM(BPF_REG_1, dnswld.fw.bpf_mark),
+    BPFI_STX_W(BPF_REG_6, BPF_REG_1, offsetof(struct __sk_buff, mark)),
+
+    BPFI_MOV64_IMM(BPF_REG_0, TC_ACT_OK),
+    BPFI_EXIT()
+  };
+  union bpf_attr attr;
+  char *log;
+  int ret;
+
+  log = (char *)malloc(BPF_LOG_BUFZ);
+  if (!log)
+  {
+    ret = RET_MEMORY_ERROR;
+    goto EXIT;
+  }
+  log[0] = 0;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_SCHED_CLS;
+  attr.insns = (unsigned long)insns;
+  attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+  attr.license = (unsigned long)"GPL";
+  attr.log_buf = (unsigned long)log;
+  attr.log_size = BPF_LOG_BUFZ;
+  attr.log_level = 1;
+  strncpy(attr.prog_name, BPF_OBJ_NAME, sizeof(attr.prog_name) - 1);
+
+  bpf_prog_fd = bpf_fw_sys(BPF_PROG_LOAD, &attr);
+  if (bpf_prog_fd < 0)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to load BPF classifier: [%s] %s",
+              strerror(errno), log);
+    ret = RET_SYS_ERROR;
+    goto EXIT;
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  free(log);
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : bpf_tc_msg                                                   */
+/*                                                                            */
+/* Description : Start a tc message on the device's clsact qdisc.             */
+/*                                                                            */
+/* Params      : ns (IN/OUT)              - Netlink socket.                   */
+/*               b (IN/OUT)               - Message buffer.                   */
+/*               type (IN)                - Message type.                     */
+/*               flags (IN)               - Netlink flags.                    */
+/*               is_filter (IN)           - Filter message, not qdisc.        */
+/*               kind (IN)                - Qdisc or classifier kind.         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void bpf_tc_msg(nl_sock *ns, nl_buf *b, int type, int flags,
+                       int is_filter, char *kind)
+{
+  struct tcmsg tcm;
+
+  memset(&tcm, 0, sizeof(tcm));
+  tcm.tcm_family = AF_UNSPEC;
+  tcm.tcm_ifindex = bpf_ifindex;
+
+  if (is_filter)
+  {
+    tcm.tcm_parent = TC_H_MAKE(TC_H_CLSACT, TC_H_MIN_INGRESS);
+    tcm.tcm_handle = BPF_TC_HANDLE;
+    tcm.tcm_info = TC_H_MAKE(BPF_TC_PRIO << 16, htons(ETH_P_ALL));
+  }
+  else
+  {
+    tcm.tcm_parent = TC_H_CLSACT;
+    tcm.tcm_handle = TC_H_MAKE(TC_H_CLSACT, 0);
+  }
+
+  nl_msg_start_hdr(ns, b, type, NLM_F_ACK | flags, &tcm, sizeof(tcm));
+  nl_put_str(b, TCA_KIND, kind);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : bpf_attach                                                   */
+/*                                                                            */
+/* Description : Add the clsact qdisc to the device if missing and the        */
+/*               classifier to its ingress hook, replacing one left by an     */
+/*               earlier run.                                                 */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int bpf_attach(void)
+{
+  nl_sock ns;
+  nl_buf *b;
+  struct nlattr *opts;
+  unsigned int val;
+  int err;
+  int ret;
+
+  ns.fd = -1;
+
+  b = (nl_buf *)malloc(sizeof(nl_buf));
+  if (!b)
+  {
+    ret = RET_MEMORY_ERROR;
+    goto EXIT;
+  }
+
+  ret = nl_open_proto(&ns, NETLINK_ROUTE);
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  nl_reset(b);
+  bpf_tc_msg(&ns, b, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL, FALSE,
+             "clsact");
+  nl_msg_end(b);
+
+  err = nl_talk(&ns, b);
+  if ((err) && (err != -EEXIST))
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to add clsact qdisc to [%s]: [%s]",
+              dnswld.fw.bpf_dev, strerror(-err));
+    ret = RET_SYS_ERROR;
+    goto EXIT;
+  }
+
+  nl_reset(b);
+  bpf_tc_msg(&ns, b, RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_REPLACE, TRUE,
+             "bpf");
+  opts = nl_nest_start(b, TCA_OPTIONS);
+  val = bpf_prog_fd;
+  nl_put(b, TCA_BPF_FD, &val, sizeof(val));
+  nl_put_str(b, TCA_BPF_NAME, BPF_OBJ_NAME);
+  val = TCA_BPF_FLAG_ACT_DIRECT;
+  nl_put(b, TCA_BPF_FLAGS, &val, sizeof(val));
+  nl_nest_end(b, opts);
+  nl_msg_end(b);
+
+  err = nl_talk(&ns, b);
+  if (err)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to attach BPF classifier to [%s]: [%s]",
+              dnswld.fw.bpf_dev, strerror(-err));
+    ret = RET_SYS_ERROR;
+    goto EXIT;
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  nl_close(&ns);
+  free(b);
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : bpf_detach                                                   */
+/*                                                                            */
+/* Description : Remove the classifier. The clsact qdisc is left as other     */
+/*               classifiers may use it.                                      */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void bpf_detach(void)
+{
+  nl_sock ns;
+  nl_buf *b;
+  int err;
+
+  b = (nl_buf *)malloc(sizeof(nl_buf));
+  if ((!b) || (nl_open_proto(&ns, NETLINK_ROUTE)))
+  {
+    free(b);
+    return;
+  }
+
+  nl_reset(b);
+  bpf_tc_msg(&ns, b, RTM_DELTFILTER, 0, TRUE, "bpf");
+  nl_msg_end(b);
+
+  err = nl_talk(&ns, b);
+  if (err)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to detach BPF classifier from [%s]: [%s]",
+              dnswld.fw.bpf_dev, strerror(-err));
+  }
+
+  nl_close(&ns);
+  free(b);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : bpf_fw_add                                                   */
+/*                                                                            */
+/* Description : Write grant into the map, replacing an existing one (e.g. on */
+/*               refresh).                                                    */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int bpf_fw_add(fw_cmd *cmd)
+{
+  union bpf_attr attr;
+  bpf_key key;
+  bpf_grant grant;
+
+  key.s_ip = htonl(cmd->s_ip);
+  key.d_ip = htonl(cmd->d_ip);
+  grant.created_at = cmd->created_at;
+  grant.expiry = cmd->expiry;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = bpf_map_fd;
+  attr.key = (unsigned long)&key;
+  attr.value = (unsigned long)&grant;
+  attr.flags = BPF_ANY;
+
+  __sync_fetch_and_add(&bpf_n_adds, 1);
+
+  if (bpf_fw_sys(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to update BPF map: [%s]", strerror(errno));
+    return(RET_SYS_ERROR);
+  }
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : bpf_fw_del                                                   */
+/*                                                                            */
+/* Description : Remove grant from the map. Grants have no kernel timeout so  */
+/*               expired ones are removed too. A missing grant (e.g. evicted  */
+/*               by a full map) is counted, not failed.                       */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int bpf_fw_del(fw_cmd *cmd)
+{
+  union bpf_attr attr;
+  bpf_key key;
+
+  key.s_ip = htonl(cmd->s_ip);
+  key.d_ip = htonl(cmd->d_ip);
+
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = bpf_map_fd;
+  attr.key = (unsigned long)&key;
+
+  __sync_fetch_and_add(&bpf_n_dels, 1);
+
+  if (bpf_fw_sys(BPF_MAP_DELETE_ELEM, &attr) < 0)
+  {
+    if (errno == ENOENT)
+    {
+      __sync_fetch_and_add(&bpf_n_missing, 1);
+      return(RET_OK);
+    }
+
+    PUTS_OSYS(LOG_ERR, "Failed to delete from BPF map: [%s]",
+              strerror(errno));
+    return(RET_SYS_ERROR);
+  }
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : bpf_fw_list                                                  */
+/*                                                                            */
+/* Description : Report the grants in the map. The callback runs on a         */
+/*               snapshot so it may program the firewall itself.              */
+/*                                                                            */
+/* Params      : fn (IN)                  - Callback per grant.               */
+/*               arg (IN)                 - Callback argument.                */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int bpf_fw_list(fw_list_fn fn, void *arg)
+{
+  union bpf_attr attr;
+  bpf_key *keys;
+  bpf_key key;
+  bpf_grant grant;
+  fw_cmd cmd;
+  int n_keys = 0;
+  int i;
+  int ret;
+
+  keys = (bpf_key *)malloc(dnswld.fw.bpf_map_size * sizeof(bpf_key));
+  if (!keys)
+  {
+    ret = RET_MEMORY_ERROR;
+    goto EXIT;
+  }
+
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = bpf_map_fd;
+  attr.next_key = (unsigned long)&key;
+
+  while ((n_keys < dnswld.fw.bpf_map_size) &&
+         (!bpf_fw_sys(BPF_MAP_GET_NEXT_KEY, &attr)))
+  {
+    keys[n_keys++] = key;
+    attr.key = (unsigned long)&keys[n_keys - 1];
+  }
+
+  for (i = 0; i < n_keys; i++)
+  {
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = bpf_map_fd;
+    attr.key = (unsigned long)&keys[i];
+    attr.value = (unsigned long)&grant;
+
+    /**************************************************************************/
+    /* Gone since the snapshot.                                               */
+    /**************************************************************************/
+    if (bpf_fw_sys(BPF_MAP_LOOKUP_ELEM, &attr) < 0)
+    {
+      continue;
+    }
+
+    cmd.op = FW_CMD_ADD;
+    cmd.s_ip = ntohl(keys[i].s_ip);
+    cmd.d_ip = ntohl(keys[i].d_ip);
+    cmd.action = FW_ACCEPT_RULE;
+    cmd.created_at = grant.created_at;
+    cmd.expiry = grant.expiry;
+    cmd.dom_id = -1;
+
+    ret = fn(&cmd, arg);
+    if (ret)
+    {
+      goto EXIT;
+    }
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  free(keys);
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : bpf_fw_init                                                  */
+/*                                                                            */
+/* Description : Open the grant map and, if bpf_dev is set, load the          */
+/*               classifier and attach it to the device.                      */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int bpf_fw_init(void)
+{
+  int ret;
+
+  ret = bpf_open_map();
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  if (!dnswld.fw.bpf_dev[0])
+  {
+    PUTS_OSYS(LOG_INFO, "No bpf_dev, grants are kept in the BPF map only.");
+    goto EXIT;
+  }
+
+  bpf_ifindex = if_nametoindex(dnswld.fw.bpf_dev);
+  if (!bpf_ifindex)
+  {
+    PUTS_OSYS(LOG_ERR, "Unknown bpf device [%s]", dnswld.fw.bpf_dev);
+    ret = RET_INVALID_CONFIG;
+    goto EXIT;
+  }
+
+  ret = bpf_load_prog();
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  ret = bpf_attach();
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  PUTS_OSYS(LOG_INFO, "BPF classifier attached to [%s], mark: [0x%X]",
+            dnswld.fw.bpf_dev, dnswld.fw.bpf_mark);
+
+  EXIT:
+
+  if (ret)
+  {
+    if (bpf_prog_fd >= 0)
+    {
+      close(bpf_prog_fd);
+      bpf_prog_fd = -1;
+    }
+
+    if (bpf_map_fd >= 0)
+    {
+      close(bpf_map_fd);
+      bpf_map_fd = -1;
+    }
+  }
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : bpf_fw_shutdown                                              */
+/*                                                                            */
+/* Description : Log the operation counts, detach the classifier and close    */
+/*               the map. A pinned map keeps its grants for the next run.     */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void bpf_fw_shutdown(void)
+{
+  union bpf_attr attr;
+  bpf_key key;
+  unsigned int n_left = 0;
+
+  if (bpf_map_fd < 0)
+  {
+    return;
+  }
+
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = bpf_map_fd;
+  attr.next_key = (unsigned long)&key;
+  while (!bpf_fw_sys(BPF_MAP_GET_NEXT_KEY, &attr))
+  {
+    attr.key = (unsigned long)&key;
+    n_left++;
+  }
+
+  PUTS_OSYS(LOG_INFO, "BPF firewall: adds: %lu, dels: %lu (%lu missing), "
+            "grants left: %u", bpf_n_adds, bpf_n_dels, bpf_n_missing, n_left);
+
+  if (bpf_prog_fd >= 0)
+  {
+    bpf_detach();
+    close(bpf_prog_fd);
+    bpf_prog_fd = -1;
+  }
+
+  close(bpf_map_fd);
+  bpf_map_fd = -1;
+}
+
+
+/******************************************************************************/
+/* Backend operations.                                                        */
+/******************************************************************************/
+fw_ops bpf_fw_ops =
+{
+  "bpf",
+  bpf_fw_init,
+  bpf_fw_add,
+  bpf_fw_del,
+  NULL,
+  bpf_fw_list,
+  bpf_fw_shutdown
+};
@@ -0,0 +1,926 @@
+/*FILE+************************************************************************/
+/* Filename    : fw_ipset.c                                                   */
+/*                                                                            */
+/* Description : ipset firewall backend. One static rule per chain matches a  */
+/*               hash:net,net set of (src, dst) hosts, and grants are added   */
+/*               and removed as set members over netlink with the ACL age as  */
+/*               the kernel timeout. No process is spawned per grant.         */
+/*               In the domain layout each whitelist entry instead gets a     */
+/*               hash:ip set of its destinations and one of the clients       */
+/*               granted it, matched together by one rule per chain.          */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <fw.h>
+#include <nl.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+
+
+/******************************************************************************/
+/* Domain set names are the configured name plus "-s<id>" or "-d<id>". The    */
+/* buffer fits any id; names over IPSET_MAXNAMELEN are refused at init.       */
+/******************************************************************************/
+#define IPSET_DOMAIN_NAME_LEN                     (FW_SET_NAME_MAX_LEN + 16)
+
+/******************************************************************************/
+/* Most copies of a stale domain rule removed from one chain.                 */
+/******************************************************************************/
+#define IPSET_MAX_RULE_COPIES                     16
+
+
+/******************************************************************************/
+/* Domain layout state.                                                       */
+/* - dsts maps a destination to the time its set member times out, so it is   */
+/*   only re-added when a new grant outlives it. Members are added with twice */
+/*   the ACL age so a domain's set is refreshed at most once per age.         */
+/* - srcs maps a client to its ipset_src.                                     */
+/******************************************************************************/
+typedef struct _ipset_src
+{
+  int n_pairs;
+  unsigned int expiry;
+} ipset_src;
+
+typedef struct _ipset_domain
+{
+  int is_ready;
+  rhash dsts;
+  rhash srcs;
+} ipset_domain;
+
+
+/******************************************************************************/
+/* Domain ids of the sets left by an earlier run.                             */
+/******************************************************************************/
+typedef struct _ipset_ids
+{
+  int n;
+  int size;
+  int *ids;
+} ipset_ids;
+
+
+/******************************************************************************/
+/* Netlink socket and message buffer. Used by the firewall thread, and by     */
+/* deletes run in place when its queue is full.                               */
+/******************************************************************************/
+static pthread_mutex_t ipset_lock = PTHREAD_MUTEX_INITIALIZER;
+static nl_sock ipset_nl = {-1, 0, 0};
+static nl_buf ipset_buf;
+static ipset_domain *ipset_domains;
+static int ipset_n_domains;
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_msg_start                                              */
+/*                                                                            */
+/* Description : Start an ipset message for a set.                            */
+/*                                                                            */
+/* Params      : cmd (IN)                 - IPSET_CMD_* command.              */
+/*               name (IN)                - Set name.                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void ipset_msg_start(int cmd, char *name)
+{
+  nl_reset(&ipset_buf);
+  nl_msg_start(&ipset_nl, &ipset_buf, (NFNL_SUBSYS_IPSET << 8) | cmd,
+               NLM_F_ACK, NFPROTO_IPV4, 0);
+  nl_put_u8(&ipset_buf, IPSET_ATTR_PROTOCOL, IPSET_PROTOCOL);
+  nl_put_str(&ipset_buf, IPSET_ATTR_SETNAME, name);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_put_addr                                               */
+/*                                                                            */
+/* Description : Append a nested IPv4 address attribute.                      */
+/*                                                                            */
+/* Params      : type (IN)                - IPSET_ATTR_IP or IPSET_ATTR_IP2.  */
+/*               ip (IN)                  - IP in host byte order.            */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void ipset_put_addr(int type, unsigned int ip)
+{
+  struct nlattr *nest;
+
+  nest = nl_nest_start(&ipset_buf, type);
+  nl_put_be32(&ipset_buf, IPSET_ATTR_IPADDR_IPV4 | NLA_F_NET_BYTEORDER, ip);
+  nl_nest_end(&ipset_buf, nest);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_adt                                                    */
+/*                                                                            */
+/* Description : Add or delete a member. Adding an existing member refreshes  */
+/*               its timeout; deleting a missing one (e.g. already timed out  */
+/*               in the kernel) is not an error. Caller holds ipset_lock.     */
+/*                                                                            */
+/* Params      : cmd (IN)                 - IPSET_CMD_ADD or IPSET_CMD_DEL.   */
+/*               name (IN)                - Set name.                         */
+/*               ips (IN)                 - Member IPs.                       */
+/*               n_ips (IN)               - 1 for hash:ip, 2 for pair sets.   */
+/*               timeout (IN)             - Timeout in secs (add only).       */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipset_adt(int cmd, char *name, unsigned int *ips, int n_ips,
+                     unsigned int timeout)
+{
+  struct nlattr *nest;
+  int ret;
+
+  if (ipset_nl.fd < 0)
+  {
+    ret = RET_SYS_ERROR;
+    goto EXIT;
+  }
+
+  ipset_msg_start(cmd, name);
+  nest = nl_nest_start(&ipset_buf, IPSET_ATTR_DATA);
+  ipset_put_addr(IPSET_ATTR_IP, ips[0]);
+  if (n_ips > 1)
+  {
+    ipset_put_addr(IPSET_ATTR_IP2, ips[1]);
+  }
+  if (cmd == IPSET_CMD_ADD)
+  {
+    nl_put_be32(&ipset_buf, IPSET_ATTR_TIMEOUT | NLA_F_NET_BYTEORDER,
+                timeout ? timeout : 1);
+  }
+  nl_nest_end(&ipset_buf, nest);
+  nl_msg_end(&ipset_buf);
+
+  ret = nl_talk(&ipset_nl, &ipset_buf);
+  if (ret)
+  {
+    PUTS_OSYS(LOG_ERR, "ipset %s [%s] error: [%s]",
+              (cmd == IPSET_CMD_ADD) ? "add" : "del", name, strerror(-ret));
+    ret = RET_SYS_ERROR;
+    goto EXIT;
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_make_set                                               */
+/*                                                                            */
+/* Description : Create (or reuse) and flush a set with a default timeout of  */
+/*               the ACL age. The set starts empty to match the empty ACL.    */
+/*                                                                            */
+/* Params      : name (IN)                - Set name.                         */
+/*               type (IN)                - Set type.                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipset_make_set(char *name, char *type)
+{
+  struct nlattr *nest;
+  int ret;
+
+  ipset_msg_start(IPSET_CMD_CREATE, name);
+  nl_put_str(&ipset_buf, IPSET_ATTR_TYPENAME, type);
+  nl_put_u8(&ipset_buf, IPSET_ATTR_REVISION, 0);
+  nl_put_u8(&ipset_buf, IPSET_ATTR_FAMILY, NFPROTO_IPV4);
+  nest = nl_nest_start(&ipset_buf, IPSET_ATTR_DATA);
+  nl_put_be32(&ipset_buf, IPSET_ATTR_TIMEOUT | NLA_F_NET_BYTEORDER,
+              dnswld.proc.wl_age);
+  nl_nest_end(&ipset_buf, nest);
+  nl_msg_end(&ipset_buf);
+
+  ret = nl_talk(&ipset_nl, &ipset_buf);
+  if (ret)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to create ipset [%s]: [%s]", name,
+              strerror(-ret));
+    return(RET_SYS_ERROR);
+  }
+
+  ipset_msg_start(IPSET_CMD_FLUSH, name);
+  nl_msg_end(&ipset_buf);
+
+  ret = nl_talk(&ipset_nl, &ipset_buf);
+  if (ret)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to flush ipset [%s]: [%s]", name,
+              strerror(-ret));
+    return(RET_SYS_ERROR);
+  }
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_make_rule                                              */
+/*                                                                            */
+/* Description : Make sure each chain has the rule accepting a set match.     */
+/*                                                                            */
+/* Params      : match (IN)               - iptables set match arguments.     */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipset_make_rule(char *match)
+{
+  char cmd[1024];
+  int i;
+
+  for (i = 0; i < dnswld.fw.n_chains; i++)
+  {
+    snprintf(cmd, sizeof(cmd),
+             "%s -C %s %s -j ACCEPT 2>/dev/null || %s -I %s %s -j ACCEPT",
+             dnswld.fw.iptables_path, dnswld.fw.chains[i], match,
+             dnswld.fw.iptables_path, dnswld.fw.chains[i], match);
+
+    PUTS_OSYS(LOG_DEBUG, " cmd: [%s]", cmd);
+    if (system(cmd))
+    {
+      PUTS_OSYS(LOG_ERR, "Failed to add ipset rule to chain [%s].",
+                dnswld.fw.chains[i]);
+      return(RET_SYS_ERROR);
+    }
+  }
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_domain_sets                                            */
+/*                                                                            */
+/* Description : Format the names of a domain's client and destination sets.  */
+/*                                                                            */
+/* Params      : dom_id (IN)              - Domain id.                        */
+/*               src_set (OUT)            - Client set name.                  */
+/*               dst_set (OUT)            - Destination set name.             */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void ipset_domain_sets(int dom_id, char *src_set, char *dst_set)
+{
+  snprintf(src_set, IPSET_DOMAIN_NAME_LEN, "%s-s%d", dnswld.fw.set_name, dom_id);
+  snprintf(dst_set, IPSET_DOMAIN_NAME_LEN, "%s-d%d", dnswld.fw.set_name, dom_id);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_domain_match                                           */
+/*                                                                            */
+/* Description : Format the iptables match of a domain's rule.                */
+/*                                                                            */
+/* Params      : dom_id (IN)              - Domain id.                        */
+/*               match (OUT)              - Match arguments.                  */
+/*               size (IN)                - Size of match.                    */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void ipset_domain_match(int dom_id, char *match, int size)
+{
+  char src_set[IPSET_DOMAIN_NAME_LEN];
+  char dst_set[IPSET_DOMAIN_NAME_LEN];
+
+  ipset_domain_sets(dom_id, src_set, dst_set);
+  snprintf(match, size, "-m set --match-set %s src -m set --match-set %s dst",
+           src_set, dst_set);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_get_domain                                             */
+/*                                                                            */
+/* Description : Get a domain's state, creating its sets and rule with its    */
+/*               first grant. Caller holds ipset_lock.                        */
+/*                                                                            */
+/* Params      : dom_id (IN)              - Domain id.                        */
+/*                                                                            */
+/* Returns     : domain                   - Domain state otherwise NULL.      */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static ipset_domain *ipset_get_domain(int dom_id)
+{
+  ipset_domain *domains;
+  ipset_domain *dom;
+  char src_set[IPSET_DOMAIN_NAME_LEN];
+  char dst_set[IPSET_DOMAIN_NAME_LEN];
+  char match[256];
+  int n;
+
+  if (dom_id < 0)
+  {
+    return(NULL);
+  }
+
+  if (dom_id >= ipset_n_domains)
+  {
+    n = (dom_id + 1) * 2;
+    domains = (ipset_domain *)realloc(ipset_domains,
+                                      n * sizeof(ipset_domain));
+    if (!domains)
+    {
+      return(NULL);
+    }
+
+    memset(&domains[ipset_n_domains], 0,
+           (n - ipset_n_domains) * sizeof(ipset_domain));
+    ipset_domains = domains;
+    ipset_n_domains = n;
+  }
+
+  dom = &ipset_domains[dom_id];
+  if (dom->is_ready)
+  {
+    return(dom);
+  }
+
+  ipset_domain_sets(dom_id, src_set, dst_set);
+
+  if ((ipset_make_set(src_set, IPSET_DOMAIN_TYPE)) ||
+      (ipset_make_set(dst_set, IPSET_DOMAIN_TYPE)))
+  {
+    return(NULL);
+  }
+
+  ipset_domain_match(dom_id, match, sizeof(match));
+  if (ipset_make_rule(match))
+  {
+    return(NULL);
+  }
+
+  if ((rhash_init(&dom->dsts)) || (rhash_init(&dom->srcs)))
+  {
+    rhash_free(&dom->dsts);
+    return(NULL);
+  }
+
+  dom->is_ready = TRUE;
+
+  return(dom);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_domain_add                                             */
+/*                                                                            */
+/* Description : Grant a client a domain. The destination is only added when  */
+/*               it is new to the domain or would time out before the grant,  */
+/*               and the client only when it is new or its membership would   */
+/*               time out first, so a client granted N addresses of a domain  */
+/*               costs one membership insert. Caller holds ipset_lock.        */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipset_domain_add(fw_cmd *cmd)
+{
+  unsigned int now = (unsigned int)time(NULL);
+  char src_set[IPSET_DOMAIN_NAME_LEN];
+  char dst_set[IPSET_DOMAIN_NAME_LEN];
+  ipset_domain *dom;
+  ipset_src *src;
+  unsigned int timeout;
+  int ret;
+
+  dom = ipset_get_domain(cmd->dom_id);
+  if (!dom)
+  {
+    PUTS_OSYS(LOG_ERR, "No ipset for domain [%d].", cmd->dom_id);
+    return(RET_SYS_ERROR);
+  }
+
+  ipset_domain_sets(cmd->dom_id, src_set, dst_set);
+
+  if ((unsigned long)rhash_find(&dom->dsts, cmd->d_ip) < cmd->expiry)
+  {
+    timeout = ((cmd->expiry > now) ? cmd->expiry - now : 0) +
+              dnswld.proc.wl_age;
+
+    ret = ipset_adt(IPSET_CMD_ADD, dst_set, &cmd->d_ip, 1, timeout);
+    if (ret)
+    {
+      return(ret);
+    }
+
+    rhash_remove(&dom->dsts, cmd->d_ip);
+    rhash_insert(&dom->dsts, cmd->d_ip, (void *)(unsigned long)(now + timeout));
+  }
+
+  src = (ipset_src *)rhash_find(&dom->srcs, cmd->s_ip);
+  if (!src)
+  {
+    src = (ipset_src *)calloc(1, sizeof(ipset_src));
+    if ((!src) || (rhash_insert(&dom->srcs, cmd->s_ip, src)))
+    {
+      free(src);
+      return(RET_MEMORY_ERROR);
+    }
+  }
+
+  if (src->expiry < cmd->expiry)
+  {
+    ret = ipset_adt(IPSET_CMD_ADD, src_set, &cmd->s_ip, 1,
+                    (cmd->expiry > now) ? cmd->expiry - now : 0);
+    if (ret)
+    {
+      if (!src->n_pairs)
+      {
+        rhash_remove(&dom->srcs, cmd->s_ip);
+        free(src);
+      }
+      return(ret);
+    }
+
+    src->expiry = cmd->expiry;
+  }
+
+  /****************************************************************************/
+  /* A refresh is for a pair already counted.                                 */
+  /****************************************************************************/
+  if ((cmd->op == FW_CMD_ADD) || (!src->n_pairs))
+  {
+    src->n_pairs++;
+  }
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_domain_del                                             */
+/*                                                                            */
+/* Description : Drop a client's pair from a domain. The client leaves the    */
+/*               domain's set with its last pair; destinations are shared and */
+/*               left to time out. Caller holds ipset_lock.                   */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipset_domain_del(fw_cmd *cmd)
+{
+  char src_set[IPSET_DOMAIN_NAME_LEN];
+  char dst_set[IPSET_DOMAIN_NAME_LEN];
+  ipset_src *src;
+  unsigned int expiry;
+
+  if ((cmd->dom_id < 0) || (cmd->dom_id >= ipset_n_domains) ||
+      (!ipset_domains[cmd->dom_id].is_ready))
+  {
+    return(RET_OK);
+  }
+
+  src = (ipset_src *)rhash_find(&ipset_domains[cmd->dom_id].srcs, cmd->s_ip);
+  if ((!src) || (--src->n_pairs > 0))
+  {
+    return(RET_OK);
+  }
+
+  expiry = src->expiry;
+  rhash_remove(&ipset_domains[cmd->dom_id].srcs, cmd->s_ip);
+  free(src);
+
+  /****************************************************************************/
+  /* On expiry the kernel already dropped the member, unless a pair deleted   */
+  /* earlier had given it a later timeout.                                    */
+  /****************************************************************************/
+  if ((cmd->op == FW_CMD_EXPIRE) && (expiry <= cmd->expiry))
+  {
+    return(RET_OK);
+  }
+
+  ipset_domain_sets(cmd->dom_id, src_set, dst_set);
+
+  return(ipset_adt(IPSET_CMD_DEL, src_set, &cmd->s_ip, 1, 0));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_fw_add                                                 */
+/*                                                                            */
+/* Description : Grant a source access to a destination until the command's   */
+/*               expiry. Re-adding a member, e.g. on refresh, moves its       */
+/*               timeout.                                                     */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipset_fw_add(fw_cmd *cmd)
+{
+  unsigned int now = (unsigned int)time(NULL);
+  unsigned int ips[2] = {cmd->s_ip, cmd->d_ip};
+  int ret;
+
+  pthread_mutex_lock(&ipset_lock);
+
+  if (dnswld.fw.layout == FW_LAYOUT_DOMAIN)
+  {
+    ret = ipset_domain_add(cmd);
+  }
+  else
+  {
+    ret = ipset_adt(IPSET_CMD_ADD, dnswld.fw.set_name, ips, 2,
+                    (cmd->expiry > now) ? cmd->expiry - now : 0);
+  }
+
+  pthread_mutex_unlock(&ipset_lock);
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_fw_del                                                 */
+/*                                                                            */
+/* Description : Revoke a grant. Expiries are skipped; the kernel already     */
+/*               dropped those members.                                       */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipset_fw_del(fw_cmd *cmd)
+{
+  unsigned int ips[2] = {cmd->s_ip, cmd->d_ip};
+  int ret = RET_OK;
+
+  pthread_mutex_lock(&ipset_lock);
+
+  if (dnswld.fw.layout == FW_LAYOUT_DOMAIN)
+  {
+    ret = ipset_domain_del(cmd);
+  }
+  else if (cmd->op != FW_CMD_EXPIRE)
+  {
+    ret = ipset_adt(IPSET_CMD_DEL, dnswld.fw.set_name, ips, 2, 0);
+  }
+
+  pthread_mutex_unlock(&ipset_lock);
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_collect_domain                                         */
+/*                                                                            */
+/* Description : Set list callback. Records the domain id of a set named as   */
+/*               a domain's client or destination set.                        */
+/*                                                                            */
+/* Params      : nlh (IN)                 - Set list message.                 */
+/*               arg (IN/OUT)             - Domain ids.                       */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void ipset_collect_domain(struct nlmsghdr *nlh, void *arg)
+{
+  ipset_ids *found = (ipset_ids *)arg;
+  struct nlattr *name;
+  char *suffix;
+  int prefix_len;
+  int dom_id;
+  int *ids;
+  int len;
+  int i;
+
+  if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct nfgenmsg)))
+  {
+    return;
+  }
+
+  name = nl_find_attr((char *)NLMSG_DATA(nlh) +
+                      NLMSG_ALIGN(sizeof(struct nfgenmsg)),
+                      nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct nfgenmsg)),
+                      IPSET_ATTR_SETNAME);
+  if ((!name) || (!memchr(NL_ATTR_DATA(name), '\0', NL_ATTR_LEN(name))))
+  {
+    return;
+  }
+
+  /****************************************************************************/
+  /* <set_name>-s<id> or <set_name>-d<id>, nothing after the id.              */
+  /****************************************************************************/
+  prefix_len = strlen(dnswld.fw.set_name);
+  suffix = NL_ATTR_DATA(name) + prefix_len;
+  if ((strncmp(NL_ATTR_DATA(name), dnswld.fw.set_name, prefix_len)) ||
+      (suffix[0] != '-') || ((suffix[1] != 's') && (suffix[1] != 'd')) ||
+      (sscanf(&suffix[2], "%d%n", &dom_id, &len) != 1) ||
+      (suffix[2 + len] != '\0') || (dom_id < 0))
+  {
+    return;
+  }
+
+  for (i = 0; i < found->n; i++)
+  {
+    if (found->ids[i] == dom_id)
+    {
+      return;
+    }
+  }
+
+  if (found->n == found->size)
+  {
+    ids = (int *)realloc(found->ids, (found->size * 2 + 16) * sizeof(int));
+    if (!ids)
+    {
+      return;
+    }
+    found->ids = ids;
+    found->size = found->size * 2 + 16;
+  }
+
+  found->ids[found->n++] = dom_id;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_drop_set                                               */
+/*                                                                            */
+/* Description : Destroy a set, or flush it if it is still referenced from    */
+/*               elsewhere. A missing set is not an error.                    */
+/*                                                                            */
+/* Params      : name (IN)                - Set name.                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipset_drop_set(char *name)
+{
+  int ret;
+
+  ipset_msg_start(IPSET_CMD_DESTROY, name);
+  nl_msg_end(&ipset_buf);
+
+  ret = nl_talk(&ipset_nl, &ipset_buf);
+  if ((!ret) || (ret == -ENOENT))
+  {
+    return(RET_OK);
+  }
+
+  PUTS_OSYS(LOG_INFO, "ipset [%s] kept: [%s]. Flushing it.", name,
+            strerror(-ret));
+
+  ipset_msg_start(IPSET_CMD_FLUSH, name);
+  nl_msg_end(&ipset_buf);
+
+  ret = nl_talk(&ipset_nl, &ipset_buf);
+  if (ret)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to flush ipset [%s]: [%s]", name,
+              strerror(-ret));
+    return(RET_SYS_ERROR);
+  }
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_reset_domains                                          */
+/*                                                                            */
+/* Description : Remove the domain sets of an earlier run, and the rules      */
+/*               matching them, so no grant outlives the empty ACL. Domain    */
+/*               ids need not map to the same whitelist entries across runs.  */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipset_reset_domains(void)
+{
+  char src_set[IPSET_DOMAIN_NAME_LEN];
+  char dst_set[IPSET_DOMAIN_NAME_LEN];
+  char match[256];
+  char cmd[1024];
+  ipset_ids found;
+  int ret;
+  int i;
+  int k;
+  int n;
+
+  memset(&found, 0, sizeof(found));
+
+  nl_reset(&ipset_buf);
+  nl_msg_start(&ipset_nl, &ipset_buf, (NFNL_SUBSYS_IPSET << 8) | IPSET_CMD_LIST,
+               NLM_F_DUMP, NFPROTO_IPV4, 0);
+  nl_put_u8(&ipset_buf, IPSET_ATTR_PROTOCOL, IPSET_PROTOCOL);
+  nl_put_be32(&ipset_buf, IPSET_ATTR_FLAGS | NLA_F_NET_BYTEORDER,
+              IPSET_FLAG_LIST_SETNAME);
+  nl_msg_end(&ipset_buf);
+
+  ret = nl_dump(&ipset_nl, &ipset_buf, ipset_collect_domain, &found);
+  if (ret)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to list ipsets: [%s]", strerror(-ret));
+    ret = RET_SYS_ERROR;
+    goto EXIT;
+  }
+
+  for (i = 0; i < found.n; i++)
+  {
+    ipset_domain_match(found.ids[i], match, sizeof(match));
+    for (k = 0; k < dnswld.fw.n_chains; k++)
+    {
+      snprintf(cmd, sizeof(cmd), "%s -D %s %s -j ACCEPT 2>/dev/null",
+               dnswld.fw.iptables_path, dnswld.fw.chains[k], match);
+
+      PUTS_OSYS(LOG_DEBUG, " cmd: [%s]", cmd);
+      for (n = 0; n < IPSET_MAX_RULE_COPIES; n++)
+      {
+        if (system(cmd))
+        {
+          break;
+        }
+      }
+    }
+
+    ipset_domain_sets(found.ids[i], src_set, dst_set);
+    ret = ipset_drop_set(src_set);
+    if (!ret)
+    {
+      ret = ipset_drop_set(dst_set);
+    }
+
+    if (ret)
+    {
+      goto EXIT;
+    }
+  }
+
+  if (found.n)
+  {
+    PUTS_OSYS(LOG_INFO, "Removed the ipsets of %d domains of an earlier run.",
+              found.n);
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  free(found.ids);
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_fw_init                                                */
+/*                                                                            */
+/* Description : Create (or reuse) and flush the set, then make sure each     */
+/*               chain has the rule accepting its members. In the domain      */
+/*               layout sets are made per domain with its first grant, and    */
+/*               those of an earlier run are removed first.                   */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipset_fw_init(void)
+{
+  char match[256];
+  int ret;
+
+  ret = nl_open(&ipset_nl);
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  if (dnswld.fw.layout == FW_LAYOUT_DOMAIN)
+  {
+    /**************************************************************************/
+    /* Leave room for the "-s<id>" / "-d<id>" suffix.                         */
+    /**************************************************************************/
+    if (strlen(dnswld.fw.set_name) > IPSET_MAXNAMELEN - 8)
+    {
+      PUTS_OSYS(LOG_ERR, "ipset name [%s] too long for the domain layout.",
+                dnswld.fw.set_name);
+      ret = RET_INVALID_CONFIG;
+      goto EXIT;
+    }
+
+    ret = ipset_reset_domains();
+    goto EXIT;
+  }
+
+  ret = ipset_make_set(dnswld.fw.set_name, IPSET_TYPE);
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  snprintf(match, sizeof(match), "-m set --match-set %s src,dst",
+           dnswld.fw.set_name);
+  ret = ipset_make_rule(match);
+
+  EXIT:
+
+  if (ret)
+  {
+    nl_close(&ipset_nl);
+  }
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_free_src                                               */
+/*                                                                            */
+/* Description : Free one client entry of a domain.                           */
+/*                                                                            */
+/* Params      : item (IN)                - Client entry.                     */
+/*               arg (IN)                 - Unused.                           */
+/*                                                                            */
+/* Returns     : 0                                                            */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipset_free_src(void *item, void *arg)
+{
+  free(item);
+  return(0);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipset_fw_clean                                               */
+/*                                                                            */
+/* Description : Release the netlink socket and domain state. The sets and    */
+/*               their rules are left in place; members still time out in the */
+/*               kernel.                                                      */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void ipset_fw_clean(void)
+{
+  int i;
+
+  pthread_mutex_lock(&ipset_lock);
+
+  nl_close(&ipset_nl);
+
+  for (i = 0; i < ipset_n_domains; i++)
+  {
+    if (ipset_domains[i].is_ready)
+    {
+      rhash_walk(&ipset_domains[i].srcs, ipset_free_src, NULL);
+      rhash_free(&ipset_domains[i].srcs);
+      rhash_free(&ipset_domains[i].dsts);
+    }
+  }
+
+  free(ipset_domains);
+  ipset_domains = NULL;
+  ipset_n_domains = 0;
+
+  pthread_mutex_unlock(&ipset_lock);
+}
+
+
+/******************************************************************************/
+/* Backend operations.                                                        */
+/******************************************************************************/
+fw_ops ipset_fw_ops =
+{
+  "ipset",
+  ipset_fw_init,
+  ipset_fw_add,
+  ipset_fw_del,
+  NULL,
+  NULL,
+  ipset_fw_clean
+};
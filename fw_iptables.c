@@ -0,0 +1,686 @@
+/*FILE+************************************************************************/
+/* Filename    : fw_iptables.c                                                */
+/*                                                                            */
+/* Description : iptables firewall backend. Grants are tagged rules added and */
+/*               deleted with the iptables binary, either one per grant in    */
+/*               each chain (flat layout) or one per grant in a chain of its  */
+/*               client's that each chain jumps to (per-client layout).       */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation. Moved from fw.c.                       */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <fw.h>
+
+#include <pthread.h>
+#include <time.h>
+
+
+/******************************************************************************/
+/* Grants per client chain in the per-client layout, keyed by source IP. The  */
+/* item is the count itself; a client without grants has no entry.            */
+/******************************************************************************/
+static pthread_mutex_t ipt_lock = PTHREAD_MUTEX_INITIALIZER;
+static rhash ipt_clients;
+
+
+/*FUNC+************************************************************************/
+/* Function    : format_fw_rule                                               */
+/*                                                                            */
+/* Description : Format the iptables arguments of a whitelist rule. The       */
+/*               comment tags the rule so it can be restored at start-up.     */
+/*                                                                            */
+/* Params      : buf (OUT)                - Output buffer.                    */
+/*               size (IN)                - Size of buffer.                   */
+/*               op (IN)                  - "-A" or "-D".                     */
+/*               chain (IN)               - Chain.                            */
+/*               s_ip (IN)                - Source IP.                        */
+/*               d_ip (IN)                - Destination IP.                   */
+/*               action (IN)              - Action.                           */
+/*               created_at (IN)          - Creation timestamp.               */
+/*               expiry (IN)              - Expiry timestamp.                 */
+/*                                                                            */
+/* Returns     : length                   - Formatted length.                 */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int format_fw_rule(char *buf, int size, char *op, char *chain,
+                   unsigned int s_ip, unsigned int d_ip, int action,
+                   unsigned int created_at, unsigned int expiry)
+{
+  time_t tt = (time_t)expiry;
+  char tt_str[31] = {0};
+  char *action_str;
+
+  action_str = (action == FW_ACCEPT_RULE) ? "ACCEPT" : "DROP";
+  ctime_r(&tt, tt_str);
+  if (strlen(tt_str))
+  {
+    tt_str[strlen(tt_str) -1] = '\0';
+  }
+
+  return(snprintf(buf, size,
+                  "%s %s -s %d.%d.%d.%d -d %d.%d.%d.%d -j %s "
+                  "-m comment --comment \"%s - %u - " FW_EXPIRY_TAG "%s\"",
+                  op, chain,
+                  (s_ip >> 24) & 0xFF,
+                  (s_ip >> 16) & 0xFF,
+                  (s_ip >> 8) & 0xFF,
+                  s_ip & 0xFF,
+                  (d_ip >> 24) & 0xFF,
+                  (d_ip >> 16) & 0xFF,
+                  (d_ip >> 8) & 0xFF,
+                  d_ip & 0xFF,
+                  action_str,
+                  FW_RULE_TAG,
+                  created_at,
+                  tt_str));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : format_fw_jump                                               */
+/*                                                                            */
+/* Description : Format the iptables arguments of a client dispatch rule.     */
+/*                                                                            */
+/* Params      : buf (OUT)                - Output buffer.                    */
+/*               size (IN)                - Size of buffer.                   */
+/*               op (IN)                  - "-A", "-C" or "-D".               */
+/*               chain (IN)               - Chain.                            */
+/*               s_ip (IN)                - Client source IP.                 */
+/*                                                                            */
+/* Returns     : length                   - Formatted length.                 */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int format_fw_jump(char *buf, int size, char *op, char *chain,
+                   unsigned int s_ip)
+{
+  return(snprintf(buf, size, "%s %s -s %d.%d.%d.%d -j " FW_CLIENT_CHAIN_FMT,
+                  op, chain,
+                  (s_ip >> 24) & 0xFF,
+                  (s_ip >> 16) & 0xFF,
+                  (s_ip >> 8) & 0xFF,
+                  s_ip & 0xFF,
+                  s_ip));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : lock_ipt_fw                                                  */
+/*                                                                            */
+/* Description : Lock iptables backend state.                                 */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void lock_ipt_fw(void)
+{
+  pthread_mutex_lock(&ipt_lock);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : unlock_ipt_fw                                                */
+/*                                                                            */
+/* Description : Unlock iptables backend state.                               */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void unlock_ipt_fw(void)
+{
+  pthread_mutex_unlock(&ipt_lock);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipt_client_grants                                            */
+/*                                                                            */
+/* Description : Number of grants in a client's chain. Caller holds the lock. */
+/*                                                                            */
+/* Params      : s_ip (IN)                - Client source IP.                 */
+/*                                                                            */
+/* Returns     : n                        - Number of grants.                 */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int ipt_client_grants(unsigned int s_ip)
+{
+  return((int)(unsigned long)rhash_find(&ipt_clients, s_ip));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipt_set_client_grants                                        */
+/*                                                                            */
+/* Description : Set the number of grants in a client's chain. Caller holds   */
+/*               the lock.                                                    */
+/*                                                                            */
+/* Params      : s_ip (IN)                - Client source IP.                 */
+/*               n (IN)                   - Number of grants.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int ipt_set_client_grants(unsigned int s_ip, int n)
+{
+  rhash_remove(&ipt_clients, s_ip);
+  if (n <= 0)
+  {
+    return(RET_OK);
+  }
+
+  return(rhash_insert(&ipt_clients, s_ip, (void *)(unsigned long)n));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipt_system                                                   */
+/*                                                                            */
+/* Description : Run an iptables command line.                                */
+/*                                                                            */
+/* Params      : buf (IN)                 - Command line.                     */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipt_system(char *buf)
+{
+  PUTS_OSYS(LOG_DEBUG, " cmd: [%s]", buf);
+
+  return(system(buf) ? RET_SYS_ERROR : RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipt_fw_flat                                                  */
+/*                                                                            */
+/* Description : Run iptables for a rule on each chain. A delete goes on to   */
+/*               the other chains when one has lost the rule.                 */
+/*                                                                            */
+/* Params      : op (IN)                  - "-A" or "-D".                     */
+/*               cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipt_fw_flat(char *op, fw_cmd *cmd)
+{
+  char buf[1024];
+  int len;
+  int err;
+  int i;
+  int ret = RET_OK;
+
+  for (i = 0; i < dnswld.fw.n_chains; i++)
+  {
+    len = snprintf(buf, sizeof(buf), "%s ", dnswld.fw.iptables_path);
+    format_fw_rule(buf + len, sizeof(buf) - len, op, dnswld.fw.chains[i],
+                   cmd->s_ip, cmd->d_ip, cmd->action, cmd->created_at,
+                   cmd->expiry);
+
+    err = ipt_system(buf);
+    if (!err)
+    {
+      continue;
+    }
+
+    if (!ret)
+    {
+      ret = err;
+    }
+
+    if (cmd->op == FW_CMD_ADD)
+    {
+      goto EXIT;
+    }
+  }
+
+  EXIT:
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipt_fw_client                                                */
+/*                                                                            */
+/* Description : Add or delete a rule in the client's chain. The chain and    */
+/*               the dispatch rules jumping to it from each chain are created */
+/*               with the client's first grant and removed with its last.     */
+/*               Caller holds the lock.                                       */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipt_fw_client(fw_cmd *cmd)
+{
+  char buf[1024];
+  char chain[FW_CHAIN_MAX_LEN];
+  char *path = dnswld.fw.iptables_path;
+  int n_grants;
+  int len;
+  int i;
+  int ret;
+
+  snprintf(chain, sizeof(chain), FW_CLIENT_CHAIN_FMT, cmd->s_ip);
+  n_grants = ipt_client_grants(cmd->s_ip);
+
+  if (cmd->op == FW_CMD_ADD)
+  {
+    /**************************************************************************/
+    /* First grant: create the chain (it may be left from an earlier run) and */
+    /* dispatch to it.                                                        */
+    /**************************************************************************/
+    if (!n_grants)
+    {
+      snprintf(buf, sizeof(buf), "%s -N %s 2>/dev/null", path, chain);
+      ipt_system(buf);
+
+      for (i = 0; i < dnswld.fw.n_chains; i++)
+      {
+        len = snprintf(buf, sizeof(buf), "%s ", path);
+        len += format_fw_jump(buf + len, sizeof(buf) - len, "-C",
+                              dnswld.fw.chains[i], cmd->s_ip);
+        len += snprintf(buf + len, sizeof(buf) - len, " 2>/dev/null || %s ",
+                        path);
+        format_fw_jump(buf + len, sizeof(buf) - len, "-A",
+                       dnswld.fw.chains[i], cmd->s_ip);
+
+        ret = ipt_system(buf);
+        if (ret)
+        {
+          goto EXIT;
+        }
+      }
+    }
+
+    len = snprintf(buf, sizeof(buf), "%s ", path);
+    format_fw_rule(buf + len, sizeof(buf) - len, "-A", chain, cmd->s_ip,
+                   cmd->d_ip, cmd->action, cmd->created_at, cmd->expiry);
+
+    ret = ipt_system(buf);
+    if (ret)
+    {
+      goto EXIT;
+    }
+
+    ret = ipt_set_client_grants(cmd->s_ip, n_grants + 1);
+    goto EXIT;
+  }
+
+  len = snprintf(buf, sizeof(buf), "%s ", path);
+  format_fw_rule(buf + len, sizeof(buf) - len, "-D", chain, cmd->s_ip,
+                 cmd->d_ip, cmd->action, cmd->created_at, cmd->expiry);
+
+  ret = ipt_system(buf);
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  ipt_set_client_grants(cmd->s_ip, n_grants - 1);
+
+  /****************************************************************************/
+  /* Last grant: drop the dispatch rules and the chain.                       */
+  /****************************************************************************/
+  if (n_grants <= 1)
+  {
+    for (i = 0; i < dnswld.fw.n_chains; i++)
+    {
+      len = snprintf(buf, sizeof(buf), "%s ", path);
+      format_fw_jump(buf + len, sizeof(buf) - len, "-D", dnswld.fw.chains[i],
+                     cmd->s_ip);
+      ipt_system(buf);
+    }
+
+    snprintf(buf, sizeof(buf), "%s -X %s", path, chain);
+    ipt_system(buf);
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipt_fw_apply                                                 */
+/*                                                                            */
+/* Description : Program one command in the configured rule layout. Rules     */
+/*               have no timeout, so refreshes are no-ops. Caller holds the   */
+/*               lock.                                                        */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int ipt_fw_apply(fw_cmd *cmd)
+{
+  if (cmd->op == FW_CMD_REFRESH)
+  {
+    return(RET_OK);
+  }
+
+  if (dnswld.fw.layout == FW_LAYOUT_CLIENT)
+  {
+    return(ipt_fw_client(cmd));
+  }
+
+  return(ipt_fw_flat((cmd->op == FW_CMD_ADD) ? "-A" : "-D", cmd));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipt_fw_add                                                   */
+/*                                                                            */
+/* Description : Add rule to iptables for given source and dest.              */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int ipt_fw_add(fw_cmd *cmd)
+{
+  int ret;
+
+  lock_ipt_fw();
+  ret = ipt_fw_apply(cmd);
+  unlock_ipt_fw();
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipt_fw_del                                                   */
+/*                                                                            */
+/* Description : Delete rule from iptables for given source and dest.         */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int ipt_fw_del(fw_cmd *cmd)
+{
+  int ret;
+
+  lock_ipt_fw();
+  ret = ipt_fw_apply(cmd);
+  unlock_ipt_fw();
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipt_parse_expiry                                             */
+/*                                                                            */
+/* Description : Get the expiry a listed rule was added with from its comment */
+/*               so it can be deleted by the same text.                       */
+/*                                                                            */
+/* Params      : line (IN)                - Listed rule.                      */
+/*                                                                            */
+/* Returns     : expiry                   - Expiry timestamp, 0 if none.      */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static unsigned int ipt_parse_expiry(char *line)
+{
+  struct tm tm;
+  char *exp;
+
+  exp = strstr(line, FW_EXPIRY_TAG);
+  if (!exp)
+  {
+    return(0);
+  }
+
+  memset(&tm, 0, sizeof(tm));
+  if (!strptime(exp + strlen(FW_EXPIRY_TAG), FW_EXPIRY_FMT, &tm))
+  {
+    return(0);
+  }
+
+  tm.tm_isdst = -1;
+
+  return((unsigned int)mktime(&tm));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipt_read_dump                                                */
+/*                                                                            */
+/* Description : Dump the tagged rules and parse them. In the per-client      */
+/*               layout the client grant counts are rebuilt from the dump, so */
+/*               they match the rules whatever happened to them since. Caller */
+/*               holds the lock.                                              */
+/*                                                                            */
+/* Params      : grants (OUT)             - Rules read, to be freed.          */
+/*               n_grants (OUT)           - Number of rules read.             */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ipt_read_dump(fw_cmd **grants, int *n_grants)
+{
+  FILE *in = NULL;
+  fw_cmd *cmd;
+  fw_cmd *more;
+  char buf[1024];
+  char *line;
+  char *token;
+  char *saveptr;
+  char src[IP4_STR_MAX_LEN];
+  char dest[IP4_STR_MAX_LEN];
+  in_addr_t addr;
+  int max_grants = 0;
+  int i;
+  int ret;
+
+  *grants = NULL;
+  *n_grants = 0;
+
+  /****************************************************************************/
+  /* Dump whitelist firewall rules.                                           */
+  /****************************************************************************/
+  snprintf(buf, sizeof(buf), "%s -n -L | grep %s > %s",
+           dnswld.fw.iptables_path, FW_RULE_TAG, DNSWLD_FW_DUMP);
+
+  PUTS_OSYS(LOG_DEBUG, " cmd: [%s]", buf);
+  ret = system(buf);
+  if (ret < 0)
+  {
+    PUTS_OSYS(LOG_DEBUG, "Error dumping whitelist firewall rules.");
+    ret = RET_SYS_ERROR;
+    goto EXIT;
+  }
+
+  /****************************************************************************/
+  /* Parse the dump file and extract ACL information.                         */
+  /****************************************************************************/
+  in = fopen(DNSWLD_FW_DUMP, "r");
+  if (!in)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to whitelist firewall rules dump file [%s].",
+              DNSWLD_FW_DUMP);
+    ret = RET_FILE_OPEN_ERROR;
+    goto EXIT;
+  }
+
+  if (dnswld.fw.layout == FW_LAYOUT_CLIENT)
+  {
+    rhash_free(&ipt_clients);
+    rhash_init(&ipt_clients);
+  }
+
+  while ((line = fgets(buf, sizeof(buf), in)))
+  {
+    trim_str(line);
+    PUTS_OSYS(LOG_DEBUG, " line: [%s]", buf);
+
+    if (*n_grants == max_grants)
+    {
+      max_grants = max_grants ? max_grants * 2 : FW_BATCH_MAX;
+      more = (fw_cmd *)realloc(*grants, max_grants * sizeof(fw_cmd));
+      if (!more)
+      {
+        ret = RET_MEMORY_ERROR;
+        goto EXIT;
+      }
+      *grants = more;
+    }
+
+    cmd = &(*grants)[*n_grants];
+    memset(cmd, 0, sizeof(fw_cmd));
+    cmd->expiry = ipt_parse_expiry(line);
+
+    for (token = strtok_r(line, " ", &saveptr), i = 0; token != NULL;
+         token = strtok_r(NULL, " ", &saveptr), i++)
+    {
+      switch (i)
+      {
+        case 3:
+          strncpy(src, token, sizeof(src) - 1);
+          break;
+
+        case 4:
+          strncpy(dest, token, sizeof(dest) - 1);
+          break;
+
+        case 8:
+          cmd->created_at = (unsigned int)strtoul(token, NULL, 10);
+          break;
+      }
+    }
+
+    addr = inet_addr(src);
+    cmd->s_ip = ntohl(*((unsigned int *)&addr));
+    addr = inet_addr(dest);
+    cmd->d_ip = ntohl(*((unsigned int *)&addr));
+    cmd->op = FW_CMD_ADD;
+    cmd->action = FW_ACCEPT_RULE;
+    cmd->dom_id = -1;
+    (*n_grants)++;
+
+    if (!cmd->expiry)
+    {
+      cmd->expiry = cmd->created_at + dnswld.proc.wl_age;
+    }
+
+    /**************************************************************************/
+    /* In the per-client layout each grant is listed once, from its client's  */
+    /* chain.                                                                 */
+    /**************************************************************************/
+    if (dnswld.fw.layout == FW_LAYOUT_CLIENT)
+    {
+      ipt_set_client_grants(cmd->s_ip, ipt_client_grants(cmd->s_ip) + 1);
+    }
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  if (in)
+  {
+    fclose(in);
+  }
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipt_fw_list                                                  */
+/*                                                                            */
+/* Description : Report the tagged rules in the firewall. A rule in several   */
+/*               chains is reported once per chain. The callback runs on the  */
+/*               parsed dump so it may program the firewall itself.           */
+/*                                                                            */
+/* Params      : fn (IN)                  - Callback per rule.                */
+/*               arg (IN)                 - Callback argument.                */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int ipt_fw_list(fw_list_fn fn, void *arg)
+{
+  fw_cmd *grants;
+  int n_grants;
+  int i;
+  int ret;
+
+  lock_ipt_fw();
+  ret = ipt_read_dump(&grants, &n_grants);
+  unlock_ipt_fw();
+
+  for (i = 0; (!ret) && (i < n_grants); i++)
+  {
+    ret = fn(&grants[i], arg);
+  }
+
+  free(grants);
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipt_fw_init                                                  */
+/*                                                                            */
+/* Description : Set up iptables backend state.                               */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int ipt_fw_init(void)
+{
+  return(rhash_init(&ipt_clients));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ipt_fw_shutdown                                              */
+/*                                                                            */
+/* Description : Release iptables backend state.                              */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void ipt_fw_shutdown(void)
+{
+  lock_ipt_fw();
+  rhash_free(&ipt_clients);
+  unlock_ipt_fw();
+}
+
+
+/******************************************************************************/
+/* Backend operations.                                                        */
+/******************************************************************************/
+fw_ops ipt_fw_ops =
+{
+  "iptables",
+  ipt_fw_init,
+  ipt_fw_add,
+  ipt_fw_del,
+  NULL,
+  ipt_fw_list,
+  ipt_fw_shutdown
+};
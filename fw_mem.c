@@ -0,0 +1,324 @@
+/*FILE+************************************************************************/
+/* Filename    : fw_mem.c                                                     */
+/*                                                                            */
+/* Description : In-memory firewall backend. Nothing reaches the kernel:      */
+/*               grants are kept in a hash table and every call can be        */
+/*               delayed by fw_latency_us, so the whitelist, sweeper and      */
+/*               firewall thread can be load-tested without root.             */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <fw.h>
+
+#include <pthread.h>
+
+
+/******************************************************************************/
+/* Installed grants, keyed by ACL_PAIR_KEY, and operation counts.             */
+/******************************************************************************/
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static rhash mem_grants;
+static unsigned long mem_n_calls;
+static unsigned long mem_n_adds;
+static unsigned long mem_n_dels;
+static unsigned long mem_n_missing;
+
+
+/*FUNC+************************************************************************/
+/* Function    : mem_fw_delay                                                 */
+/*                                                                            */
+/* Description : Stand in for the cost of a firewall call.                    */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void mem_fw_delay(void)
+{
+  struct timespec ts;
+
+  if (dnswld.fw.latency_us > 0)
+  {
+    ts.tv_sec = dnswld.fw.latency_us / 1000000;
+    ts.tv_nsec = (dnswld.fw.latency_us % 1000000) * 1000L;
+    nanosleep(&ts, NULL);
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : mem_fw_apply                                                 */
+/*                                                                            */
+/* Description : Record one command. Caller holds mem_lock. A repeated add or */
+/*               a refresh replaces the grant; a delete of a missing grant is */
+/*               counted, not failed.                                         */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int mem_fw_apply(fw_cmd *cmd)
+{
+  unsigned long long key = ACL_PAIR_KEY(cmd->s_ip, cmd->d_ip);
+  fw_cmd *grant;
+
+  if ((cmd->op == FW_CMD_DEL) || (cmd->op == FW_CMD_EXPIRE))
+  {
+    mem_n_dels++;
+
+    grant = (fw_cmd *)rhash_remove(&mem_grants, key);
+    if (!grant)
+    {
+      mem_n_missing++;
+      return(RET_OK);
+    }
+
+    free(grant);
+    return(RET_OK);
+  }
+
+  mem_n_adds++;
+
+  grant = (fw_cmd *)rhash_find(&mem_grants, key);
+  if (grant)
+  {
+    *grant = *cmd;
+    return(RET_OK);
+  }
+
+  grant = (fw_cmd *)malloc(sizeof(fw_cmd));
+  if (!grant)
+  {
+    return(RET_MEMORY_ERROR);
+  }
+
+  *grant = *cmd;
+
+  if (rhash_insert(&mem_grants, key, grant))
+  {
+    free(grant);
+    return(RET_MEMORY_ERROR);
+  }
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : mem_fw_run                                                   */
+/*                                                                            */
+/* Description : Program one command as its own call.                         */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int mem_fw_run(fw_cmd *cmd)
+{
+  int ret;
+
+  mem_fw_delay();
+
+  pthread_mutex_lock(&mem_lock);
+  mem_n_calls++;
+  ret = mem_fw_apply(cmd);
+  pthread_mutex_unlock(&mem_lock);
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : mem_fw_bulk                                                  */
+/*                                                                            */
+/* Description : Program a batch as one call.                                 */
+/*                                                                            */
+/* Params      : cmds (IN)                - Firewall commands.                */
+/*               n (IN)                   - Number of commands.               */
+/*               status (OUT)             - RET_OK or error per command.      */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void mem_fw_bulk(fw_cmd *cmds, int n, int *status)
+{
+  int i;
+
+  mem_fw_delay();
+
+  pthread_mutex_lock(&mem_lock);
+
+  mem_n_calls++;
+  for (i = 0; i < n; i++)
+  {
+    status[i] = mem_fw_apply(&cmds[i]);
+  }
+
+  pthread_mutex_unlock(&mem_lock);
+}
+
+
+/******************************************************************************/
+/* Grant snapshot taken by mem_fw_list.                                       */
+/******************************************************************************/
+typedef struct _mem_snapshot
+{
+  fw_cmd *grants;
+  int n;
+} mem_snapshot;
+
+
+/*FUNC+************************************************************************/
+/* Function    : mem_fw_copy_one                                              */
+/*                                                                            */
+/* Description : Copy one grant into the snapshot.                            */
+/*                                                                            */
+/* Params      : item (IN)                - Grant.                            */
+/*               arg (IN/OUT)             - Snapshot.                         */
+/*                                                                            */
+/* Returns     : 0                                                            */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int mem_fw_copy_one(void *item, void *arg)
+{
+  mem_snapshot *snap = (mem_snapshot *)arg;
+
+  snap->grants[snap->n++] = *(fw_cmd *)item;
+  return(0);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : mem_fw_list                                                  */
+/*                                                                            */
+/* Description : Report the recorded grants. The callback runs on a snapshot  */
+/*               so it may program the firewall itself.                       */
+/*                                                                            */
+/* Params      : fn (IN)                  - Callback per grant.               */
+/*               arg (IN)                 - Callback argument.                */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int mem_fw_list(fw_list_fn fn, void *arg)
+{
+  mem_snapshot snap = {NULL, 0};
+  int i;
+  int ret;
+
+  pthread_mutex_lock(&mem_lock);
+
+  snap.grants = (fw_cmd *)malloc((rhash_count(&mem_grants) + 1) *
+                                 sizeof(fw_cmd));
+  if (snap.grants)
+  {
+    rhash_walk(&mem_grants, mem_fw_copy_one, &snap);
+  }
+
+  pthread_mutex_unlock(&mem_lock);
+
+  if (!snap.grants)
+  {
+    ret = RET_MEMORY_ERROR;
+    goto EXIT;
+  }
+
+  for (i = 0; i < snap.n; i++)
+  {
+    ret = fn(&snap.grants[i], arg);
+    if (ret)
+    {
+      goto EXIT;
+    }
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  free(snap.grants);
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : mem_fw_init                                                  */
+/*                                                                            */
+/* Description : Create the empty grant table.                                */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int mem_fw_init(void)
+{
+  return(rhash_init(&mem_grants));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : mem_fw_free_one                                              */
+/*                                                                            */
+/* Description : Free one grant.                                              */
+/*                                                                            */
+/* Params      : item (IN)                - Grant.                            */
+/*               arg (IN)                 - Unused.                           */
+/*                                                                            */
+/* Returns     : 0                                                            */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int mem_fw_free_one(void *item, void *arg)
+{
+  free(item);
+  return(0);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : mem_fw_shutdown                                              */
+/*                                                                            */
+/* Description : Log the operation counts and drop the grant table.           */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void mem_fw_shutdown(void)
+{
+  pthread_mutex_lock(&mem_lock);
+
+  PUTS_OSYS(LOG_INFO, "Memory firewall: calls: %lu, adds: %lu, dels: %lu "
+            "(%lu missing), grants left: %u", mem_n_calls, mem_n_adds,
+            mem_n_dels, mem_n_missing, rhash_count(&mem_grants));
+
+  rhash_walk(&mem_grants, mem_fw_free_one, NULL);
+  rhash_free(&mem_grants);
+
+  pthread_mutex_unlock(&mem_lock);
+}
+
+
+/******************************************************************************/
+/* Backend operations.                                                        */
+/******************************************************************************/
+fw_ops mem_fw_ops =
+{
+  "memory",
+  mem_fw_init,
+  mem_fw_run,
+  mem_fw_run,
+  mem_fw_bulk,
+  mem_fw_list,
+  mem_fw_shutdown
+};
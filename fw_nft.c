@@ -0,0 +1,517 @@
+/*FILE+************************************************************************/
+/* Filename    : fw_nft.c                                                     */
+/*                                                                            */
+/* Description : nftables firewall backend. Grants are elements of a set of   */
+/*               "ipv4_addr . ipv4_addr" pairs with per-element timeouts.     */
+/*               Queued commands are committed as one netlink batch           */
+/*               transaction, one element list message per run of adds or     */
+/*               deletes. A single add or delete is a batch of one.           */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <fw.h>
+#include <nl.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/utsname.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+
+
+/******************************************************************************/
+/* Set key: concatenation of two ipv4_addr (type 7) fields.                   */
+/******************************************************************************/
+#define NFT_TYPE_IPV4_ADDR                        7
+#define NFT_TYPE_BITS                             6
+#define NFT_PAIR_KEY_TYPE                         ((NFT_TYPE_IPV4_ADDR << NFT_TYPE_BITS) | NFT_TYPE_IPV4_ADDR)
+#define NFT_PAIR_KEY_LEN                          8
+
+#define NFT_MSG_TYPE(m)                           ((NFNL_SUBSYS_NFTABLES << 8) | (m))
+
+/******************************************************************************/
+/* First kernel (major << 8 | minor) where re-adding an element moves its     */
+/* timeout. Older kernels keep the element as it is.                          */
+/******************************************************************************/
+#define NFT_ELEM_UPDATE_KERNEL                    ((6 << 8) | 11)
+
+/******************************************************************************/
+/* Most buffer room one command takes: an element list message of one         */
+/* element to delete and one to add it back, with the longest names, timeout  */
+/* and expiration, plus the batch end.                                        */
+/******************************************************************************/
+#define NFT_ELEMS_ROOM                            (NLMSG_SPACE(sizeof(struct nfgenmsg)) + 2 * NLA_ALIGN(NLA_HDRLEN + FW_SET_NAME_MAX_LEN) + NLA_HDRLEN)
+#define NFT_ELEM_ROOM                             (3 * NLA_HDRLEN + 3 * NLA_ALIGN(NLA_HDRLEN + sizeof(unsigned long long)))
+#define NFT_CMD_ROOM                              (2 * (NFT_ELEMS_ROOM + NFT_ELEM_ROOM) + NLMSG_SPACE(sizeof(struct nfgenmsg)))
+
+/******************************************************************************/
+/* Netlink socket and message buffer. Used by the firewall thread, and by     */
+/* deletes run in place when its queue is full.                               */
+/******************************************************************************/
+static pthread_mutex_t nft_lock = PTHREAD_MUTEX_INITIALIZER;
+static nl_sock nft_nl = {-1, 0, 0};
+static nl_buf nft_buf;
+static int nft_can_update = FALSE;
+
+/******************************************************************************/
+/* The kernel release is read through nft_fw_uname. Tests swap in an older    */
+/* release to check the delete and re-add refresh.                            */
+/******************************************************************************/
+int (*nft_fw_uname)(struct utsname *uts) = uname;
+
+
+/*FUNC+************************************************************************/
+/* Function    : nft_batch_begin                                              */
+/*                                                                            */
+/* Description : Start a batch transaction.                                   */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void nft_batch_begin(void)
+{
+  nl_reset(&nft_buf);
+  nl_msg_start(&nft_nl, &nft_buf, NFNL_MSG_BATCH_BEGIN, 0, AF_UNSPEC,
+               NFNL_SUBSYS_NFTABLES);
+  nl_msg_end(&nft_buf);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nft_batch_commit                                             */
+/*                                                                            */
+/* Description : End the batch transaction and send it. The kernel applies    */
+/*               all of it or none of it.                                     */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : 0                        - Success.                          */
+/*               -errno                   - First error reported.             */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int nft_batch_commit(void)
+{
+  nl_msg_start(&nft_nl, &nft_buf, NFNL_MSG_BATCH_END, 0, AF_UNSPEC,
+               NFNL_SUBSYS_NFTABLES);
+  nl_msg_end(&nft_buf);
+
+  return(nl_talk(&nft_nl, &nft_buf));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nft_elems_start                                              */
+/*                                                                            */
+/* Description : Start a set element list message.                            */
+/*                                                                            */
+/* Params      : msg (IN)                 - NFT_MSG_NEWSETELEM or             */
+/*                                          NFT_MSG_DELSETELEM.               */
+/*                                                                            */
+/* Returns     : nest                     - Element list nest.                */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static struct nlattr *nft_elems_start(int msg)
+{
+  nl_msg_start(&nft_nl, &nft_buf, NFT_MSG_TYPE(msg),
+               (msg == NFT_MSG_NEWSETELEM) ? NLM_F_CREATE | NLM_F_ACK :
+               NLM_F_ACK, NFPROTO_IPV4, 0);
+  nl_put_str(&nft_buf, NFTA_SET_ELEM_LIST_TABLE, dnswld.fw.table_name);
+  nl_put_str(&nft_buf, NFTA_SET_ELEM_LIST_SET, dnswld.fw.set_name);
+
+  return(nl_nest_start(&nft_buf, NFTA_SET_ELEM_LIST_ELEMENTS));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nft_put_elem                                                 */
+/*                                                                            */
+/* Description : Append a (src, dst) element to the element list. Added       */
+/*               elements carry their timeout; refreshed ones also restart    */
+/*               their expiration from it.                                    */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*               msg (IN)                 - NFT_MSG_NEWSETELEM or             */
+/*                                          NFT_MSG_DELSETELEM.               */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void nft_put_elem(fw_cmd *cmd, int msg)
+{
+  struct nlattr *elem;
+  struct nlattr *key;
+  unsigned int pair[2];
+  unsigned long long timeout;
+  time_t now;
+
+  pair[0] = htonl(cmd->s_ip);
+  pair[1] = htonl(cmd->d_ip);
+
+  elem = nl_nest_start(&nft_buf, NFTA_LIST_ELEM);
+  key = nl_nest_start(&nft_buf, NFTA_SET_ELEM_KEY);
+  nl_put(&nft_buf, NFTA_DATA_VALUE, pair, sizeof(pair));
+  nl_nest_end(&nft_buf, key);
+
+  if (msg == NFT_MSG_NEWSETELEM)
+  {
+    now = time(NULL);
+    timeout = (cmd->expiry > (unsigned int)now) ?
+              (unsigned long long)(cmd->expiry - (unsigned int)now) * 1000 :
+              1000;
+    nl_put_be64(&nft_buf, NFTA_SET_ELEM_TIMEOUT, timeout);
+
+    if (cmd->op == FW_CMD_REFRESH)
+    {
+      nl_put_be64(&nft_buf, NFTA_SET_ELEM_EXPIRATION, timeout);
+    }
+  }
+
+  nl_nest_end(&nft_buf, elem);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nft_commit                                                   */
+/*                                                                            */
+/* Description : Commit commands as one transaction. Consecutive commands of  */
+/*               the same kind share one element list message. A refresh re-  */
+/*               adds the element with its new timeout, or on kernels where   */
+/*               that leaves the timeout alone, deletes and adds it back.     */
+/*               Commands that would overflow the buffer go in a further      */
+/*               transaction, sent once the ones before it succeeded.         */
+/*                                                                            */
+/* Params      : cmds (IN)                - Firewall commands.                */
+/*               n (IN)                   - Number of commands.               */
+/*                                                                            */
+/* Returns     : 0                        - Success.                          */
+/*               -errno                   - First error reported.             */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int nft_commit(fw_cmd *cmds, int n)
+{
+  struct nlattr *nest = NULL;
+  int msg = -1;
+  int cmd_msg;
+  int err;
+  int i;
+
+  nft_batch_begin();
+
+  for (i = 0; i < n; i++)
+  {
+    if ((nest) && (nl_room(&nft_buf) < NFT_CMD_ROOM))
+    {
+      nl_nest_end(&nft_buf, nest);
+      nl_msg_end(&nft_buf);
+
+      err = nft_batch_commit();
+      if (err)
+      {
+        return(err);
+      }
+
+      nft_batch_begin();
+      nest = NULL;
+      msg = -1;
+    }
+
+    cmd_msg = ((cmds[i].op == FW_CMD_ADD) || (cmds[i].op == FW_CMD_REFRESH)) ?
+              NFT_MSG_NEWSETELEM : NFT_MSG_DELSETELEM;
+
+    if ((cmd_msg != msg) ||
+        ((cmds[i].op == FW_CMD_REFRESH) && (!nft_can_update)))
+    {
+      if (nest)
+      {
+        nl_nest_end(&nft_buf, nest);
+        nl_msg_end(&nft_buf);
+      }
+
+      if ((cmds[i].op == FW_CMD_REFRESH) && (!nft_can_update))
+      {
+        nest = nft_elems_start(NFT_MSG_DELSETELEM);
+        nft_put_elem(&cmds[i], NFT_MSG_DELSETELEM);
+        nl_nest_end(&nft_buf, nest);
+        nl_msg_end(&nft_buf);
+      }
+
+      nest = nft_elems_start(cmd_msg);
+      msg = cmd_msg;
+    }
+
+    nft_put_elem(&cmds[i], cmd_msg);
+  }
+
+  if (nest)
+  {
+    nl_nest_end(&nft_buf, nest);
+    nl_msg_end(&nft_buf);
+  }
+
+  return(nft_batch_commit());
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nft_fw_commit                                                */
+/*                                                                            */
+/* Description : Program a batch of firewall commands. Expiries are skipped;  */
+/*               the kernel already dropped those elements. If the            */
+/*               transaction fails each command is retried alone so a single  */
+/*               bad one does not fail the rest. A delete of a missing        */
+/*               element is not an error, and a refresh of one that already   */
+/*               timed out adds it back.                                      */
+/*                                                                            */
+/* Params      : cmds (IN)                - Firewall commands.                */
+/*               n (IN)                   - Number of commands.               */
+/*               status (OUT)             - RET_OK or error per command.      */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void nft_fw_commit(fw_cmd *cmds, int n, int *status)
+{
+  fw_cmd batch[FW_BATCH_MAX];
+  int idx[FW_BATCH_MAX];
+  int n_batch;
+  int err;
+  int i;
+
+  for (i = 0, n_batch = 0; i < n; i++)
+  {
+    status[i] = RET_OK;
+    if (cmds[i].op != FW_CMD_EXPIRE)
+    {
+      idx[n_batch] = i;
+      batch[n_batch++] = cmds[i];
+    }
+  }
+
+  if (!n_batch)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&nft_lock);
+
+  if (nft_nl.fd < 0)
+  {
+    for (i = 0; i < n_batch; i++)
+    {
+      status[idx[i]] = RET_SYS_ERROR;
+    }
+    goto EXIT;
+  }
+
+  err = nft_commit(batch, n_batch);
+  if (!err)
+  {
+    goto EXIT;
+  }
+
+  PUTS_OSYS(LOG_DEBUG, "nft batch of %d failed: [%s]. Retrying one by one.",
+            n_batch, strerror(-err));
+
+  for (i = 0; i < n_batch; i++)
+  {
+    err = (n_batch > 1) ? nft_commit(&batch[i], 1) : err;
+    if ((err == -ENOENT) && (batch[i].op == FW_CMD_REFRESH))
+    {
+      batch[i].op = FW_CMD_ADD;
+      err = nft_commit(&batch[i], 1);
+    }
+
+    if ((err) && (!((err == -ENOENT) && (batch[i].op == FW_CMD_DEL))))
+    {
+      PUTS_OSYS(LOG_ERR, "nft %s element error: [%s]",
+                (batch[i].op == FW_CMD_DEL) ? "del" : "add", strerror(-err));
+      status[idx[i]] = RET_SYS_ERROR;
+    }
+  }
+
+  EXIT:
+
+  pthread_mutex_unlock(&nft_lock);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nft_fw_add                                                   */
+/*                                                                            */
+/* Description : Add or refresh one element, as a batch of one.               */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int nft_fw_add(fw_cmd *cmd)
+{
+  int status;
+
+  nft_fw_commit(cmd, 1, &status);
+
+  return(status);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nft_fw_del                                                   */
+/*                                                                            */
+/* Description : Delete one element, as a batch of one.                       */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Firewall command.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int nft_fw_del(fw_cmd *cmd)
+{
+  int status;
+
+  nft_fw_commit(cmd, 1, &status);
+
+  return(status);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nft_kernel_updates                                           */
+/*                                                                            */
+/* Description : Whether the running kernel moves an element's timeout when   */
+/*               it is added again.                                           */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : TRUE                     - Re-adding updates the timeout.    */
+/*               FALSE                    - Otherwise, or unknown.            */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int nft_kernel_updates(void)
+{
+  struct utsname uts;
+  int major;
+  int minor;
+
+  if ((nft_fw_uname(&uts)) ||
+      (sscanf(uts.release, "%d.%d", &major, &minor) != 2))
+  {
+    return(FALSE);
+  }
+
+  return(((major << 8) | minor) >= NFT_ELEM_UPDATE_KERNEL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nft_fw_init                                                  */
+/*                                                                            */
+/* Description : Create (or reuse) the table and set, and flush the set so it */
+/*               matches the empty ACL. One transaction.                      */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int nft_fw_init(void)
+{
+  int ret;
+
+  ret = nl_open(&nft_nl);
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  nft_batch_begin();
+
+  nl_msg_start(&nft_nl, &nft_buf, NFT_MSG_TYPE(NFT_MSG_NEWTABLE),
+               NLM_F_CREATE | NLM_F_ACK, NFPROTO_IPV4, 0);
+  nl_put_str(&nft_buf, NFTA_TABLE_NAME, dnswld.fw.table_name);
+  nl_msg_end(&nft_buf);
+
+  nl_msg_start(&nft_nl, &nft_buf, NFT_MSG_TYPE(NFT_MSG_NEWSET),
+               NLM_F_CREATE | NLM_F_ACK, NFPROTO_IPV4, 0);
+  nl_put_str(&nft_buf, NFTA_SET_TABLE, dnswld.fw.table_name);
+  nl_put_str(&nft_buf, NFTA_SET_NAME, dnswld.fw.set_name);
+  nl_put_be32(&nft_buf, NFTA_SET_FLAGS, NFT_SET_TIMEOUT);
+  nl_put_be32(&nft_buf, NFTA_SET_KEY_TYPE, NFT_PAIR_KEY_TYPE);
+  nl_put_be32(&nft_buf, NFTA_SET_KEY_LEN, NFT_PAIR_KEY_LEN);
+  nl_put_be32(&nft_buf, NFTA_SET_ID, 1);
+  nl_msg_end(&nft_buf);
+
+  /****************************************************************************/
+  /* An element delete without an element list flushes the set.               */
+  /****************************************************************************/
+  nl_msg_start(&nft_nl, &nft_buf, NFT_MSG_TYPE(NFT_MSG_DELSETELEM), NLM_F_ACK,
+               NFPROTO_IPV4, 0);
+  nl_put_str(&nft_buf, NFTA_SET_ELEM_LIST_TABLE, dnswld.fw.table_name);
+  nl_put_str(&nft_buf, NFTA_SET_ELEM_LIST_SET, dnswld.fw.set_name);
+  nl_msg_end(&nft_buf);
+
+  ret = nft_batch_commit();
+  if (ret)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to set up nft set [%s %s]: [%s]",
+              dnswld.fw.table_name, dnswld.fw.set_name, strerror(-ret));
+    ret = RET_SYS_ERROR;
+    goto EXIT;
+  }
+
+  nft_can_update = nft_kernel_updates();
+  PUTS_OSYS(LOG_INFO, "nft refreshes %s.", (nft_can_update) ?
+            "update element timeouts" : "delete and re-add elements");
+
+  ret = RET_OK;
+
+  EXIT:
+
+  if (ret)
+  {
+    nl_close(&nft_nl);
+  }
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nft_fw_clean                                                 */
+/*                                                                            */
+/* Description : Release the netlink socket. The table and set are left in    */
+/*               place for the rules that reference them.                     */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void nft_fw_clean(void)
+{
+  pthread_mutex_lock(&nft_lock);
+  nl_close(&nft_nl);
+  pthread_mutex_unlock(&nft_lock);
+}
+
+
+/******************************************************************************/
+/* Backend operations.                                                        */
+/******************************************************************************/
+fw_ops nft_fw_ops =
+{
+  "nft",
+  nft_fw_init,
+  nft_fw_add,
+  nft_fw_del,
+  nft_fw_commit,
+  NULL,
+  nft_fw_clean
+};
@@ -0,0 +1,225 @@
+/*FILE+************************************************************************/
+/* Filename    : fw_restore.c                                                 */
+/*                                                                            */
+/* Description : iptables-restore firewall backend. Rules are the same as the */
+/*               iptables backend's, but a batch of adds and deletes is       */
+/*               committed through one "iptables-restore --noflush" run       */
+/*               instead of one iptables process per rule and chain.          */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <fw.h>
+
+
+/******************************************************************************/
+/* Grants per client as the batch goes, for the per-client layout. Written    */
+/* back to the iptables backend once the batch is committed.                  */
+/******************************************************************************/
+typedef struct _restore_client
+{
+  unsigned int s_ip;
+  int n_grants;
+} restore_client;
+
+
+/*FUNC+************************************************************************/
+/* Function    : restore_find_client                                          */
+/*                                                                            */
+/* Description : Find a client's batch grant count, starting from its         */
+/*               committed count the first time it is seen.                   */
+/*                                                                            */
+/* Params      : clients (IN/OUT)         - Batch clients.                    */
+/*               n_clients (IN/OUT)       - Number of batch clients.          */
+/*               s_ip (IN)                - Client source IP.                 */
+/*                                                                            */
+/* Returns     : client                   - Batch client.                     */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static restore_client *restore_find_client(restore_client *clients,
+                                           int *n_clients, unsigned int s_ip)
+{
+  int i;
+
+  for (i = 0; i < *n_clients; i++)
+  {
+    if (clients[i].s_ip == s_ip)
+    {
+      return(&clients[i]);
+    }
+  }
+
+  clients[i].s_ip = s_ip;
+  clients[i].n_grants = ipt_client_grants(s_ip);
+  (*n_clients)++;
+
+  return(&clients[i]);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : restore_put_client                                           */
+/*                                                                            */
+/* Description : Write the lines of a command in the per-client layout,       */
+/*               creating or removing the client's chain and dispatch rules   */
+/*               with its first and last grant.                               */
+/*                                                                            */
+/* Params      : out (IN)                 - iptables-restore input.           */
+/*               cmd (IN)                 - Firewall command.                 */
+/*               client (IN/OUT)          - Batch client.                     */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void restore_put_client(FILE *out, fw_cmd *cmd, restore_client *client)
+{
+  char line[1024];
+  char chain[FW_CHAIN_MAX_LEN];
+  int i;
+
+  snprintf(chain, sizeof(chain), FW_CLIENT_CHAIN_FMT, cmd->s_ip);
+
+  if ((cmd->op == FW_CMD_ADD) && (!client->n_grants))
+  {
+    fprintf(out, "-N %s\n", chain);
+    for (i = 0; i < dnswld.fw.n_chains; i++)
+    {
+      format_fw_jump(line, sizeof(line), "-A", dnswld.fw.chains[i],
+                     cmd->s_ip);
+      fprintf(out, "%s\n", line);
+    }
+  }
+
+  format_fw_rule(line, sizeof(line), (cmd->op == FW_CMD_ADD) ? "-A" : "-D",
+                 chain, cmd->s_ip, cmd->d_ip, cmd->action, cmd->created_at,
+                 cmd->expiry);
+  fprintf(out, "%s\n", line);
+
+  if (cmd->op == FW_CMD_ADD)
+  {
+    client->n_grants++;
+    return;
+  }
+
+  if (--client->n_grants <= 0)
+  {
+    client->n_grants = 0;
+    for (i = 0; i < dnswld.fw.n_chains; i++)
+    {
+      format_fw_jump(line, sizeof(line), "-D", dnswld.fw.chains[i],
+                     cmd->s_ip);
+      fprintf(out, "%s\n", line);
+    }
+    fprintf(out, "-X %s\n", chain);
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : restore_fw_commit                                            */
+/*                                                                            */
+/* Description : Commit a batch of firewall commands as one iptables-restore  */
+/*               transaction. If it fails, e.g. on a delete of a rule that is */
+/*               already gone, the commands are run one by one so the rest    */
+/*               still take effect.                                           */
+/*                                                                            */
+/* Params      : cmds (IN)                - Firewall commands.                */
+/*               n (IN)                   - Number of commands.               */
+/*               status (OUT)             - RET_OK or error per command.      */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void restore_fw_commit(fw_cmd *cmds, int n, int *status)
+{
+  restore_client clients[FW_BATCH_MAX];
+  FILE *out;
+  fw_cmd *cmd;
+  char line[1024];
+  int n_clients = 0;
+  int i;
+  int ii;
+
+  for (i = 0; i < n; i++)
+  {
+    status[i] = RET_OK;
+  }
+
+  snprintf(line, sizeof(line), "%s --noflush", dnswld.fw.restore_path);
+  PUTS_OSYS(LOG_DEBUG, " cmd: [%s], %d commands", line, n);
+
+  lock_ipt_fw();
+
+  out = popen(line, "w");
+  if (out)
+  {
+    fputs("*filter\n", out);
+
+    for (i = 0, cmd = cmds; i < n; i++, cmd++)
+    {
+      if (cmd->op == FW_CMD_REFRESH)
+      {
+        continue;
+      }
+
+      if (dnswld.fw.layout == FW_LAYOUT_CLIENT)
+      {
+        restore_put_client(out, cmd,
+                           restore_find_client(clients, &n_clients,
+                                               cmd->s_ip));
+        continue;
+      }
+
+      for (ii = 0; ii < dnswld.fw.n_chains; ii++)
+      {
+        format_fw_rule(line, sizeof(line),
+                       (cmd->op == FW_CMD_ADD) ? "-A" : "-D",
+                       dnswld.fw.chains[ii], cmd->s_ip, cmd->d_ip,
+                       cmd->action, cmd->created_at, cmd->expiry);
+        fprintf(out, "%s\n", line);
+      }
+    }
+
+    fputs("COMMIT\n", out);
+
+    if (!pclose(out))
+    {
+      for (i = 0; i < n_clients; i++)
+      {
+        ipt_set_client_grants(clients[i].s_ip, clients[i].n_grants);
+      }
+      goto EXIT;
+    }
+  }
+
+  PUTS_OSYS(LOG_ERR, "iptables-restore of %d commands failed. Retrying one "
+            "by one.", n);
+
+  for (i = 0, cmd = cmds; i < n; i++, cmd++)
+  {
+    status[i] = ipt_fw_apply(cmd);
+  }
+
+  EXIT:
+
+  unlock_ipt_fw();
+}
+
+
+/******************************************************************************/
+/* Backend operations. Everything but batches is the iptables backend's.      */
+/******************************************************************************/
+fw_ops restore_fw_ops =
+{
+  "iptables-restore",
+  ipt_fw_init,
+  ipt_fw_add,
+  ipt_fw_del,
+  restore_fw_commit,
+  ipt_fw_list,
+  ipt_fw_shutdown
+};
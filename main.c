@@ -12,6 +12,10 @@
 #include <dnswldcb.h>
 #include <config.h>
 #include <network.h>
+#include <worker.h>
+#include <fw.h>
+#include <conntrack.h>
+#include <reconcile.h>
 
 
 /*FUNC+************************************************************************/
@@ -89,8 +93,6 @@ static int daemonize(void)
 int main(int argc, char **argv)
 {
   struct sigaction sig_act;
-  fd_set r_fdset;
-  int nfds;
   int ret;
 
   strncpy(prog_name, argv[0], sizeof(prog_name) - 1);
@@ -101,6 +103,7 @@ int main(int argc, char **argv)
   /* Init global control block.                                               */
   /****************************************************************************/
   init_dnswld();
+  init_stats();
 
   /****************************************************************************/
   /* Parse command line parameters.                                           */
@@ -117,6 +120,16 @@ int main(int argc, char **argv)
   /****************************************************************************/
   init_data_stores();
 
+  /****************************************************************************/
+  /* Initialize source-destination whitelist.                                 */
+  /****************************************************************************/
+  ret = init_src_dest_whitelist();
+  if (ret)
+  {
+    PUTS_OSYS(LOG_INFO, "Error initializing whitelist.");
+    goto EXIT;
+  }
+
   /****************************************************************************/
   /* Process config file.                                                     */
   /****************************************************************************/
@@ -128,6 +141,16 @@ int main(int argc, char **argv)
     goto EXIT;
   }
 
+  /****************************************************************************/
+  /* Set up firewall backend.                                                 */
+  /****************************************************************************/
+  ret = init_fw();
+  if (ret)
+  {
+    PUTS_OSYS(LOG_INFO, "Error initializing firewall backend.");
+    goto EXIT;
+  }
+
   /****************************************************************************/
   /* Initialize DNS packet buffer.                                            */
   /****************************************************************************/
@@ -138,6 +161,24 @@ int main(int argc, char **argv)
     goto EXIT;
   }
 
+  /****************************************************************************/
+  /* Initialize answer cache.                                                 */
+  /****************************************************************************/
+  ret = init_cache();
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  /****************************************************************************/
+  /* Create event loop. All listeners are registered to it.                   */
+  /****************************************************************************/
+  ret = create_event_loop(&dnswld.evloop);
+  if (ret)
+  {
+    goto EXIT;
+  }
+
   /****************************************************************************/
   /* Create listeners.                                                        */
   /****************************************************************************/
@@ -147,6 +188,16 @@ int main(int argc, char **argv)
     goto EXIT;
   }
 
+  /****************************************************************************/
+  /* Create upstream resolvers.                                               */
+  /****************************************************************************/
+  ret = create_resolvers();
+  if (ret)
+  {
+    PUTS_OSYS(LOG_INFO, "Error creating upstream resolvers.");
+    goto EXIT;
+  }
+
   /****************************************************************************/
   /* Create command channel listener.                                         */
   /****************************************************************************/
@@ -181,11 +232,27 @@ int main(int argc, char **argv)
   sigaction(SIGHUP, &sig_act, NULL);
   sigaction(SIGTERM, &sig_act, NULL);
 
+  /****************************************************************************/
+  /* A firewall helper exiting early must not kill us on write.               */
+  /****************************************************************************/
+  signal(SIGPIPE, SIG_IGN);
+
   /****************************************************************************/
   /* Re-create whitelist from existing firewall rules.                        */
   /****************************************************************************/
   ret = create_whitelist_from_fw_rules();
 
+  /****************************************************************************/
+  /* Launch firewall thread before any query can add a rule. Threads do not   */
+  /* survive fork(), so this comes after daemonizing.                         */
+  /****************************************************************************/
+  ret = create_start_fw_worker();
+  if (ret)
+  {
+    PUTS_OSYS(LOG_INFO, "Failed to create and start firewall thread.");
+    goto EXIT;
+  }
+
   /****************************************************************************/
   /* Launch ACL sweeper.                                                      */
   /****************************************************************************/
@@ -197,18 +264,51 @@ int main(int argc, char **argv)
   }
 
   /****************************************************************************/
-  /* Map listener descriptors.                                                */
+  /* Launch conntrack watcher, if grants expire on idleness.                  */
   /****************************************************************************/
-  nfds = map_listeners_fdset(&r_fdset);
+  if (dnswld.acl.ct_grace)
+  {
+    ret = create_start_ct_watcher();
+    if (ret)
+    {
+      PUTS_OSYS(LOG_INFO, "Failed to create and start conntrack watcher.");
+      goto EXIT;
+    }
+  }
 
   /****************************************************************************/
-  /* Main loop.                                                               */
+  /* Launch firewall reconciler, if configured.                               */
   /****************************************************************************/
-  while (dnswld.proc.is_running)
+  if ((dnswld.fw.reconcile_secs) && (!dnswld.proc.disable_fw))
+  {
+    ret = create_start_reconciler();
+    if (ret)
+    {
+      PUTS_OSYS(LOG_INFO, "Failed to create and start firewall reconciler.");
+      goto EXIT;
+    }
+  }
+
+  /****************************************************************************/
+  /* Launch DNS workers, if configured.                                       */
+  /****************************************************************************/
+  ret = start_workers();
+  if (ret)
   {
-    check_listeners(&r_fdset, nfds);
+    goto EXIT;
+  }
 
-    usleep(10);
+  /****************************************************************************/
+  /* Main loop. Blocks until a listener is ready or the timeout lapses so the */
+  /* running flag is re-checked.                                              */
+  /****************************************************************************/
+  while (dnswld.proc.is_running)
+  {
+    ret = run_event_loop(&dnswld.evloop, EVLOOP_TIMEOUT_MS);
+    if (ret)
+    {
+      break;
+    }
   }
 
   EXIT:
@@ -216,10 +316,20 @@ int main(int argc, char **argv)
   /****************************************************************************/
   /* Clean-up.                                                                */
   /****************************************************************************/
+  dnswld.proc.is_running = FALSE;
+  wait_workers();
   wait_acl_sweeper();
+  wait_ct_watcher();
+  wait_reconciler();
   clean_src_dest_whitelist();
+  stop_fw_worker();
+  clean_fw();
+  clean_resolvers();
+  clean_worker_listeners();
   clean_listeners();
+  clean_event_loop(&dnswld.evloop);
   clean_dns_bufs();
+  clean_cache();
   clean_ds_stores();
 
   PUTS_OSYS(LOG_DEBUG, "Done.");
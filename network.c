@@ -10,11 +10,14 @@
 
 #include <common.h>
 
+#include <errno.h>
 #include <sys/socket.h>
 #include <netdb.h>
 
 #include <dnswldcb.h>
 #include <response.h>
+#include <network.h>
+#include <worker.h>
 
 
 /*FUNC+************************************************************************/
@@ -68,29 +71,15 @@ static void dump_dns_header(dns_header *dns_hdr, struct sockaddr_in *s_addr)
 /*FUNC-************************************************************************/
 void dump_dns_question(dns_question *q)
 {
-  char name[DNS_MAX_NAME_LEN];
-  int i;
+  char name[DNS_MAX_NAME_LEN + 1];
+
+  dns_name_to_str(q->msg, q->name, name, sizeof(name));
 
-  memset(name, 0, sizeof(name));
   PUTS_OSYS(LOG_DEBUG, "Question:");
   PUTS_OSYS(LOG_DEBUG, " Type : %d", q->q_type);
   PUTS_OSYS(LOG_DEBUG, " Class: %d", q->q_class);
-
-  for (i = 0; i < q->n_label; i++)
-  {
-    if (i)
-    {
-      snprintf(&name[strlen(name)], sizeof(name) - strlen(name), ".%s",
-               q->labels[i]);
-    }
-    else
-    {
-      snprintf(&name[strlen(name)], sizeof(name) - strlen(name), "%s",
-               q->labels[i]);
-    }
-  }
-
-  PUTS_OSYS(LOG_DEBUG, " Name: [%s]", name);
+  PUTS_OSYS(LOG_DEBUG, " Name: [%s], labels: %d, hash: %08x", name,
+            q->n_label, q->hash);
 }
 
 
@@ -121,7 +110,9 @@ void dump_dns_questions(dns_question *qs, int n)
 /*FUNC+************************************************************************/
 /* Function    : parse_question_section                                       */
 /*                                                                            */
-/* Description : Parse DNS question section.                                  */
+/* Description : Parse DNS question section. Questions are left as views of   */
+/*               the packet: each name is validated and hashed in one pass    */
+/*               over its octets, and nothing is copied.                      */
 /*                                                                            */
 /* Params      : pkt (IN/OUT)             - Points to sections in DNS query.  */
 /*               pkt_len (IN)             - Len of DNS query packet.          */
@@ -135,10 +126,17 @@ int parse_question_section(char **pkt, int pkt_len, dns_question *questions,
                            int n_q)
 {
   dns_question *q_ptr;
-  char *pkt_ptr = *pkt;
-  char label_len;
+  unsigned char *pkt_ptr = (unsigned char *)*pkt;
+  unsigned char *msg = pkt_ptr - sizeof(dns_header);
+  unsigned char *end = pkt_ptr + pkt_len;
+  unsigned char *label;
+  unsigned char *limit;
+  unsigned char *name_end;
+  unsigned int hash;
+  int label_len;
+  int name_len;
+  int i_oct;
   int i;
-  int i_label;
   int ret;
 
   PUTS_OSYS(LOG_DEBUG, "pkt_len: [%d]", pkt_len);
@@ -149,30 +147,54 @@ int parse_question_section(char **pkt, int pkt_len, dns_question *questions,
   for (i = 0; i < n_q; i++)
   {
     q_ptr = &questions[i];
-    memset(q_ptr, 0, sizeof(*q_ptr));
-
-    for (i_label = 0; ; i_label++)
+    q_ptr->msg = msg;
+    q_ptr->name = pkt_ptr;
+    q_ptr->n_label = 0;
+    q_ptr->ans.n_rec = 0;
+    q_ptr->ans.tmpl_len = 0;
+    hash = HASH_NAME_BASIS;
+    name_len = 1;
+    name_end = NULL;
+
+    for (label = limit = pkt_ptr; ; label += label_len)
     {
-      /************************************************************************/
-      /* There needs to be at least 4 bytes left for question type and code.  */
-      /************************************************************************/
-      if (pkt_len <= 4)
+      if (label >= end)
       {
-        PUTS_OSYS(LOG_DEBUG,
-                  "Malformed DNS request. Question section too short: [%d]",
-                  pkt_len);
+        PUTS_OSYS(LOG_DEBUG, "Malformed DNS request. Name runs past end.");
         ret = RET_MALFORMED_DNS_REQ;
         goto EXIT;
       }
 
       /************************************************************************/
-      /* Get label length and sanitize.                                       */
+      /* Follow a compression pointer. Each pointer must land on a label      */
+      /* strictly before the last one taken, which rules out loops and        */
+      /* forward references. The name ends in the section at the first.       */
       /************************************************************************/
-      label_len = *pkt_ptr++;
-      pkt_len--;
-
-      PUTS_OSYS(LOG_DEBUG, "-> label_len[%d]: [%d]", i_label, label_len);
+      if (DNS_IS_PTR(*label))
+      {
+        if ((label + 1 >= end) ||
+            (DNS_PTR_OFF(label) < sizeof(dns_header)) ||
+            (msg + DNS_PTR_OFF(label) >= limit) ||
+            (DNS_IS_PTR(msg[DNS_PTR_OFF(label)])))
+        {
+          PUTS_OSYS(LOG_DEBUG, "Malformed DNS request. "
+                    "Bad compression pointer: [%d]", DNS_PTR_OFF(label));
+          ret = RET_MALFORMED_DNS_REQ;
+          goto EXIT;
+        }
+
+        if (name_end == NULL)
+        {
+          name_end = label + 2;
+        }
+
+        limit = label = msg + DNS_PTR_OFF(label);
+      }
 
+      /************************************************************************/
+      /* Get label length and sanitize.                                       */
+      /************************************************************************/
+      label_len = *label++;
       if (label_len == 0)
       {
         break;
@@ -186,7 +208,8 @@ int parse_question_section(char **pkt, int pkt_len, dns_question *questions,
         goto EXIT;
       }
 
-      if (label_len >= pkt_len)
+      name_len += label_len + 1;
+      if ((label_len >= end - label) || (name_len > DNS_MAX_ENC_NAME_LEN))
       {
         PUTS_OSYS(LOG_DEBUG, "Malformed DNS request. "
                   "Label octets too short: [%d]", label_len);
@@ -195,44 +218,56 @@ int parse_question_section(char **pkt, int pkt_len, dns_question *questions,
       }
 
       /************************************************************************/
-      /* Get label octets.                                                    */
+      /* Fold label octets into the name hash, dot separated. Names are       */
+      /* matched as dotted strings, so a NUL or dot octet would let one name  */
+      /* pass for another; reject them.                                       */
       /************************************************************************/
-      memcpy(&q_ptr->labels[i_label], pkt_ptr, label_len);
-
-      PUTS_OSYS(LOG_DEBUG, "-> label[%d]: [%s]", i_label,
-                q_ptr->labels[i_label]);
-
-      if (i_label)
+      if (q_ptr->n_label++)
       {
-        snprintf(&q_ptr->name[strlen(q_ptr->name)],
-                 (sizeof(q_ptr->name) - strlen(q_ptr->name)), ".%s",
-                 q_ptr->labels[i_label]);
+        hash = HASH_NAME_STEP(hash, '.');
       }
-      else
+
+      for (i_oct = 0; i_oct < label_len; i_oct++)
       {
-        snprintf(&q_ptr->name[strlen(q_ptr->name)],
-                 (sizeof(q_ptr->name) - strlen(q_ptr->name)), "%s",
-                 q_ptr->labels[i_label]);
+        if ((label[i_oct] == '\0') || (label[i_oct] == '.'))
+        {
+          PUTS_OSYS(LOG_DEBUG, "Malformed DNS request. "
+                    "Bad label octet: [%d]", label[i_oct]);
+          ret = RET_MALFORMED_DNS_REQ;
+          goto EXIT;
+        }
+
+        hash = HASH_NAME_STEP(hash, LOWER_CHAR(label[i_oct]));
       }
+    }
+
+    /**************************************************************************/
+    /* Name ends after its first pointer, or at its root label if it has      */
+    /* none. Labels reached through a pointer may lie anywhere before it.     */
+    /* Question type and class follow.                                        */
+    /**************************************************************************/
+    pkt_ptr = (name_end != NULL) ? name_end : label;
 
-      pkt_ptr += label_len;
-      pkt_len -= label_len;
+    if (end - pkt_ptr < 2 * sizeof(unsigned short))
+    {
+      PUTS_OSYS(LOG_DEBUG,
+                "Malformed DNS request. Question section too short: [%d]",
+                (int)(end - pkt_ptr));
+      ret = RET_MALFORMED_DNS_REQ;
+      goto EXIT;
     }
 
-    q_ptr->n_label = i_label;
+    q_ptr->hash = hash;
 
-    q_ptr->q_type = ntohs(*(unsigned short *)pkt_ptr);
-    pkt_ptr += sizeof(unsigned short);
-    pkt_len -= sizeof(unsigned short);
-    q_ptr->q_class = ntohs(*(unsigned short *)pkt_ptr);
-    pkt_ptr += sizeof(unsigned short);
-    pkt_len -= sizeof(unsigned short);
+    q_ptr->q_type = (pkt_ptr[0] << 8) | pkt_ptr[1];
+    q_ptr->q_class = (pkt_ptr[2] << 8) | pkt_ptr[3];
+    pkt_ptr += 2 * sizeof(unsigned short);
 
     PUTS_OSYS(LOG_DEBUG, "-> q_type: [%d]", q_ptr->q_type);
     PUTS_OSYS(LOG_DEBUG, "-> q_class: [%d]", q_ptr->q_class);
   }
 
-  *pkt = pkt_ptr;
+  *pkt = (char *)pkt_ptr;
   ret = RET_OK;
 
   EXIT:
@@ -242,42 +277,152 @@ int parse_question_section(char **pkt, int pkt_len, dns_question *questions,
 
 
 /*FUNC+************************************************************************/
-/* Function    : dns_sock_reader                                              */
+/* Function    : parse_edns                                                   */
 /*                                                                            */
-/* Description : DNS socket reader.                                           */
+/* Description : Walk the RRs after the question section for an OPT RR. It    */
+/*               must be in the additional section, owned by the root and the */
+/*               only one.                                                    */
 /*                                                                            */
-/* Params      : param (IN)               - Listener info                     */
+/* Params      : msg (IN)                 - DNS message.                      */
+/*               len (IN)                 - Length of message.                */
+/*               off (IN)                 - Offset after question section.    */
+/*               dns_hdr (IN)             - DNS header, host order.           */
+/*               edns (OUT)               - EDNS0 state.                      */
 /*                                                                            */
 /* Returns     : RET_OK                   - Success otherwise error.          */
 /*                                                                            */
 /*FUNC-************************************************************************/
-int dns_sock_reader(void *param)
+static int parse_edns(unsigned char *msg, int len, int off,
+                      dns_header *dns_hdr, dns_edns *edns)
 {
-  listeners_cb *listener = (listeners_cb *)param;
+  int n_rr = dns_hdr->ans_count + dns_hdr->ns_count + dns_hdr->addrec_count;
+  int name_off;
+  int rd_len;
+  int i;
+  int ret;
+
+  memset(edns, 0, sizeof(*edns));
+
+  for (i = 0; i < n_rr; i++)
+  {
+    name_off = off;
+    off = dns_skip_name(msg, len, off);
+    if ((off < 0) || (off + 10 > len))
+    {
+      PUTS_OSYS(LOG_DEBUG, "Malformed DNS request. RR[%d] too short.", i);
+      ret = RET_MALFORMED_DNS_REQ;
+      goto EXIT;
+    }
+
+    rd_len = (msg[off + 8] << 8) | msg[off + 9];
+    if (off + 10 + rd_len > len)
+    {
+      PUTS_OSYS(LOG_DEBUG, "Malformed DNS request. RR[%d] rdata too short.",
+                i);
+      ret = RET_MALFORMED_DNS_REQ;
+      goto EXIT;
+    }
+
+    /**************************************************************************/
+    /* OPT class is the UDP payload size; the TTL holds extended RCODE,       */
+    /* version and flags.                                                     */
+    /**************************************************************************/
+    if (((msg[off] << 8) | msg[off + 1]) == DNS_RR_TYPE_OPT)
+    {
+      if ((i < dns_hdr->ans_count + dns_hdr->ns_count) ||
+          (msg[name_off]) || (edns->is_present))
+      {
+        PUTS_OSYS(LOG_DEBUG, "Malformed DNS request. Misplaced OPT RR.");
+        ret = RET_MALFORMED_DNS_REQ;
+        goto EXIT;
+      }
+
+      edns->is_present = TRUE;
+      edns->udp_size = (msg[off + 2] << 8) | msg[off + 3];
+      edns->version = msg[off + 5];
+
+      PUTS_OSYS(LOG_DEBUG, "-> EDNS version: [%d], udp size: [%d]",
+                edns->version, edns->udp_size);
+    }
+
+    off += 10 + rd_len;
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : edns_reply_size                                              */
+/*                                                                            */
+/* Description : Largest reply a query may get: 512 bytes, or the size its    */
+/*               OPT RR advertises, up to the configured cap.                 */
+/*                                                                            */
+/* Params      : edns (IN)                - EDNS0 state.                      */
+/*               bufz (IN)                - Size of packet buffer.            */
+/*                                                                            */
+/* Returns     : size                     - Reply size limit.                 */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int edns_reply_size(dns_edns *edns, int bufz)
+{
+  int size = DNS_PAYLOADZ;
+
+  if ((edns->is_present) && (edns->udp_size > DNS_PAYLOADZ))
+  {
+    size = (edns->udp_size < dnswld.proc.edns_payload) ?
+           edns->udp_size : dnswld.proc.edns_payload;
+  }
+
+  return((size < bufz) ? size : bufz);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : process_dns_query                                            */
+/*                                                                            */
+/* Description : Parse and answer one DNS query held in a ring slot. The      */
+/*               reply is left in the slot for the caller to send. Queries    */
+/*               for whitelisted names are parked on the worker's resolver    */
+/*               and answered once the upstream lookups are done.             */
+/*                                                                            */
+/* Params      : worker (IN/OUT)          - Worker owning the slot.           */
+/*               sock (IN)                - Listener socket.                  */
+/*               slot (IN/OUT)            - Packet slot.                      */
+/*               rcv_time (IN)            - Receive time in usecs.            */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success.                          */
+/*               RET_QUERY_PARKED         - Answered later.                   */
+/*               error                    - Otherwise.                        */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int process_dns_query(worker_cb *worker, int sock, pkt_slot *slot,
+                             unsigned long rcv_time)
+{
+  dns_question *questions = worker->qs;
   dns_header *dns_hdr;
-  struct sockaddr_in s_addr;
-  dns_question *questions = NULL;
+  dns_edns edns;
   char *pkt_ptr;
-  socklen_t s_size;
-  int len;
+  int len = slot->len;
+  int bufz;
   int ret;
 
-  /****************************************************************************/
-  /* Read DNS query.                                                          */
-  /****************************************************************************/
-  s_size = sizeof(s_addr);
-  pkt_ptr = dnswld.proc.pkt_buf;
-  len = recvfrom(listener->sock, pkt_ptr, dnswld.proc.pkt_bufz,
-                 MSG_DONTWAIT, (struct sockaddr*)&s_addr, &s_size);
+  slot->reply_len = 0;
+  pkt_ptr = slot->buf;
+
   PUTS_OSYS(LOG_DEBUG, "DNS request len: [%d]", len);
-  if (len < sizeof(dns_header))
+  if (len < (int)sizeof(dns_header))
   {
     PUTS_OSYS(LOG_DEBUG, "DNS request too short: [%d]. Discarding.", len);
     ret = RET_SOCK_READ_ERROR;
     goto EXIT;
   }
 
-  dns_hdr = (dns_header *)dnswld.proc.pkt_buf;
+  dns_hdr = (dns_header *)slot->buf;
 
   dns_hdr->id = ntohs(dns_hdr->id);
   dns_hdr->fc = ntohs(dns_hdr->fc);
@@ -288,13 +433,13 @@ int dns_sock_reader(void *param)
 
   if (dnswld.log.is_debug_on)
   {
-    dump_dns_header(dns_hdr, &s_addr);
+    dump_dns_header(dns_hdr, &slot->addr);
   }
 
   /****************************************************************************/
   /* Query must have at least one question.                                   */
   /****************************************************************************/
-  if (dns_hdr->q_count <= 0)
+  if ((dns_hdr->q_count <= 0) || (dns_hdr->q_count > DNS_MAX_QUESTIONS))
   {
     PUTS_OSYS(LOG_DEBUG, "Malformed DNS header. Invalid question count.");
     ret = RET_MALFORMED_DNS_REQ;
@@ -314,45 +459,232 @@ int dns_sock_reader(void *param)
   /****************************************************************************/
   /* Read questions.                                                          */
   /****************************************************************************/
-  questions = (dns_question*)malloc(sizeof(dns_question) * dns_hdr->q_count);
-  if (questions == NULL)
+  ret = parse_question_section(&pkt_ptr, len, questions, dns_hdr->q_count);
+  if (ret)
   {
-    PUTS_OSYS(LOG_DEBUG, "Failed to allocate memory for questions.");
-    ret = RET_MEMORY_ERROR;
     goto EXIT;
   }
 
-  ret = parse_question_section(&pkt_ptr, len, questions, dns_hdr->q_count);
-  if (ret)
+  dump_dns_questions(questions, dns_hdr->q_count);
+
+  /****************************************************************************/
+  /* Read EDNS0 OPT RR, unless EDNS0 is off. The reply is sized by it.        */
+  /****************************************************************************/
+  memset(&edns, 0, sizeof(edns));
+  if (dnswld.proc.edns_payload)
+  {
+    ret = parse_edns((unsigned char *)slot->buf, slot->len,
+                     pkt_ptr - slot->buf, dns_hdr, &edns);
+    if (ret)
+    {
+      goto EXIT;
+    }
+  }
+
+  bufz = edns_reply_size(&edns, worker->ring.bufz);
+
+  /****************************************************************************/
+  /* Unknown EDNS versions get BADVERS, and questions too long to echo within */
+  /* the reply limit FORMERR, without looking at the names.                   */
+  /****************************************************************************/
+  if ((edns.version) ||
+      ((pkt_ptr - slot->buf) + (edns.is_present ? DNS_OPT_RR_LEN : 0) > bufz))
   {
+    ret = process_response(slot->buf, pkt_ptr, dns_hdr, questions, &edns,
+                           bufz, &slot->reply_len);
     goto EXIT;
   }
 
-  dump_dns_questions(questions, dns_hdr->q_count);
+  /****************************************************************************/
+  /* Whitelisted names are resolved upstream. If the query can't be parked it */
+  /* is answered now without records.                                         */
+  /****************************************************************************/
+  if (match_requested_domains(questions, dns_hdr->q_count))
+  {
+    ret = park_dns_query(&worker->rslv, sock, &slot->addr, slot->buf,
+                         pkt_ptr - slot->buf, bufz, &edns, rcv_time,
+                         questions, dns_hdr->q_count);
+    if (!ret)
+    {
+      ret = RET_QUERY_PARKED;
+      goto EXIT;
+    }
+  }
 
   /****************************************************************************/
   /* Process requested domains.                                               */
   /****************************************************************************/
-  ret = process_requested_domains(&s_addr, questions, dns_hdr->q_count);
+  ret = process_requested_domains(&slot->addr, questions, dns_hdr->q_count);
   if (!ret)
   {
     /**************************************************************************/
-    /* Send response.                                                         */
+    /* Build response.                                                        */
     /**************************************************************************/
-    process_response(listener, &s_addr, pkt_ptr, dns_hdr, questions);
+    ret = process_response(slot->buf, pkt_ptr, dns_hdr, questions, &edns,
+                           bufz, &slot->reply_len);
   }
 
   EXIT:
 
-  if (ret)
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : flush_replies                                                */
+/*                                                                            */
+/* Description : Send the replies held in a ring with sendmmsg().             */
+/*                                                                            */
+/* Params      : sock (IN)                - Listener socket.                  */
+/*               ring (IN/OUT)            - Packet ring.                      */
+/*               n_slots (IN)             - Number of used slots.             */
+/*                                                                            */
+/* Returns     : n                        - Number of replies sent.           */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int flush_replies(int sock, pkt_ring *ring, int n_slots)
+{
+  struct msghdr *hdr;
+  pkt_slot *slot;
+  int n_replies = 0;
+  int n_sent = 0;
+  int i;
+  int ret;
+
+  for (i = 0; i < n_slots; i++)
   {
-    if (questions)
+    slot = &ring->slots[i];
+    if (slot->reply_len <= 0)
     {
-      free(questions);
+      continue;
     }
+
+    ring->s_iovs[n_replies].iov_base = slot->buf;
+    ring->s_iovs[n_replies].iov_len = slot->reply_len;
+
+    hdr = &ring->s_msgs[n_replies].msg_hdr;
+    hdr->msg_name = &slot->addr;
+    hdr->msg_namelen = sizeof(slot->addr);
+    hdr->msg_iov = &ring->s_iovs[n_replies];
+    hdr->msg_iovlen = 1;
+
+    n_replies++;
   }
 
-  return(ret);
+  /****************************************************************************/
+  /* sendmmsg() may stop short, e.g. on a per-message error. Skip the failed  */
+  /* message and carry on with the rest.                                      */
+  /****************************************************************************/
+  for (i = 0; i < n_replies; )
+  {
+    ret = sendmmsg(sock, &ring->s_msgs[i], n_replies - i, 0);
+    if (ret <= 0)
+    {
+      PUTS_OSYS(LOG_ERR, "Error in sending response. errno: [%d]", errno);
+      i++;
+      continue;
+    }
+
+    STATS_INC(n_tx_batches);
+
+    n_sent += ret;
+    i += ret;
+  }
+
+  return(n_sent);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : dns_sock_reader                                              */
+/*                                                                            */
+/* Description : DNS socket reader. Pulls up to a batch of datagrams with     */
+/*               recvmmsg(), answers them and flushes the replies at once.    */
+/*                                                                            */
+/* Params      : param (IN)               - Listener info                     */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int dns_sock_reader(void *param)
+{
+  listeners_cb *listener = (listeners_cb *)param;
+  worker_cb *worker = listener->worker;
+  pkt_ring *ring = &worker->ring;
+  pkt_slot *slot;
+  unsigned long rcv_time;
+  unsigned long lat;
+  int n_msgs;
+  int n_sent;
+  int i;
+  int ret;
+
+  /****************************************************************************/
+  /* Read DNS queries.                                                        */
+  /****************************************************************************/
+  for (i = 0; i < ring->n_slots; i++)
+  {
+    ring->r_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+  }
+
+  n_msgs = recvmmsg(listener->sock, ring->r_msgs, ring->n_slots, MSG_DONTWAIT,
+                    NULL);
+  if (n_msgs < 0)
+  {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+    {
+      return(RET_SOCK_WOULD_BLOCK);
+    }
+
+    return(RET_SOCK_READ_ERROR);
+  }
+
+  rcv_time = get_mono_usecs();
+  STATS_ADD(n_queries, n_msgs);
+  STATS_INC(n_rx_batches);
+
+  PUTS_OSYS(LOG_DEBUG, "DNS batch received: [%d]", n_msgs);
+
+  /****************************************************************************/
+  /* Process batch.                                                           */
+  /****************************************************************************/
+  for (i = 0; i < n_msgs; i++)
+  {
+    slot = &ring->slots[i];
+    slot->len = ring->r_msgs[i].msg_len;
+
+    ret = process_dns_query(worker, listener->sock, slot, rcv_time);
+    if ((ret) && (ret != RET_QUERY_PARKED))
+    {
+      STATS_INC(n_dropped);
+    }
+  }
+
+  /****************************************************************************/
+  /* Send replies.                                                            */
+  /****************************************************************************/
+  n_sent = flush_replies(listener->sock, ring, n_msgs);
+  if (n_sent)
+  {
+    STATS_ADD(n_responses, n_sent);
+
+    lat = get_mono_usecs() - rcv_time;
+    for (i = 0; i < n_sent; i++)
+    {
+      stats_add_latency(dnswld.stats.lat_hist, lat);
+    }
+  }
+
+  /****************************************************************************/
+  /* A short batch means the socket queue was empty. A new datagram raises a  */
+  /* new edge.                                                                */
+  /****************************************************************************/
+  if (n_msgs < ring->n_slots)
+  {
+    return(RET_SOCK_WOULD_BLOCK);
+  }
+
+  return(RET_OK);
 }
 
 
@@ -364,13 +696,15 @@ int dns_sock_reader(void *param)
 /* Params      : fam (IN)                 - Protocal family                   */
 /*               ip (IN)                  - IP address                        */
 /*               port (IN)                - Port                              */
+/*               reuse_port (IN)          - Share port with other sockets.    */
 /*                                                                            */
-/* Returns     : RET_OK                   - Success otherwise error.          */
+/* Returns     : sock                     - Socket otherwise -1 on error.     */
 /*                                                                            */
 /*FUNC-************************************************************************/
-static int create_udp_listener(int fam, char *ip, int port)
+int create_udp_listener(int fam, char *ip, int port, int reuse_port)
 {
   struct sockaddr_in s_addr;
+  int opt = 1;
   int sock;
   int ret;
 
@@ -380,6 +714,20 @@ static int create_udp_listener(int fam, char *ip, int port)
     return(-1);
   }
 
+  /****************************************************************************/
+  /* Each worker binds its own socket to the same address. The kernel spreads */
+  /* datagrams across them by flow hash.                                      */
+  /****************************************************************************/
+  if (reuse_port)
+  {
+    ret = setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    if (ret < 0)
+    {
+      close(sock);
+      return(-1);
+    }
+  }
+
   memset(&s_addr, 0, sizeof(s_addr));
   s_addr.sin_family = fam;
   s_addr.sin_addr.s_addr = inet_addr(ip);
@@ -399,6 +747,33 @@ static int create_udp_listener(int fam, char *ip, int port)
 }
 
 
+/*FUNC+************************************************************************/
+/* Function    : register_listener                                            */
+/*                                                                            */
+/* Description : Add listener to listeners list and event loop.               */
+/*                                                                            */
+/* Params      : listener (IN)            - Listener CB.                      */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int register_listener(listeners_cb *listener)
+{
+  int ret;
+
+  ret = add_event_source(&dnswld.evloop, &listener->ev, listener->sock,
+                         listener->sock_reader, listener);
+  if (ret)
+  {
+    return(ret);
+  }
+
+  llist_add((llist *)&dnswld.listeners, (llitem *)listener);
+
+  return(RET_OK);
+}
+
+
 /*FUNC+************************************************************************/
 /* Function    : create_net_listeners                                         */
 /*                                                                            */
@@ -422,7 +797,7 @@ int create_net_listeners(int fam, int type, char *ip, int port,
 
   if (type == SOCK_DGRAM)
   {
-    sock = create_udp_listener(fam, ip, port);
+    sock = create_udp_listener(fam, ip, port, FALSE);
   }
   else
   {
@@ -454,7 +829,11 @@ int create_net_listeners(int fam, int type, char *ip, int port,
 
   listener->sock_reader = sock_reader;
 
-  llist_add((llist *)&dnswld.listeners, (llitem *)listener);
+  ret = register_listener(listener);
+  if (ret)
+  {
+    goto EXIT;
+  }
 
   PUTS_OSYS(LOG_DEBUG, "Network listener socket: [%d].", listener->sock);
 
@@ -495,7 +874,7 @@ int create_def_listeners(void)
   int sock;
   int ret;
 
-  sock = create_udp_listener(PF_INET, DEF_DNSWLD_IP4, DEF_DNSWLD_PORT);
+  sock = create_udp_listener(PF_INET, DEF_DNSWLD_IP4, DEF_DNSWLD_PORT, FALSE);
   if (sock < 0)
   {
     PUTS_OSYS(LOG_ERR, "Error creating UDP listener: [%s:%d]",
@@ -518,8 +897,13 @@ int create_def_listeners(void)
   strncpy(listener->addr4_str, DEF_DNSWLD_IP4, sizeof(listener->addr4_str) - 1);
 
   listener->sock_reader = dns_sock_reader;
+  listener->worker = &dnswld.workers[0];
 
-  llist_add((llist *)&dnswld.listeners, (llitem *)listener);
+  ret = register_listener(listener);
+  if (ret)
+  {
+    goto EXIT;
+  }
 
   PUTS_OSYS(LOG_DEBUG, "Default listener socket: [%d].", listener->sock);
 
@@ -547,7 +931,8 @@ int create_def_listeners(void)
 /*FUNC+************************************************************************/
 /* Function    : create_listeners                                             */
 /*                                                                            */
-/* Description : Create listeners.                                            */
+/* Description : Create listeners. With worker threads configured, the DNS    */
+/*               listeners belong to the workers instead.                     */
 /*                                                                            */
 /* Params      : none                                                         */
 /*                                                                            */
@@ -558,8 +943,13 @@ int create_listeners(void)
 {
   int ret;
 
-  if (dnswld.listeners.head)
+  if (dnswld.proc.n_workers)
   {
+    ret = create_worker_listeners();
+  }
+  else if (dnswld.listeners.head)
+  {
+    ret = RET_OK;
   }
   else
   {
@@ -592,6 +982,7 @@ void clean_listeners(void)
       if (runner->sock >= 0)
       {
         PUTS_OSYS(LOG_DEBUG, "Closing socket: [%d].", runner->sock);
+        del_event_source(&dnswld.evloop, &runner->ev);
         close(runner->sock);
       }
 
@@ -601,86 +992,3 @@ void clean_listeners(void)
     llist_clean((llist *)&dnswld.listeners);
   }
 }
-
-
-/*FUNC+************************************************************************/
-/* Function    : map_listeners_fdset                                          */
-/*                                                                            */
-/* Description : Map listener sockets to fdset.                               */
-/*                                                                            */
-/* Params      : fdset_ptr (OUT)          - Listener fdset                    */
-/*                                                                            */
-/* Returns     : nfds                     - Highest numbered socket.          */
-/*                                                                            */
-/*FUNC-************************************************************************/
-int map_listeners_fdset(void *ptr)
-{
-  fd_set r_fdset;
-  listeners_cb *runner = dnswld.listeners.head;
-  int nfds = 0;
-
-  FD_ZERO(&r_fdset);
-
-  while (runner)
-  {
-    if (runner->sock >= 0)
-    {
-      FD_SET(runner->sock, &r_fdset);
-
-      if (runner->sock > nfds)
-      {
-        nfds = runner->sock;
-      }
-    }
-
-    runner = runner->next;
-  }
-
-  *((fd_set *)ptr) = r_fdset;
-
-  return(nfds);
-}
-
-
-/*FUNC+************************************************************************/
-/* Function    : check_listeners                                              */
-/*                                                                            */
-/* Description : Chekc if listeners has incoming connections.                 */
-/*                                                                            */
-/* Params      : ptr (IN)                 - Read fdset                        */
-/*               nfds (IN)                - Highest numbered socket in fdset  */
-/*                                                                            */
-/* Returns     : none                                                         */
-/*                                                                            */
-/*FUNC-************************************************************************/
-void check_listeners(void *ptr, int nfds)
-{
-  struct timeval tval;
-  fd_set r_fdset = *((fd_set *)ptr);
-  listeners_cb *runner = dnswld.listeners.head;
-  int nset;
-
-  nfds++;
-
-  tval.tv_sec  = 1;
-  tval.tv_usec = 0;
-
-  nset = select(nfds, &r_fdset, NULL, NULL, &tval);
-  if (nset <= 0)
-  {
-    return;
-  }
-
-  while (runner)
-  {
-    if ((runner->sock >= 0) && (FD_ISSET(runner->sock, &r_fdset)))
-    {
-      PUTS_OSYS(LOG_DEBUG, "data ready on listener socket: [%d]",
-                runner->sock);
-      runner->sock_reader(runner);
-    }
-
-    runner = runner->next;
-  }
-}
-
@@ -16,9 +16,11 @@
 /******************************************************************************/
 extern int create_net_listeners(int fam, int type, char *ip, int port,
                                 SOCK_READER sock_reader);
+extern int parse_question_section(char **pkt, int pkt_len,
+                                  dns_question *questions, int n_q);
+extern int create_udp_listener(int fam, char *ip, int port, int reuse_port);
+extern int dns_sock_reader(void *param);
 extern int create_listeners(void);
 extern void clean_listeners(void);
-extern int map_listeners_fdset(void *ptr);
-extern void check_listeners(void *ptr, int nfds);
 
 #endif
@@ -0,0 +1,633 @@
+/*FILE+************************************************************************/
+/* Filename    : nl.c                                                         */
+/*                                                                            */
+/* Description : Netlink message helpers. Messages are built in a flat        */
+/*               buffer, sent in one datagram and their acks collected.       */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <nl.h>
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <time.h>
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_socket                                                    */
+/*                                                                            */
+/* Description : Open a netlink socket bound to a kernel assigned port.       */
+/*                                                                            */
+/* Params      : proto (IN)               - Netlink family.                   */
+/*                                                                            */
+/* Returns     : >= 0                     - Socket.                           */
+/*               -1                       - Error, errno set.                 */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int nl_socket(int proto)
+{
+  struct sockaddr_nl addr;
+  int err;
+  int fd;
+
+  fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, proto);
+  if (fd < 0)
+  {
+    return(-1);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    err = errno;
+    close(fd);
+    errno = err;
+    return(-1);
+  }
+
+  return(fd);
+}
+
+
+/******************************************************************************/
+/* All netlink sockets are opened through nl_sys_socket. Tests swap in one    */
+/* end of a socket pair served by a fake kernel, so the messages the          */
+/* backends send are checked without privilege.                               */
+/******************************************************************************/
+int (*nl_sys_socket)(int proto) = nl_socket;
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_open_proto                                                */
+/*                                                                            */
+/* Description : Open netlink socket of a netlink family.                     */
+/*                                                                            */
+/* Params      : ns (OUT)                 - Netlink socket.                   */
+/*               proto (IN)               - Netlink family.                   */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int nl_open_proto(nl_sock *ns, int proto)
+{
+  struct sockaddr_nl addr;
+  struct timeval tv;
+  socklen_t addr_len;
+  int on = 1;
+  int ret;
+
+  ns->fd = nl_sys_socket(proto);
+  if (ns->fd < 0)
+  {
+    PUTS_OSYS(LOG_ERR, "Failed to open netlink socket: [%s]", strerror(errno));
+    ret = RET_SOCK_OPEN_ERROR;
+    goto EXIT;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr_len = sizeof(addr);
+  getsockname(ns->fd, (struct sockaddr *)&addr, &addr_len);
+  ns->port_id = addr.nl_pid;
+  ns->seq = (unsigned int)time(NULL);
+
+  /****************************************************************************/
+  /* A lost ack must not hang the caller.                                     */
+  /****************************************************************************/
+  tv.tv_sec = NL_RCV_TIMEOUT_MS / 1000;
+  tv.tv_usec = (NL_RCV_TIMEOUT_MS % 1000) * 1000;
+  setsockopt(ns->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  /****************************************************************************/
+  /* Error acks carry only the failed message's header, not all of it. Older  */
+  /* kernels ignore this; nl_talk reads acks of a full buffer either way.     */
+  /****************************************************************************/
+  setsockopt(ns->fd, SOL_NETLINK, NETLINK_CAP_ACK, &on, sizeof(on));
+
+  ret = RET_OK;
+
+  EXIT:
+
+  if ((ret) && (ns->fd >= 0))
+  {
+    close(ns->fd);
+    ns->fd = -1;
+  }
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_open                                                      */
+/*                                                                            */
+/* Description : Open netfilter netlink socket.                               */
+/*                                                                            */
+/* Params      : ns (OUT)                 - Netlink socket.                   */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int nl_open(nl_sock *ns)
+{
+  return(nl_open_proto(ns, NETLINK_NETFILTER));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_close                                                     */
+/*                                                                            */
+/* Description : Close netlink socket.                                        */
+/*                                                                            */
+/* Params      : ns (IN/OUT)              - Netlink socket.                   */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void nl_close(nl_sock *ns)
+{
+  if (ns->fd >= 0)
+  {
+    close(ns->fd);
+    ns->fd = -1;
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_reset                                                     */
+/*                                                                            */
+/* Description : Empty message buffer.                                        */
+/*                                                                            */
+/* Params      : b (OUT)                  - Message buffer.                   */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void nl_reset(nl_buf *b)
+{
+  b->len = 0;
+  b->msg = 0;
+  b->n_msgs = 0;
+  b->is_full = FALSE;
+  b->ack_seq = 0;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_room                                                      */
+/*                                                                            */
+/* Description : Get free space left in message buffer.                       */
+/*                                                                            */
+/* Params      : b (IN)                   - Message buffer.                   */
+/*                                                                            */
+/* Returns     : bytes                    - Free space.                       */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int nl_room(nl_buf *b)
+{
+  return(NL_BUFZ - b->len);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_msg_start_hdr                                             */
+/*                                                                            */
+/* Description : Start a message with a family specific header. A header that */
+/*               does not fit is not written and marks the buffer full.       */
+/*                                                                            */
+/* Params      : ns (IN/OUT)              - Netlink socket.                   */
+/*               b (IN/OUT)               - Message buffer.                   */
+/*               type (IN)                - Message type.                     */
+/*               flags (IN)               - Netlink flags.                    */
+/*               hdr (IN)                 - Family header.                    */
+/*               hdr_len (IN)             - Family header length.             */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void nl_msg_start_hdr(nl_sock *ns, nl_buf *b, int type, int flags, void *hdr,
+                      int hdr_len)
+{
+  struct nlmsghdr *nlh;
+
+  if ((b->is_full) || (NLMSG_SPACE(hdr_len) > nl_room(b)))
+  {
+    b->is_full = TRUE;
+    return;
+  }
+
+  b->msg = b->len;
+
+  nlh = (struct nlmsghdr *)&b->data[b->len];
+  nlh->nlmsg_len = NLMSG_LENGTH(hdr_len);
+  nlh->nlmsg_type = type;
+  nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+  nlh->nlmsg_seq = ++ns->seq;
+  nlh->nlmsg_pid = 0;
+
+  memcpy(NLMSG_DATA(nlh), hdr, hdr_len);
+  memset((char *)nlh + nlh->nlmsg_len, 0,
+         NLMSG_ALIGN(nlh->nlmsg_len) - nlh->nlmsg_len);
+
+  b->len += NLMSG_ALIGN(nlh->nlmsg_len);
+  b->n_msgs++;
+
+  if (flags & NLM_F_ACK)
+  {
+    b->ack_seq = nlh->nlmsg_seq;
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_msg_start                                                 */
+/*                                                                            */
+/* Description : Start a netfilter message (netlink and nfgen headers).       */
+/*                                                                            */
+/* Params      : ns (IN/OUT)              - Netlink socket.                   */
+/*               b (IN/OUT)               - Message buffer.                   */
+/*               type (IN)                - Subsystem and command.            */
+/*               flags (IN)               - Netlink flags.                    */
+/*               family (IN)              - Protocol family.                  */
+/*               res_id (IN)              - Resource ID.                      */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void nl_msg_start(nl_sock *ns, nl_buf *b, int type, int flags, int family,
+                  int res_id)
+{
+  struct nfgenmsg nfg;
+
+  nfg.nfgen_family = family;
+  nfg.version = NFNETLINK_V0;
+  nfg.res_id = htons(res_id);
+
+  nl_msg_start_hdr(ns, b, type, flags, &nfg, sizeof(nfg));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_msg_end                                                   */
+/*                                                                            */
+/* Description : Close the message being built.                               */
+/*                                                                            */
+/* Params      : b (IN/OUT)               - Message buffer.                   */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void nl_msg_end(nl_buf *b)
+{
+  struct nlmsghdr *nlh = (struct nlmsghdr *)&b->data[b->msg];
+
+  if (b->is_full)
+  {
+    return;
+  }
+
+  nlh->nlmsg_len = b->len - b->msg;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_put                                                       */
+/*                                                                            */
+/* Description : Append attribute to the message being built. An attribute    */
+/*               that does not fit is not written and marks the buffer full.  */
+/*                                                                            */
+/* Params      : b (IN/OUT)               - Message buffer.                   */
+/*               type (IN)                - Attribute type and flags.         */
+/*               data (IN)                - Payload.                          */
+/*               len (IN)                 - Payload length.                   */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void nl_put(nl_buf *b, int type, void *data, int len)
+{
+  struct nlattr *nla = (struct nlattr *)&b->data[b->len];
+
+  if ((b->is_full) || (NLA_ALIGN(NLA_HDRLEN + len) > nl_room(b)))
+  {
+    b->is_full = TRUE;
+    return;
+  }
+
+  nla->nla_type = type;
+  nla->nla_len = NLA_HDRLEN + len;
+  if (len)
+  {
+    memcpy((char *)nla + NLA_HDRLEN, data, len);
+  }
+
+  memset((char *)nla + nla->nla_len, 0, NLA_ALIGN(nla->nla_len) - nla->nla_len);
+  b->len += NLA_ALIGN(nla->nla_len);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_put_u8                                                    */
+/*                                                                            */
+/* Description : Append 8-bit attribute.                                      */
+/*                                                                            */
+/* Params      : b (IN/OUT)               - Message buffer.                   */
+/*               type (IN)                - Attribute type.                   */
+/*               val (IN)                 - Value.                            */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void nl_put_u8(nl_buf *b, int type, unsigned char val)
+{
+  nl_put(b, type, &val, sizeof(val));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_put_be32                                                  */
+/*                                                                            */
+/* Description : Append 32-bit attribute in network byte order.               */
+/*                                                                            */
+/* Params      : b (IN/OUT)               - Message buffer.                   */
+/*               type (IN)                - Attribute type and flags.         */
+/*               val (IN)                 - Value in host byte order.         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void nl_put_be32(nl_buf *b, int type, unsigned int val)
+{
+  val = htonl(val);
+  nl_put(b, type, &val, sizeof(val));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_put_be64                                                  */
+/*                                                                            */
+/* Description : Append 64-bit attribute in network byte order.               */
+/*                                                                            */
+/* Params      : b (IN/OUT)               - Message buffer.                   */
+/*               type (IN)                - Attribute type and flags.         */
+/*               val (IN)                 - Value in host byte order.         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void nl_put_be64(nl_buf *b, int type, unsigned long long val)
+{
+  unsigned int be[2];
+
+  be[0] = htonl((unsigned int)(val >> 32));
+  be[1] = htonl((unsigned int)val);
+  nl_put(b, type, be, sizeof(be));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_put_str                                                   */
+/*                                                                            */
+/* Description : Append NUL terminated string attribute.                      */
+/*                                                                            */
+/* Params      : b (IN/OUT)               - Message buffer.                   */
+/*               type (IN)                - Attribute type.                   */
+/*               str (IN)                 - String.                           */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void nl_put_str(nl_buf *b, int type, char *str)
+{
+  nl_put(b, type, str, strlen(str) + 1);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_nest_start                                                */
+/*                                                                            */
+/* Description : Open nested attribute.                                       */
+/*                                                                            */
+/* Params      : b (IN/OUT)               - Message buffer.                   */
+/*               type (IN)                - Attribute type.                   */
+/*                                                                            */
+/* Returns     : nest                     - Nest to pass to nl_nest_end.      */
+/*                                                                            */
+/*FUNC-************************************************************************/
+struct nlattr *nl_nest_start(nl_buf *b, int type)
+{
+  struct nlattr *nest = (struct nlattr *)&b->data[b->len];
+
+  nl_put(b, type | NLA_F_NESTED, NULL, 0);
+
+  return(nest);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_nest_end                                                  */
+/*                                                                            */
+/* Description : Close nested attribute.                                      */
+/*                                                                            */
+/* Params      : b (IN)                   - Message buffer.                   */
+/*               nest (IN/OUT)            - Nest from nl_nest_start.          */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void nl_nest_end(nl_buf *b, struct nlattr *nest)
+{
+  if (b->is_full)
+  {
+    return;
+  }
+
+  nest->nla_len = &b->data[b->len] - (char *)nest;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_find_attr                                                 */
+/*                                                                            */
+/* Description : Find attribute in a received attribute stream.               */
+/*                                                                            */
+/* Params      : data (IN)                - First attribute.                  */
+/*               len (IN)                 - Length of the stream.             */
+/*               type (IN)                - Attribute type, flags ignored.    */
+/*                                                                            */
+/* Returns     : attr                     - Attribute otherwise NULL.         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+struct nlattr *nl_find_attr(void *data, int len, int type)
+{
+  struct nlattr *nla = (struct nlattr *)data;
+
+  while ((len >= NLA_HDRLEN) && (nla->nla_len >= NLA_HDRLEN) &&
+         (nla->nla_len <= len))
+  {
+    if ((nla->nla_type & NLA_TYPE_MASK) == type)
+    {
+      return(nla);
+    }
+
+    len -= NLA_ALIGN(nla->nla_len);
+    nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len));
+  }
+
+  return(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_talk                                                      */
+/*                                                                            */
+/* Description : Send the buffered messages and read replies until the last   */
+/*               message that requested an ack is acked. Errors of earlier    */
+/*               messages are reported on the way. The receive buffer holds   */
+/*               an error ack that echoes a whole NL_BUFZ message. A buffer   */
+/*               that overflowed is not sent.                                 */
+/*                                                                            */
+/* Params      : ns (IN)                  - Netlink socket.                   */
+/*               b (IN)                   - Message buffer.                   */
+/*                                                                            */
+/* Returns     : 0                        - Success.                          */
+/*               -EMSGSIZE                - Buffer overflowed.                */
+/*               -errno                   - First error reported.             */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int nl_talk(nl_sock *ns, nl_buf *b)
+{
+  struct sockaddr_nl addr;
+  struct nlmsghdr *nlh;
+  struct nlmsgerr *err;
+  char buf[NL_RCVZ];
+  int first_err = 0;
+  int len;
+
+  if (b->is_full)
+  {
+    return(-EMSGSIZE);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+
+  if (sendto(ns->fd, b->data, b->len, 0, (struct sockaddr *)&addr,
+             sizeof(addr)) < 0)
+  {
+    return(-errno);
+  }
+
+  for (;;)
+  {
+    len = recv(ns->fd, buf, sizeof(buf), 0);
+    if (len < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return(-errno);
+    }
+
+    for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len))
+    {
+      if ((nlh->nlmsg_pid != ns->port_id) ||
+          (nlh->nlmsg_type != NLMSG_ERROR))
+      {
+        continue;
+      }
+
+      err = (struct nlmsgerr *)NLMSG_DATA(nlh);
+      if ((err->error) && (!first_err))
+      {
+        first_err = err->error;
+      }
+
+      if (nlh->nlmsg_seq == b->ack_seq)
+      {
+        return(first_err);
+      }
+    }
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nl_dump                                                      */
+/*                                                                            */
+/* Description : Send a dump request and pass each reply message to a         */
+/*               callback until the dump is done.                             */
+/*                                                                            */
+/* Params      : ns (IN)                  - Netlink socket.                   */
+/*               b (IN)                   - Buffer holding the request.       */
+/*               fn (IN)                  - Callback per reply message.       */
+/*               arg (IN)                 - Callback argument.                */
+/*                                                                            */
+/* Returns     : 0                        - Success.                          */
+/*               -EMSGSIZE                - Buffer overflowed.                */
+/*               -errno                   - Error reported.                   */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int nl_dump(nl_sock *ns, nl_buf *b, nl_msg_fn fn, void *arg)
+{
+  struct sockaddr_nl addr;
+  struct nlmsghdr *nlh;
+  char buf[NL_RCVZ];
+  int len;
+
+  if (b->is_full)
+  {
+    return(-EMSGSIZE);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+
+  if (sendto(ns->fd, b->data, b->len, 0, (struct sockaddr *)&addr,
+             sizeof(addr)) < 0)
+  {
+    return(-errno);
+  }
+
+  for (;;)
+  {
+    len = recv(ns->fd, buf, sizeof(buf), 0);
+    if (len < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return(-errno);
+    }
+
+    for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len))
+    {
+      if (nlh->nlmsg_pid != ns->port_id)
+      {
+        continue;
+      }
+
+      if (nlh->nlmsg_type == NLMSG_DONE)
+      {
+        return(0);
+      }
+
+      if (nlh->nlmsg_type == NLMSG_ERROR)
+      {
+        return(((struct nlmsgerr *)NLMSG_DATA(nlh))->error);
+      }
+
+      fn(nlh, arg);
+    }
+  }
+}
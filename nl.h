@@ -0,0 +1,92 @@
+/*INC+*************************************************************************/
+/* Filename    : nl.h                                                         */
+/*                                                                            */
+/* Description : Netlink message helpers header file.                         */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*INC+*************************************************************************/
+
+#ifndef _NL_H
+#define _NL_H
+
+/******************************************************************************/
+/* Includes.                                                                  */
+/******************************************************************************/
+#include <linux/netlink.h>
+#include <linux/netfilter/nfnetlink.h>
+
+/******************************************************************************/
+/* Constants.                                                                 */
+/******************************************************************************/
+#define NL_BUFZ                                   65536
+#define NL_RCVZ                                   (NL_BUFZ + NLMSG_HDRLEN + sizeof(struct nlmsgerr))
+#define NL_RCV_TIMEOUT_MS                         1000
+
+/******************************************************************************/
+/* Received attribute payload and its length.                                 */
+/******************************************************************************/
+#define NL_ATTR_DATA(a)                           ((char *)(a) + NLA_HDRLEN)
+#define NL_ATTR_LEN(a)                            ((a)->nla_len - NLA_HDRLEN)
+
+/******************************************************************************/
+/* Netlink socket. seq is the sequence number of the last message started.    */
+/******************************************************************************/
+typedef struct _nl_sock
+{
+  int fd;
+  unsigned int seq;
+  unsigned int port_id;
+} nl_sock;
+
+
+/******************************************************************************/
+/* Message buffer. Holds one or more messages; msg is the offset of the       */
+/* message being built and ack_seq the sequence number of the last message    */
+/* that requested an ack. is_full is set once a write did not fit; nothing    */
+/* more is written and the buffer is refused by nl_talk and nl_dump.          */
+/******************************************************************************/
+typedef struct _nl_buf
+{
+  int len;
+  int msg;
+  int n_msgs;
+  int is_full;
+  unsigned int ack_seq;
+  char data[NL_BUFZ];
+} nl_buf;
+
+
+/******************************************************************************/
+/* Dump reply callback for nl_dump.                                           */
+/******************************************************************************/
+typedef void (*nl_msg_fn)(struct nlmsghdr *nlh, void *arg);
+
+
+/******************************************************************************/
+/* Forwards decls.                                                            */
+/******************************************************************************/
+extern int (*nl_sys_socket)(int proto);
+extern int nl_open_proto(nl_sock *ns, int proto);
+extern int nl_open(nl_sock *ns);
+extern void nl_close(nl_sock *ns);
+extern void nl_reset(nl_buf *b);
+extern int nl_room(nl_buf *b);
+extern void nl_msg_start_hdr(nl_sock *ns, nl_buf *b, int type, int flags,
+                             void *hdr, int hdr_len);
+extern void nl_msg_start(nl_sock *ns, nl_buf *b, int type, int flags,
+                         int family, int res_id);
+extern void nl_msg_end(nl_buf *b);
+extern void nl_put(nl_buf *b, int type, void *data, int len);
+extern void nl_put_u8(nl_buf *b, int type, unsigned char val);
+extern void nl_put_be32(nl_buf *b, int type, unsigned int val);
+extern void nl_put_be64(nl_buf *b, int type, unsigned long long val);
+extern void nl_put_str(nl_buf *b, int type, char *str);
+extern struct nlattr *nl_nest_start(nl_buf *b, int type);
+extern void nl_nest_end(nl_buf *b, struct nlattr *nest);
+extern struct nlattr *nl_find_attr(void *data, int len, int type);
+extern int nl_talk(nl_sock *ns, nl_buf *b);
+extern int nl_dump(nl_sock *ns, nl_buf *b, nl_msg_fn fn, void *arg);
+
+#endif
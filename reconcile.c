@@ -0,0 +1,548 @@
+/*FILE+************************************************************************/
+/* Filename    : reconcile.c                                                  */
+/*                                                                            */
+/* Description : Firewall reconciler. Periodically lists the grants in the    */
+/*               firewall in one dump, merges them against the whitelist,     */
+/*               both sorted on (src, dst, created_at), and queues only the   */
+/*               differences: grants missing from the firewall are re-added   */
+/*               and tagged rules the whitelist does not know are deleted.    */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <fw.h>
+#include <reconcile.h>
+
+#include <pthread.h>
+
+
+/******************************************************************************/
+/* Reconciler pthread.                                                        */
+/******************************************************************************/
+static int is_rc_started = FALSE;
+static pthread_t rc_thread;
+
+
+/*FUNC+************************************************************************/
+/* Function    : rc_push                                                      */
+/*                                                                            */
+/* Description : Append a grant to a list.                                    */
+/*                                                                            */
+/* Params      : list (IN/OUT)            - List.                             */
+/*               key (IN)                 - ACL_PAIR_KEY of the grant.        */
+/*               created_at (IN)          - Creation timestamp.               */
+/*               expiry (IN)              - Expiry timestamp.                 */
+/*               n (IN)                   - Count.                            */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int rc_push(rc_list *list, unsigned long long key,
+                   unsigned int created_at, unsigned int expiry, int n)
+{
+  rc_grant *more;
+
+  if (list->n == list->max)
+  {
+    list->max = list->max ? list->max * 2 : FW_BATCH_MAX;
+    more = (rc_grant *)realloc(list->grants, list->max * sizeof(rc_grant));
+    if (!more)
+    {
+      return(RET_MEMORY_ERROR);
+    }
+    list->grants = more;
+  }
+
+  list->grants[list->n].key = key;
+  list->grants[list->n].created_at = created_at;
+  list->grants[list->n].expiry = expiry;
+  list->grants[list->n].n = n;
+  list->n++;
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rc_cmp                                                       */
+/*                                                                            */
+/* Description : Order grants on (src, dst, created_at).                      */
+/*                                                                            */
+/* Params      : a (IN)                   - Grant.                            */
+/*               b (IN)                   - Grant.                            */
+/*                                                                            */
+/* Returns     : <0, 0, >0                - a before, same as, after b.       */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int rc_cmp(const void *a, const void *b)
+{
+  const rc_grant *ga = (const rc_grant *)a;
+  const rc_grant *gb = (const rc_grant *)b;
+
+  if (ga->key != gb->key)
+  {
+    return((ga->key < gb->key) ? -1 : 1);
+  }
+
+  if (ga->created_at != gb->created_at)
+  {
+    return((ga->created_at < gb->created_at) ? -1 : 1);
+  }
+
+  return(0);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rc_sort                                                      */
+/*                                                                            */
+/* Description : Sort a list and fold equal grants into one, adding up their  */
+/*               counts.                                                      */
+/*                                                                            */
+/* Params      : list (IN/OUT)            - List.                             */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void rc_sort(rc_list *list)
+{
+  int i;
+  int n;
+
+  if (!list->n)
+  {
+    return;
+  }
+
+  qsort(list->grants, list->n, sizeof(rc_grant), rc_cmp);
+
+  for (i = 1, n = 1; i < list->n; i++)
+  {
+    if (!rc_cmp(&list->grants[n - 1], &list->grants[i]))
+    {
+      list->grants[n - 1].n += list->grants[i].n;
+      continue;
+    }
+
+    list->grants[n++] = list->grants[i];
+  }
+
+  list->n = n;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rc_find                                                      */
+/*                                                                            */
+/* Description : Find a grant in a sorted list.                               */
+/*                                                                            */
+/* Params      : list (IN)                - Sorted list.                      */
+/*               key (IN)                 - ACL_PAIR_KEY of the grant.        */
+/*               created_at (IN)          - Creation timestamp.               */
+/*                                                                            */
+/* Returns     : grant                    - Grant otherwise NULL.             */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static rc_grant *rc_find(rc_list *list, unsigned long long key,
+                         unsigned int created_at)
+{
+  rc_grant grant;
+
+  if (!list->n)
+  {
+    return(NULL);
+  }
+
+  grant.key = key;
+  grant.created_at = created_at;
+
+  return((rc_grant *)bsearch(&grant, list->grants, list->n, sizeof(rc_grant),
+                             rc_cmp));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rc_collect                                                   */
+/*                                                                            */
+/* Description : Add a grant listed by the firewall to the list.              */
+/*                                                                            */
+/* Params      : cmd (IN)                 - Installed grant.                  */
+/*               arg (IN/OUT)             - List.                             */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int rc_collect(fw_cmd *cmd, void *arg)
+{
+  return(rc_push((rc_list *)arg, ACL_PAIR_KEY(cmd->s_ip, cmd->d_ip),
+                 cmd->created_at, cmd->expiry, 1));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rc_snapshot_acl                                              */
+/*                                                                            */
+/* Description : Copy the whitelist's grants.                                 */
+/*                                                                            */
+/* Params      : list (OUT)               - List.                             */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int rc_snapshot_acl(rc_list *list)
+{
+  src_dest_cb *runner;
+  int ret = RET_OK;
+
+  lock_acl();
+
+  for (runner = dnswld.acl.sd.head; (runner) && (!ret); runner = runner->next)
+  {
+    ret = rc_push(list, ACL_PAIR_KEY(runner->src, runner->dst),
+                  (unsigned int)runner->created_at,
+                  (unsigned int)runner->fw_expiry, 1);
+  }
+
+  unlock_acl();
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rc_diff                                                      */
+/*                                                                            */
+/* Description : Merge the sorted whitelist and firewall grants. A grant the  */
+/*               firewall lacks is re-added. A rule the whitelist lacks is    */
+/*               deleted, once per set of copies listed. A grant listed a     */
+/*               wrong number of times, e.g. missing from some chains, is     */
+/*               deleted and re-added.                                        */
+/*                                                                            */
+/* Params      : acl (IN)                 - Whitelist grants.                 */
+/*               fw (IN)                  - Firewall grants.                  */
+/*               copies (IN)              - Times each grant is listed.       */
+/*               dels (OUT)               - Rules to delete.                  */
+/*               adds (OUT)               - Grants to re-add.                 */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int rc_diff(rc_list *acl, rc_list *fw, int copies, rc_list *dels,
+                   rc_list *adds)
+{
+  rc_grant *a;
+  rc_grant *f;
+  int i = 0;
+  int j = 0;
+  int cmp;
+  int ret = RET_OK;
+
+  while ((!ret) && ((i < acl->n) || (j < fw->n)))
+  {
+    a = (i < acl->n) ? &acl->grants[i] : NULL;
+    f = (j < fw->n) ? &fw->grants[j] : NULL;
+    cmp = (!f) ? -1 : (!a) ? 1 : rc_cmp(a, f);
+
+    if (cmp < 0)
+    {
+      ret = rc_push(adds, a->key, a->created_at, a->expiry, 1);
+      i++;
+      continue;
+    }
+
+    if ((cmp > 0) || (f->n != copies))
+    {
+      ret = rc_push(dels, f->key, f->created_at, f->expiry,
+                    (f->n + copies - 1) / copies);
+    }
+
+    if ((!ret) && (!cmp) && (f->n != copies))
+    {
+      ret = rc_push(adds, a->key, a->created_at, a->expiry, 1);
+    }
+
+    i += (!cmp);
+    j++;
+  }
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rc_fix                                                       */
+/*                                                                            */
+/* Description : Queue the fixes, deletes first. Each is checked against the  */
+/*               whitelist as it is now, with the ACL locked so later changes */
+/*               queue after it: a grant made or removed since the snapshot   */
+/*               is left alone.                                               */
+/*                                                                            */
+/* Params      : dels (IN)                - Rules to delete.                  */
+/*               adds (IN)                - Grants to re-add, sorted.         */
+/*                                                                            */
+/* Returns     : n                        - Grants fixed.                     */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int rc_fix(rc_list *dels, rc_list *adds)
+{
+  src_dest_cb *sd_cb;
+  rc_grant *g;
+  fw_cmd cmd;
+  int n_fixed = 0;
+  int i;
+  int k;
+
+  lock_acl();
+
+  for (i = 0, g = dels->grants; i < dels->n; i++, g++)
+  {
+    cmd.op = FW_CMD_DEL;
+    cmd.s_ip = (unsigned int)(g->key >> 32);
+    cmd.d_ip = (unsigned int)g->key;
+    cmd.action = FW_ACCEPT_RULE;
+    cmd.created_at = g->created_at;
+    cmd.expiry = g->expiry;
+    cmd.dom_id = -1;
+
+    /**************************************************************************/
+    /* The pair may have been granted again since; only delete under a grant  */
+    /* that is re-added right after.                                          */
+    /**************************************************************************/
+    sd_cb = find_src_dest_acl(cmd.s_ip, cmd.d_ip);
+    if ((sd_cb) &&
+        (!rc_find(adds, g->key, (unsigned int)sd_cb->created_at)))
+    {
+      continue;
+    }
+
+    if (!sd_cb)
+    {
+      n_fixed++;
+    }
+
+    for (k = 0; k < g->n; k++)
+    {
+      if (post_fw_cmd(&cmd))
+      {
+        run_fw_cmd(&cmd);
+      }
+    }
+  }
+
+  for (i = 0, g = adds->grants; i < adds->n; i++, g++)
+  {
+    sd_cb = find_src_dest_acl((unsigned int)(g->key >> 32),
+                              (unsigned int)g->key);
+    if ((!sd_cb) || ((unsigned int)sd_cb->created_at != g->created_at))
+    {
+      continue;
+    }
+
+    cmd.op = FW_CMD_ADD;
+    cmd.s_ip = sd_cb->src;
+    cmd.d_ip = sd_cb->dst;
+    cmd.action = FW_ACCEPT_RULE;
+    cmd.created_at = sd_cb->created_at;
+    cmd.expiry = sd_cb->fw_expiry;
+    cmd.dom_id = sd_cb->dom_id;
+
+    /**************************************************************************/
+    /* A full queue leaves the grant to the next pass, or the next query.     */
+    /**************************************************************************/
+    sd_cb->last_status = ACL_OK;
+    if (post_fw_cmd(&cmd))
+    {
+      sd_cb->last_status = ACL_ADD_ALLOW_RULE_ERR;
+      continue;
+    }
+
+    n_fixed++;
+  }
+
+  unlock_acl();
+
+  return(n_fixed);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : reconcile_fw                                                 */
+/*                                                                            */
+/* Description : Run one reconcile pass. The whitelist is copied first and    */
+/*               the firewall listed once the commands queued by then have    */
+/*               been run, so grants still in the queue are not taken for     */
+/*               drift.                                                       */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int reconcile_fw(void)
+{
+  rc_list acl = {NULL, 0, 0};
+  rc_list fw = {NULL, 0, 0};
+  rc_list dels = {NULL, 0, 0};
+  rc_list adds = {NULL, 0, 0};
+  unsigned long started;
+  unsigned long usecs;
+  int n_fixed;
+  int ret;
+
+  started = get_mono_usecs();
+
+  ret = rc_snapshot_acl(&acl);
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  fw_sync();
+
+  ret = list_fw_rules(rc_collect, &fw);
+  if (ret)
+  {
+    PUTS_OSYS(LOG_ERR, "Reconcile: failed to list firewall grants.");
+    goto EXIT;
+  }
+
+  rc_sort(&acl);
+  rc_sort(&fw);
+
+  ret = rc_diff(&acl, &fw, fw_list_copies(), &dels, &adds);
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  n_fixed = rc_fix(&dels, &adds);
+  usecs = get_mono_usecs() - started;
+
+  STATS_INC(n_reconciles);
+  STATS_ADD(n_reconcile_fixes, n_fixed);
+  dnswld.stats.reconcile_usecs = usecs;
+
+  PUTS_OSYS(n_fixed ? LOG_INFO : LOG_DEBUG, "Reconciled %d grants against %d "
+            "in the firewall in %lu usecs: %d fixes queued.", acl.n, fw.n,
+            usecs, n_fixed);
+
+  ret = RET_OK;
+
+  EXIT:
+
+  free(acl.grants);
+  free(fw.grants);
+  free(dels.grants);
+  free(adds.grants);
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : reconciler                                                   */
+/*                                                                            */
+/* Description : Reconciler processing loop. Polls the running flag between   */
+/*               passes.                                                      */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void *reconciler(void *param)
+{
+  struct timespec ts;
+  unsigned long next;
+
+  PUTS_OSYS(LOG_DEBUG, "Reconciler thread: Started");
+
+  ts.tv_sec = 0;
+  ts.tv_nsec = RECONCILE_POLL_MS * 1000000L;
+  next = get_mono_usecs() + dnswld.fw.reconcile_secs * 1000000UL;
+
+  while (dnswld.proc.is_running)
+  {
+    nanosleep(&ts, NULL);
+
+    if (get_mono_usecs() < next)
+    {
+      continue;
+    }
+
+    reconcile_fw();
+    next = get_mono_usecs() + dnswld.fw.reconcile_secs * 1000000UL;
+  }
+
+  PUTS_OSYS(LOG_DEBUG, "Reconciler thread: Done");
+
+  return(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : create_start_reconciler                                      */
+/*                                                                            */
+/* Description : Create and start the reconciler thread, if the backend can   */
+/*               list its grants.                                             */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int create_start_reconciler(void)
+{
+  int ret;
+
+  if (!fw_list_copies())
+  {
+    PUTS_OSYS(LOG_INFO, "Firewall backend cannot list its grants. Not "
+              "reconciling.");
+    ret = RET_OK;
+    goto EXIT;
+  }
+
+  ret = pthread_create(&rc_thread, NULL, reconciler, NULL);
+  if (ret)
+  {
+    PUTS_OSYS(LOG_DEBUG, "Failed to create reconciler pthread!");
+    ret = RET_SYS_ERROR;
+    goto EXIT;
+  }
+
+  is_rc_started = TRUE;
+
+  PUTS_OSYS(LOG_INFO, "Reconciling firewall every %d secs.",
+            dnswld.fw.reconcile_secs);
+
+  ret = RET_OK;
+
+  EXIT:
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : wait_reconciler                                              */
+/*                                                                            */
+/* Description : Wait for reconciler to end.                                  */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void wait_reconciler(void)
+{
+  if (is_rc_started)
+  {
+    pthread_join(rc_thread, NULL);
+    is_rc_started = FALSE;
+  }
+}
@@ -0,0 +1,52 @@
+/*INC+*************************************************************************/
+/* Filename    : reconcile.h                                                  */
+/*                                                                            */
+/* Description : Firewall reconciler header file.                             */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*INC+*************************************************************************/
+
+#ifndef _RECONCILE_H
+#define _RECONCILE_H
+
+/******************************************************************************/
+/* Constants.                                                                 */
+/******************************************************************************/
+#define MAX_FW_RECONCILE_SECS                     86400
+#define RECONCILE_POLL_MS                         200
+
+/******************************************************************************/
+/* Grant of a reconcile pass, from the whitelist or the firewall. expiry is   */
+/* the one a listed rule was added with. n is the number of times the         */
+/* firewall listed it, or deletes to post for it.                             */
+/******************************************************************************/
+typedef struct _rc_grant
+{
+  unsigned long long key;
+  unsigned int created_at;
+  unsigned int expiry;
+  int n;
+} rc_grant;
+
+
+/******************************************************************************/
+/* Growable array of grants.                                                  */
+/******************************************************************************/
+typedef struct _rc_list
+{
+  rc_grant *grants;
+  int n;
+  int max;
+} rc_list;
+
+
+/******************************************************************************/
+/* Forwards decls.                                                            */
+/******************************************************************************/
+extern int reconcile_fw(void);
+extern int create_start_reconciler(void);
+extern void wait_reconciler(void);
+
+#endif
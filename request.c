@@ -11,86 +11,76 @@
 #include <common.h>
 #include <dnswldcb.h>
 
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <netdb.h>
-
 
 /*FUNC+************************************************************************/
-/* Function    : process_requested_domains                                    */
+/* Function    : match_requested_domains                                      */
 /*                                                                            */
-/* Description : Process requested domains.                                   */
+/* Description : Answer whitelisted A questions from the answer cache and     */
+/*               flag the rest to be resolved upstream.                       */
 /*                                                                            */
-/* Params      : src_addr (IN)            - Source IP address                 */
-/*               qs (IN)                  - Array of questions.               */
+/* Params      : qs (IN/OUT)              - Array of questions.               */
 /*               n_qs (IN)                - Number of questions.              */
 /*                                                                            */
-/* Returns     : RET_OK                   - Success otherwise error.          */
+/* Returns     : n                        - Number of questions to resolve.   */
 /*                                                                            */
 /*FUNC-************************************************************************/
-int process_requested_domains(void *src_addr, dns_question *qs, int n_qs)
+int match_requested_domains(dns_question *qs, int n_qs)
 {
-  struct addrinfo hints;
-  struct addrinfo *res0 = NULL;
-  struct addrinfo *res;
   dns_question *q;
-  int i_rec;
+  int n_match = 0;
   int i;
-  int ret;
 
   /****************************************************************************/
   /* Look for A requests.                                                     */
   /****************************************************************************/
   for (i = 0, q = qs; i < n_qs; i++, q++)
   {
+    q->is_whitelisted = FALSE;
+    q->dom_id = -1;
+
     if ((q->q_type == DNS_RR_TYPE_A) && (q->q_class == DNS_RR_CLASS_IN))
     {
       /************************************************************************/
       /* Check if name is included in whitelist.                              */
       /************************************************************************/
-      if (find_name(q, dnswld.ds.whitelist))
+      q->dom_id = find_name_id(q, dnswld.ds.whitelist);
+      if (q->dom_id < 0)
       {
-        PUTS_OSYS(LOG_DEBUG, "[%s] found in whitelist! Resolving ...",
-                  q->name);
+        continue;
+      }
 
-        /**********************************************************************/
-        /* Resolve address of name. We're interested for IPv4 for now.        */
-        /**********************************************************************/
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_DGRAM;
-        hints.ai_flags = AI_CANONNAME;
+      if (cache_lookup(q))
+      {
+        PUTS_OSYS(LOG_DEBUG, "Domain[%d] found in whitelist! Cached.",
+                  q->dom_id);
+        continue;
+      }
 
-        ret = getaddrinfo(q->name, NULL, &hints, &res0);
-        if (ret != 0)
-        {
-          PUTS_OSYS(LOG_ERR, " Failed to resolve name!");
-          continue;
-        }
+      PUTS_OSYS(LOG_DEBUG, "Domain[%d] found in whitelist!", q->dom_id);
+      q->is_whitelisted = TRUE;
+      n_match++;
+    }
+  }
 
-        /**********************************************************************/
-        /* Get returned address.                                              */
-        /**********************************************************************/
-        for (i_rec = 0, res = res0; res && i_rec < DNS_MAX_ANS_RR_NUM;
-             res = res->ai_next)
-        {
-          ret = getnameinfo(res->ai_addr, res->ai_addrlen, q->ans.recs[i_rec],
-                            DNS_MAX_ANS_RR_LEN, NULL, 0, NI_NUMERICHOST);
-          if (ret)
-          {
-            PUTS_OSYS(LOG_ERR, " Failed to translate address to name!");
-            continue;
-          }
+  return(n_match);
+}
 
-          PUTS_OSYS(LOG_DEBUG, " recs[%d]: [%s]", i_rec, q->ans.recs[i_rec]);
-          PUTS_OSYS(LOG_DEBUG, " ai_canonname: [%s]", res->ai_canonname);
-          i_rec++;
-        }
 
-        q->ans.n_rec = i_rec;
-      }
-    }
-  }
+/*FUNC+************************************************************************/
+/* Function    : process_requested_domains                                    */
+/*                                                                            */
+/* Description : Process requested domains. Answers are already resolved.     */
+/*                                                                            */
+/* Params      : src_addr (IN)            - Source IP address                 */
+/*               qs (IN)                  - Array of questions.               */
+/*               n_qs (IN)                - Number of questions.              */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int process_requested_domains(void *src_addr, dns_question *qs, int n_qs)
+{
+  int ret;
 
   ret = add_src_dest_to_whitelist(src_addr, qs, n_qs);
   if (ret)
@@ -102,11 +92,5 @@ int process_requested_domains(void *src_addr, dns_question *qs, int n_qs)
 
   EXIT:
 
-  if (res0 != NULL)
-  {
-    freeaddrinfo(res0);
-  }
-
   return(ret);
 }
-
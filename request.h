@@ -14,6 +14,7 @@
 /******************************************************************************/
 /* Forwards decls.                                                            */
 /******************************************************************************/
+extern int match_requested_domains(dns_question *qs, int n_qs);
 extern int process_requested_domains(void *src_addr, dns_question *qs,
                                      int n_qs);
 
@@ -0,0 +1,1092 @@
+/*FILE+************************************************************************/
+/* Filename    : resolver.c                                                   */
+/*                                                                            */
+/* Description : Non-blocking upstream stub resolver. Whitelisted queries are */
+/*               parked while their A lookups are forwarded to the upstream   */
+/*               servers. Replies, timeouts and retries are all driven by the */
+/*               event loop so other queries keep being served.               */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <netdb.h>
+
+#include <dnswldcb.h>
+#include <response.h>
+#include <network.h>
+
+/******************************************************************************/
+/* Forwards decls.                                                            */
+/******************************************************************************/
+static int upstream_sock_reader(void *param);
+
+
+/*FUNC+************************************************************************/
+/* Function    : add_upstream_server                                          */
+/*                                                                            */
+/* Description : Add one upstream server.                                     */
+/*                                                                            */
+/* Params      : entry (IN)               - Server as ip[:port].              */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int add_upstream_server(char *entry)
+{
+  struct sockaddr_in *server;
+  char *port_str;
+  int port = DEF_RSLV_PORT;
+
+  if (dnswld.rslv.n_servers >= RSLV_MAX_SERVERS)
+  {
+    PUTS_OSYS(LOG_INFO, "Too many upstream servers. Skipping [%s].", entry);
+    return(RET_OK);
+  }
+
+  port_str = strchr(entry, ':');
+  if (port_str)
+  {
+    *port_str++ = '\0';
+    port = atoi(port_str);
+    if ((port <= 0) || (port > 65535))
+    {
+      PUTS_OSYS(LOG_INFO, "Invalid upstream server port: [%s]", port_str);
+      return(RET_INVALID_CONFIG);
+    }
+  }
+
+  server = &dnswld.rslv.servers[dnswld.rslv.n_servers];
+  memset(server, 0, sizeof(*server));
+  server->sin_family = AF_INET;
+  server->sin_port = htons(port);
+
+  if (!inet_aton(entry, &server->sin_addr))
+  {
+    PUTS_OSYS(LOG_INFO, "Invalid upstream server address: [%s]", entry);
+    return(RET_INVALID_CONFIG);
+  }
+
+  PUTS_OSYS(LOG_DEBUG, "Upstream server [%d]: [%s:%d]", dnswld.rslv.n_servers,
+            entry, port);
+  dnswld.rslv.n_servers++;
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : add_upstream_servers                                         */
+/*                                                                            */
+/* Description : Parse and add upstream servers.                              */
+/*                                                                            */
+/* Params      : entries (IN)             - Space separated list of servers.  */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int add_upstream_servers(char *entries)
+{
+  char *token;
+  char *saveptr;
+  int ret;
+
+  for (token = strtok_r(entries, " ", &saveptr); token != NULL;
+       token = strtok_r(NULL, " ", &saveptr))
+  {
+    ret = add_upstream_server(token);
+    if (ret)
+    {
+      return(ret);
+    }
+  }
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : load_resolv_conf                                             */
+/*                                                                            */
+/* Description : Use the system nameservers when no upstream servers are      */
+/*               configured. A loopback nameserver on our own DNS port would  */
+/*               forward queries back to us and is skipped.                   */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int load_resolv_conf(void)
+{
+  FILE *in;
+  char line[256];
+  char *ptr;
+  char *key;
+  struct in_addr addr;
+  int ret;
+
+  if (dnswld.rslv.n_servers)
+  {
+    return(RET_OK);
+  }
+
+  in = fopen(RSLV_RESOLV_CONF, "r");
+  if (in == NULL)
+  {
+    PUTS_OSYS(LOG_INFO, "Failed to open [%s]", RSLV_RESOLV_CONF);
+    ret = RET_FILE_OPEN_ERROR;
+    goto EXIT;
+  }
+
+  while (fgets(line, sizeof(line), in))
+  {
+    ptr = trim_str(line);
+    key = strsep(&ptr, " \t");
+    if ((ptr == NULL) || (strcmp(key, "nameserver")))
+    {
+      continue;
+    }
+
+    ptr = trim_str(ptr);
+    if ((!inet_aton(ptr, &addr)) ||
+        ((ntohl(addr.s_addr) >> 24) == IN_LOOPBACKNET))
+    {
+      PUTS_OSYS(LOG_DEBUG, "Skipping nameserver [%s].", ptr);
+      continue;
+    }
+
+    ret = add_upstream_server(ptr);
+    if (ret)
+    {
+      goto EXIT;
+    }
+  }
+
+  if (!dnswld.rslv.n_servers)
+  {
+    PUTS_OSYS(LOG_INFO, "No usable upstream servers. Whitelisted names will "
+              "not resolve.");
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  if (in)
+  {
+    fclose(in);
+  }
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : next_txid                                                    */
+/*                                                                            */
+/* Description : Pick an unpredictable transaction ID. Each lookup has its    */
+/*               own socket, so IDs need not be unique.                       */
+/*                                                                            */
+/* Params      : ctx (IN/OUT)             - Resolver context.                 */
+/*                                                                            */
+/* Returns     : txid                     - Transaction ID.                   */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static unsigned short next_txid(rslv_ctx *ctx)
+{
+  unsigned int x;
+
+  x = ctx->rand_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  ctx->rand_state = x;
+
+  return((unsigned short)(x >> 8));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : close_lookup_sock                                            */
+/*                                                                            */
+/* Description : Close the socket of a lookup's current try.                  */
+/*                                                                            */
+/* Params      : ctx (IN/OUT)             - Resolver context.                 */
+/*               lookup (IN/OUT)          - Lookup.                           */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void close_lookup_sock(rslv_ctx *ctx, rslv_lookup *lookup)
+{
+  if (lookup->sock < 0)
+  {
+    return;
+  }
+
+  if (lookup->sock_ev.handler)
+  {
+    del_event_source(ctx->loop, &lookup->sock_ev);
+    lookup->sock_ev.handler = NULL;
+  }
+
+  close(lookup->sock);
+  lookup->sock = -1;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : find_lookup_by_name                                          */
+/*                                                                            */
+/* Description : Find the pending lookup of a question's name.                */
+/*                                                                            */
+/* Params      : ctx (IN)                 - Resolver context.                 */
+/*               q (IN)                   - Question.                         */
+/*                                                                            */
+/* Returns     : lookup                   - Lookup otherwise NULL.            */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static rslv_lookup *find_lookup_by_name(rslv_ctx *ctx, dns_question *q)
+{
+  rslv_lookup *lookup;
+  int off = q->name - q->msg;
+
+  for (lookup = ctx->name_hash[q->hash % RSLV_NAME_HASH_SIZE]; lookup;
+       lookup = lookup->name_next)
+  {
+    if ((lookup->name_hash == q->hash) &&
+        (dns_name_equal(q->msg, off + DNS_MAX_ENC_NAME_LEN, off,
+                        lookup->name)))
+    {
+      return(lookup);
+    }
+  }
+
+  return(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : unhash_lookup_name                                           */
+/*                                                                            */
+/* Description : Remove lookup from the name hash.                            */
+/*                                                                            */
+/* Params      : ctx (IN/OUT)             - Resolver context.                 */
+/*               lookup (IN)              - Lookup.                           */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void unhash_lookup_name(rslv_ctx *ctx, rslv_lookup *lookup)
+{
+  rslv_lookup **pp;
+
+  for (pp = &ctx->name_hash[lookup->name_hash % RSLV_NAME_HASH_SIZE]; *pp;
+       pp = &(*pp)->name_next)
+  {
+    if (*pp == lookup)
+    {
+      *pp = lookup->name_next;
+      lookup->name_next = NULL;
+      return;
+    }
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : unlink_lookup                                                */
+/*                                                                            */
+/* Description : Remove lookup from the send order list.                      */
+/*                                                                            */
+/* Params      : ctx (IN/OUT)             - Resolver context.                 */
+/*               lookup (IN)              - Lookup.                           */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void unlink_lookup(rslv_ctx *ctx, rslv_lookup *lookup)
+{
+  if (lookup->prev)
+  {
+    lookup->prev->next = lookup->next;
+  }
+  else
+  {
+    ctx->head = lookup->next;
+  }
+
+  if (lookup->next)
+  {
+    lookup->next->prev = lookup->prev;
+  }
+  else
+  {
+    ctx->tail = lookup->prev;
+  }
+
+  lookup->prev = lookup->next = NULL;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : arm_timer                                                    */
+/*                                                                            */
+/* Description : Start or stop the timeout tick. The tick only runs while     */
+/*               lookups are pending.                                         */
+/*                                                                            */
+/* Params      : ctx (IN/OUT)             - Resolver context.                 */
+/*               on (IN)                  - TRUE to start, FALSE to stop.     */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void arm_timer(rslv_ctx *ctx, int on)
+{
+  struct itimerspec its;
+
+  if (ctx->is_timer_armed == on)
+  {
+    return;
+  }
+
+  memset(&its, 0, sizeof(its));
+  if (on)
+  {
+    its.it_value.tv_nsec = RSLV_TICK_MS * 1000000L;
+    its.it_interval.tv_nsec = RSLV_TICK_MS * 1000000L;
+  }
+
+  timerfd_settime(ctx->timer_fd, 0, &its, NULL);
+  ctx->is_timer_armed = on;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : send_lookup                                                  */
+/*                                                                            */
+/* Description : Send (or resend) a lookup to its current upstream server     */
+/*               from a fresh socket under a fresh transaction ID and queue   */
+/*               it for timeout.                                              */
+/*                                                                            */
+/* Params      : ctx (IN/OUT)             - Resolver context.                 */
+/*               lookup (IN/OUT)          - Lookup.                           */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int send_lookup(rslv_ctx *ctx, rslv_lookup *lookup)
+{
+  dns_header *hdr = (dns_header *)ctx->buf;
+  struct sockaddr_in *server;
+  char *pkt_ptr;
+  char *label;
+  char *dot;
+  int label_len;
+
+  lookup->txid = next_txid(ctx);
+
+  /****************************************************************************/
+  /* Build a recursive A query.                                               */
+  /****************************************************************************/
+  memset(hdr, 0, sizeof(*hdr));
+  hdr->id = htons(lookup->txid);
+  hdr->fc = htons(DNS_HDR_RD << 8);
+  hdr->q_count = htons(1);
+
+  pkt_ptr = ctx->buf + sizeof(*hdr);
+  for (label = lookup->name; *label; label = dot + 1)
+  {
+    dot = strchr(label, '.');
+    label_len = dot ? (dot - label) : strlen(label);
+
+    *pkt_ptr++ = label_len;
+    memcpy(pkt_ptr, label, label_len);
+    pkt_ptr += label_len;
+
+    if (!dot)
+    {
+      break;
+    }
+  }
+
+  *pkt_ptr++ = 0;
+
+  *((unsigned short *)pkt_ptr) = htons(DNS_RR_TYPE_A);
+  pkt_ptr += sizeof(unsigned short);
+  *((unsigned short *)pkt_ptr) = htons(DNS_RR_CLASS_IN);
+  pkt_ptr += sizeof(unsigned short);
+
+  /****************************************************************************/
+  /* Connecting picks a random ephemeral port and has the kernel drop         */
+  /* datagrams from anyone but the server.                                    */
+  /****************************************************************************/
+  server = &dnswld.rslv.servers[lookup->server];
+  lookup->ctx = ctx;
+  lookup->sock = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if ((lookup->sock < 0) ||
+      (connect(lookup->sock, (struct sockaddr *)server, sizeof(*server))) ||
+      (add_event_source(ctx->loop, &lookup->sock_ev, lookup->sock,
+                        upstream_sock_reader, lookup)))
+  {
+    PUTS_OSYS(LOG_ERR, "Error opening upstream socket. errno: [%d]", errno);
+    lookup->sock_ev.handler = NULL;
+    close_lookup_sock(ctx, lookup);
+  }
+  else if (send(lookup->sock, ctx->buf, pkt_ptr - ctx->buf, 0) < 0)
+  {
+    PUTS_OSYS(LOG_ERR, "Error sending upstream query. errno: [%d]", errno);
+  }
+  else
+  {
+    STATS_INC(n_upstream_sent);
+  }
+
+  /****************************************************************************/
+  /* A failed send is handled like a lost datagram: it times out and retries. */
+  /****************************************************************************/
+  lookup->deadline = get_mono_usecs() + (dnswld.rslv.timeout_ms * 1000UL);
+  lookup->prev = ctx->tail;
+  lookup->next = NULL;
+  if (ctx->tail)
+  {
+    ctx->tail->next = lookup;
+  }
+  else
+  {
+    ctx->head = lookup;
+  }
+  ctx->tail = lookup;
+
+  arm_timer(ctx, TRUE);
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : answer_client                                                */
+/*                                                                            */
+/* Description : Build and send the reply of a parked query once all of its   */
+/*               lookups are done.                                            */
+/*                                                                            */
+/* Params      : ctx (IN)                 - Resolver context.                 */
+/*               client (IN)              - Parked query.                     */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void answer_client(rslv_ctx *ctx, rslv_client *client)
+{
+  dns_header *dns_hdr = (dns_header *)client->pkt;
+  dns_question *qs = ctx->worker->qs;
+  dns_question *q;
+  char *pkt_ptr;
+  int reply_len = 0;
+  int i;
+  int ret;
+
+  /****************************************************************************/
+  /* The request was validated when parked; parse it again into the worker    */
+  /* scratch questions and fill in the answers.                               */
+  /****************************************************************************/
+  pkt_ptr = client->pkt + sizeof(*dns_hdr);
+  ret = parse_question_section(&pkt_ptr, client->pkt_len - sizeof(*dns_hdr),
+                               qs, dns_hdr->q_count);
+  if (ret)
+  {
+    STATS_INC(n_dropped);
+    return;
+  }
+
+  for (i = 0, q = qs; i < dns_hdr->q_count; i++, q++)
+  {
+    q->ans.n_rec = client->ans[i].n_rec;
+    q->ans.tmpl_len = 0;
+    memcpy(q->ans.recs, client->ans[i].recs,
+           q->ans.n_rec * sizeof(in_addr_t));
+  }
+
+  ret = process_requested_domains(&client->addr, qs, dns_hdr->q_count);
+  if (!ret)
+  {
+    ret = process_response(client->pkt, pkt_ptr, dns_hdr, qs, &client->edns,
+                           client->bufz, &reply_len);
+  }
+
+  if ((ret) || (reply_len <= 0))
+  {
+    STATS_INC(n_dropped);
+    return;
+  }
+
+  ret = sendto(client->sock, client->pkt, reply_len, 0,
+               (struct sockaddr *)&client->addr, sizeof(client->addr));
+  if (ret < 0)
+  {
+    PUTS_OSYS(LOG_ERR, "Error in sending response. errno: [%d]", errno);
+    return;
+  }
+
+  STATS_INC(n_responses);
+  stats_add_latency(dnswld.stats.lat_hist,
+                    get_mono_usecs() - client->rcv_time);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : finish_lookup                                                */
+/*                                                                            */
+/* Description : Retire a lookup and hand its answer to every waiting query.  */
+/*               A query is answered when it was its last pending lookup.     */
+/*                                                                            */
+/* Params      : ctx (IN/OUT)             - Resolver context.                 */
+/*               lookup (IN)              - Lookup. Freed.                    */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void finish_lookup(rslv_ctx *ctx, rslv_lookup *lookup)
+{
+  rslv_waiter *waiter;
+  rslv_client *client;
+
+  close_lookup_sock(ctx, lookup);
+  unhash_lookup_name(ctx, lookup);
+  unlink_lookup(ctx, lookup);
+
+  if (!ctx->head)
+  {
+    arm_timer(ctx, FALSE);
+  }
+
+  while ((waiter = lookup->waiters))
+  {
+    lookup->waiters = waiter->next;
+    client = waiter->client;
+    client->ans[waiter->q_idx] = lookup->ans;
+    free(waiter);
+    ctx->n_pending--;
+
+    if (--client->n_pending == 0)
+    {
+      answer_client(ctx, client);
+      free(client);
+    }
+  }
+
+  free(lookup);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : retry_lookup                                                 */
+/*                                                                            */
+/* Description : Resend a lookup to the next upstream server, or give up when */
+/*               the retries are used up.                                     */
+/*                                                                            */
+/* Params      : ctx (IN/OUT)             - Resolver context.                 */
+/*               lookup (IN/OUT)          - Lookup.                           */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void retry_lookup(rslv_ctx *ctx, rslv_lookup *lookup)
+{
+  if (lookup->n_tries > dnswld.rslv.retries)
+  {
+    PUTS_OSYS(LOG_DEBUG, "Upstream lookup of [%s] failed.", lookup->name);
+    finish_lookup(ctx, lookup);
+    return;
+  }
+
+  close_lookup_sock(ctx, lookup);
+  unlink_lookup(ctx, lookup);
+
+  lookup->server = (lookup->server + 1) % dnswld.rslv.n_servers;
+  lookup->n_tries++;
+  send_lookup(ctx, lookup);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : parse_upstream_reply                                         */
+/*                                                                            */
+/* Description : Validate an upstream reply against its lookup and collect    */
+/*               the A records.                                               */
+/*                                                                            */
+/* Params      : pkt (IN)                 - Reply.                            */
+/*               len (IN)                 - Reply length.                     */
+/*               lookup (IN)              - Matching lookup.                  */
+/*               ans (OUT)                - Answer.                           */
+/*               rcode (OUT)              - Response code.                    */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int parse_upstream_reply(unsigned char *pkt, int len,
+                                rslv_lookup *lookup, rslv_answer *ans,
+                                int *rcode)
+{
+  dns_header *hdr = (dns_header *)pkt;
+  unsigned short type;
+  unsigned short class;
+  unsigned short rd_len;
+  unsigned int ttl;
+  int n_ans;
+  int off;
+  int i;
+
+  if ((!(pkt[2] & DNS_HDR_QR)) || (ntohs(hdr->q_count) != 1))
+  {
+    return(RET_MALFORMED_DNS_REQ);
+  }
+
+  /****************************************************************************/
+  /* Question must echo ours.                                                 */
+  /****************************************************************************/
+  off = sizeof(*hdr);
+  if (!dns_name_equal(pkt, len, off, lookup->name))
+  {
+    return(RET_MALFORMED_DNS_REQ);
+  }
+
+  off = dns_skip_name(pkt, len, off);
+  if ((off < 0) || (off + 4 > len) ||
+      (ntohs(*(unsigned short *)&pkt[off]) != DNS_RR_TYPE_A) ||
+      (ntohs(*(unsigned short *)&pkt[off + 2]) != DNS_RR_CLASS_IN))
+  {
+    return(RET_MALFORMED_DNS_REQ);
+  }
+
+  off += 4;
+  *rcode = pkt[3] & DNS_HDR_RC;
+
+  /****************************************************************************/
+  /* Collect A records. CNAMEs ahead of them are skipped; the whitelist entry */
+  /* is for the name asked.                                                   */
+  /****************************************************************************/
+  memset(ans, 0, sizeof(*ans));
+  n_ans = ntohs(hdr->ans_count);
+
+  for (i = 0; (i < n_ans) && (ans->n_rec < DNS_MAX_ANS_RR_NUM); i++)
+  {
+    off = dns_skip_name(pkt, len, off);
+    if ((off < 0) || (off + 10 > len))
+    {
+      return(RET_MALFORMED_DNS_REQ);
+    }
+
+    type = ntohs(*(unsigned short *)&pkt[off]);
+    class = ntohs(*(unsigned short *)&pkt[off + 2]);
+    ttl = ntohl(*(unsigned int *)&pkt[off + 4]);
+    rd_len = ntohs(*(unsigned short *)&pkt[off + 8]);
+    off += 10;
+
+    if (off + rd_len > len)
+    {
+      return(RET_MALFORMED_DNS_REQ);
+    }
+
+    if ((type == DNS_RR_TYPE_A) && (class == DNS_RR_CLASS_IN) &&
+        (rd_len == DNS_RR_TYPE_A_LEN))
+    {
+      memcpy(&ans->recs[ans->n_rec], &pkt[off], DNS_RR_TYPE_A_LEN);
+      if ((!ans->n_rec) || (ttl < ans->ttl))
+      {
+        ans->ttl = ttl;
+      }
+      ans->n_rec++;
+    }
+
+    off += rd_len;
+  }
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : upstream_sock_reader                                         */
+/*                                                                            */
+/* Description : Read an upstream reply to a lookup. The lookup is retired or */
+/*               retried, and its socket closed, once a reply matches.        */
+/*                                                                            */
+/* Params      : param (IN)               - Lookup.                           */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int upstream_sock_reader(void *param)
+{
+  rslv_lookup *lookup = (rslv_lookup *)param;
+  rslv_ctx *ctx = lookup->ctx;
+  unsigned short txid;
+  int rcode = 0;
+  int len;
+  int ret;
+
+  len = recv(lookup->sock, ctx->buf, sizeof(ctx->buf), MSG_DONTWAIT);
+  if (len < 0)
+  {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+    {
+      return(RET_SOCK_WOULD_BLOCK);
+    }
+
+    return(RET_SOCK_READ_ERROR);
+  }
+
+  if (len < (int)sizeof(dns_header))
+  {
+    return(RET_OK);
+  }
+
+  /****************************************************************************/
+  /* The socket only receives from the server. Match the transaction ID;      */
+  /* anything else is spoofed and dropped.                                    */
+  /****************************************************************************/
+  txid = ntohs(((dns_header *)ctx->buf)->id);
+  if (txid != lookup->txid)
+  {
+    PUTS_OSYS(LOG_DEBUG, "Unexpected upstream reply id: [%X]", txid);
+    return(RET_OK);
+  }
+
+  ret = parse_upstream_reply((unsigned char *)ctx->buf, len, lookup,
+                             &lookup->ans, &rcode);
+  if (ret)
+  {
+    PUTS_OSYS(LOG_DEBUG, "Malformed upstream reply id: [%X]", txid);
+    return(RET_OK);
+  }
+
+  /****************************************************************************/
+  /* NOERROR and NXDOMAIN are final. Server failures try the next server.     */
+  /****************************************************************************/
+  if ((rcode == DNS_HDR_RCODE_NO_ERR) || (rcode == DNS_HDR_RCODE_NAME_ERR))
+  {
+    cache_add(lookup->name, lookup->ans.n_rec, lookup->ans.recs,
+              lookup->ans.ttl);
+    finish_lookup(ctx, lookup);
+  }
+  else
+  {
+    PUTS_OSYS(LOG_DEBUG, "Upstream rcode [%d] for [%s].", rcode,
+              lookup->name);
+    memset(&lookup->ans, 0, sizeof(lookup->ans));
+    retry_lookup(ctx, lookup);
+  }
+
+  /****************************************************************************/
+  /* This socket is closed either way.                                        */
+  /****************************************************************************/
+  return(RET_SOCK_WOULD_BLOCK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : upstream_timer_reader                                        */
+/*                                                                            */
+/* Description : Timeout tick. Expired lookups are retried or given up on.    */
+/*                                                                            */
+/* Params      : param (IN)               - Resolver context.                 */
+/*                                                                            */
+/* Returns     : RET_SOCK_WOULD_BLOCK     - Tick consumed.                    */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int upstream_timer_reader(void *param)
+{
+  rslv_ctx *ctx = (rslv_ctx *)param;
+  rslv_lookup *lookup;
+  unsigned long long n_ticks;
+  unsigned long now;
+
+  if (read(ctx->timer_fd, &n_ticks, sizeof(n_ticks)) < 0)
+  {
+    return(RET_SOCK_WOULD_BLOCK);
+  }
+
+  /****************************************************************************/
+  /* Every lookup has the same timeout so the list is in deadline order.      */
+  /****************************************************************************/
+  now = get_mono_usecs();
+  while ((lookup = ctx->head) && (lookup->deadline <= now))
+  {
+    STATS_INC(n_upstream_timeouts);
+    retry_lookup(ctx, lookup);
+  }
+
+  return(RET_SOCK_WOULD_BLOCK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : park_dns_query                                               */
+/*                                                                            */
+/* Description : Park a query on the upstream lookups of its whitelisted A    */
+/*               questions. A name already being looked up is not sent again; */
+/*               the question waits on the pending lookup.                    */
+/*                                                                            */
+/* Params      : ctx (IN/OUT)             - Resolver context.                 */
+/*               sock (IN)                - Socket to reply on.               */
+/*               addr (IN)                - Client address.                   */
+/*               pkt (IN)                 - Request, header in host order.    */
+/*               pkt_len (IN)             - Request length.                   */
+/*               bufz (IN)                - Room for the reply.               */
+/*               edns (IN)                - EDNS0 state of the request.       */
+/*               rcv_time (IN)            - Receive time in usecs.            */
+/*               qs (IN)                  - Parsed questions.                 */
+/*               n_qs (IN)                - Number of questions.              */
+/*                                                                            */
+/* Returns     : RET_OK                   - Parked otherwise error.           */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int park_dns_query(rslv_ctx *ctx, int sock, struct sockaddr_in *addr,
+                   char *pkt, int pkt_len, int bufz, dns_edns *edns,
+                   unsigned long rcv_time, dns_question *qs, int n_qs)
+{
+  rslv_client *client;
+  rslv_waiter *waiters[DNS_MAX_QUESTIONS];
+  rslv_lookup *lookups[DNS_MAX_QUESTIONS];
+  rslv_lookup *lookup;
+  unsigned int hash;
+  int n_lookups = 0;
+  int i;
+
+  if ((ctx->timer_fd < 0) || (!dnswld.rslv.n_servers))
+  {
+    return(RET_DATA_NOT_FOUND);
+  }
+
+  for (i = 0; i < n_qs; i++)
+  {
+    n_lookups += qs[i].is_whitelisted ? 1 : 0;
+  }
+
+  if ((!n_lookups) || (ctx->n_pending + n_lookups > RSLV_MAX_PENDING))
+  {
+    return(RET_DATA_NOT_FOUND);
+  }
+
+  /****************************************************************************/
+  /* The buffer holds the request, which may be larger than the reply limit.  */
+  /****************************************************************************/
+  client = (rslv_client *)calloc(1, sizeof(*client) +
+                                 ((pkt_len > bufz) ? pkt_len : bufz));
+  if (!client)
+  {
+    return(RET_MEMORY_ERROR);
+  }
+
+  client->sock = sock;
+  client->addr = *addr;
+  client->rcv_time = rcv_time;
+  client->pkt_len = pkt_len;
+  client->bufz = bufz;
+  client->edns = *edns;
+  memcpy(client->pkt, pkt, pkt_len);
+
+  /****************************************************************************/
+  /* Keep answers already known, e.g. from the cache.                         */
+  /****************************************************************************/
+  for (i = 0; i < n_qs; i++)
+  {
+    if (!qs[i].is_whitelisted)
+    {
+      client->ans[i].n_rec = qs[i].ans.n_rec;
+      memcpy(client->ans[i].recs, qs[i].ans.recs,
+             qs[i].ans.n_rec * sizeof(in_addr_t));
+    }
+  }
+
+  /****************************************************************************/
+  /* Allocate everything before sending anything, so a failure leaves nothing */
+  /* behind and an early reply can't answer the client too soon.              */
+  /****************************************************************************/
+  memset(waiters, 0, sizeof(waiters));
+  memset(lookups, 0, sizeof(lookups));
+  for (i = 0; i < n_qs; i++)
+  {
+    if (!qs[i].is_whitelisted)
+    {
+      continue;
+    }
+
+    waiters[i] = (rslv_waiter *)calloc(1, sizeof(rslv_waiter));
+    lookups[i] = (rslv_lookup *)calloc(1, sizeof(rslv_lookup));
+    if ((!waiters[i]) || (!lookups[i]))
+    {
+      for (i = 0; i < n_qs; i++)
+      {
+        free(waiters[i]);
+        free(lookups[i]);
+      }
+
+      free(client);
+      return(RET_MEMORY_ERROR);
+    }
+  }
+
+  client->n_pending = n_lookups;
+
+  for (i = 0; i < n_qs; i++)
+  {
+    if (!waiters[i])
+    {
+      continue;
+    }
+
+    /**************************************************************************/
+    /* Join a pending lookup of the same name, or start a new one.            */
+    /**************************************************************************/
+    hash = qs[i].hash;
+    lookup = find_lookup_by_name(ctx, &qs[i]);
+    if (lookup)
+    {
+      PUTS_OSYS(LOG_DEBUG, "[%s] found in whitelist! Lookup pending.",
+                lookup->name);
+      free(lookups[i]);
+      STATS_INC(n_coalesced);
+    }
+    else
+    {
+      lookup = lookups[i];
+      lookup->sock = -1;
+      lookup->n_tries = 1;
+      lookup->name_hash = hash;
+      dns_name_to_str(qs[i].msg, qs[i].name, lookup->name,
+                      sizeof(lookup->name));
+
+      lookup->name_next = ctx->name_hash[hash % RSLV_NAME_HASH_SIZE];
+      ctx->name_hash[hash % RSLV_NAME_HASH_SIZE] = lookup;
+
+      PUTS_OSYS(LOG_DEBUG, "[%s] found in whitelist! Resolving ...",
+                lookup->name);
+      STATS_INC(n_lookups);
+      send_lookup(ctx, lookup);
+    }
+
+    waiters[i]->client = client;
+    waiters[i]->q_idx = i;
+    waiters[i]->next = lookup->waiters;
+    lookup->waiters = waiters[i];
+    ctx->n_pending++;
+  }
+
+  STATS_INC(n_parked);
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : create_resolver                                              */
+/*                                                                            */
+/* Description : Create resolver timer and add it to a loop. Lookups open     */
+/*               their own sockets.                                           */
+/*                                                                            */
+/* Params      : ctx (OUT)                - Resolver context.                 */
+/*               loop (IN)                - Event loop.                       */
+/*               worker (IN)              - Worker owning the loop.           */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int create_resolver(rslv_ctx *ctx, evloop_cb *loop, struct _worker_cb *worker)
+{
+  int ret;
+
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->worker = worker;
+  ctx->loop = loop;
+  ctx->timer_fd = -1;
+  ctx->rand_state = (unsigned int)(get_mono_usecs() ^ (getpid() << 16) ^
+                                   (unsigned long)ctx);
+  if (!ctx->rand_state)
+  {
+    ctx->rand_state = 1;
+  }
+
+  ctx->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (ctx->timer_fd < 0)
+  {
+    PUTS_OSYS(LOG_ERR, "Error creating upstream resolver timer!");
+    ret = RET_SYS_ERROR;
+    goto EXIT;
+  }
+
+  ret = add_event_source(loop, &ctx->timer_ev, ctx->timer_fd,
+                         upstream_timer_reader, ctx);
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : clean_resolver                                               */
+/*                                                                            */
+/* Description : Drop pending lookups and close resolver descriptors.         */
+/*                                                                            */
+/* Params      : ctx (IN/OUT)             - Resolver context.                 */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void clean_resolver(rslv_ctx *ctx)
+{
+  rslv_lookup *lookup;
+  rslv_waiter *waiter;
+
+  if (!ctx->loop)
+  {
+    return;
+  }
+
+  while ((lookup = ctx->head))
+  {
+    close_lookup_sock(ctx, lookup);
+    unlink_lookup(ctx, lookup);
+
+    while ((waiter = lookup->waiters))
+    {
+      lookup->waiters = waiter->next;
+      if (--waiter->client->n_pending == 0)
+      {
+        free(waiter->client);
+      }
+      free(waiter);
+    }
+
+    free(lookup);
+  }
+
+  memset(ctx->name_hash, 0, sizeof(ctx->name_hash));
+  ctx->n_pending = 0;
+  arm_timer(ctx, FALSE);
+
+  if (ctx->timer_fd >= 0)
+  {
+    if (ctx->timer_ev.handler)
+    {
+      del_event_source(ctx->loop, &ctx->timer_ev);
+    }
+    close(ctx->timer_fd);
+    ctx->timer_fd = -1;
+  }
+}
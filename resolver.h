@@ -0,0 +1,148 @@
+/*INC+*************************************************************************/
+/* Filename    : resolver.h                                                   */
+/*                                                                            */
+/* Description : Non-blocking upstream stub resolver header file.             */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*INC+*************************************************************************/
+
+#ifndef _RESOLVER_H
+#define _RESOLVER_H
+
+/******************************************************************************/
+/* Includes.                                                                  */
+/******************************************************************************/
+#include <netinet/in.h>
+
+#include <dns.h>
+#include <evloop.h>
+
+/******************************************************************************/
+/* Constants.                                                                 */
+/******************************************************************************/
+#define RSLV_MAX_SERVERS                          4
+#define RSLV_NAME_HASH_SIZE                       1024
+#define RSLV_MAX_PENDING                          4096
+#define RSLV_TICK_MS                              100
+#define RSLV_PKTZ                                 1232
+
+#define DEF_RSLV_TIMEOUT_MS                       1000
+#define DEF_RSLV_RETRIES                          2
+#define DEF_RSLV_PORT                             53
+#define RSLV_RESOLV_CONF                          "/etc/resolv.conf"
+
+/******************************************************************************/
+/* Upstream answer. A records in network byte order.                          */
+/******************************************************************************/
+typedef struct _rslv_answer
+{
+  int n_rec;
+  unsigned int ttl;
+  in_addr_t recs[DNS_MAX_ANS_RR_NUM];
+} rslv_answer;
+
+
+/******************************************************************************/
+/* Parked client query. Holds a copy of the request (header already in host   */
+/* order) so the reply can be built once every lookup is done.                */
+/******************************************************************************/
+typedef struct _rslv_client
+{
+  int sock;
+  struct sockaddr_in addr;
+  unsigned long rcv_time;
+  int n_pending;
+  int pkt_len;
+  int bufz;
+  dns_edns edns;
+  rslv_answer ans[DNS_MAX_QUESTIONS];
+  char pkt[];
+} rslv_client;
+
+
+/******************************************************************************/
+/* Question of a parked query waiting on a lookup.                            */
+/******************************************************************************/
+typedef struct _rslv_waiter
+{
+  struct _rslv_waiter *next;
+  rslv_client *client;
+  int q_idx;
+} rslv_waiter;
+
+
+/******************************************************************************/
+/* Pending upstream lookup. Queries for a name already being looked up wait   */
+/* on the same lookup instead of starting their own.                          */
+/* - sock is connected to the server from a fresh ephemeral port on every     */
+/*   try, so a spoofed reply must guess the port as well as the txid.         */
+/* - name_next chains lookups in the name hash.                               */
+/* - prev/next keep lookups in send order. The timeout is the same for all,   */
+/*   so the list head always expires first.                                   */
+/******************************************************************************/
+typedef struct _rslv_lookup
+{
+  struct _rslv_lookup *name_next;
+  struct _rslv_lookup *prev;
+  struct _rslv_lookup *next;
+  struct _rslv_ctx *ctx;
+  int sock;
+  ev_source sock_ev;
+  unsigned short txid;
+  unsigned int name_hash;
+  int server;
+  int n_tries;
+  unsigned long deadline;
+  rslv_waiter *waiters;
+  rslv_answer ans;
+  char name[DNS_MAX_NAME_LEN + 1];
+} rslv_lookup;
+
+
+/******************************************************************************/
+/* Resolver context. One per event loop (DNS worker).                         */
+/* - n_pending counts parked questions.                                       */
+/******************************************************************************/
+typedef struct _rslv_ctx
+{
+  struct _worker_cb *worker;
+  evloop_cb *loop;
+  int timer_fd;
+  int is_timer_armed;
+  ev_source timer_ev;
+  unsigned int rand_state;
+  int n_pending;
+  rslv_lookup *head;
+  rslv_lookup *tail;
+  rslv_lookup *name_hash[RSLV_NAME_HASH_SIZE];
+  char buf[RSLV_PKTZ];
+} rslv_ctx;
+
+
+/******************************************************************************/
+/* Resolver settings.                                                         */
+/******************************************************************************/
+typedef struct _rslv_cfg
+{
+  int n_servers;
+  struct sockaddr_in servers[RSLV_MAX_SERVERS];
+  int timeout_ms;
+  int retries;
+} rslv_cfg;
+
+
+/******************************************************************************/
+/* Forwards decls.                                                            */
+/******************************************************************************/
+extern int add_upstream_servers(char *entries);
+extern int load_resolv_conf(void);
+extern int create_resolver(rslv_ctx *ctx, evloop_cb *loop,
+                           struct _worker_cb *worker);
+extern void clean_resolver(rslv_ctx *ctx);
+extern int park_dns_query(rslv_ctx *ctx, int sock, struct sockaddr_in *addr,
+                          char *pkt, int pkt_len, int bufz, dns_edns *edns,
+                          unsigned long rcv_time, dns_question *qs, int n_qs);
+
+#endif
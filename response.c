@@ -16,83 +16,145 @@
 #include <netdb.h>
 
 
+/*FUNC+************************************************************************/
+/* Function    : encode_a_answers                                             */
+/*                                                                            */
+/* Description : Encode A records of a name as answer RRs. The owner name is  */
+/*               a compression pointer to the question. Stops at the end of   */
+/*               the buffer.                                                  */
+/*                                                                            */
+/* Params      : buf (OUT)                - Buffer.                           */
+/*               size (IN)                - Size of buffer.                   */
+/*               name_off (IN)            - Message offset of owner name.     */
+/*               recs (IN)                - Records, network byte order.      */
+/*               n_rec (IN)               - Number of records.                */
+/*               len (OUT)                - Number of bytes encoded.          */
+/*                                                                            */
+/* Returns     : n                        - Number of records encoded.        */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int encode_a_answers(unsigned char *buf, int size, int name_off,
+                     in_addr_t *recs, int n_rec, int *len)
+{
+  unsigned char *last = buf;
+  int i;
+
+  for (i = 0; (i < n_rec) && ((last - buf) + DNS_A_RR_LEN <= size); i++)
+  {
+    *((unsigned short *)last) = htons(DNS_PTR_TO(name_off));
+    last += sizeof(unsigned short);
+
+    *((unsigned short *)last) = htons(DNS_RR_TYPE_A);
+    last += sizeof(unsigned short);
+
+    *((unsigned short *)last) = htons(DNS_RR_CLASS_IN);
+    last += sizeof(unsigned short);
+
+    *((unsigned int *)last) = htonl(DNS_MAX_DEFAULT_TTL);
+    last += sizeof(unsigned int);
+
+    *((unsigned short *)last) = htons(DNS_RR_TYPE_A_LEN);
+    last += sizeof(unsigned short);
+
+    memcpy(last, &recs[i], DNS_RR_TYPE_A_LEN);
+    last += DNS_RR_TYPE_A_LEN;
+  }
+
+  *len = last - buf;
+
+  return(i);
+}
+
+
 /*FUNC+************************************************************************/
 /* Function    : process_response                                             */
 /*                                                                            */
-/* Description : Process DNS response.                                        */
+/* Description : Process DNS response. The reply is built in place over the   */
+/*               request. An EDNS0 request gets an OPT RR back. Sending is    */
+/*               left to the caller so replies can be flushed in batches.     */
 /*                                                                            */
-/* Params      : listener (IN)            - Listener CB.                      */
-/*               d_addr (IN)              - Destination address.              */
+/* Params      : pkt_buf (IN/OUT)         - Packet buffer holding request.    */
 /*               last (IN)                - Pointer to last part of request.  */
 /*               dns_hdr (IN)             - DNS header.                       */
 /*               q (IN)                   - Questions with answers.           */
+/*               edns (IN)                - EDNS0 state of the request.       */
+/*               bufz (IN)                - Reply size limit.                 */
+/*               reply_len (OUT)          - Length of reply.                  */
 /*                                                                            */
 /* Returns     : RET_OK                   - Success otherwise error.          */
 /*                                                                            */
 /*FUNC-************************************************************************/
-int process_response(listeners_cb *listener, struct sockaddr_in *d_addr,
-                     char *last, dns_header *dns_hdr, dns_question *q)
+int process_response(char *pkt_buf, char *last, dns_header *dns_hdr,
+                     dns_question *q, dns_edns *edns, int bufz,
+                     int *reply_len)
 {
-  unsigned short fc = 0;
-  int pkt_len;
-  int label_len;
-  int i;
-  int ii;
-  int ret;
+  unsigned short fc;
+  int ext_rcode = 0;
+  int room;
+  int len;
+  int n = 0;
 
   PUTS_OSYS(LOG_DEBUG, "Processing response ...");
 
   /****************************************************************************/
-  /* Update DNS header.                                                       */
+  /* Update DNS header. Opcode and RD are echoed from the request; the header */
+  /* is in host order, so flags are built in host order and swapped once.     */
   /****************************************************************************/
-  dns_hdr->id = ntohs(dns_hdr->id);
-  fc |= DNS_HDR_QR_RESP;
+  dns_hdr->id = htons(dns_hdr->id);
+  fc = (dns_hdr->fc & ((DNS_HDR_OPCODE | DNS_HDR_RD) << 8)) |
+       (DNS_HDR_QR_RESP << 8) | DNS_HDR_RA;
   dns_hdr->q_count = htons(dns_hdr->q_count);
 
-  pkt_len = last - dnswld.proc.pkt_buf;
+  /****************************************************************************/
+  /* Answers leave room for the OPT RR.                                       */
+  /****************************************************************************/
+  room = bufz - (last - pkt_buf) - (edns->is_present ? DNS_OPT_RR_LEN : 0);
 
-  if (q->ans.n_rec > 0)
+  /****************************************************************************/
+  /* A question section that alone exceeds the reply limit can't be echoed.   */
+  /* Reply FORMERR with the header only.                                      */
+  /****************************************************************************/
+  if (room < 0)
+  {
+    PUTS_OSYS(LOG_DEBUG, " Question section too long for reply: [%d]",
+              (int)(last - pkt_buf));
+    last = pkt_buf + sizeof(dns_header);
+    dns_hdr->q_count = 0;
+    fc |= DNS_HDR_RCODE_FORMAT_ERR;
+  }
+  else if (edns->version)
+  {
+    ext_rcode = DNS_EXT_RCODE_BADVERS;
+  }
+  else if (q->ans.n_rec > 0)
   {
     fc |= DNS_HDR_RCODE_NO_ERR;
-    dns_hdr->ans_count = htons(q->ans.n_rec);
 
     /**************************************************************************/
-    /* Encode answers.                                                        */
+    /* Cached names have their answer section ready, pointing at the first    */
+    /* question; otherwise encode it. Stop at the end of the buffer; adjacent */
+    /* ring slots must never be overwritten.                                  */
     /**************************************************************************/
-    for (i = 0; i < q->ans.n_rec; i++)
+    if ((q->ans.tmpl_len) && (q->ans.tmpl_len <= room) &&
+        ((char *)q->name == pkt_buf + sizeof(dns_header)))
+    {
+      memcpy(last, q->ans.tmpl, q->ans.tmpl_len);
+      last += q->ans.tmpl_len;
+      n = q->ans.n_rec;
+      STATS_INC(n_tmpl_replies);
+    }
+    else
     {
-      for (ii = 0; ii < q->n_label; ii++)
+      n = encode_a_answers((unsigned char *)last, room,
+                           (char *)q->name - pkt_buf, q->ans.recs,
+                           q->ans.n_rec, &len);
+      last += len;
+
+      if (n < q->ans.n_rec)
       {
-        label_len = strlen(q->labels[ii]);
-        *last = label_len;
-        last++;
-        memcpy(last, q->labels[ii], label_len);
-        last += label_len;
+        PUTS_OSYS(LOG_DEBUG, " Reply truncated at rec[%d].", n);
+        fc |= DNS_HDR_TC << 8;
       }
-
-      *last = 0;
-      last++;
-
-      pkt_len = last - dnswld.proc.pkt_buf;
-
-      *((unsigned short *)last) = htons(DNS_RR_TYPE_A);
-      last += sizeof(unsigned short);
-
-      *((unsigned short *)last) = htons(DNS_RR_CLASS_IN);
-      last += sizeof(unsigned short);
-
-      *((unsigned int *)last) = 0;
-      last += sizeof(unsigned int);
-
-      *((unsigned short *)last) = htons(DNS_RR_TYPE_A_LEN);
-      last += sizeof(unsigned short);
-
-      /************************************************************************/
-      /* Encode resource data.                                                */
-      /************************************************************************/
-      PUTS_OSYS(LOG_DEBUG, " rec[%d]: [%s]", i, q->ans.recs[i]);
-      inet_aton(q->ans.recs[i], (struct in_addr *)last);
-      last += DNS_RR_TYPE_A_LEN;
     }
   }
   else
@@ -100,26 +162,37 @@ int process_response(listeners_cb *listener, struct sockaddr_in *d_addr,
     fc |= DNS_HDR_RCODE_NAME_ERR;
   }
 
-  dns_hdr->fc = fc;
-  pkt_len = last - dnswld.proc.pkt_buf;
-  PUTS_OSYS(LOG_DEBUG, "pkt_len: [%d]", pkt_len);
+  dns_hdr->ans_count = htons(n);
+  dns_hdr->ns_count = 0;
+  dns_hdr->addrec_count = 0;
 
   /****************************************************************************/
-  /* Send reply.                                                              */
+  /* Echo OPT: root owner, our payload size as class, extended RCODE and      */
+  /* version 0 in the TTL, no options.                                        */
   /****************************************************************************/
-  ret = sendto(listener->sock, dnswld.proc.pkt_buf, pkt_len, 0,
-               (struct sockaddr *)d_addr, sizeof(struct sockaddr));
-  if (ret != pkt_len)
+  if ((edns->is_present) && ((last - pkt_buf) + DNS_OPT_RR_LEN <= bufz))
   {
-    PUTS_OSYS(LOG_ERR, "Error in sending response. ret: [%d]", ret);
-    ret = RET_SOCK_WRITE_ERROR;
-    goto EXIT;
+    *last++ = 0;
+
+    *((unsigned short *)last) = htons(DNS_RR_TYPE_OPT);
+    last += sizeof(unsigned short);
+
+    *((unsigned short *)last) = htons(dnswld.proc.edns_payload);
+    last += sizeof(unsigned short);
+
+    *((unsigned int *)last) = htonl(ext_rcode << 24);
+    last += sizeof(unsigned int);
+
+    *((unsigned short *)last) = 0;
+    last += sizeof(unsigned short);
+
+    dns_hdr->addrec_count = htons(1);
   }
 
-  ret = RET_OK;
+  dns_hdr->fc = htons(fc);
 
-  EXIT:
+  *reply_len = last - pkt_buf;
+  PUTS_OSYS(LOG_DEBUG, "pkt_len: [%d]", *reply_len);
 
-  return(ret);
+  return(RET_OK);
 }
-
@@ -14,6 +14,9 @@
 /******************************************************************************/
 /* Forwards decls.                                                            */
 /******************************************************************************/
-extern int process_response(listeners_cb *listener, struct sockaddr_in *d_addr,
-                            char *last, dns_header *dns_hdr, dns_question *q);
+extern int encode_a_answers(unsigned char *buf, int size, int name_off,
+                            in_addr_t *recs, int n_rec, int *len);
+extern int process_response(char *pkt_buf, char *last, dns_header *dns_hdr,
+                            dns_question *q, dns_edns *edns, int bufz,
+                            int *reply_len);
 #endif
@@ -113,5 +113,25 @@
 /******************************************************************************/
 #define RET_DATA_NOT_FOUND                        17
 
+/******************************************************************************/
+/* Non-blocking descriptor drained.                                           */
+/******************************************************************************/
+#define RET_SOCK_WOULD_BLOCK                      18
+
+/******************************************************************************/
+/* DNS query parked until upstream lookups finish.                            */
+/******************************************************************************/
+#define RET_QUERY_PARKED                          19
+
+/******************************************************************************/
+/* Bounded queue full.                                                        */
+/******************************************************************************/
+#define RET_QUEUE_FULL                            20
+
+/******************************************************************************/
+/* Firewall thread not running.                                               */
+/******************************************************************************/
+#define RET_FW_NOT_STARTED                        21
+
 #endif
 
@@ -0,0 +1,433 @@
+/*FILE+************************************************************************/
+/* Filename    : rhash.c                                                      */
+/*                                                                            */
+/* Description : Robin Hood open addressing hash table keyed by 64-bit ints.  */
+/*               Deletion shifts the following run back instead of leaving    */
+/*               tombstones, and growth is spread over later operations.      */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <rhash.h>
+
+
+/*FUNC+************************************************************************/
+/* Function    : hash_key                                                     */
+/*                                                                            */
+/* Description : Mix a 64-bit key (MurmurHash3 finalizer).                    */
+/*                                                                            */
+/* Params      : key (IN)                 - Key.                              */
+/*                                                                            */
+/* Returns     : hash                     - Hash value.                       */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static inline unsigned int hash_key(unsigned long long key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+
+  return((unsigned int)key);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : probe_dist                                                   */
+/*                                                                            */
+/* Description : Distance of a slot from the home slot of its item.           */
+/*                                                                            */
+/* Params      : t (IN)                   - Slot array.                       */
+/*               idx (IN)                 - Slot index.                       */
+/*                                                                            */
+/* Returns     : dist                     - Probe distance.                   */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static inline unsigned int probe_dist(rhash_table *t, unsigned int idx)
+{
+  return((idx - t->slots[idx].hash) & (t->n_slots - 1));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : table_find                                                   */
+/*                                                                            */
+/* Description : Find the slot of a key. The search stops as soon as it       */
+/*               meets an item closer to home than the key would be.          */
+/*                                                                            */
+/* Params      : t (IN)                   - Slot array.                       */
+/*               key (IN)                 - Key.                              */
+/*               hash (IN)                - Hash of key.                      */
+/*                                                                            */
+/* Returns     : idx                      - Slot index otherwise -1.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int table_find(rhash_table *t, unsigned long long key,
+                      unsigned int hash)
+{
+  unsigned int mask = t->n_slots - 1;
+  unsigned int idx;
+  unsigned int dist;
+
+  if (!t->n_items)
+  {
+    return(-1);
+  }
+
+  for (idx = hash & mask, dist = 0; ; idx = (idx + 1) & mask, dist++)
+  {
+    if ((!t->slots[idx].item) || (probe_dist(t, idx) < dist))
+    {
+      return(-1);
+    }
+
+    if ((t->slots[idx].hash == hash) && (t->slots[idx].key == key))
+    {
+      return(idx);
+    }
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : table_insert                                                 */
+/*                                                                            */
+/* Description : Insert an item. Richer items (closer to home) give up their  */
+/*               slot to poorer ones, keeping probe lengths even.             */
+/*                                                                            */
+/* Params      : t (IN/OUT)               - Slot array. Must have room.       */
+/*               key (IN)                 - Key.                              */
+/*               hash (IN)                - Hash of key.                      */
+/*               item (IN)                - Item.                             */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void table_insert(rhash_table *t, unsigned long long key,
+                         unsigned int hash, void *item)
+{
+  rhash_slot entry;
+  rhash_slot tmp;
+  unsigned int mask = t->n_slots - 1;
+  unsigned int idx;
+  unsigned int dist;
+  unsigned int cur_dist;
+
+  entry.key = key;
+  entry.item = item;
+  entry.hash = hash & mask;
+
+  for (idx = entry.hash, dist = 0; ; idx = (idx + 1) & mask, dist++)
+  {
+    if (!t->slots[idx].item)
+    {
+      t->slots[idx] = entry;
+      t->n_items++;
+      return;
+    }
+
+    cur_dist = probe_dist(t, idx);
+    if (cur_dist < dist)
+    {
+      tmp = t->slots[idx];
+      t->slots[idx] = entry;
+      entry = tmp;
+      dist = cur_dist;
+    }
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : table_remove_at                                              */
+/*                                                                            */
+/* Description : Empty a slot and shift the rest of its run back by one.      */
+/*                                                                            */
+/* Params      : t (IN/OUT)               - Slot array.                       */
+/*               idx (IN)                 - Slot index.                       */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void table_remove_at(rhash_table *t, unsigned int idx)
+{
+  unsigned int mask = t->n_slots - 1;
+  unsigned int next;
+
+  for (next = (idx + 1) & mask;
+       (t->slots[next].item) && (probe_dist(t, next));
+       idx = next, next = (next + 1) & mask)
+  {
+    t->slots[idx] = t->slots[next];
+  }
+
+  t->slots[idx].item = NULL;
+  t->n_items--;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : migrate_step                                                 */
+/*                                                                            */
+/* Description : Move a few items from the old slot array to the current one. */
+/*               Slots below migrate_pos are always empty, so removals in the */
+/*               old array never shift an item behind it.                     */
+/*                                                                            */
+/* Params      : h (IN/OUT)               - Hash table.                       */
+/*               n_steps (IN)             - Max slots to visit.               */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void migrate_step(rhash *h, unsigned int n_steps)
+{
+  rhash_slot *slot;
+
+  while ((h->old.slots) && (n_steps--))
+  {
+    if ((!h->old.n_items) || (h->migrate_pos >= h->old.n_slots))
+    {
+      free(h->old.slots);
+      memset(&h->old, 0, sizeof(h->old));
+      h->migrate_pos = 0;
+      return;
+    }
+
+    slot = &h->old.slots[h->migrate_pos];
+    if (!slot->item)
+    {
+      h->migrate_pos++;
+      continue;
+    }
+
+    table_insert(&h->cur, slot->key, hash_key(slot->key), slot->item);
+    table_remove_at(&h->old, h->migrate_pos);
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rhash_init                                                   */
+/*                                                                            */
+/* Description : Initialize an empty hash table.                              */
+/*                                                                            */
+/* Params      : h (OUT)                  - Hash table.                       */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int rhash_init(rhash *h)
+{
+  memset(h, 0, sizeof(*h));
+
+  h->cur.slots = (rhash_slot *)calloc(RHASH_MIN_SLOTS, sizeof(rhash_slot));
+  if (!h->cur.slots)
+  {
+    return(RET_MEMORY_ERROR);
+  }
+
+  h->cur.n_slots = RHASH_MIN_SLOTS;
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rhash_free                                                   */
+/*                                                                            */
+/* Description : Free slot arrays. Items are owned by the caller.             */
+/*                                                                            */
+/* Params      : h (IN/OUT)               - Hash table.                       */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void rhash_free(rhash *h)
+{
+  free(h->cur.slots);
+  free(h->old.slots);
+  memset(h, 0, sizeof(*h));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rhash_find                                                   */
+/*                                                                            */
+/* Description : Find the item of a key.                                      */
+/*                                                                            */
+/* Params      : h (IN)                   - Hash table.                       */
+/*               key (IN)                 - Key.                              */
+/*                                                                            */
+/* Returns     : item                     - Item otherwise NULL.              */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void *rhash_find(rhash *h, unsigned long long key)
+{
+  unsigned int hash = hash_key(key);
+  int idx;
+
+  idx = table_find(&h->cur, key, hash & (h->cur.n_slots - 1));
+  if (idx >= 0)
+  {
+    return(h->cur.slots[idx].item);
+  }
+
+  if (h->old.slots)
+  {
+    idx = table_find(&h->old, key, hash & (h->old.n_slots - 1));
+    if (idx >= 0)
+    {
+      return(h->old.slots[idx].item);
+    }
+  }
+
+  return(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rhash_insert                                                 */
+/*                                                                            */
+/* Description : Insert an item. The key must not be present.                 */
+/*                                                                            */
+/* Params      : h (IN/OUT)               - Hash table.                       */
+/*               key (IN)                 - Key.                              */
+/*               item (IN)                - Item. Not NULL.                   */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int rhash_insert(rhash *h, unsigned long long key, void *item)
+{
+  rhash_slot *slots;
+
+  migrate_step(h, RHASH_MIGRATE_STEP);
+
+  /****************************************************************************/
+  /* Start growing at 3/4 load. A pending migration is finished first; with   */
+  /* the step above it has always ended well before this point.               */
+  /****************************************************************************/
+  if ((h->cur.n_items + 1) * 4 > h->cur.n_slots * 3)
+  {
+    migrate_step(h, (unsigned int)-1);
+
+    slots = (rhash_slot *)calloc(h->cur.n_slots * 2, sizeof(rhash_slot));
+    if (!slots)
+    {
+      return(RET_MEMORY_ERROR);
+    }
+
+    h->old = h->cur;
+    h->cur.slots = slots;
+    h->cur.n_slots *= 2;
+    h->cur.n_items = 0;
+    h->migrate_pos = 0;
+  }
+
+  table_insert(&h->cur, key, hash_key(key), item);
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rhash_remove                                                 */
+/*                                                                            */
+/* Description : Remove the item of a key.                                    */
+/*                                                                            */
+/* Params      : h (IN/OUT)               - Hash table.                       */
+/*               key (IN)                 - Key.                              */
+/*                                                                            */
+/* Returns     : item                     - Removed item otherwise NULL.      */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void *rhash_remove(rhash *h, unsigned long long key)
+{
+  unsigned int hash = hash_key(key);
+  void *item;
+  int idx;
+
+  migrate_step(h, RHASH_MIGRATE_STEP);
+
+  idx = table_find(&h->cur, key, hash & (h->cur.n_slots - 1));
+  if (idx >= 0)
+  {
+    item = h->cur.slots[idx].item;
+    table_remove_at(&h->cur, idx);
+    return(item);
+  }
+
+  if (h->old.slots)
+  {
+    idx = table_find(&h->old, key, hash & (h->old.n_slots - 1));
+    if (idx >= 0)
+    {
+      item = h->old.slots[idx].item;
+      table_remove_at(&h->old, idx);
+      return(item);
+    }
+  }
+
+  return(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rhash_count                                                  */
+/*                                                                            */
+/* Description : Number of items.                                             */
+/*                                                                            */
+/* Params      : h (IN)                   - Hash table.                       */
+/*                                                                            */
+/* Returns     : n                        - Number of items.                  */
+/*                                                                            */
+/*FUNC-************************************************************************/
+unsigned int rhash_count(rhash *h)
+{
+  return(h->cur.n_items + h->old.n_items);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : rhash_walk                                                   */
+/*                                                                            */
+/* Description : Call a function on every item, in no particular order. The   */
+/*               table must not be changed during the walk.                   */
+/*                                                                            */
+/* Params      : h (IN)                   - Hash table.                       */
+/*               fn (IN)                  - Callback. Non-zero stops the      */
+/*                                          walk.                             */
+/*               arg (IN)                 - Callback argument.                */
+/*                                                                            */
+/* Returns     : ret                      - Callback return that stopped the  */
+/*                                          walk, otherwise 0.                */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int rhash_walk(rhash *h, rhash_walk_fn fn, void *arg)
+{
+  rhash_table *tables[2] = {&h->cur, &h->old};
+  unsigned int i;
+  int t;
+  int ret;
+
+  for (t = 0; t < 2; t++)
+  {
+    for (i = 0; i < tables[t]->n_slots; i++)
+    {
+      if (tables[t]->slots[i].item)
+      {
+        ret = fn(tables[t]->slots[i].item, arg);
+        if (ret)
+        {
+          return(ret);
+        }
+      }
+    }
+  }
+
+  return(0);
+}
@@ -0,0 +1,73 @@
+/*INC+*************************************************************************/
+/* Filename    : rhash.h                                                      */
+/*                                                                            */
+/* Description : Robin Hood open addressing hash table header file.           */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*INC+*************************************************************************/
+
+#ifndef _RHASH_H
+#define _RHASH_H
+
+/******************************************************************************/
+/* Constants.                                                                 */
+/* - Tables grow at 3/4 load. Each operation moves up to RHASH_MIGRATE_STEP   */
+/*   slots of the previous table, so no single call pays for a full rehash.   */
+/******************************************************************************/
+#define RHASH_MIN_SLOTS                           64
+#define RHASH_MIGRATE_STEP                        32
+
+/******************************************************************************/
+/* Hash slot. An empty slot has a NULL item.                                  */
+/******************************************************************************/
+typedef struct _rhash_slot
+{
+  unsigned long long key;
+  void *item;
+  unsigned int hash;
+} rhash_slot;
+
+
+/******************************************************************************/
+/* Slot array.                                                                */
+/******************************************************************************/
+typedef struct _rhash_table
+{
+  rhash_slot *slots;
+  unsigned int n_slots;
+  unsigned int n_items;
+} rhash_table;
+
+
+/******************************************************************************/
+/* Hash table. While growing, items live in either table: new items go to     */
+/* cur and old is drained from slot migrate_pos upward.                       */
+/******************************************************************************/
+typedef struct _rhash
+{
+  rhash_table cur;
+  rhash_table old;
+  unsigned int migrate_pos;
+} rhash;
+
+
+/******************************************************************************/
+/* Walk callback.                                                             */
+/******************************************************************************/
+typedef int (*rhash_walk_fn)(void *item, void *arg);
+
+
+/******************************************************************************/
+/* Forwards decls.                                                            */
+/******************************************************************************/
+extern int rhash_init(rhash *h);
+extern void rhash_free(rhash *h);
+extern void *rhash_find(rhash *h, unsigned long long key);
+extern int rhash_insert(rhash *h, unsigned long long key, void *item);
+extern void *rhash_remove(rhash *h, unsigned long long key);
+extern unsigned int rhash_count(rhash *h);
+extern int rhash_walk(rhash *h, rhash_walk_fn fn, void *arg);
+
+#endif
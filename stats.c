@@ -0,0 +1,54 @@
+/*FILE+************************************************************************/
+/* Filename    : stats.c                                                      */
+/*                                                                            */
+/* Description : Daemon statistics routines.                                  */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+
+
+/*FUNC+************************************************************************/
+/* Function    : init_stats                                                   */
+/*                                                                            */
+/* Description : Reset statistics.                                            */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void init_stats(void)
+{
+  memset(&dnswld.stats, 0, sizeof(dnswld.stats));
+  dnswld.stats.started_at = time(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : stats_add_latency                                            */
+/*                                                                            */
+/* Description : Add latency sample to a log2 histogram.                      */
+/*                                                                            */
+/* Params      : hist (IN/OUT)            - Histogram of STATS_LAT_BUCKETS.   */
+/*               usecs (IN)               - Sample in usecs.                  */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void stats_add_latency(unsigned long *hist, unsigned long usecs)
+{
+  int idx = 0;
+
+  while ((usecs) && (idx < STATS_LAT_BUCKETS - 1))
+  {
+    usecs >>= 1;
+    idx++;
+  }
+
+  __sync_fetch_and_add(&hist[idx], 1);
+}
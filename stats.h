@@ -0,0 +1,78 @@
+/*INC+*************************************************************************/
+/* Filename    : stats.h                                                      */
+/*                                                                            */
+/* Description : Daemon statistics counters.                                  */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*INC+*************************************************************************/
+
+#ifndef _STATS_H
+#define _STATS_H
+
+/******************************************************************************/
+/* Includes.                                                                  */
+/******************************************************************************/
+#include <time.h>
+
+/******************************************************************************/
+/* Constants.                                                                 */
+/* - Latency histogram bucket i counts samples below 2^i usecs. The last      */
+/*   bucket takes everything above.                                           */
+/******************************************************************************/
+#define STATS_LAT_BUCKETS                         20
+
+/******************************************************************************/
+/* Counter update macros. Counters are shared by all threads.                 */
+/******************************************************************************/
+#define STATS_INC(f)                              __sync_fetch_and_add(&dnswld.stats.f, 1)
+#define STATS_ADD(f,v)                            __sync_fetch_and_add(&dnswld.stats.f, (v))
+
+/******************************************************************************/
+/* Statistics CB.                                                             */
+/******************************************************************************/
+typedef struct _stats_cb
+{
+  time_t started_at;
+  unsigned long n_queries;
+  unsigned long n_responses;
+  unsigned long n_dropped;
+  unsigned long n_wakeups;
+  unsigned long n_events;
+  unsigned long n_workers;
+  unsigned long batch_size;
+  unsigned long n_rx_batches;
+  unsigned long n_tx_batches;
+  unsigned long n_parked;
+  unsigned long n_upstream_sent;
+  unsigned long n_upstream_timeouts;
+  unsigned long n_lookups;
+  unsigned long n_coalesced;
+  unsigned long n_cache_hits;
+  unsigned long n_cache_misses;
+  unsigned long n_tmpl_replies;
+  unsigned long n_fw_cmds;
+  unsigned long n_fw_batches;
+  unsigned long n_fw_errors;
+  unsigned long n_fw_queue_full;
+  unsigned long n_fw_coalesced;
+  unsigned long n_ct_events;
+  unsigned long n_ct_overruns;
+  unsigned long n_ct_resyncs;
+  unsigned long n_acl_refreshes;
+  unsigned long n_acl_reclaimed;
+  unsigned long n_reconciles;
+  unsigned long n_reconcile_fixes;
+  unsigned long reconcile_usecs;
+  unsigned long lat_hist[STATS_LAT_BUCKETS];
+} stats_cb;
+
+
+/******************************************************************************/
+/* Forwards decls.                                                            */
+/******************************************************************************/
+extern void init_stats(void);
+extern void stats_add_latency(unsigned long *hist, unsigned long usecs);
+
+#endif
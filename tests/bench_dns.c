@@ -0,0 +1,245 @@
+/*FILE+************************************************************************/
+/* Filename    : bench_dns.c                                                  */
+/*                                                                            */
+/* Description : Benchmarks of DNS message encoding and decoding.             */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <network.h>
+#include <response.h>
+
+#include <test.h>
+
+#define BENCH_ITERS                               2000000
+
+
+/*FUNC+************************************************************************/
+/* Function    : encode_name                                                  */
+/*                                                                            */
+/* Description : Encode a dotted name with its root label.                    */
+/*                                                                            */
+/* Returns     : len                      - Encoded length.                   */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int encode_name(unsigned char *buf, char *name)
+{
+  char *dot;
+  int len = 0;
+  int label_len;
+
+  while (*name)
+  {
+    dot = strchr(name, '.');
+    label_len = (dot) ? dot - name : strlen(name);
+
+    buf[len++] = label_len;
+    memcpy(&buf[len], name, label_len);
+    len += label_len;
+    name += (dot) ? label_len + 1 : label_len;
+  }
+
+  buf[len++] = 0;
+
+  return(len);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : build_query                                                  */
+/*                                                                            */
+/* Description : Build an A/IN query. With n_q of 2 the second question is    */
+/*               "mail" and a pointer to the parent of the first.             */
+/*                                                                            */
+/* Returns     : len                      - Message length.                   */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int build_query(unsigned char *msg, char *name, int n_q)
+{
+  static unsigned char type_class[] = {0, DNS_RR_TYPE_A, 0, DNS_RR_CLASS_IN};
+  int len = sizeof(dns_header);
+  int ptr;
+
+  memset(msg, 0, sizeof(dns_header));
+  ((dns_header *)msg)->q_count = htons(n_q);
+
+  len += encode_name(&msg[len], name);
+  memcpy(&msg[len], type_class, sizeof(type_class));
+  len += sizeof(type_class);
+
+  if (n_q > 1)
+  {
+    ptr = DNS_PTR_TO(sizeof(dns_header) + 1 + msg[sizeof(dns_header)]);
+    len += encode_name(&msg[len], "mail") - 1;
+    msg[len++] = ptr >> 8;
+    msg[len++] = ptr & 0xFF;
+    memcpy(&msg[len], type_class, sizeof(type_class));
+    len += sizeof(type_class);
+  }
+
+  return(len);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : bench_parse                                                  */
+/*                                                                            */
+/* Description : Question section parse time, plain and compressed.           */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void bench_parse(char *name, int n_q)
+{
+  unsigned char msg[DNS_PAYLOADZ];
+  dns_question qs[DNS_MAX_QUESTIONS];
+  char *pkt_ptr;
+  double start;
+  int len;
+  long i;
+
+  len = build_query(msg, name, n_q);
+
+  start = test_now_ns();
+  for (i = 0; i < BENCH_ITERS; i++)
+  {
+    pkt_ptr = (char *)msg + sizeof(dns_header);
+    if (parse_question_section(&pkt_ptr, len - sizeof(dns_header), qs, n_q))
+    {
+      printf("parse failed\n");
+      return;
+    }
+  }
+
+  printf("parse   %-24s q=%d %4d bytes %8.1f ns/query\n", name, n_q, len,
+         (test_now_ns() - start) / BENCH_ITERS);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : bench_parse_match                                            */
+/*                                                                            */
+/* Description : Parse a query and look its name up in the whitelist, the     */
+/*               per query work of the listener. Names alternate between      */
+/*               exact, wildcard and missing entries.                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void bench_parse_match(void)
+{
+  static char *names[] = {"www.facebook.com", "a.b.example.org",
+    "nothing.here.net", "x.y.z.w.v.u.deep.example.com"};
+  unsigned char msgs[4][DNS_PAYLOADZ];
+  dns_question qs[DNS_MAX_QUESTIONS];
+  char exact[] = "www.facebook.com";
+  char wildcard[] = "*.example.org";
+  char *pkt_ptr;
+  double start;
+  int lens[4];
+  int hits = 0;
+  int k;
+  long i;
+
+  create_name_index(&dnswld.ds.whitelist);
+  add_name_to_dictionary(exact, dnswld.ds.whitelist);
+  add_name_to_dictionary(wildcard, dnswld.ds.whitelist);
+
+  for (k = 0; k < 4; k++)
+  {
+    lens[k] = build_query(msgs[k], names[k], 1);
+  }
+
+  start = test_now_ns();
+  for (i = 0; i < BENCH_ITERS; i++)
+  {
+    k = i & 3;
+    pkt_ptr = (char *)msgs[k] + sizeof(dns_header);
+    if (parse_question_section(&pkt_ptr, lens[k] - sizeof(dns_header), qs, 1))
+    {
+      printf("parse failed\n");
+      break;
+    }
+
+    hits += (find_name_id(qs, dnswld.ds.whitelist) >= 0);
+  }
+
+  printf("match   sizeof(dns_question) %zu, hits %d/%d %8.1f ns/query\n",
+         sizeof(dns_question), hits, BENCH_ITERS,
+         (test_now_ns() - start) / BENCH_ITERS);
+
+  destroy_name_index(&dnswld.ds.whitelist);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : bench_reply                                                  */
+/*                                                                            */
+/* Description : Reply build time and size, from the cached answer template   */
+/*               or encoded per reply. Uncompressed size is what the answers  */
+/*               would take with a full owner name each.                      */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void bench_reply(char *name, int n_rec, int is_tmpl)
+{
+  unsigned char msg[DNS_PAYLOADZ];
+  unsigned char buf[DNS_PAYLOADZ];
+  dns_header *dns_hdr = (dns_header *)buf;
+  dns_question q;
+  dns_edns edns = {0};
+  char *pkt_ptr;
+  double start;
+  int reply_len;
+  int name_len;
+  int len;
+  int k;
+  long i;
+
+  len = build_query(msg, name, 1);
+  memcpy(buf, msg, len);
+  pkt_ptr = (char *)buf + sizeof(dns_header);
+  parse_question_section(&pkt_ptr, len - sizeof(dns_header), &q, 1);
+
+  q.ans.n_rec = n_rec;
+  for (k = 0; k < n_rec; k++)
+  {
+    q.ans.recs[k] = htonl(0x0A000001 + k);
+  }
+
+  q.ans.tmpl_len = 0;
+  if (is_tmpl)
+  {
+    encode_a_answers(q.ans.tmpl, sizeof(q.ans.tmpl), sizeof(dns_header),
+                     q.ans.recs, n_rec, &q.ans.tmpl_len);
+  }
+
+  start = test_now_ns();
+  for (i = 0; i < BENCH_ITERS; i++)
+  {
+    memset(dns_hdr, 0, sizeof(dns_header));
+    dns_hdr->q_count = 1;
+    process_response((char *)buf, (char *)buf + len, dns_hdr, &q, &edns,
+                     DNS_PAYLOADZ, &reply_len);
+  }
+
+  name_len = len - sizeof(dns_header) - 2 * sizeof(unsigned short);
+  printf("reply   %-24s r=%d %s %4d bytes (uncompressed %4d) %8.1f ns/reply\n",
+         name, n_rec, (is_tmpl) ? "tmpl" : "enc ", reply_len,
+         len + n_rec * (DNS_A_RR_LEN - 2 + name_len),
+         (test_now_ns() - start) / BENCH_ITERS);
+}
+
+
+int main(int argc, char **argv)
+{
+  bench_parse("www.facebook.com", 1);
+  bench_parse("www.facebook.com", 2);
+  bench_parse("x.y.z.w.v.u.deep.example.com", 1);
+  bench_parse_match();
+
+  bench_reply("www.facebook.com", 1, FALSE);
+  bench_reply("www.facebook.com", 5, FALSE);
+  bench_reply("www.facebook.com", 5, TRUE);
+
+  return(0);
+}
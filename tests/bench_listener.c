@@ -0,0 +1,238 @@
+/*FILE+************************************************************************/
+/* Filename    : bench_listener.c                                             */
+/*                                                                            */
+/* Description : DNS listener throughput and latency benchmark over loopback. */
+/*               A client thread keeps a window of queries in flight against  */
+/*               the listener, served three ways:                             */
+/*               - select() + usleep(10), one datagram per wakeup, as the     */
+/*                 main loop did before the event loop;                       */
+/*               - the epoll event loop, one datagram per read;               */
+/*               - the epoll event loop with recvmmsg()/sendmmsg() batches.   */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <network.h>
+
+#include <poll.h>
+#include <pthread.h>
+#include <sys/select.h>
+
+#include <test.h>
+
+#define BENCH_N_QUERIES                           100000
+#define BENCH_WINDOW                              64
+#define BENCH_WAIT_MS                             1000
+#define BENCH_NAME                                "\5bench\7example\3com"
+
+#define BENCH_MODE_SELECT                         0
+#define BENCH_MODE_EPOLL                          1
+
+/******************************************************************************/
+/* Listener under test and how it is driven.                                  */
+/******************************************************************************/
+static worker_cb worker;
+static struct sockaddr_in server_addr;
+static volatile int is_stopped;
+static int mode;
+static double lats[BENCH_N_QUERIES];
+
+
+/*FUNC+************************************************************************/
+/* Function    : server_main                                                  */
+/*                                                                            */
+/* Description : Serve queries until stopped.                                 */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void *server_main(void *param)
+{
+  listeners_cb *listener = &worker.listener;
+  struct timeval tv;
+  fd_set fds;
+
+  while (!is_stopped)
+  {
+    if (mode == BENCH_MODE_EPOLL)
+    {
+      run_event_loop(&worker.evloop, 100);
+      continue;
+    }
+
+    FD_ZERO(&fds);
+    FD_SET(listener->sock, &fds);
+    tv.tv_sec = 0;
+    tv.tv_usec = 100000;
+
+    if (select(listener->sock + 1, &fds, NULL, NULL, &tv) > 0)
+    {
+      usleep(10);
+      dns_sock_reader(listener);
+    }
+  }
+
+  return(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : cmp_double                                                   */
+/*                                                                            */
+/* Description : qsort() comparison of doubles.                               */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int cmp_double(const void *a, const void *b)
+{
+  return((*(double *)a > *(double *)b) - (*(double *)a < *(double *)b));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : run_client                                                   */
+/*                                                                            */
+/* Description : Send queries keeping a window in flight and time replies.    */
+/*               Query IDs index the send times.                              */
+/*                                                                            */
+/* Returns     : n                        - Number of replies.                */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int run_client(double *elapsed_ns)
+{
+  static double sent_at[BENCH_N_QUERIES];
+  unsigned char pkt[DNS_PAYLOADZ];
+  dns_header *hdr = (dns_header *)pkt;
+  struct pollfd pfd;
+  double start;
+  int sock;
+  int len;
+  int n_sent = 0;
+  int n_recv = 0;
+  int id;
+
+  sock = socket(PF_INET, SOCK_DGRAM, 0);
+  connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr));
+  pfd.fd = sock;
+  pfd.events = POLLIN;
+
+  memset(pkt, 0, sizeof(dns_header));
+  hdr->fc = htons(DNS_HDR_RD << 8);
+  hdr->q_count = htons(1);
+  len = sizeof(dns_header);
+  memcpy(&pkt[len], BENCH_NAME, sizeof(BENCH_NAME));
+  len += sizeof(BENCH_NAME);
+  pkt[len++] = 0;
+  pkt[len++] = DNS_RR_TYPE_A;
+  pkt[len++] = 0;
+  pkt[len++] = DNS_RR_CLASS_IN;
+
+  start = test_now_ns();
+  while (n_recv < BENCH_N_QUERIES)
+  {
+    while ((n_sent < BENCH_N_QUERIES) && (n_sent - n_recv < BENCH_WINDOW))
+    {
+      hdr->id = htons(n_sent & 0xFFFF);
+      sent_at[n_sent] = test_now_ns();
+      send(sock, pkt, len, 0);
+      n_sent++;
+    }
+
+    if (poll(&pfd, 1, BENCH_WAIT_MS) <= 0)
+    {
+      break;
+    }
+
+    while (recv(sock, pkt, sizeof(pkt), MSG_DONTWAIT) > 0)
+    {
+      /************************************************************************/
+      /* IDs wrap; the window keeps the match unambiguous.                    */
+      /************************************************************************/
+      id = ntohs(hdr->id);
+      id += (n_sent - 1) & ~0xFFFF;
+      id -= (id > n_sent - 1) ? 0x10000 : 0;
+      lats[n_recv++] = test_now_ns() - sent_at[id];
+    }
+  }
+
+  *elapsed_ns = test_now_ns() - start;
+  close(sock);
+
+  return(n_recv);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : bench_mode                                                   */
+/*                                                                            */
+/* Description : Serve with the given mode and batch size and report.         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void bench_mode(char *what, int how, int batch_size)
+{
+  listeners_cb *listener = &worker.listener;
+  socklen_t addr_len = sizeof(server_addr);
+  pthread_t thread;
+  double elapsed_ns;
+  int n;
+
+  memset(&worker, 0, sizeof(worker));
+  worker.qs = (dns_question *)calloc(DNS_MAX_QUESTIONS, sizeof(dns_question));
+  init_pkt_ring(&worker.ring, batch_size, dnswld.proc.pkt_bufz);
+  create_event_loop(&worker.evloop);
+
+  listener->sock = create_udp_listener(PF_INET, "127.0.0.1", 0, FALSE);
+  getsockname(listener->sock, (struct sockaddr *)&server_addr, &addr_len);
+  listener->sock_reader = dns_sock_reader;
+  listener->worker = &worker;
+
+  if (how == BENCH_MODE_EPOLL)
+  {
+    add_event_source(&worker.evloop, &listener->ev, listener->sock,
+                     dns_sock_reader, listener);
+  }
+
+  mode = how;
+  is_stopped = FALSE;
+  pthread_create(&thread, NULL, server_main, NULL);
+
+  n = run_client(&elapsed_ns);
+
+  is_stopped = TRUE;
+  pthread_join(thread, NULL);
+
+  qsort(lats, n, sizeof(lats[0]), cmp_double);
+  printf("listen  %-28s %8.0f q/s  p50 %7.1f us  p99 %7.1f us  (%d/%d)\n",
+         what, n / (elapsed_ns / 1e9), (n) ? lats[n / 2] / 1e3 : 0,
+         (n) ? lats[n * 99 / 100] / 1e3 : 0, n, BENCH_N_QUERIES);
+
+  if (how == BENCH_MODE_EPOLL)
+  {
+    del_event_source(&worker.evloop, &listener->ev);
+  }
+
+  close(listener->sock);
+  clean_event_loop(&worker.evloop);
+  clean_pkt_ring(&worker.ring);
+  free(worker.qs);
+}
+
+
+int main(int argc, char **argv)
+{
+  /****************************************************************************/
+  /* Empty whitelist: every query is answered NXDOMAIN in place.              */
+  /****************************************************************************/
+  init_dnswld();
+  dnswld.proc.disable_fw = TRUE;
+  init_data_stores();
+
+  bench_mode("select+usleep, 1/read", BENCH_MODE_SELECT, 1);
+  bench_mode("epoll, 1/read", BENCH_MODE_EPOLL, 1);
+  bench_mode("epoll, recvmmsg 32/read", BENCH_MODE_EPOLL, DEF_BATCH_SIZE);
+
+  clean_ds_stores();
+
+  return(0);
+}
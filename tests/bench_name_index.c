@@ -0,0 +1,289 @@
+/*FILE+************************************************************************/
+/* Filename    : bench_name_index.c                                           */
+/*                                                                            */
+/* Description : Whitelist lookup benchmark. The hashed name index against    */
+/*               the sorted linked-list label trie it replaced, kept here     */
+/*               without logging as the reference.                            */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <network.h>
+
+#include <test.h>
+
+#define BENCH_N_NAMES                             100000
+#define BENCH_N_WILDCARDS                         1000
+#define BENCH_N_QUERIES                           4096
+#define BENCH_ITERS                               2000000
+#define BENCH_REF_ITERS                           (BENCH_ITERS / 20)
+#define BENCH_MAX_LABELS                          6
+
+/******************************************************************************/
+/* Reference trie node. Children are a sorted singly-linked list.             */
+/******************************************************************************/
+typedef struct _ref_node
+{
+  struct _ref_node *h_child;
+  struct _ref_node *next;
+  char name[DNS_MAX_LABEL_LEN + 1];
+  int is_wildcard;
+} ref_node;
+
+
+/******************************************************************************/
+/* Query split into labels, as the reference trie takes it.                   */
+/******************************************************************************/
+typedef struct _ref_query
+{
+  int n_label;
+  char labels[BENCH_MAX_LABELS][DNS_MAX_LABEL_LEN + 1];
+} ref_query;
+
+
+/*FUNC+************************************************************************/
+/* Function    : split_name                                                   */
+/*                                                                            */
+/* Description : Split a dotted name into labels.                             */
+/*                                                                            */
+/* Returns     : n                        - Number of labels.                 */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int split_name(char *name, char labels[][DNS_MAX_LABEL_LEN + 1])
+{
+  char *dot;
+  int len;
+  int n = 0;
+
+  while ((*name) && (n < BENCH_MAX_LABELS))
+  {
+    dot = strchr(name, '.');
+    len = (dot) ? dot - name : strlen(name);
+    memcpy(labels[n], name, len);
+    labels[n++][len] = '\0';
+    name += (dot) ? len + 1 : len;
+  }
+
+  return(n);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ref_add                                                      */
+/*                                                                            */
+/* Description : Add a name to the reference trie, TLD first.                 */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void ref_add(ref_node *root, char *name)
+{
+  char labels[BENCH_MAX_LABELS][DNS_MAX_LABEL_LEN + 1];
+  ref_node **link;
+  ref_node *node;
+  int cmp = 1;
+  int n;
+
+  for (n = split_name(name, labels) - 1; n >= 0; n--)
+  {
+    for (link = &root->h_child; *link; link = &(*link)->next)
+    {
+      cmp = strcasecmp(labels[n], (*link)->name);
+      if (cmp <= 0)
+      {
+        break;
+      }
+    }
+
+    if ((*link) && (!cmp))
+    {
+      root = *link;
+      continue;
+    }
+
+    node = (ref_node *)calloc(1, sizeof(ref_node));
+    strcpy(node->name, labels[n]);
+    node->is_wildcard = !strcmp(labels[n], "*");
+    node->next = *link;
+    *link = node;
+    root = node;
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : ref_find                                                     */
+/*                                                                            */
+/* Description : Reference trie lookup.                                       */
+/*                                                                            */
+/* Returns     : TRUE                     - Found otherwise FALSE.            */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int ref_find(ref_node *root, ref_query *q)
+{
+  ref_node *runner;
+  int cmp;
+  int n;
+
+  for (n = q->n_label - 1; n >= 0; n--)
+  {
+    for (runner = root->h_child; runner; runner = runner->next)
+    {
+      if (runner->is_wildcard)
+      {
+        return(TRUE);
+      }
+
+      cmp = strcasecmp(q->labels[n], runner->name);
+      if (!cmp)
+      {
+        root = runner;
+        break;
+      }
+
+      if (cmp < 0)
+      {
+        return(FALSE);
+      }
+    }
+
+    if (!runner)
+    {
+      return(FALSE);
+    }
+  }
+
+  return(TRUE);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : encode_query                                                 */
+/*                                                                            */
+/* Description : Encode an A query for name and parse its question.           */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void encode_query(unsigned char *msg, char *name, dns_question *q)
+{
+  char labels[BENCH_MAX_LABELS][DNS_MAX_LABEL_LEN + 1];
+  char *pkt_ptr;
+  int len = sizeof(dns_header);
+  int n_label;
+  int i;
+
+  memset(msg, 0, sizeof(dns_header));
+  n_label = split_name(name, labels);
+  for (i = 0; i < n_label; i++)
+  {
+    msg[len++] = strlen(labels[i]);
+    memcpy(&msg[len], labels[i], strlen(labels[i]));
+    len += strlen(labels[i]);
+  }
+
+  msg[len++] = 0;
+  msg[len++] = 0;
+  msg[len++] = DNS_RR_TYPE_A;
+  msg[len++] = 0;
+  msg[len++] = DNS_RR_CLASS_IN;
+
+  pkt_ptr = (char *)msg + sizeof(dns_header);
+  parse_question_section(&pkt_ptr, len - sizeof(dns_header), q, 1);
+}
+
+
+int main(int argc, char **argv)
+{
+  static unsigned char msgs[BENCH_N_QUERIES][DNS_MAX_ENC_NAME_LEN + 32];
+  static dns_question qs[BENCH_N_QUERIES];
+  static ref_query ref_qs[BENCH_N_QUERIES];
+  static char *tlds[] = {"com", "net", "org"};
+  ref_node ref_root;
+  name_index *index;
+  char name[DNS_MAX_NAME_LEN + 1];
+  double start;
+  double ref_ns;
+  double index_ns;
+  int ref_hits = 0;
+  int index_hits = 0;
+  int n_hit;
+  int i;
+
+  /****************************************************************************/
+  /* Whitelist of exact names spread over many parents, plus wildcards.       */
+  /****************************************************************************/
+  memset(&ref_root, 0, sizeof(ref_root));
+  create_name_index(&index);
+
+  for (i = 0; i < BENCH_N_NAMES; i++)
+  {
+    snprintf(name, sizeof(name), "h%d.d%d.%s", i, i % 1000, tlds[i % 3]);
+    ref_add(&ref_root, name);
+    add_name_to_dictionary(name, index);
+  }
+
+  for (i = 0; i < BENCH_N_WILDCARDS; i++)
+  {
+    snprintf(name, sizeof(name), "*.w%d.example.org", i);
+    ref_add(&ref_root, name);
+    add_name_to_dictionary(name, index);
+  }
+
+  /****************************************************************************/
+  /* Queries: a third exact hits, a third wildcard hits, a third misses.      */
+  /****************************************************************************/
+  for (i = 0; i < BENCH_N_QUERIES; i++)
+  {
+    switch (i % 3)
+    {
+      case 0:
+        snprintf(name, sizeof(name), "H%d.d%d.%s", i * 7, (i * 7) % 1000,
+                 tlds[(i * 7) % 3]);
+        break;
+
+      case 1:
+        snprintf(name, sizeof(name), "a.b.w%d.example.org", i % 1000);
+        break;
+
+      default:
+        snprintf(name, sizeof(name), "x%d.d%d.%s", i, i % 1000, tlds[i % 3]);
+        break;
+    }
+
+    ref_qs[i].n_label = split_name(name, ref_qs[i].labels);
+    encode_query(msgs[i], name, &qs[i]);
+  }
+
+  start = test_now_ns();
+  for (i = 0; i < BENCH_REF_ITERS; i++)
+  {
+    ref_hits += ref_find(&ref_root, &ref_qs[i & (BENCH_N_QUERIES - 1)]);
+  }
+  ref_ns = (test_now_ns() - start) / BENCH_REF_ITERS;
+
+  start = test_now_ns();
+  for (i = 0; i < BENCH_ITERS; i++)
+  {
+    n_hit = (find_name_id(&qs[i & (BENCH_N_QUERIES - 1)], index) >= 0);
+    index_hits += (i < BENCH_REF_ITERS) ? n_hit : 0;
+  }
+  index_ns = (test_now_ns() - start) / BENCH_ITERS;
+
+  printf("lookup  %d names  list trie  %8.1f ns/lookup\n",
+         BENCH_N_NAMES + BENCH_N_WILDCARDS, ref_ns);
+  printf("lookup  %d names  name index %8.1f ns/lookup\n",
+         BENCH_N_NAMES + BENCH_N_WILDCARDS, index_ns);
+
+  /****************************************************************************/
+  /* Both must agree on the queries they were both given.                     */
+  /****************************************************************************/
+  if (ref_hits != index_hits)
+  {
+    printf("hit counts differ: %d vs %d\n", ref_hits, index_hits);
+  }
+
+  destroy_name_index(&index);
+
+  return((ref_hits == index_hits) ? 0 : 1);
+}
@@ -0,0 +1,62 @@
+/*INC+*************************************************************************/
+/* Filename    : test.h                                                       */
+/*                                                                            */
+/* Description : Minimal check macros shared by unit tests and benchmarks.    */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*INC+*************************************************************************/
+
+#ifndef _TEST_H
+#define _TEST_H
+
+#include <stdio.h>
+#include <time.h>
+
+/******************************************************************************/
+/* Failure count of the running test program.                                 */
+/******************************************************************************/
+static int n_test_fail __attribute__((unused)) = 0;
+
+/******************************************************************************/
+/* Report a failed condition with its location and keep going.                */
+/******************************************************************************/
+#define CHECK(cond)                                                            \
+  do                                                                           \
+  {                                                                            \
+    if (!(cond))                                                               \
+    {                                                                          \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+      n_test_fail++;                                                           \
+    }                                                                          \
+  } while (0)
+
+/******************************************************************************/
+/* Run one test function and print its name.                                  */
+/******************************************************************************/
+#define RUN_TEST(func)                                                         \
+  do                                                                           \
+  {                                                                            \
+    int n_prev_fail = n_test_fail;                                             \
+    func();                                                                    \
+    printf("%-40s %s\n", #func, (n_test_fail == n_prev_fail) ? "ok" : "FAIL"); \
+  } while (0)
+
+/******************************************************************************/
+/* Exit status of a test program.                                             */
+/******************************************************************************/
+#define TEST_RESULT() ((n_test_fail) ? 1 : 0)
+
+/******************************************************************************/
+/* Monotonic clock in nanoseconds, for benchmarks.                            */
+/******************************************************************************/
+static inline double test_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,134 @@
+/*FILE+************************************************************************/
+/* Filename    : test_acl.c                                                   */
+/*                                                                            */
+/* Description : Unit tests of the whitelist's flow accounting, as driven by  */
+/*               the conntrack watcher.                                       */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <access_list.h>
+#include <fw.h>
+
+#include <test.h>
+
+#define TEST_SRC_IP                               0x0A000001
+#define TEST_DST_IP                               0x0A000002
+
+
+/*FUNC+************************************************************************/
+/* Function    : grant                                                        */
+/*                                                                            */
+/* Description : Whitelist a pair as a query's A answer would.                */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static src_dest_cb *grant(unsigned int s_ip, unsigned int d_ip)
+{
+  struct sockaddr_in src;
+  dns_question q;
+
+  memset(&src, 0, sizeof(src));
+  src.sin_family = AF_INET;
+  src.sin_addr.s_addr = htonl(s_ip);
+
+  memset(&q, 0, sizeof(q));
+  q.q_type = DNS_RR_TYPE_A;
+  q.q_class = DNS_RR_CLASS_IN;
+  q.dom_id = -1;
+  q.ans.n_rec = 1;
+  q.ans.recs[0] = htonl(d_ip);
+
+  CHECK(add_src_dest_to_whitelist(&src, &q, 1) == RET_OK);
+
+  return(find_src_dest_acl(s_ip, d_ip));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_lost_end                                                */
+/*                                                                            */
+/* Description : A flow whose end event was lost is dropped from the count by */
+/*               a re-sync dump. Flows the dump lists are kept, and pairs it  */
+/*               does not list go back to zero.                               */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_lost_end(void)
+{
+  src_dest_cb *sd_cb;
+  src_dest_cb *other;
+
+  CHECK((sd_cb = grant(TEST_SRC_IP, TEST_DST_IP)) != NULL);
+  CHECK((other = grant(TEST_SRC_IP, TEST_DST_IP + 1)) != NULL);
+  if ((!sd_cb) || (!other))
+  {
+    return;
+  }
+
+  note_acl_flow(TEST_SRC_IP, TEST_DST_IP, ACL_FLOW_NEW);
+  note_acl_flow(TEST_SRC_IP, TEST_DST_IP, ACL_FLOW_NEW);
+  note_acl_flow(TEST_SRC_IP, TEST_DST_IP + 1, ACL_FLOW_NEW);
+  CHECK(sd_cb->n_flows == 2);
+  CHECK(other->n_flows == 1);
+
+  /****************************************************************************/
+  /* One flow of the first pair is still open; the rest ended unseen.         */
+  /****************************************************************************/
+  note_acl_flow(TEST_SRC_IP, TEST_DST_IP, ACL_FLOW_DUMP);
+  CHECK(sd_cb->n_flows == 2);
+  sync_acl_flows(TRUE);
+  CHECK(sd_cb->n_flows == 1);
+  CHECK(other->n_flows == 0);
+
+  note_acl_flow(TEST_SRC_IP, TEST_DST_IP, ACL_FLOW_END);
+  CHECK(sd_cb->n_flows == 0);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_failed_dump                                             */
+/*                                                                            */
+/* Description : A dump that failed leaves the counts as they were and does   */
+/*               not carry over into the next one.                            */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_failed_dump(void)
+{
+  src_dest_cb *sd_cb;
+
+  CHECK((sd_cb = find_src_dest_acl(TEST_SRC_IP, TEST_DST_IP)) != NULL);
+  if (!sd_cb)
+  {
+    return;
+  }
+
+  note_acl_flow(TEST_SRC_IP, TEST_DST_IP, ACL_FLOW_NEW);
+  note_acl_flow(TEST_SRC_IP, TEST_DST_IP, ACL_FLOW_NEW);
+  note_acl_flow(TEST_SRC_IP, TEST_DST_IP, ACL_FLOW_DUMP);
+  sync_acl_flows(FALSE);
+  CHECK(sd_cb->n_flows == 2);
+
+  sync_acl_flows(TRUE);
+  CHECK(sd_cb->n_flows == 0);
+}
+
+
+int main(int argc, char **argv)
+{
+  init_dnswld();
+  dnswld.fw.backend = FW_BACKEND_MEMORY;
+  dnswld.acl.ct_grace = 10;
+  init_src_dest_whitelist();
+  init_fw();
+
+  RUN_TEST(test_lost_end);
+  RUN_TEST(test_failed_dump);
+
+  clean_src_dest_whitelist();
+  clean_fw();
+
+  return(TEST_RESULT());
+}
@@ -0,0 +1,484 @@
+/*FILE+************************************************************************/
+/* Filename    : test_dns.c                                                   */
+/*                                                                            */
+/* Description : Unit tests of DNS message encoding and decoding.             */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <network.h>
+#include <response.h>
+
+#include <test.h>
+
+/******************************************************************************/
+/* Message under construction.                                                */
+/******************************************************************************/
+static unsigned char msg[600];
+static int msg_len;
+
+
+/*FUNC+************************************************************************/
+/* Function    : put_header                                                   */
+/*                                                                            */
+/* Description : Start a query message with n_q questions.                    */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void put_header(int n_q)
+{
+  memset(msg, 0, sizeof(dns_header));
+  ((dns_header *)msg)->q_count = htons(n_q);
+  msg_len = sizeof(dns_header);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : put_name                                                     */
+/*                                                                            */
+/* Description : Append labels of a dotted name. The root label is appended   */
+/*               only if is_root is set.                                      */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void put_name(char *name, int is_root)
+{
+  char *dot;
+  int len;
+
+  while (*name)
+  {
+    dot = strchr(name, '.');
+    len = (dot) ? dot - name : strlen(name);
+
+    msg[msg_len++] = len;
+    memcpy(&msg[msg_len], name, len);
+    msg_len += len;
+    name += (dot) ? len + 1 : len;
+  }
+
+  if (is_root)
+  {
+    msg[msg_len++] = 0;
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : put_ptr                                                      */
+/*                                                                            */
+/* Description : Append a compression pointer.                                */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void put_ptr(int off)
+{
+  msg[msg_len++] = DNS_PTR_TO(off) >> 8;
+  msg[msg_len++] = DNS_PTR_TO(off) & 0xFF;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : put_type_class                                               */
+/*                                                                            */
+/* Description : Append question type and class.                              */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void put_type_class(int q_type, int q_class)
+{
+  msg[msg_len++] = q_type >> 8;
+  msg[msg_len++] = q_type & 0xFF;
+  msg[msg_len++] = q_class >> 8;
+  msg[msg_len++] = q_class & 0xFF;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : parse                                                        */
+/*                                                                            */
+/* Description : Parse the question section of the message.                   */
+/*                                                                            */
+/* Returns     : consumed (OUT)           - Bytes consumed from message start.*/
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int parse(dns_question *qs, int n_q, int *consumed)
+{
+  char *pkt_ptr = (char *)msg + sizeof(dns_header);
+  int ret;
+
+  ret = parse_question_section(&pkt_ptr, msg_len - sizeof(dns_header), qs, n_q);
+  *consumed = (unsigned char *)pkt_ptr - msg;
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : check_question                                               */
+/*                                                                            */
+/* Description : Check a parsed question decodes back to name.                */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void check_question(dns_question *q, char *name, int n_label)
+{
+  char buf[DNS_MAX_NAME_LEN + 1];
+
+  CHECK(dns_name_to_str(q->msg, q->name, buf, sizeof(buf)) == strlen(name));
+  CHECK(strcmp(buf, name) == 0);
+  CHECK(q->hash == hash_name(name));
+  CHECK(q->n_label == n_label);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_round_trip                                              */
+/*                                                                            */
+/* Description : Names encoded as a query decode back to the same name, and   */
+/*               answers encoded against them point back at the question.     */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_round_trip(void)
+{
+  static char *names[] = {"com", "www.example.com", "A.b-C.d.example.org",
+    "x.y.z.w.v.u.t.s.r.q.p.deep.example.net"};
+  static int n_labels[] = {1, 3, 5, 14};
+  dns_question q;
+  in_addr_t recs[DNS_MAX_ANS_RR_NUM];
+  unsigned char *rr;
+  int consumed;
+  int len;
+  int n;
+  int i;
+  int j;
+
+  for (i = 0; i < DNS_MAX_ANS_RR_NUM; i++)
+  {
+    recs[i] = htonl(0x0A000001 + i);
+  }
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+  {
+    put_header(1);
+    put_name(names[i], TRUE);
+    put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+
+    CHECK(parse(&q, 1, &consumed) == RET_OK);
+    CHECK(consumed == msg_len);
+    CHECK(q.q_type == DNS_RR_TYPE_A);
+    CHECK(q.q_class == DNS_RR_CLASS_IN);
+    check_question(&q, names[i], n_labels[i]);
+
+    n = encode_a_answers(&msg[msg_len], sizeof(msg) - msg_len,
+                         sizeof(dns_header), recs, DNS_MAX_ANS_RR_NUM, &len);
+    CHECK(n == DNS_MAX_ANS_RR_NUM);
+    CHECK(len == n * DNS_A_RR_LEN);
+
+    for (j = 0, rr = &msg[msg_len]; j < n; j++, rr += DNS_A_RR_LEN)
+    {
+      CHECK(dns_name_equal(msg, msg_len + len, rr - msg, names[i]));
+      CHECK(((rr[2] << 8) | rr[3]) == DNS_RR_TYPE_A);
+      CHECK(((rr[10] << 8) | rr[11]) == DNS_RR_TYPE_A_LEN);
+      CHECK(memcmp(&rr[12], &recs[j], DNS_RR_TYPE_A_LEN) == 0);
+    }
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_encode_truncated                                        */
+/*                                                                            */
+/* Description : Encoder stops at whole records when the buffer runs out.     */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_encode_truncated(void)
+{
+  in_addr_t recs[DNS_MAX_ANS_RR_NUM] = {0};
+  unsigned char buf[DNS_A_RR_LEN * 5];
+  int len;
+
+  CHECK(encode_a_answers(buf, 2 * DNS_A_RR_LEN + 5, sizeof(dns_header),
+                         recs, DNS_MAX_ANS_RR_NUM, &len) == 2);
+  CHECK(len == 2 * DNS_A_RR_LEN);
+
+  CHECK(encode_a_answers(buf, DNS_A_RR_LEN - 1, sizeof(dns_header),
+                         recs, DNS_MAX_ANS_RR_NUM, &len) == 0);
+  CHECK(len == 0);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_compressed_question                                     */
+/*                                                                            */
+/* Description : A question ending in a pointer to an earlier one decodes to  */
+/*               the joined name and the cursor stops after the pointer.      */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_compressed_question(void)
+{
+  dns_question qs[2];
+  int consumed;
+
+  put_header(2);
+  put_name("www.example.com", TRUE);
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  put_name("mail", FALSE);
+  put_ptr(sizeof(dns_header) + 4);
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+
+  CHECK(parse(qs, 2, &consumed) == RET_OK);
+  CHECK(consumed == msg_len);
+  check_question(&qs[0], "www.example.com", 3);
+  check_question(&qs[1], "mail.example.com", 3);
+  CHECK(qs[1].q_type == DNS_RR_TYPE_A);
+  CHECK(qs[1].q_class == DNS_RR_CLASS_IN);
+
+  put_header(2);
+  put_name("a.b", TRUE);
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  put_ptr(sizeof(dns_header));
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+
+  CHECK(parse(qs, 2, &consumed) == RET_OK);
+  CHECK(consumed == msg_len);
+  check_question(&qs[1], "a.b", 2);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_ptr_labels_past_ptr                                     */
+/*                                                                            */
+/* Description : Pointer target whose labels run past the pointer itself. The */
+/*               question type must still be read right after the pointer.    */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_ptr_labels_past_ptr(void)
+{
+  dns_question qs[2];
+  int consumed;
+  int q2_off;
+
+  /****************************************************************************/
+  /* First type/class is 0x0005/0x4141. Its low type octet is a label of 5    */
+  /* covering the class, the pointer to it and the next type's high octet.    */
+  /* Next type's low octet ends the name.                                     */
+  /****************************************************************************/
+  put_header(2);
+  put_name("a", TRUE);
+  put_type_class(0x0005, 0x4141);
+  q2_off = msg_len;
+  put_ptr(q2_off - 3);
+  put_type_class(0x4100, DNS_RR_CLASS_IN);
+
+  CHECK(parse(qs, 2, &consumed) == RET_OK);
+  CHECK(consumed == msg_len);
+  CHECK(qs[1].name == &msg[q2_off]);
+  CHECK(qs[1].n_label == 1);
+  CHECK(qs[1].q_type == 0x4100);
+  CHECK(qs[1].q_class == DNS_RR_CLASS_IN);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_bad_pointers                                            */
+/*                                                                            */
+/* Description : Loops, forward references, pointers into the header or to    */
+/*               other pointers and truncated pointers are rejected.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_bad_pointers(void)
+{
+  dns_question qs[3];
+  int consumed;
+
+  put_header(1);
+  put_name("a", FALSE);
+  put_ptr(sizeof(dns_header));
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  CHECK(parse(qs, 1, &consumed) == RET_MALFORMED_DNS_REQ);
+
+  put_header(1);
+  put_ptr(sizeof(dns_header) + 2);
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  put_name("x", TRUE);
+  CHECK(parse(qs, 1, &consumed) == RET_MALFORMED_DNS_REQ);
+
+  put_header(1);
+  put_ptr(2);
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  CHECK(parse(qs, 1, &consumed) == RET_MALFORMED_DNS_REQ);
+
+  put_header(3);
+  put_name("a", TRUE);
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  put_ptr(sizeof(dns_header));
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  put_ptr(sizeof(dns_header) + 7);
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  CHECK(parse(qs, 3, &consumed) == RET_MALFORMED_DNS_REQ);
+
+  put_header(1);
+  put_name("a", FALSE);
+  msg[msg_len++] = 0xC0;
+  CHECK(parse(qs, 1, &consumed) == RET_MALFORMED_DNS_REQ);
+
+  put_header(2);
+  put_name("a", TRUE);
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  put_name("b", FALSE);
+  put_ptr(sizeof(dns_header));
+  CHECK(parse(qs, 2, &consumed) == RET_MALFORMED_DNS_REQ);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_name_length                                             */
+/*                                                                            */
+/* Description : Encoded name limit applies across pointers.                  */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_name_length(void)
+{
+  dns_question qs[2];
+  int consumed;
+  int i;
+
+  /****************************************************************************/
+  /* 62 labels of 3 plus root is 249. A 4 octet label brings it to 254 and    */
+  /* one more label of 1 to 256.                                              */
+  /****************************************************************************/
+  put_header(2);
+  for (i = 0; i < 62; i++)
+  {
+    put_name("abc", FALSE);
+  }
+  put_name("", TRUE);
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  put_name("abcd", FALSE);
+  put_ptr(sizeof(dns_header));
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  CHECK(parse(qs, 2, &consumed) == RET_OK);
+  CHECK(consumed == msg_len);
+
+  put_header(2);
+  for (i = 0; i < 62; i++)
+  {
+    put_name("abc", FALSE);
+  }
+  put_name("", TRUE);
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  put_name("abcd.x", FALSE);
+  put_ptr(sizeof(dns_header));
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  CHECK(parse(qs, 2, &consumed) == RET_MALFORMED_DNS_REQ);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_label_octets                                            */
+/*                                                                            */
+/* Description : Labels holding a NUL or dot octet are rejected, so they      */
+/*               can't be matched as another dotted name.                     */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_label_octets(void)
+{
+  dns_question q;
+  int consumed;
+
+  put_header(1);
+  put_name("www", FALSE);
+  msg[msg_len++] = 3;
+  memcpy(&msg[msg_len], "a.b", 3);
+  msg_len += 3;
+  put_name("", TRUE);
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  CHECK(parse(&q, 1, &consumed) == RET_MALFORMED_DNS_REQ);
+
+  put_header(1);
+  msg[msg_len++] = 3;
+  memcpy(&msg[msg_len], "a\0b", 3);
+  msg_len += 3;
+  put_name("", TRUE);
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  CHECK(parse(&q, 1, &consumed) == RET_MALFORMED_DNS_REQ);
+
+  put_header(1);
+  put_name("x-1_y.Z", TRUE);
+  put_type_class(DNS_RR_TYPE_A, DNS_RR_CLASS_IN);
+  CHECK(parse(&q, 1, &consumed) == RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_name_equal                                              */
+/*                                                                            */
+/* Description : Encoded names compare with dotted names label by label,      */
+/*               ignoring case only.                                          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_name_equal(void)
+{
+  int off;
+
+  put_header(0);
+  off = msg_len;
+  put_name("WWW.Example.com", TRUE);
+  CHECK(dns_name_equal(msg, msg_len, off, "www.example.com"));
+  CHECK(!dns_name_equal(msg, msg_len, off, "www.example.co"));
+  CHECK(!dns_name_equal(msg, msg_len, off, "www.example.com.x"));
+  CHECK(!dns_name_equal(msg, msg_len, off, "www.example"));
+  CHECK(!dns_name_equal(msg, msg_len, off, "wwwexample.com"));
+  CHECK(!dns_name_equal(msg, msg_len - 1, off, "www.example.com"));
+
+  /****************************************************************************/
+  /* One label "a.b" must not match the two labels of "a.b".                  */
+  /****************************************************************************/
+  put_header(0);
+  off = msg_len;
+  msg[msg_len++] = 3;
+  memcpy(&msg[msg_len], "a.b", 3);
+  msg_len += 3;
+  put_name("", TRUE);
+  CHECK(!dns_name_equal(msg, msg_len, off, "a.b"));
+
+  /****************************************************************************/
+  /* A NUL octet must not end the compare early.                              */
+  /****************************************************************************/
+  put_header(0);
+  off = msg_len;
+  msg[msg_len++] = 3;
+  memcpy(&msg[msg_len], "a\0b", 3);
+  msg_len += 3;
+  put_name("", TRUE);
+  CHECK(!dns_name_equal(msg, msg_len, off, "a"));
+  CHECK(!dns_name_equal(msg, msg_len, off, "a.b"));
+
+  /****************************************************************************/
+  /* Pointers are followed backwards only.                                    */
+  /****************************************************************************/
+  put_header(0);
+  put_name("example.com", TRUE);
+  off = msg_len;
+  put_name("www", FALSE);
+  put_ptr(sizeof(dns_header));
+  CHECK(dns_name_equal(msg, msg_len, off, "www.example.com"));
+  off = msg_len;
+  put_ptr(msg_len);
+  CHECK(!dns_name_equal(msg, msg_len, off, "www.example.com"));
+}
+
+
+int main(int argc, char **argv)
+{
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_encode_truncated);
+  RUN_TEST(test_compressed_question);
+  RUN_TEST(test_ptr_labels_past_ptr);
+  RUN_TEST(test_bad_pointers);
+  RUN_TEST(test_name_length);
+  RUN_TEST(test_label_octets);
+  RUN_TEST(test_name_equal);
+
+  return(TEST_RESULT());
+}
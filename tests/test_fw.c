@@ -0,0 +1,285 @@
+/*FILE+************************************************************************/
+/* Filename    : test_fw.c                                                    */
+/*                                                                            */
+/* Description : Unit tests of the firewall command queue, on the in-memory   */
+/*               backend.                                                     */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <access_list.h>
+#include <fw.h>
+
+#include <sys/wait.h>
+
+#include <test.h>
+
+#define TEST_DEADLINE_SECS                        10
+#define TEST_COALESCE_MS                          200
+#define TEST_SRC_IP                               0x0A000001
+#define TEST_DST_IP                               0x0A000002
+
+
+/*FUNC+************************************************************************/
+/* Function    : count_grant                                                  */
+/*                                                                            */
+/* Description : List callback. Counts the grants.                            */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int count_grant(fw_cmd *cmd, void *arg)
+{
+  (*(int *)arg)++;
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : n_grants                                                     */
+/*                                                                            */
+/* Description : Number of grants the backend holds.                          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int n_grants(void)
+{
+  int n = 0;
+
+  CHECK(list_fw_rules(count_grant, &n) == RET_OK);
+
+  return(n);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : grant_query                                                  */
+/*                                                                            */
+/* Description : Whitelist the test pair as a query's A answer would.         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int grant_query(void)
+{
+  struct sockaddr_in src;
+  dns_question q;
+
+  memset(&src, 0, sizeof(src));
+  src.sin_family = AF_INET;
+  src.sin_addr.s_addr = htonl(TEST_SRC_IP);
+
+  memset(&q, 0, sizeof(q));
+  q.q_type = DNS_RR_TYPE_A;
+  q.q_class = DNS_RR_CLASS_IN;
+  q.dom_id = -1;
+  q.ans.n_rec = 1;
+  q.ans.recs[0] = htonl(TEST_DST_IP);
+
+  return(add_src_dest_to_whitelist(&src, &q, 1));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_post_unstarted                                          */
+/*                                                                            */
+/* Description : Without the firewall thread a command is refused, not run in */
+/*               place under the ACL lock. The refused add is marked on the   */
+/*               entry and retried by the next query once the thread runs.    */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_post_unstarted(void)
+{
+  src_dest_cb *sd_cb;
+  fw_cmd cmd;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.op = FW_CMD_ADD;
+  cmd.s_ip = TEST_SRC_IP;
+  cmd.d_ip = TEST_DST_IP;
+  cmd.dom_id = -1;
+  CHECK(post_fw_cmd(&cmd) == RET_FW_NOT_STARTED);
+  CHECK(n_grants() == 0);
+
+  CHECK(grant_query() == RET_OK);
+  sd_cb = find_src_dest_acl(TEST_SRC_IP, TEST_DST_IP);
+  CHECK((sd_cb) && (sd_cb->last_status == ACL_ADD_ALLOW_RULE_ERR));
+  CHECK(n_grants() == 0);
+
+  CHECK(create_start_fw_worker() == RET_OK);
+
+  CHECK(grant_query() == RET_OK);
+  fw_sync();
+  sd_cb = find_src_dest_acl(TEST_SRC_IP, TEST_DST_IP);
+  CHECK((sd_cb) && (sd_cb->last_status == ACL_OK));
+  CHECK(n_grants() == 1);
+
+  stop_fw_worker();
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_coalesce_window                                         */
+/*                                                                            */
+/* Description : With the default flush window of 0, an add and a delete of   */
+/*               the same grant posted within the coalesce window never reach */
+/*               the backend. Other pairs are still programmed.               */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_coalesce_window(void)
+{
+  unsigned long n_coalesced = dnswld.stats.n_fw_coalesced;
+  fw_cmd cmd;
+
+  CHECK(dnswld.fw.flush_ms == 0);
+  dnswld.fw.coalesce_ms = TEST_COALESCE_MS;
+  CHECK(create_start_fw_worker() == RET_OK);
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.op = FW_CMD_ADD;
+  cmd.s_ip = TEST_SRC_IP;
+  cmd.d_ip = TEST_DST_IP + 1;
+  cmd.created_at = 100;
+  cmd.expiry = 200;
+  cmd.dom_id = -1;
+  CHECK(post_fw_cmd(&cmd) == RET_OK);
+
+  cmd.d_ip = TEST_DST_IP + 2;
+  CHECK(post_fw_cmd(&cmd) == RET_OK);
+
+  /****************************************************************************/
+  /* Well after the thread has woken, well within the window.                 */
+  /****************************************************************************/
+  usleep(TEST_COALESCE_MS * 1000 / 4);
+
+  cmd.op = FW_CMD_DEL;
+  cmd.d_ip = TEST_DST_IP + 1;
+  CHECK(post_fw_cmd(&cmd) == RET_OK);
+
+  fw_sync();
+  CHECK(dnswld.stats.n_fw_coalesced - n_coalesced == 2);
+  CHECK(n_grants() == 2);
+
+  cmd.d_ip = TEST_DST_IP + 2;
+  CHECK(post_fw_cmd(&cmd) == RET_OK);
+  fw_sync();
+  CHECK(n_grants() == 1);
+
+  stop_fw_worker();
+  dnswld.fw.coalesce_ms = DEF_FW_COALESCE_MS;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_coalesce_replaced                                       */
+/*                                                                            */
+/* Description : An expiry of grant A, then an add and a delete of grant B of */
+/*               the same pair, in one batch. The add replaces A's delete and */
+/*               cancels with B's; a delete must still reach the backend.     */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_coalesce_replaced(void)
+{
+  unsigned long n_coalesced;
+  fw_cmd cmd;
+  int n;
+
+  dnswld.fw.coalesce_ms = TEST_COALESCE_MS;
+  CHECK(create_start_fw_worker() == RET_OK);
+  n = n_grants();
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.op = FW_CMD_ADD;
+  cmd.s_ip = TEST_SRC_IP;
+  cmd.d_ip = TEST_DST_IP + 4;
+  cmd.created_at = 100;
+  cmd.expiry = 200;
+  cmd.dom_id = -1;
+  CHECK(post_fw_cmd(&cmd) == RET_OK);
+  fw_sync();
+  CHECK(n_grants() == n + 1);
+
+  n_coalesced = dnswld.stats.n_fw_coalesced;
+
+  cmd.op = FW_CMD_EXPIRE;
+  CHECK(post_fw_cmd(&cmd) == RET_OK);
+
+  cmd.op = FW_CMD_ADD;
+  cmd.created_at = 150;
+  cmd.expiry = 250;
+  CHECK(post_fw_cmd(&cmd) == RET_OK);
+
+  cmd.op = FW_CMD_DEL;
+  CHECK(post_fw_cmd(&cmd) == RET_OK);
+
+  fw_sync();
+  CHECK(dnswld.stats.n_fw_coalesced - n_coalesced == 2);
+  CHECK(n_grants() == n);
+
+  stop_fw_worker();
+  dnswld.fw.coalesce_ms = DEF_FW_COALESCE_MS;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_post_after_fork                                         */
+/*                                                                            */
+/* Description : The daemon forks before it serves. A firewall thread started */
+/*               in the forked process runs a posted add.                     */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_post_after_fork(void)
+{
+  fw_cmd cmd;
+  pid_t pid;
+  int status;
+  int n;
+
+  pid = fork();
+  if (pid == 0)
+  {
+    alarm(TEST_DEADLINE_SECS);
+    n = n_grants();
+    CHECK(create_start_fw_worker() == RET_OK);
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.op = FW_CMD_ADD;
+    cmd.s_ip = TEST_SRC_IP;
+    cmd.d_ip = TEST_DST_IP + 3;
+    cmd.dom_id = -1;
+    CHECK(post_fw_cmd(&cmd) == RET_OK);
+    fw_sync();
+    CHECK(n_grants() == n + 1);
+
+    stop_fw_worker();
+    _exit(TEST_RESULT());
+  }
+
+  CHECK(pid > 0);
+  CHECK(waitpid(pid, &status, 0) == pid);
+  CHECK((WIFEXITED(status)) && (WEXITSTATUS(status) == 0));
+}
+
+
+int main(int argc, char **argv)
+{
+  /****************************************************************************/
+  /* A lock taken twice hangs; fail instead.                                  */
+  /****************************************************************************/
+  alarm(TEST_DEADLINE_SECS);
+
+  init_dnswld();
+  dnswld.fw.backend = FW_BACKEND_MEMORY;
+  init_src_dest_whitelist();
+  init_fw();
+
+  RUN_TEST(test_post_unstarted);
+  RUN_TEST(test_coalesce_window);
+  RUN_TEST(test_coalesce_replaced);
+  RUN_TEST(test_post_after_fork);
+
+  clean_src_dest_whitelist();
+  clean_fw();
+
+  return(TEST_RESULT());
+}
@@ -0,0 +1,292 @@
+/*FILE+************************************************************************/
+/* Filename    : test_fw_bpf.c                                                */
+/*                                                                            */
+/* Description : Unit tests of the bpf firewall backend's map updates. They   */
+/*               run against a map kept in userspace, swapped in for the      */
+/*               bpf() call, and again against a kernel map when the process  */
+/*               may create one.                                              */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <fw.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/bpf.h>
+
+#include <test.h>
+
+#define TEST_MAX_ENTRIES                          16
+#define TEST_KEYZ                                 8
+#define TEST_VALUEZ                               8
+
+/******************************************************************************/
+/* Userspace map: entries in insertion order, as raw key and value bytes.     */
+/******************************************************************************/
+static unsigned char fake_keys[TEST_MAX_ENTRIES][TEST_KEYZ];
+static unsigned char fake_values[TEST_MAX_ENTRIES][TEST_VALUEZ];
+static int fake_n;
+static int (*kernel_sys)(int cmd, union bpf_attr *attr);
+
+/******************************************************************************/
+/* Grants reported by list.                                                   */
+/******************************************************************************/
+static fw_cmd listed[TEST_MAX_ENTRIES];
+static int n_listed;
+
+
+/*FUNC+************************************************************************/
+/* Function    : fake_find                                                    */
+/*                                                                            */
+/* Description : Index of a key in the userspace map.                         */
+/*                                                                            */
+/* Returns     : >= 0                     - Index, -1 if missing.             */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int fake_find(unsigned long key)
+{
+  int i;
+
+  for (i = 0; i < fake_n; i++)
+  {
+    if (!memcmp(fake_keys[i], (void *)key, TEST_KEYZ))
+    {
+      return(i);
+    }
+  }
+
+  return(-1);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : fake_sys                                                     */
+/*                                                                            */
+/* Description : bpf() on the userspace map, with the kernel's semantics for  */
+/*               the map commands the backend uses. Anything else is EPERM.   */
+/*                                                                            */
+/* Returns     : >= 0                     - Success, -1 with errno set.       */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int fake_sys(int cmd, union bpf_attr *attr)
+{
+  int i;
+
+  switch (cmd)
+  {
+    case BPF_MAP_CREATE:
+      CHECK(attr->map_type == BPF_MAP_TYPE_LRU_HASH);
+      CHECK(attr->key_size == TEST_KEYZ);
+      CHECK(attr->value_size == TEST_VALUEZ);
+      fake_n = 0;
+      return(open("/dev/null", O_RDONLY));
+
+    case BPF_MAP_UPDATE_ELEM:
+      CHECK(attr->flags == BPF_ANY);
+      i = fake_find(attr->key);
+      if (i < 0)
+      {
+        if (fake_n == TEST_MAX_ENTRIES)
+        {
+          errno = E2BIG;
+          return(-1);
+        }
+
+        i = fake_n++;
+        memcpy(fake_keys[i], (void *)(unsigned long)attr->key, TEST_KEYZ);
+      }
+
+      memcpy(fake_values[i], (void *)(unsigned long)attr->value, TEST_VALUEZ);
+      return(0);
+
+    case BPF_MAP_DELETE_ELEM:
+      i = fake_find(attr->key);
+      if (i < 0)
+      {
+        errno = ENOENT;
+        return(-1);
+      }
+
+      fake_n--;
+      memmove(fake_keys[i], fake_keys[i + 1], (fake_n - i) * TEST_KEYZ);
+      memmove(fake_values[i], fake_values[i + 1], (fake_n - i) * TEST_VALUEZ);
+      return(0);
+
+    case BPF_MAP_LOOKUP_ELEM:
+      i = fake_find(attr->key);
+      if (i < 0)
+      {
+        errno = ENOENT;
+        return(-1);
+      }
+
+      memcpy((void *)(unsigned long)attr->value, fake_values[i], TEST_VALUEZ);
+      return(0);
+
+    case BPF_MAP_GET_NEXT_KEY:
+      i = (attr->key) ? fake_find(attr->key) + 1 : 0;
+      if (i >= fake_n)
+      {
+        errno = ENOENT;
+        return(-1);
+      }
+
+      memcpy((void *)(unsigned long)attr->next_key, fake_keys[i], TEST_KEYZ);
+      return(0);
+  }
+
+  errno = EPERM;
+  return(-1);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : list_grant                                                   */
+/*                                                                            */
+/* Description : List callback. Collects the grants.                          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int list_grant(fw_cmd *cmd, void *arg)
+{
+  if (n_listed < TEST_MAX_ENTRIES)
+  {
+    listed[n_listed++] = *cmd;
+  }
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : make_cmd                                                     */
+/*                                                                            */
+/* Description : Fill a firewall command.                                     */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void make_cmd(fw_cmd *cmd, int op, unsigned int s_ip, unsigned int d_ip,
+                     unsigned int created_at, unsigned int expiry)
+{
+  memset(cmd, 0, sizeof(fw_cmd));
+  cmd->op = op;
+  cmd->s_ip = s_ip;
+  cmd->d_ip = d_ip;
+  cmd->action = FW_ACCEPT_RULE;
+  cmd->created_at = created_at;
+  cmd->expiry = expiry;
+  cmd->dom_id = 3;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : check_updates                                                */
+/*                                                                            */
+/* Description : Add, refresh, list and delete grants through the backend.    */
+/*               A refresh replaces the grant in place, list reports them in  */
+/*               host order and a missing grant deletes without error.        */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void check_updates(void)
+{
+  fw_cmd cmd;
+
+  make_cmd(&cmd, FW_CMD_ADD, 0x0A000001, 0x0A000002, 100, 200);
+  CHECK(bpf_fw_ops.add(&cmd) == RET_OK);
+  make_cmd(&cmd, FW_CMD_ADD, 0x0A000001, 0x0A000003, 110, 210);
+  CHECK(bpf_fw_ops.add(&cmd) == RET_OK);
+  make_cmd(&cmd, FW_CMD_REFRESH, 0x0A000001, 0x0A000002, 100, 300);
+  CHECK(bpf_fw_ops.add(&cmd) == RET_OK);
+
+  n_listed = 0;
+  CHECK(bpf_fw_ops.list(list_grant, NULL) == RET_OK);
+  CHECK(n_listed == 2);
+  CHECK((listed[0].op == FW_CMD_ADD) && (listed[0].dom_id == -1));
+  CHECK(listed[0].s_ip == 0x0A000001);
+  CHECK(listed[0].d_ip + listed[1].d_ip == 0x0A000002 + 0x0A000003);
+  CHECK(listed[0].expiry + listed[1].expiry == 300 + 210);
+
+  make_cmd(&cmd, FW_CMD_DEL, 0x0A000001, 0x0A000002, 0, 0);
+  CHECK(bpf_fw_ops.del(&cmd) == RET_OK);
+  CHECK(bpf_fw_ops.del(&cmd) == RET_OK);
+  make_cmd(&cmd, FW_CMD_EXPIRE, 0x0A000001, 0x0A000003, 0, 0);
+  CHECK(bpf_fw_ops.del(&cmd) == RET_OK);
+
+  n_listed = 0;
+  CHECK(bpf_fw_ops.list(list_grant, NULL) == RET_OK);
+  CHECK(n_listed == 0);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_fake_map                                                */
+/*                                                                            */
+/* Description : Map updates on the userspace map, and the key and value      */
+/*               layout the classifier looks up.                              */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_fake_map(void)
+{
+  static unsigned char key[TEST_KEYZ] = {10, 0, 0, 1, 10, 0, 0, 2};
+  unsigned int value[2];
+  fw_cmd cmd;
+
+  bpf_fw_sys = fake_sys;
+  CHECK(bpf_fw_ops.init() == RET_OK);
+
+  make_cmd(&cmd, FW_CMD_ADD, 0x0A000001, 0x0A000002, 100, 200);
+  CHECK(bpf_fw_ops.add(&cmd) == RET_OK);
+  CHECK(fake_n == 1);
+  CHECK(!memcmp(fake_keys[0], key, TEST_KEYZ));
+  memcpy(value, fake_values[0], sizeof(value));
+  CHECK((value[0] == 100) && (value[1] == 200));
+  CHECK(bpf_fw_ops.del(&cmd) == RET_OK);
+
+  check_updates();
+
+  /****************************************************************************/
+  /* A failed update is reported.                                             */
+  /****************************************************************************/
+  fake_n = TEST_MAX_ENTRIES;
+  CHECK(bpf_fw_ops.add(&cmd) == RET_SYS_ERROR);
+  fake_n = 0;
+
+  bpf_fw_ops.shutdown();
+  bpf_fw_sys = kernel_sys;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_kernel_map                                              */
+/*                                                                            */
+/* Description : The same updates on a kernel map. Skipped if the process may */
+/*               not create one.                                              */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_kernel_map(void)
+{
+  if (bpf_fw_ops.init() != RET_OK)
+  {
+    printf("  (no kernel BPF map, skipped)\n");
+    return;
+  }
+
+  check_updates();
+
+  bpf_fw_ops.shutdown();
+}
+
+
+int main(int argc, char **argv)
+{
+  init_dnswld();
+  kernel_sys = bpf_fw_sys;
+
+  RUN_TEST(test_fake_map);
+  RUN_TEST(test_kernel_map);
+
+  return(TEST_RESULT());
+}
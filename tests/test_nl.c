@@ -0,0 +1,939 @@
+/*FILE+************************************************************************/
+/* Filename    : test_nl.c                                                    */
+/*                                                                            */
+/* Description : Unit tests of the netlink message buffer, and of the         */
+/*               messages the ipset and nft backends send. Netlink sockets    */
+/*               are swapped for socket pairs served by a fake kernel that    */
+/*               logs each request and acks, or fails, its messages.          */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <fw.h>
+#include <nl.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/utsname.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/nf_tables.h>
+
+#include <test.h>
+
+#define TEST_ATTR_LEN                             1000
+#define TEST_DEADLINE_SECS                        30
+#define TEST_MAX_DGRAMS                           64
+#define TEST_SRC_IP                               0x0A000001
+#define TEST_DST_IP                               0x0A000002
+#define TEST_AGE_SECS                             100
+#define TEST_LONG_NAME                            "dnswld-0123456789abcdefghijklmn"
+
+#define TEST_IPSET_TYPE(c)                        ((NFNL_SUBSYS_IPSET << 8) | (c))
+#define TEST_NFT_TYPE(m)                          ((NFNL_SUBSYS_NFTABLES << 8) | (m))
+
+/******************************************************************************/
+/* Fake kernel state, under fake_lock.                                        */
+/* - dgrams are the requests received, in order, lens their lengths.          */
+/* - Messages of fail_type fail with fail_err, n_fails more times. Their      */
+/*   error ack echoes the whole message unless is_cap_ack is set, as with a   */
+/*   kernel that ignores NETLINK_CAP_ACK.                                     */
+/******************************************************************************/
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *fake_dgrams[TEST_MAX_DGRAMS];
+static int fake_lens[TEST_MAX_DGRAMS];
+static int fake_n;
+static int fake_fail_type = -1;
+static int fake_fail_err;
+static int fake_n_fails;
+static int fake_is_cap_ack;
+
+/******************************************************************************/
+/* Buffer under test, with a guard after it that must stay untouched.         */
+/******************************************************************************/
+static struct
+{
+  nl_buf b;
+  char guard[TEST_ATTR_LEN];
+} test_buf;
+
+
+/*FUNC+************************************************************************/
+/* Function    : fake_reset                                                   */
+/*                                                                            */
+/* Description : Forget the logged requests and stop failing messages.        */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void fake_reset(void)
+{
+  int i;
+
+  pthread_mutex_lock(&fake_lock);
+
+  for (i = 0; i < fake_n; i++)
+  {
+    free(fake_dgrams[i]);
+  }
+  fake_n = 0;
+  fake_fail_type = -1;
+  fake_n_fails = 0;
+  fake_is_cap_ack = TRUE;
+
+  pthread_mutex_unlock(&fake_lock);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : fake_fail                                                    */
+/*                                                                            */
+/* Description : Fail the next n messages of a type with an error.            */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void fake_fail(int type, int err, int n)
+{
+  pthread_mutex_lock(&fake_lock);
+
+  fake_fail_type = type;
+  fake_fail_err = err;
+  fake_n_fails = n;
+
+  pthread_mutex_unlock(&fake_lock);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : fake_ack                                                     */
+/*                                                                            */
+/* Description : Send the ack of a request message, as the kernel would.      */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void fake_ack(int fd, struct nlmsghdr *req, int err, int is_cap_ack)
+{
+  char buf[NL_RCVZ];
+  struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+  struct nlmsgerr *nle = (struct nlmsgerr *)NLMSG_DATA(nlh);
+  int echo_len;
+
+  echo_len = ((err) && (!is_cap_ack)) ? req->nlmsg_len : NLMSG_HDRLEN;
+
+  nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct nlmsgerr) - NLMSG_HDRLEN +
+                                echo_len);
+  nlh->nlmsg_type = NLMSG_ERROR;
+  nlh->nlmsg_flags = (echo_len == NLMSG_HDRLEN) ? NLM_F_CAPPED : 0;
+  nlh->nlmsg_seq = req->nlmsg_seq;
+  nlh->nlmsg_pid = 0;
+  nle->error = err;
+  memcpy(&nle->msg, req, echo_len);
+
+  send(fd, buf, nlh->nlmsg_len, 0);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : fake_kernel                                                  */
+/*                                                                            */
+/* Description : Serve one socket until it is closed. Each request is logged; */
+/*               dumps end at once, failed messages and those asking for one  */
+/*               are acked.                                                   */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void *fake_kernel(void *arg)
+{
+  int fd = (int)(long)arg;
+  struct nlmsghdr *nlh;
+  struct nlmsghdr done;
+  char *buf;
+  int is_cap_ack;
+  int err;
+  int len;
+
+  buf = (char *)malloc(NL_BUFZ * 2);
+
+  while ((buf) && ((len = recv(fd, buf, NL_BUFZ * 2, MSG_TRUNC)) > 0))
+  {
+    pthread_mutex_lock(&fake_lock);
+
+    if (fake_n < TEST_MAX_DGRAMS)
+    {
+      fake_dgrams[fake_n] = (char *)malloc(len);
+      memcpy(fake_dgrams[fake_n], buf, len);
+      fake_lens[fake_n++] = len;
+    }
+    is_cap_ack = fake_is_cap_ack;
+
+    pthread_mutex_unlock(&fake_lock);
+
+    for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len))
+    {
+      pthread_mutex_lock(&fake_lock);
+
+      err = 0;
+      if ((nlh->nlmsg_type == fake_fail_type) && (fake_n_fails > 0))
+      {
+        err = fake_fail_err;
+        fake_n_fails--;
+      }
+
+      pthread_mutex_unlock(&fake_lock);
+
+      if (nlh->nlmsg_flags & NLM_F_DUMP)
+      {
+        memset(&done, 0, sizeof(done));
+        done.nlmsg_len = NLMSG_HDRLEN;
+        done.nlmsg_type = NLMSG_DONE;
+        done.nlmsg_seq = nlh->nlmsg_seq;
+        send(fd, &done, sizeof(done), 0);
+      }
+      else if ((err) || (nlh->nlmsg_flags & NLM_F_ACK))
+      {
+        fake_ack(fd, nlh, err, is_cap_ack);
+      }
+    }
+  }
+
+  free(buf);
+  close(fd);
+
+  return(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : fake_socket                                                  */
+/*                                                                            */
+/* Description : Stands in for nl_sys_socket. Returns one end of a socket     */
+/*               pair, with a fake kernel serving the other.                  */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int fake_socket(int proto)
+{
+  pthread_attr_t attr;
+  pthread_t tid;
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv))
+  {
+    return(-1);
+  }
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if (pthread_create(&tid, &attr, fake_kernel, (void *)(long)sv[1]))
+  {
+    close(sv[0]);
+    close(sv[1]);
+    sv[0] = -1;
+  }
+  pthread_attr_destroy(&attr);
+
+  return(sv[0]);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : old_uname                                                    */
+/*                                                                            */
+/* Description : Stands in for nft_fw_uname on a kernel whose re-added        */
+/*               elements keep their timeout.                                 */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int old_uname(struct utsname *uts)
+{
+  memset(uts, 0, sizeof(*uts));
+  strcpy(uts->release, "6.1.0");
+
+  return(0);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : new_uname                                                    */
+/*                                                                            */
+/* Description : Stands in for nft_fw_uname on a kernel whose re-added        */
+/*               elements take the new timeout.                               */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int new_uname(struct utsname *uts)
+{
+  memset(uts, 0, sizeof(*uts));
+  strcpy(uts->release, "6.11.0");
+
+  return(0);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : fake_msg                                                     */
+/*                                                                            */
+/* Description : A message of a logged request, NULL past the last.           */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static struct nlmsghdr *fake_msg(int dgram, int msg)
+{
+  struct nlmsghdr *nlh;
+  int len;
+
+  if (dgram >= fake_n)
+  {
+    return(NULL);
+  }
+
+  len = fake_lens[dgram];
+  for (nlh = (struct nlmsghdr *)fake_dgrams[dgram]; NLMSG_OK(nlh, len);
+       nlh = NLMSG_NEXT(nlh, len))
+  {
+    if (!msg--)
+    {
+      return(nlh);
+    }
+  }
+
+  return(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : fake_n_msgs                                                  */
+/*                                                                            */
+/* Description : Number of messages in a logged request.                      */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int fake_n_msgs(int dgram)
+{
+  int n = 0;
+
+  while (fake_msg(dgram, n))
+  {
+    n++;
+  }
+
+  return(n);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : msg_type                                                     */
+/*                                                                            */
+/* Description : Type of a logged message, -1 if missing.                     */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int msg_type(int dgram, int msg)
+{
+  struct nlmsghdr *nlh = fake_msg(dgram, msg);
+
+  return((nlh) ? nlh->nlmsg_type : -1);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : msg_attr                                                     */
+/*                                                                            */
+/* Description : Top level attribute of a netfilter message.                  */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static struct nlattr *msg_attr(struct nlmsghdr *nlh, int type)
+{
+  if ((!nlh) || (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct nfgenmsg))))
+  {
+    return(NULL);
+  }
+
+  return(nl_find_attr((char *)NLMSG_DATA(nlh) +
+                      NLMSG_ALIGN(sizeof(struct nfgenmsg)),
+                      nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct nfgenmsg)),
+                      type));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : nest_attr                                                    */
+/*                                                                            */
+/* Description : Attribute of a nest, NULL if either is missing.              */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static struct nlattr *nest_attr(struct nlattr *nest, int type)
+{
+  if (!nest)
+  {
+    return(NULL);
+  }
+
+  return(nl_find_attr(NL_ATTR_DATA(nest), NL_ATTR_LEN(nest), type));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : n_nested                                                     */
+/*                                                                            */
+/* Description : Number of attributes in a nest.                              */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int n_nested(struct nlattr *nest)
+{
+  struct nlattr *nla;
+  int len;
+  int n = 0;
+
+  if (!nest)
+  {
+    return(0);
+  }
+
+  len = NL_ATTR_LEN(nest);
+  for (nla = (struct nlattr *)NL_ATTR_DATA(nest);
+       (len >= NLA_HDRLEN) && (nla->nla_len >= NLA_HDRLEN) &&
+       (nla->nla_len <= len);
+       nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len)))
+  {
+    len -= NLA_ALIGN(nla->nla_len);
+    n++;
+  }
+
+  return(n);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : attr_str_is                                                  */
+/*                                                                            */
+/* Description : Whether an attribute holds a NUL terminated string.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int attr_str_is(struct nlattr *nla, char *str)
+{
+  return((nla) && (NL_ATTR_LEN(nla) == (int)strlen(str) + 1) &&
+         (!memcmp(NL_ATTR_DATA(nla), str, strlen(str) + 1)));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : attr_be32                                                    */
+/*                                                                            */
+/* Description : 32-bit attribute in network byte order, 0 if missing.        */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static unsigned int attr_be32(struct nlattr *nla)
+{
+  unsigned int val;
+
+  if ((!nla) || (NL_ATTR_LEN(nla) != sizeof(val)))
+  {
+    return(0);
+  }
+
+  memcpy(&val, NL_ATTR_DATA(nla), sizeof(val));
+
+  return(ntohl(val));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : attr_be64                                                    */
+/*                                                                            */
+/* Description : 64-bit attribute in network byte order, 0 if missing.        */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static unsigned long long attr_be64(struct nlattr *nla)
+{
+  unsigned int be[2];
+
+  if ((!nla) || (NL_ATTR_LEN(nla) != sizeof(be)))
+  {
+    return(0);
+  }
+
+  memcpy(be, NL_ATTR_DATA(nla), sizeof(be));
+
+  return(((unsigned long long)ntohl(be[0]) << 32) | ntohl(be[1]));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : guard_intact                                                 */
+/*                                                                            */
+/* Description : Whether nothing was written past the buffer.                 */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int guard_intact(void)
+{
+  int i;
+
+  for (i = 0; i < TEST_ATTR_LEN; i++)
+  {
+    if (test_buf.guard[i] != 0x5A)
+    {
+      return(FALSE);
+    }
+  }
+
+  return(TRUE);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_put_overflow                                            */
+/*                                                                            */
+/* Description : Attributes and messages that do not fit are not written.     */
+/*               The buffer is marked full, refused by nl_talk and nl_dump    */
+/*               without sending, and usable again after a reset.             */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_put_overflow(void)
+{
+  nl_buf *b = &test_buf.b;
+  nl_sock ns = {-1, 0, 0};
+  char data[TEST_ATTR_LEN];
+  struct nlattr *nest;
+  int len;
+
+  memset(data, 0xA5, sizeof(data));
+  memset(test_buf.guard, 0x5A, sizeof(test_buf.guard));
+
+  nl_reset(b);
+  nl_msg_start(&ns, b, 1, NLM_F_ACK, AF_UNSPEC, 0);
+  nest = nl_nest_start(b, 1);
+  while (nl_room(b) >= NLA_ALIGN(NLA_HDRLEN + sizeof(data)))
+  {
+    nl_put(b, 2, data, sizeof(data));
+  }
+  CHECK(!b->is_full);
+
+  len = b->len;
+  nl_put(b, 2, data, sizeof(data));
+  CHECK(b->is_full);
+  CHECK(b->len == len);
+
+  /****************************************************************************/
+  /* Once full nothing more is written, even what would fit.                  */
+  /****************************************************************************/
+  nl_put_u8(b, 3, 1);
+  nl_nest_end(b, nest);
+  nl_msg_end(b);
+  nl_msg_start(&ns, b, 1, NLM_F_ACK, AF_UNSPEC, 0);
+  CHECK(b->len == len);
+  CHECK(b->n_msgs == 1);
+  CHECK(guard_intact());
+
+  CHECK(nl_talk(&ns, b) == -EMSGSIZE);
+  CHECK(nl_dump(&ns, b, NULL, NULL) == -EMSGSIZE);
+
+  nl_reset(b);
+  CHECK(!b->is_full);
+  nl_msg_start(&ns, b, 1, NLM_F_ACK, AF_UNSPEC, 0);
+  nl_put(b, 2, data, sizeof(data));
+  nl_msg_end(b);
+  CHECK(b->len == NLMSG_SPACE(sizeof(struct nfgenmsg)) +
+                  NLA_ALIGN(NLA_HDRLEN + sizeof(data)));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_msg_overflow                                            */
+/*                                                                            */
+/* Description : A message header that does not fit is not written.           */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_msg_overflow(void)
+{
+  nl_buf *b = &test_buf.b;
+  nl_sock ns = {-1, 0, 0};
+  char data[TEST_ATTR_LEN];
+
+  memset(data, 0xA5, sizeof(data));
+  memset(test_buf.guard, 0x5A, sizeof(test_buf.guard));
+
+  nl_reset(b);
+  nl_msg_start(&ns, b, 1, 0, AF_UNSPEC, 0);
+  while (nl_room(b) >= NLA_ALIGN(NLA_HDRLEN + sizeof(data)))
+  {
+    nl_put(b, 2, data, sizeof(data));
+  }
+  nl_put(b, 2, data, nl_room(b) - NLA_HDRLEN - NLA_HDRLEN);
+  nl_msg_end(b);
+  CHECK(!b->is_full);
+  CHECK(nl_room(b) == NLA_HDRLEN);
+
+  nl_msg_start(&ns, b, 1, 0, AF_UNSPEC, 0);
+  CHECK(b->is_full);
+  CHECK(b->n_msgs == 1);
+  CHECK(nl_room(b) == NLA_HDRLEN);
+  CHECK(guard_intact());
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_talk_errors                                             */
+/*                                                                            */
+/* Description : An error of an earlier message is reported though a later    */
+/*               one is acked. The error ack of a message filling the buffer  */
+/*               is read whole whether or not the kernel caps it.             */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_talk_errors(void)
+{
+  nl_buf *b = &test_buf.b;
+  nl_sock ns = {-1, 0, 0};
+  char data[TEST_ATTR_LEN];
+
+  memset(data, 0xA5, sizeof(data));
+  fake_reset();
+  CHECK(nl_open(&ns) == RET_OK);
+
+  nl_reset(b);
+  nl_msg_start(&ns, b, TEST_NFT_TYPE(NFT_MSG_NEWTABLE), 0, NFPROTO_IPV4, 0);
+  nl_msg_end(b);
+  nl_msg_start(&ns, b, TEST_NFT_TYPE(NFT_MSG_NEWSET), NLM_F_ACK,
+               NFPROTO_IPV4, 0);
+  nl_msg_end(b);
+  fake_fail(TEST_NFT_TYPE(NFT_MSG_NEWTABLE), -EEXIST, 1);
+  CHECK(nl_talk(&ns, b) == -EEXIST);
+
+  nl_reset(b);
+  nl_msg_start(&ns, b, TEST_NFT_TYPE(NFT_MSG_NEWSET), NLM_F_ACK,
+               NFPROTO_IPV4, 0);
+  while (nl_room(b) >= NLA_ALIGN(NLA_HDRLEN + sizeof(data)))
+  {
+    nl_put(b, 2, data, sizeof(data));
+  }
+  nl_put(b, 2, data, nl_room(b) - NLA_HDRLEN);
+  nl_msg_end(b);
+  CHECK(nl_room(b) == 0);
+
+  fake_is_cap_ack = FALSE;
+  fake_fail(TEST_NFT_TYPE(NFT_MSG_NEWSET), -EPERM, 1);
+  CHECK(nl_talk(&ns, b) == -EPERM);
+
+  fake_is_cap_ack = TRUE;
+  fake_fail(TEST_NFT_TYPE(NFT_MSG_NEWSET), -EPERM, 1);
+  CHECK(nl_talk(&ns, b) == -EPERM);
+
+  CHECK(nl_talk(&ns, b) == 0);
+  CHECK(fake_n == 4);
+
+  nl_close(&ns);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_ipset_msgs                                              */
+/*                                                                            */
+/* Description : The ipset backend creates and flushes its set, adds members  */
+/*               with their timeout, deletes them without, leaves expiries to */
+/*               the kernel and reports a failed add.                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_ipset_msgs(void)
+{
+  unsigned int now = (unsigned int)time(NULL);
+  struct nlmsghdr *nlh;
+  struct nlattr *data;
+  fw_cmd cmd;
+
+  fake_reset();
+  CHECK(ipset_fw_ops.init() == RET_OK);
+  CHECK(fake_n == 2);
+
+  nlh = fake_msg(0, 0);
+  CHECK(msg_type(0, 0) == TEST_IPSET_TYPE(IPSET_CMD_CREATE));
+  CHECK((nlh) && (nlh->nlmsg_flags & NLM_F_ACK));
+  CHECK(attr_str_is(msg_attr(nlh, IPSET_ATTR_SETNAME), dnswld.fw.set_name));
+  CHECK(attr_str_is(msg_attr(nlh, IPSET_ATTR_TYPENAME), IPSET_TYPE));
+  data = msg_attr(nlh, IPSET_ATTR_DATA);
+  CHECK(attr_be32(nest_attr(data, IPSET_ATTR_TIMEOUT)) ==
+        (unsigned int)dnswld.proc.wl_age);
+  CHECK(msg_type(1, 0) == TEST_IPSET_TYPE(IPSET_CMD_FLUSH));
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.op = FW_CMD_ADD;
+  cmd.s_ip = TEST_SRC_IP;
+  cmd.d_ip = TEST_DST_IP;
+  cmd.expiry = now + TEST_AGE_SECS;
+  cmd.dom_id = -1;
+
+  fake_reset();
+  CHECK(ipset_fw_ops.add(&cmd) == RET_OK);
+  CHECK(fake_n == 1);
+  CHECK(msg_type(0, 0) == TEST_IPSET_TYPE(IPSET_CMD_ADD));
+  data = msg_attr(fake_msg(0, 0), IPSET_ATTR_DATA);
+  CHECK(attr_be32(nest_attr(nest_attr(data, IPSET_ATTR_IP),
+                            IPSET_ATTR_IPADDR_IPV4)) == TEST_SRC_IP);
+  CHECK(attr_be32(nest_attr(nest_attr(data, IPSET_ATTR_IP2),
+                            IPSET_ATTR_IPADDR_IPV4)) == TEST_DST_IP);
+  CHECK(attr_be32(nest_attr(data, IPSET_ATTR_TIMEOUT)) >= TEST_AGE_SECS - 1);
+  CHECK(attr_be32(nest_attr(data, IPSET_ATTR_TIMEOUT)) <= TEST_AGE_SECS);
+
+  cmd.op = FW_CMD_DEL;
+  fake_reset();
+  CHECK(ipset_fw_ops.del(&cmd) == RET_OK);
+  CHECK(fake_n == 1);
+  CHECK(msg_type(0, 0) == TEST_IPSET_TYPE(IPSET_CMD_DEL));
+  data = msg_attr(fake_msg(0, 0), IPSET_ATTR_DATA);
+  CHECK(attr_be32(nest_attr(nest_attr(data, IPSET_ATTR_IP2),
+                            IPSET_ATTR_IPADDR_IPV4)) == TEST_DST_IP);
+  CHECK(!nest_attr(data, IPSET_ATTR_TIMEOUT));
+
+  cmd.op = FW_CMD_EXPIRE;
+  CHECK(ipset_fw_ops.del(&cmd) == RET_OK);
+  CHECK(fake_n == 1);
+
+  cmd.op = FW_CMD_ADD;
+  fake_fail(TEST_IPSET_TYPE(IPSET_CMD_ADD), -EPERM, 1);
+  CHECK(ipset_fw_ops.add(&cmd) == RET_SYS_ERROR);
+
+  ipset_fw_ops.shutdown();
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_nft_msgs                                                */
+/*                                                                            */
+/* Description : The nft backend sets up its table and set in one batch, adds */
+/*               elements with their timeout, refreshes them in place, and    */
+/*               deletes them without one. Every change is a batch.           */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_nft_msgs(void)
+{
+  unsigned int now = (unsigned int)time(NULL);
+  unsigned int pair[2] = {htonl(TEST_SRC_IP), htonl(TEST_DST_IP)};
+  struct nlmsghdr *nlh;
+  struct nfgenmsg *nfg;
+  struct nlattr *elem;
+  struct nlattr *key;
+  fw_cmd cmd;
+  int status;
+
+  nft_fw_uname = new_uname;
+  fake_reset();
+  CHECK(nft_fw_ops.init() == RET_OK);
+  CHECK(fake_n == 1);
+  CHECK(fake_n_msgs(0) == 5);
+
+  nlh = fake_msg(0, 0);
+  CHECK(msg_type(0, 0) == NFNL_MSG_BATCH_BEGIN);
+  nfg = (nlh) ? (struct nfgenmsg *)NLMSG_DATA(nlh) : NULL;
+  CHECK((nfg) && (nfg->res_id == htons(NFNL_SUBSYS_NFTABLES)));
+  CHECK(msg_type(0, 1) == TEST_NFT_TYPE(NFT_MSG_NEWTABLE));
+  CHECK(attr_str_is(msg_attr(fake_msg(0, 1), NFTA_TABLE_NAME),
+                    dnswld.fw.table_name));
+  nlh = fake_msg(0, 2);
+  CHECK(msg_type(0, 2) == TEST_NFT_TYPE(NFT_MSG_NEWSET));
+  CHECK(attr_str_is(msg_attr(nlh, NFTA_SET_NAME), dnswld.fw.set_name));
+  CHECK(attr_be32(msg_attr(nlh, NFTA_SET_FLAGS)) == NFT_SET_TIMEOUT);
+  CHECK(attr_be32(msg_attr(nlh, NFTA_SET_KEY_LEN)) == sizeof(pair));
+  CHECK(msg_type(0, 3) == TEST_NFT_TYPE(NFT_MSG_DELSETELEM));
+  CHECK(!msg_attr(fake_msg(0, 3), NFTA_SET_ELEM_LIST_ELEMENTS));
+  CHECK(msg_type(0, 4) == NFNL_MSG_BATCH_END);
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.op = FW_CMD_ADD;
+  cmd.s_ip = TEST_SRC_IP;
+  cmd.d_ip = TEST_DST_IP;
+  cmd.expiry = now + TEST_AGE_SECS;
+  cmd.dom_id = -1;
+
+  fake_reset();
+  CHECK(nft_fw_ops.add(&cmd) == RET_OK);
+  CHECK(fake_n == 1);
+  CHECK(fake_n_msgs(0) == 3);
+  CHECK(msg_type(0, 0) == NFNL_MSG_BATCH_BEGIN);
+  nlh = fake_msg(0, 1);
+  CHECK(msg_type(0, 1) == TEST_NFT_TYPE(NFT_MSG_NEWSETELEM));
+  CHECK((nlh) && (nlh->nlmsg_flags & NLM_F_CREATE) &&
+        (nlh->nlmsg_flags & NLM_F_ACK));
+  CHECK(attr_str_is(msg_attr(nlh, NFTA_SET_ELEM_LIST_TABLE),
+                    dnswld.fw.table_name));
+  CHECK(attr_str_is(msg_attr(nlh, NFTA_SET_ELEM_LIST_SET),
+                    dnswld.fw.set_name));
+  CHECK(n_nested(msg_attr(nlh, NFTA_SET_ELEM_LIST_ELEMENTS)) == 1);
+  elem = nest_attr(msg_attr(nlh, NFTA_SET_ELEM_LIST_ELEMENTS), NFTA_LIST_ELEM);
+  key = nest_attr(nest_attr(elem, NFTA_SET_ELEM_KEY), NFTA_DATA_VALUE);
+  CHECK((key) && (NL_ATTR_LEN(key) == sizeof(pair)) &&
+        (!memcmp(NL_ATTR_DATA(key), pair, sizeof(pair))));
+  CHECK(attr_be64(nest_attr(elem, NFTA_SET_ELEM_TIMEOUT)) >=
+        (TEST_AGE_SECS - 1) * 1000ULL);
+  CHECK(attr_be64(nest_attr(elem, NFTA_SET_ELEM_TIMEOUT)) <=
+        TEST_AGE_SECS * 1000ULL);
+  CHECK(!nest_attr(elem, NFTA_SET_ELEM_EXPIRATION));
+  CHECK(msg_type(0, 2) == NFNL_MSG_BATCH_END);
+
+  cmd.op = FW_CMD_REFRESH;
+  fake_reset();
+  CHECK(nft_fw_ops.add(&cmd) == RET_OK);
+  CHECK(fake_n_msgs(0) == 3);
+  CHECK(msg_type(0, 1) == TEST_NFT_TYPE(NFT_MSG_NEWSETELEM));
+  elem = nest_attr(msg_attr(fake_msg(0, 1), NFTA_SET_ELEM_LIST_ELEMENTS),
+                   NFTA_LIST_ELEM);
+  CHECK(attr_be64(nest_attr(elem, NFTA_SET_ELEM_EXPIRATION)) ==
+        attr_be64(nest_attr(elem, NFTA_SET_ELEM_TIMEOUT)));
+
+  cmd.op = FW_CMD_DEL;
+  fake_reset();
+  CHECK(nft_fw_ops.del(&cmd) == RET_OK);
+  CHECK(fake_n_msgs(0) == 3);
+  CHECK(msg_type(0, 1) == TEST_NFT_TYPE(NFT_MSG_DELSETELEM));
+  elem = nest_attr(msg_attr(fake_msg(0, 1), NFTA_SET_ELEM_LIST_ELEMENTS),
+                   NFTA_LIST_ELEM);
+  CHECK(nest_attr(elem, NFTA_SET_ELEM_KEY) != NULL);
+  CHECK(!nest_attr(elem, NFTA_SET_ELEM_TIMEOUT));
+
+  /****************************************************************************/
+  /* Expiries are left to the kernel.                                         */
+  /****************************************************************************/
+  cmd.op = FW_CMD_EXPIRE;
+  fake_reset();
+  nft_fw_ops.bulk(&cmd, 1, &status);
+  CHECK(status == RET_OK);
+  CHECK(fake_n == 0);
+
+  nft_fw_ops.shutdown();
+  nft_fw_uname = uname;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_nft_batch_errors                                        */
+/*                                                                            */
+/* Description : A failed batch is retried one command at a time. A delete of */
+/*               a missing element is not an error and a failed add is        */
+/*               reported alone, with error acks echoing the whole message.   */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_nft_batch_errors(void)
+{
+  unsigned int now = (unsigned int)time(NULL);
+  fw_cmd cmds[2];
+  int status[2];
+
+  CHECK(nft_fw_ops.init() == RET_OK);
+
+  memset(cmds, 0, sizeof(cmds));
+  cmds[0].op = FW_CMD_ADD;
+  cmds[0].s_ip = TEST_SRC_IP;
+  cmds[0].d_ip = TEST_DST_IP;
+  cmds[0].expiry = now + TEST_AGE_SECS;
+  cmds[0].dom_id = -1;
+  cmds[1] = cmds[0];
+  cmds[1].op = FW_CMD_DEL;
+  cmds[1].d_ip = TEST_DST_IP + 1;
+
+  fake_reset();
+  fake_is_cap_ack = FALSE;
+  fake_fail(TEST_NFT_TYPE(NFT_MSG_DELSETELEM), -ENOENT, 2);
+  nft_fw_ops.bulk(cmds, 2, status);
+  CHECK(fake_n == 3);
+  CHECK((status[0] == RET_OK) && (status[1] == RET_OK));
+
+  cmds[1].op = FW_CMD_ADD;
+  fake_reset();
+  fake_is_cap_ack = FALSE;
+  fake_fail(TEST_NFT_TYPE(NFT_MSG_NEWSETELEM), -ENOSPC, 2);
+  nft_fw_ops.bulk(cmds, 2, status);
+  CHECK(fake_n == 3);
+  CHECK((status[0] == RET_SYS_ERROR) && (status[1] == RET_OK));
+
+  nft_fw_ops.shutdown();
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_nft_split                                               */
+/*                                                                            */
+/* Description : A full batch of refreshes with the longest names, on a       */
+/*               kernel where each is a delete and an add, does not fit one   */
+/*               buffer. It is split into whole batches that carry every      */
+/*               element once each way.                                       */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_nft_split(void)
+{
+  unsigned int now = (unsigned int)time(NULL);
+  static fw_cmd cmds[FW_BATCH_MAX];
+  static int status[FW_BATCH_MAX];
+  struct nlmsghdr *nlh;
+  int n_dels = 0;
+  int n_adds = 0;
+  int d;
+  int m;
+  int i;
+
+  strcpy(dnswld.fw.table_name, TEST_LONG_NAME);
+  strcpy(dnswld.fw.set_name, TEST_LONG_NAME);
+  nft_fw_uname = old_uname;
+  CHECK(nft_fw_ops.init() == RET_OK);
+
+  memset(cmds, 0, sizeof(cmds));
+  for (i = 0; i < FW_BATCH_MAX; i++)
+  {
+    cmds[i].op = FW_CMD_REFRESH;
+    cmds[i].s_ip = TEST_SRC_IP;
+    cmds[i].d_ip = TEST_DST_IP + i;
+    cmds[i].expiry = now + TEST_AGE_SECS;
+    cmds[i].dom_id = -1;
+  }
+
+  fake_reset();
+  nft_fw_ops.bulk(cmds, FW_BATCH_MAX, status);
+  CHECK(fake_n == 2);
+
+  for (d = 0; d < fake_n; d++)
+  {
+    CHECK(fake_lens[d] <= NL_BUFZ);
+    CHECK(msg_type(d, 0) == NFNL_MSG_BATCH_BEGIN);
+    CHECK(msg_type(d, fake_n_msgs(d) - 1) == NFNL_MSG_BATCH_END);
+
+    for (m = 1; (nlh = fake_msg(d, m)); m++)
+    {
+      if (nlh->nlmsg_type == TEST_NFT_TYPE(NFT_MSG_DELSETELEM))
+      {
+        n_dels += n_nested(msg_attr(nlh, NFTA_SET_ELEM_LIST_ELEMENTS));
+      }
+      else if (nlh->nlmsg_type == TEST_NFT_TYPE(NFT_MSG_NEWSETELEM))
+      {
+        n_adds += n_nested(msg_attr(nlh, NFTA_SET_ELEM_LIST_ELEMENTS));
+      }
+    }
+  }
+
+  CHECK(n_dels == FW_BATCH_MAX);
+  CHECK(n_adds == FW_BATCH_MAX);
+  for (i = 0; i < FW_BATCH_MAX; i++)
+  {
+    CHECK(status[i] == RET_OK);
+  }
+
+  nft_fw_ops.shutdown();
+  nft_fw_uname = uname;
+  strcpy(dnswld.fw.table_name, DEF_NFT_TABLE);
+  strcpy(dnswld.fw.set_name, DEF_IPSET_NAME);
+}
+
+
+int main(int argc, char **argv)
+{
+  /****************************************************************************/
+  /* A lost ack times out in nl_talk; a lost fake kernel must not hang.       */
+  /****************************************************************************/
+  alarm(TEST_DEADLINE_SECS);
+
+  init_dnswld();
+  dnswld.fw.n_chains = 0;
+  nl_sys_socket = fake_socket;
+
+  RUN_TEST(test_put_overflow);
+  RUN_TEST(test_msg_overflow);
+  RUN_TEST(test_talk_errors);
+  RUN_TEST(test_ipset_msgs);
+  RUN_TEST(test_nft_msgs);
+  RUN_TEST(test_nft_batch_errors);
+  RUN_TEST(test_nft_split);
+
+  fake_reset();
+
+  return(TEST_RESULT());
+}
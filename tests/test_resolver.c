@@ -0,0 +1,602 @@
+/*FILE+************************************************************************/
+/* Filename    : test_resolver.c                                              */
+/*                                                                            */
+/* Description : Tests of the upstream resolver against fake upstream servers */
+/*               on loopback. The test drives both sides from one thread:     */
+/*               queries are parked, the fake servers read what the resolver  */
+/*               sent and answer (or not), and the event loop is pumped.      */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <network.h>
+#include <access_list.h>
+
+#include <poll.h>
+
+#include <test.h>
+
+#define TEST_TIMEOUT_MS                           200
+#define TEST_RETRIES                              1
+#define TEST_WAIT_MS                              2000
+#define TEST_NAME                                 "www.example.com"
+#define TEST_ADDR                                 0x0A000001
+
+/******************************************************************************/
+/* Fake upstream servers, the listener socket replies are sent on and the     */
+/* client socket they are received on.                                        */
+/******************************************************************************/
+static int fake_socks[2];
+static int listen_sock;
+static int client_sock;
+static struct sockaddr_in client_addr;
+static worker_cb worker;
+
+
+/*FUNC+************************************************************************/
+/* Function    : open_loopback                                                */
+/*                                                                            */
+/* Description : Open a UDP socket on a loopback ephemeral port.              */
+/*                                                                            */
+/* Returns     : sock                     - Socket, -1 on error.              */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int open_loopback(struct sockaddr_in *addr)
+{
+  socklen_t addr_len = sizeof(*addr);
+  int sock;
+
+  sock = socket(PF_INET, SOCK_DGRAM, 0);
+  if (sock < 0)
+  {
+    return(-1);
+  }
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((bind(sock, (struct sockaddr *)addr, sizeof(*addr))) ||
+      (getsockname(sock, (struct sockaddr *)addr, &addr_len)))
+  {
+    close(sock);
+    return(-1);
+  }
+
+  return(sock);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : recv_wait                                                    */
+/*                                                                            */
+/* Description : Receive a datagram, waiting up to timeout_ms.                */
+/*                                                                            */
+/* Returns     : len                      - Length, -1 if none arrived.       */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int recv_wait(int sock, unsigned char *buf, int size,
+                     struct sockaddr_in *from, int timeout_ms)
+{
+  struct pollfd pfd = {sock, POLLIN, 0};
+  socklen_t from_len = sizeof(*from);
+
+  if (poll(&pfd, 1, timeout_ms) <= 0)
+  {
+    return(-1);
+  }
+
+  return(recvfrom(sock, buf, size, 0, (struct sockaddr *)from, &from_len));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : pump                                                         */
+/*                                                                            */
+/* Description : Run the resolver event loop for ms msecs.                    */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void pump(int ms)
+{
+  unsigned long end = get_mono_usecs() + ms * 1000UL;
+
+  while (get_mono_usecs() < end)
+  {
+    run_event_loop(&worker.evloop, 10);
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : park                                                         */
+/*                                                                            */
+/* Description : Park an A query for name with request ID id.                 */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int park(char *name, unsigned short id)
+{
+  char pkt[DNS_PAYLOADZ];
+  dns_header *dns_hdr = (dns_header *)pkt;
+  dns_question qs[DNS_MAX_QUESTIONS];
+  dns_edns edns = {0};
+  char *pkt_ptr = pkt + sizeof(dns_header);
+  char *dot;
+  int len;
+
+  memset(dns_hdr, 0, sizeof(*dns_hdr));
+  dns_hdr->id = id;
+  dns_hdr->fc = DNS_HDR_RD << 8;
+  dns_hdr->q_count = 1;
+
+  while (*name)
+  {
+    dot = strchr(name, '.');
+    len = (dot) ? dot - name : strlen(name);
+    *pkt_ptr++ = len;
+    memcpy(pkt_ptr, name, len);
+    pkt_ptr += len;
+    name += (dot) ? len + 1 : len;
+  }
+
+  *pkt_ptr++ = 0;
+  *((unsigned short *)pkt_ptr) = htons(DNS_RR_TYPE_A);
+  pkt_ptr += sizeof(unsigned short);
+  *((unsigned short *)pkt_ptr) = htons(DNS_RR_CLASS_IN);
+  pkt_ptr += sizeof(unsigned short);
+  len = pkt_ptr - pkt;
+
+  pkt_ptr = pkt + sizeof(dns_header);
+  if (parse_question_section(&pkt_ptr, len - sizeof(dns_header), qs, 1))
+  {
+    return(RET_MALFORMED_DNS_REQ);
+  }
+
+  qs[0].is_whitelisted = TRUE;
+  qs[0].dom_id = 0;
+
+  return(park_dns_query(&worker.rslv, listen_sock, &client_addr, pkt, len,
+                        DNS_PAYLOADZ, &edns, get_mono_usecs(), qs, 1));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : fake_reply                                                   */
+/*                                                                            */
+/* Description : Answer an upstream query from a fake server. The reply ID is */
+/*               the query's plus id_delta. An A record is added if d_ip is   */
+/*               set.                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void fake_reply(int fake, unsigned char *query, int len,
+                       struct sockaddr_in *to, int id_delta, int rcode,
+                       unsigned int d_ip)
+{
+  unsigned char buf[DNS_PAYLOADZ];
+  dns_header *hdr = (dns_header *)buf;
+  unsigned char *last = buf + len;
+
+  memcpy(buf, query, len);
+  hdr->id = htons(ntohs(hdr->id) + id_delta);
+  buf[2] = DNS_HDR_QR | DNS_HDR_RD;
+  buf[3] = DNS_HDR_RA | rcode;
+  hdr->ans_count = 0;
+
+  if (d_ip)
+  {
+    hdr->ans_count = htons(1);
+    *last++ = DNS_PTR_TO(sizeof(dns_header)) >> 8;
+    *last++ = DNS_PTR_TO(sizeof(dns_header)) & 0xFF;
+    *((unsigned short *)last) = htons(DNS_RR_TYPE_A);
+    last += sizeof(unsigned short);
+    *((unsigned short *)last) = htons(DNS_RR_CLASS_IN);
+    last += sizeof(unsigned short);
+    *((unsigned int *)last) = htonl(60);
+    last += sizeof(unsigned int);
+    *((unsigned short *)last) = htons(DNS_RR_TYPE_A_LEN);
+    last += sizeof(unsigned short);
+    *((unsigned int *)last) = htonl(d_ip);
+    last += DNS_RR_TYPE_A_LEN;
+  }
+
+  sendto(fake, buf, last - buf, 0, (struct sockaddr *)to, sizeof(*to));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : fake_recv                                                    */
+/*                                                                            */
+/* Description : Read an upstream query on a fake server.                     */
+/*                                                                            */
+/* Returns     : len                      - Length, -1 if none arrived.       */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int fake_recv(int fake, unsigned char *buf, struct sockaddr_in *from,
+                     int timeout_ms)
+{
+  int len;
+
+  len = recv_wait(fake, buf, DNS_PAYLOADZ, from, timeout_ms);
+  if ((len > 0) && (!dns_name_equal(buf, len, sizeof(dns_header), TEST_NAME)))
+  {
+    return(-1);
+  }
+
+  return(len);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : pump_fake_recv                                               */
+/*                                                                            */
+/* Description : Run the event loop until a fake server gets a query, e.g. a  */
+/*               retry after a timeout, or max_ms msecs pass.                 */
+/*                                                                            */
+/* Returns     : len                      - Length, -1 if none arrived.       */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int pump_fake_recv(int fake, unsigned char *buf,
+                          struct sockaddr_in *from, int max_ms)
+{
+  unsigned long end = get_mono_usecs() + max_ms * 1000UL;
+  int len;
+
+  while ((len = fake_recv(fake, buf, from, 0)) < 0)
+  {
+    if (get_mono_usecs() >= end)
+    {
+      break;
+    }
+
+    run_event_loop(&worker.evloop, 10);
+  }
+
+  return(len);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : client_recv                                                  */
+/*                                                                            */
+/* Description : Read the reply to a parked query.                            */
+/*                                                                            */
+/* Returns     : n_ans                    - Answer count, -1 if no reply.     */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int client_recv(unsigned short *id, int *rcode, unsigned int *d_ip,
+                       int timeout_ms)
+{
+  unsigned char buf[DNS_PAYLOADZ];
+  struct sockaddr_in from;
+  int len;
+
+  len = recv_wait(client_sock, buf, sizeof(buf), &from, timeout_ms);
+  if (len < (int)sizeof(dns_header))
+  {
+    return(-1);
+  }
+
+  *id = ntohs(((dns_header *)buf)->id);
+  *rcode = buf[3] & DNS_HDR_RC;
+  *d_ip = ntohl(*(unsigned int *)&buf[len - DNS_RR_TYPE_A_LEN]);
+
+  return(ntohs(((dns_header *)buf)->ans_count));
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_answer                                                  */
+/*                                                                            */
+/* Description : A parked query is answered from the upstream reply.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_answer(void)
+{
+  unsigned char query[DNS_PAYLOADZ];
+  struct sockaddr_in from;
+  unsigned short id;
+  unsigned int d_ip;
+  int rcode;
+  int len;
+
+  CHECK(park(TEST_NAME, 0x1111) == RET_OK);
+  CHECK((len = fake_recv(fake_socks[0], query, &from, 500)) > 0);
+  CHECK(query[2] & DNS_HDR_RD);
+
+  fake_reply(fake_socks[0], query, len, &from, 0, DNS_HDR_RCODE_NO_ERR,
+             TEST_ADDR);
+  pump(50);
+
+  CHECK(client_recv(&id, &rcode, &d_ip, 100) == 1);
+  CHECK(id == 0x1111);
+  CHECK(rcode == DNS_HDR_RCODE_NO_ERR);
+  CHECK(d_ip == TEST_ADDR);
+  CHECK(worker.rslv.n_pending == 0);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_txid_mismatch                                           */
+/*                                                                            */
+/* Description : Replies with another transaction ID, or from a server the    */
+/*               lookup wasn't sent to, are dropped.                          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_txid_mismatch(void)
+{
+  unsigned char query[DNS_PAYLOADZ];
+  struct sockaddr_in from;
+  unsigned short id;
+  unsigned int d_ip;
+  int rcode;
+  int len;
+
+  CHECK(park(TEST_NAME, 0x2222) == RET_OK);
+  CHECK((len = fake_recv(fake_socks[0], query, &from, 500)) > 0);
+
+  fake_reply(fake_socks[0], query, len, &from, 1, DNS_HDR_RCODE_NO_ERR,
+             TEST_ADDR + 1);
+  fake_reply(fake_socks[1], query, len, &from, 0, DNS_HDR_RCODE_NO_ERR,
+             TEST_ADDR + 2);
+  pump(50);
+  CHECK(client_recv(&id, &rcode, &d_ip, 0) < 0);
+  CHECK(worker.rslv.n_pending == 1);
+
+  fake_reply(fake_socks[0], query, len, &from, 0, DNS_HDR_RCODE_NO_ERR,
+             TEST_ADDR);
+  pump(50);
+  CHECK(client_recv(&id, &rcode, &d_ip, 100) == 1);
+  CHECK(id == 0x2222);
+  CHECK(d_ip == TEST_ADDR);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_source_port                                             */
+/*                                                                            */
+/* Description : Each lookup is sent from its own port. A reply with the      */
+/*               right transaction ID sent to another port is not taken.      */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_source_port(void)
+{
+  unsigned char query[DNS_PAYLOADZ];
+  struct sockaddr_in from;
+  struct sockaddr_in spoof;
+  unsigned short id;
+  unsigned int d_ip;
+  int rcode;
+  int len;
+
+  CHECK(park(TEST_NAME, 0x2323) == RET_OK);
+  CHECK((len = fake_recv(fake_socks[0], query, &spoof, 500)) > 0);
+  fake_reply(fake_socks[0], query, len, &spoof, 0, DNS_HDR_RCODE_NO_ERR,
+             TEST_ADDR);
+  pump(50);
+  CHECK(client_recv(&id, &rcode, &d_ip, 100) == 1);
+
+  CHECK(park(TEST_NAME, 0x2424) == RET_OK);
+  CHECK((len = fake_recv(fake_socks[0], query, &from, 500)) > 0);
+  CHECK(from.sin_port != spoof.sin_port);
+
+  fake_reply(fake_socks[0], query, len, &spoof, 0, DNS_HDR_RCODE_NO_ERR,
+             TEST_ADDR + 1);
+  pump(50);
+  CHECK(client_recv(&id, &rcode, &d_ip, 0) < 0);
+
+  fake_reply(fake_socks[0], query, len, &from, 0, DNS_HDR_RCODE_NO_ERR,
+             TEST_ADDR);
+  pump(50);
+  CHECK(client_recv(&id, &rcode, &d_ip, 100) == 1);
+  CHECK(id == 0x2424);
+  CHECK(d_ip == TEST_ADDR);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_timeout_retry                                           */
+/*                                                                            */
+/* Description : An unanswered lookup is resent under a new transaction ID    */
+/*               and from a new port after the timeout. A late reply to the   */
+/*               first send is dropped.                                       */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_timeout_retry(void)
+{
+  unsigned char query[DNS_PAYLOADZ];
+  unsigned char retry[DNS_PAYLOADZ];
+  struct sockaddr_in from;
+  struct sockaddr_in first;
+  unsigned long n_timeouts = dnswld.stats.n_upstream_timeouts;
+  unsigned short id;
+  unsigned int d_ip;
+  int rcode;
+  int len;
+  int retry_len;
+
+  CHECK(park(TEST_NAME, 0x3333) == RET_OK);
+  CHECK((len = fake_recv(fake_socks[0], query, &first, 500)) > 0);
+
+  /****************************************************************************/
+  /* Retries go to the next server.                                           */
+  /****************************************************************************/
+  CHECK((retry_len = pump_fake_recv(fake_socks[1], retry, &from,
+                                    TEST_WAIT_MS)) > 0);
+  CHECK(dnswld.stats.n_upstream_timeouts == n_timeouts + 1);
+  CHECK(memcmp(query, retry, sizeof(unsigned short)));
+  CHECK(from.sin_port != first.sin_port);
+
+  fake_reply(fake_socks[1], query, len, &from, 0, DNS_HDR_RCODE_NO_ERR,
+             TEST_ADDR + 1);
+  pump(50);
+  CHECK(client_recv(&id, &rcode, &d_ip, 0) < 0);
+
+  fake_reply(fake_socks[1], retry, retry_len, &from, 0, DNS_HDR_RCODE_NO_ERR,
+             TEST_ADDR);
+  pump(50);
+  CHECK(client_recv(&id, &rcode, &d_ip, 100) == 1);
+  CHECK(id == 0x3333);
+  CHECK(d_ip == TEST_ADDR);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_server_failure                                          */
+/*                                                                            */
+/* Description : SERVFAIL retries on the next server right away.              */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_server_failure(void)
+{
+  unsigned char query[DNS_PAYLOADZ];
+  struct sockaddr_in from;
+  unsigned short id;
+  unsigned int d_ip;
+  int rcode;
+  int len;
+
+  CHECK(park(TEST_NAME, 0x4444) == RET_OK);
+  CHECK((len = fake_recv(fake_socks[0], query, &from, 500)) > 0);
+
+  fake_reply(fake_socks[0], query, len, &from, 0,
+             DNS_HDR_RCODE_SERVER_FAILURE, 0);
+  pump(50);
+  CHECK(client_recv(&id, &rcode, &d_ip, 0) < 0);
+
+  CHECK((len = fake_recv(fake_socks[1], query, &from, 100)) > 0);
+  fake_reply(fake_socks[1], query, len, &from, 0, DNS_HDR_RCODE_NO_ERR,
+             TEST_ADDR);
+  pump(50);
+  CHECK(client_recv(&id, &rcode, &d_ip, 100) == 1);
+  CHECK(d_ip == TEST_ADDR);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_give_up                                                 */
+/*                                                                            */
+/* Description : Once the retries are used up the query is answered NXDOMAIN. */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_give_up(void)
+{
+  unsigned char query[DNS_PAYLOADZ];
+  struct sockaddr_in from;
+  unsigned short id;
+  unsigned int d_ip;
+  int rcode;
+  int i;
+
+  CHECK(park(TEST_NAME, 0x5555) == RET_OK);
+
+  for (i = 0; i <= TEST_RETRIES; i++)
+  {
+    CHECK(pump_fake_recv(fake_socks[i % 2], query, &from, TEST_WAIT_MS) > 0);
+  }
+
+  for (i = 0; (i < TEST_WAIT_MS / 10) && (worker.rslv.head); i++)
+  {
+    pump(10);
+  }
+
+  CHECK(client_recv(&id, &rcode, &d_ip, 100) == 0);
+  CHECK(id == 0x5555);
+  CHECK(rcode == DNS_HDR_RCODE_NAME_ERR);
+  CHECK(fake_recv(fake_socks[0], query, &from, 0) < 0);
+  CHECK(worker.rslv.n_pending == 0);
+  CHECK(worker.rslv.head == NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_coalesce                                                */
+/*                                                                            */
+/* Description : Queries for a name being looked up share the lookup. One     */
+/*               upstream query is sent and its reply answers all of them.    */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_coalesce(void)
+{
+  unsigned char query[DNS_PAYLOADZ];
+  struct sockaddr_in from;
+  unsigned long n_coalesced = dnswld.stats.n_coalesced;
+  unsigned short id;
+  unsigned short ids = 0;
+  unsigned int d_ip;
+  int rcode;
+  int len;
+  int i;
+
+  CHECK(park(TEST_NAME, 0x0601) == RET_OK);
+  CHECK(park(TEST_NAME, 0x0602) == RET_OK);
+  CHECK(park(TEST_NAME, 0x0604) == RET_OK);
+  CHECK(dnswld.stats.n_coalesced == n_coalesced + 2);
+
+  CHECK((len = fake_recv(fake_socks[0], query, &from, 500)) > 0);
+  CHECK(fake_recv(fake_socks[0], query + len, &from, 50) < 0);
+
+  fake_reply(fake_socks[0], query, len, &from, 0, DNS_HDR_RCODE_NO_ERR,
+             TEST_ADDR);
+  pump(50);
+
+  for (i = 0; i < 3; i++)
+  {
+    CHECK(client_recv(&id, &rcode, &d_ip, 100) == 1);
+    CHECK(d_ip == TEST_ADDR);
+    ids |= id;
+  }
+
+  CHECK(ids == 0x0607);
+  CHECK(worker.rslv.n_pending == 0);
+}
+
+
+int main(int argc, char **argv)
+{
+  struct sockaddr_in addr;
+  int i;
+
+  /****************************************************************************/
+  /* Two fake servers, firewall off, cache off so every query goes upstream.  */
+  /****************************************************************************/
+  for (i = 0; i < 2; i++)
+  {
+    fake_socks[i] = open_loopback(&dnswld.rslv.servers[i]);
+    CHECK(fake_socks[i] >= 0);
+  }
+
+  dnswld.rslv.n_servers = 2;
+  dnswld.rslv.timeout_ms = TEST_TIMEOUT_MS;
+  dnswld.rslv.retries = TEST_RETRIES;
+  dnswld.proc.disable_fw = TRUE;
+  dnswld.proc.wl_age = 60;
+
+  listen_sock = open_loopback(&addr);
+  client_sock = open_loopback(&client_addr);
+  CHECK((listen_sock >= 0) && (client_sock >= 0));
+
+  CHECK(init_src_dest_whitelist() == RET_OK);
+  CHECK(create_event_loop(&worker.evloop) == RET_OK);
+  worker.qs = (dns_question *)calloc(DNS_MAX_QUESTIONS, sizeof(dns_question));
+  CHECK(create_resolver(&worker.rslv, &worker.evloop, &worker) == RET_OK);
+
+  if (TEST_RESULT())
+  {
+    return(TEST_RESULT());
+  }
+
+  RUN_TEST(test_answer);
+  RUN_TEST(test_txid_mismatch);
+  RUN_TEST(test_source_port);
+  RUN_TEST(test_timeout_retry);
+  RUN_TEST(test_server_failure);
+  RUN_TEST(test_give_up);
+  RUN_TEST(test_coalesce);
+
+  clean_resolver(&worker.rslv);
+  clean_event_loop(&worker.evloop);
+
+  return(TEST_RESULT());
+}
@@ -0,0 +1,268 @@
+/*FILE+************************************************************************/
+/* Filename    : test_rhash.c                                                 */
+/*                                                                            */
+/* Description : Unit tests of the incremental hash table.                    */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <rhash.h>
+
+#include <test.h>
+
+#define TEST_N_KEYS                               20000
+
+/******************************************************************************/
+/* Keys and whether each is expected in the table. Items point at their key.  */
+/******************************************************************************/
+static unsigned long long keys[TEST_N_KEYS];
+static int is_in[TEST_N_KEYS];
+
+
+/*FUNC+************************************************************************/
+/* Function    : make_keys                                                    */
+/*                                                                            */
+/* Description : Distinct keys: the extremes, a dense run and random values.  */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void make_keys(void)
+{
+  unsigned long long x = 88172645463325252ULL;
+  int i;
+
+  keys[0] = 0;
+  keys[1] = ~0ULL;
+  for (i = 2; i < 1000; i++)
+  {
+    keys[i] = i;
+  }
+
+  for (; i < TEST_N_KEYS; i++)
+  {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    keys[i] = x | (1ULL << 63);
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : count_item                                                   */
+/*                                                                            */
+/* Description : Walk callback. Counts items and checks each is expected.     */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int count_item(void *item, void *arg)
+{
+  int i = (unsigned long long *)item - keys;
+
+  CHECK((i >= 0) && (i < TEST_N_KEYS) && (is_in[i]));
+  (*(int *)arg)++;
+
+  return(0);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : check_table                                                  */
+/*                                                                            */
+/* Description : Every expected key is found with its item, every other one   */
+/*               is not, and count and walk agree.                            */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void check_table(rhash *h)
+{
+  int n_in = 0;
+  int n_walk = 0;
+  int n_bad = 0;
+  int i;
+
+  for (i = 0; i < TEST_N_KEYS; i++)
+  {
+    n_bad += (rhash_find(h, keys[i]) != (is_in[i] ? &keys[i] : NULL));
+    n_in += is_in[i];
+  }
+
+  CHECK(n_bad == 0);
+  CHECK(rhash_count(h) == n_in);
+  CHECK(rhash_walk(h, count_item, &n_walk) == 0);
+  CHECK(n_walk == n_in);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_insert_grow                                             */
+/*                                                                            */
+/* Description : Inserts through several growths. All keys stay findable      */
+/*               while items are split between the old and new arrays.        */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_insert_grow(void)
+{
+  rhash h;
+  int n_migrating = 0;
+  int i;
+
+  memset(is_in, 0, sizeof(is_in));
+  CHECK(rhash_init(&h) == RET_OK);
+  CHECK(h.cur.n_slots == RHASH_MIN_SLOTS);
+
+  for (i = 0; i < TEST_N_KEYS; i++)
+  {
+    CHECK(rhash_insert(&h, keys[i], &keys[i]) == RET_OK);
+    is_in[i] = TRUE;
+
+    if (h.old.slots)
+    {
+      n_migrating++;
+      CHECK(h.old.n_items + h.cur.n_items == i + 1);
+    }
+
+    CHECK(h.cur.n_items * 4 <= h.cur.n_slots * 3);
+
+    /**************************************************************************/
+    /* Full check at powers of two, around growth points.                     */
+    /**************************************************************************/
+    if (!((i + 1) & i))
+    {
+      check_table(&h);
+    }
+  }
+
+  CHECK(n_migrating > 0);
+  CHECK(h.cur.n_slots >= TEST_N_KEYS * 4 / 3);
+  check_table(&h);
+
+  rhash_free(&h);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_delete                                                  */
+/*                                                                            */
+/* Description : Removes hit only their key, including during a migration,    */
+/*               and removed keys can be inserted again.                      */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_delete(void)
+{
+  rhash h;
+  int n_migrating = 0;
+  int i;
+
+  memset(is_in, 0, sizeof(is_in));
+  CHECK(rhash_init(&h) == RET_OK);
+
+  /****************************************************************************/
+  /* Remove every third key as soon as the next is in, so removals land in    */
+  /* both arrays while growing.                                               */
+  /****************************************************************************/
+  for (i = 0; i < TEST_N_KEYS; i++)
+  {
+    CHECK(rhash_insert(&h, keys[i], &keys[i]) == RET_OK);
+    is_in[i] = TRUE;
+
+    if ((i) && (!((i - 1) % 3)))
+    {
+      n_migrating += (h.old.slots != NULL);
+      CHECK(rhash_remove(&h, keys[i - 1]) == &keys[i - 1]);
+      is_in[i - 1] = FALSE;
+    }
+  }
+
+  CHECK(n_migrating > 0);
+  check_table(&h);
+
+  for (i = 0; i < TEST_N_KEYS; i++)
+  {
+    if (!is_in[i])
+    {
+      CHECK(rhash_remove(&h, keys[i]) == NULL);
+    }
+  }
+
+  check_table(&h);
+
+  for (i = 0; i < TEST_N_KEYS; i += 2)
+  {
+    if (is_in[i])
+    {
+      CHECK(rhash_remove(&h, keys[i]) == &keys[i]);
+      is_in[i] = FALSE;
+    }
+    else
+    {
+      CHECK(rhash_insert(&h, keys[i], &keys[i]) == RET_OK);
+      is_in[i] = TRUE;
+    }
+  }
+
+  check_table(&h);
+
+  for (i = 0; i < TEST_N_KEYS; i++)
+  {
+    if (is_in[i])
+    {
+      CHECK(rhash_remove(&h, keys[i]) == &keys[i]);
+      is_in[i] = FALSE;
+    }
+  }
+
+  CHECK(rhash_count(&h) == 0);
+  check_table(&h);
+
+  rhash_free(&h);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : stop_at_third                                                */
+/*                                                                            */
+/* Description : Walk callback. Stops the walk at the third item.             */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int stop_at_third(void *item, void *arg)
+{
+  return((++(*(int *)arg) == 3) ? 7 : 0);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_walk_stop                                               */
+/*                                                                            */
+/* Description : A non-zero callback return stops the walk and is returned.   */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_walk_stop(void)
+{
+  rhash h;
+  int n = 0;
+  int i;
+
+  CHECK(rhash_init(&h) == RET_OK);
+  for (i = 0; i < 10; i++)
+  {
+    CHECK(rhash_insert(&h, keys[i], &keys[i]) == RET_OK);
+  }
+
+  CHECK(rhash_walk(&h, stop_at_third, &n) == 7);
+  CHECK(n == 3);
+
+  rhash_free(&h);
+}
+
+
+int main(int argc, char **argv)
+{
+  make_keys();
+
+  RUN_TEST(test_insert_grow);
+  RUN_TEST(test_delete);
+  RUN_TEST(test_walk_stop);
+
+  return(TEST_RESULT());
+}
@@ -0,0 +1,215 @@
+/*FILE+************************************************************************/
+/* Filename    : test_twheel.c                                                */
+/*                                                                            */
+/* Description : Unit tests of the hierarchical timing wheel.                 */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <twheel.h>
+
+#include <test.h>
+
+#define TEST_MAX_TIMERS                           64
+
+/******************************************************************************/
+/* Timer and the tick it fired at, 0 if it hasn't.                            */
+/******************************************************************************/
+typedef struct _test_timer
+{
+  tw_node node;
+  unsigned long fired_at;
+  int n_fired;
+} test_timer;
+
+static test_timer timers[TEST_MAX_TIMERS];
+
+
+/*FUNC+************************************************************************/
+/* Function    : on_expire                                                    */
+/*                                                                            */
+/* Description : Expiry callback. Records the tick being processed.           */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void on_expire(tw_node *node, void *arg)
+{
+  test_timer *timer = (test_timer *)node->data;
+
+  timer->fired_at = ((twheel *)arg)->cur;
+  timer->n_fired++;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : run_boundaries                                               */
+/*                                                                            */
+/* Description : Add timers one tick either side of each level boundary, from */
+/*               a start tick, and check each fires exactly at its expiry,    */
+/*               once, whatever the step the wheel is advanced by.            */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void run_boundaries(unsigned long start, unsigned long step)
+{
+  static unsigned long spans[] = {1, TW_L0_SLOTS,
+    1UL << (TW_L0_BITS + TW_LN_BITS),
+    1UL << (TW_L0_BITS + 2 * TW_LN_BITS)};
+  twheel *tw;
+  unsigned long now;
+  unsigned long last = 0;
+  int n = 0;
+  int n_bad = 0;
+  int i;
+  int d;
+
+  tw = (twheel *)malloc(sizeof(twheel));
+  tw_init(tw, start);
+  memset(timers, 0, sizeof(timers));
+
+  /****************************************************************************/
+  /* Boundaries relative to the start tick and absolute multiples of each     */
+  /* span, so both aligned and unaligned slots get cascaded.                  */
+  /****************************************************************************/
+  for (i = 0; i < sizeof(spans) / sizeof(spans[0]); i++)
+  {
+    for (d = -1; d <= 1; d++)
+    {
+      timers[n].node.data = &timers[n];
+      tw_add(tw, &timers[n].node, start + spans[i] + d);
+      n++;
+
+      timers[n].node.data = &timers[n];
+      tw_add(tw, &timers[n].node,
+             (start / spans[i] + 2) * spans[i] + d);
+      n++;
+    }
+  }
+
+  CHECK(tw->n_timers == n);
+
+  for (i = 0; i < n; i++)
+  {
+    last = (timers[i].node.expires > last) ? timers[i].node.expires : last;
+  }
+
+  for (now = start; now <= last + step; now += step)
+  {
+    tw_advance(tw, now, on_expire, tw);
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    if ((timers[i].n_fired != 1) ||
+        (timers[i].fired_at != timers[i].node.expires))
+    {
+      fprintf(stderr, "start %lu step %lu: expires %lu fired %d at %lu\n",
+              start, step, timers[i].node.expires, timers[i].n_fired,
+              timers[i].fired_at);
+      n_bad++;
+    }
+  }
+
+  CHECK(n_bad == 0);
+  CHECK(tw->n_timers == 0);
+
+  free(tw);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_cascade_boundaries                                      */
+/*                                                                            */
+/* Description : Timers at slot and level boundaries fire on time from start  */
+/*               ticks on and off those boundaries.                           */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_cascade_boundaries(void)
+{
+  static unsigned long starts[] = {0, 1, TW_L0_SLOTS - 1, TW_L0_SLOTS,
+    TW_L0_SLOTS + 44, (1UL << (TW_L0_BITS + TW_LN_BITS)) - 1, 1000003};
+  int i;
+
+  for (i = 0; i < sizeof(starts) / sizeof(starts[0]); i++)
+  {
+    run_boundaries(starts[i], 1);
+    run_boundaries(starts[i], 97);
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_due_and_clamp                                           */
+/*                                                                            */
+/* Description : A timer already due fires on the next tick; one beyond the   */
+/*               wheel's reach is clamped to it.                              */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_due_and_clamp(void)
+{
+  twheel *tw;
+
+  tw = (twheel *)malloc(sizeof(twheel));
+  tw_init(tw, 5000);
+  memset(timers, 0, sizeof(timers));
+
+  timers[0].node.data = &timers[0];
+  tw_add(tw, &timers[0].node, 4000);
+  CHECK(tw_advance(tw, 5000, on_expire, tw) == 1);
+  CHECK(timers[0].fired_at == 5000);
+
+  timers[1].node.data = &timers[1];
+  tw_add(tw, &timers[1].node, tw->cur + TW_MAX_TICKS + 1000);
+  CHECK(timers[1].node.expires == tw->cur + TW_MAX_TICKS);
+  tw_del(tw, &timers[1].node);
+
+  free(tw);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : test_del                                                     */
+/*                                                                            */
+/* Description : Deleted timers don't fire, from any level. Deleting twice or */
+/*               a timer never added is harmless.                             */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void test_del(void)
+{
+  twheel *tw;
+  int i;
+
+  tw = (twheel *)malloc(sizeof(twheel));
+  tw_init(tw, 0);
+  memset(timers, 0, sizeof(timers));
+
+  for (i = 0; i < 4; i++)
+  {
+    timers[i].node.data = &timers[i];
+    tw_add(tw, &timers[i].node, 10UL << (i * TW_LN_BITS));
+  }
+
+  tw_del(tw, &timers[1].node);
+  tw_del(tw, &timers[1].node);
+  tw_del(tw, &timers[3].node);
+  tw_del(tw, &timers[4].node);
+  CHECK(tw->n_timers == 2);
+
+  CHECK(tw_advance(tw, 10UL << (3 * TW_LN_BITS), on_expire, tw) == 2);
+  CHECK((timers[0].n_fired == 1) && (timers[2].n_fired == 1));
+  CHECK((timers[1].n_fired == 0) && (timers[3].n_fired == 0));
+  CHECK(tw->n_timers == 0);
+
+  free(tw);
+}
+
+
+int main(int argc, char **argv)
+{
+  RUN_TEST(test_cascade_boundaries);
+  RUN_TEST(test_due_and_clamp);
+  RUN_TEST(test_del);
+
+  return(TEST_RESULT());
+}
@@ -0,0 +1,279 @@
+/*FILE+************************************************************************/
+/* Filename    : twheel.c                                                     */
+/*                                                                            */
+/* Description : Hierarchical timing wheel. Adding and removing a timer is    */
+/*               O(1), and a tick only visits the timers that expire on it    */
+/*               plus, once per turn, the slot cascaded from the level above. */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <twheel.h>
+
+
+/*FUNC+************************************************************************/
+/* Function    : list_init                                                    */
+/*                                                                            */
+/* Description : Make a slot sentinel an empty list.                          */
+/*                                                                            */
+/* Params      : head (OUT)               - Slot sentinel.                    */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static inline void list_init(tw_node *head)
+{
+  head->prev = head->next = head;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : list_append                                                  */
+/*                                                                            */
+/* Description : Append node to a slot list.                                  */
+/*                                                                            */
+/* Params      : head (IN/OUT)            - Slot sentinel.                    */
+/*               node (IN/OUT)            - Timer node.                       */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static inline void list_append(tw_node *head, tw_node *node)
+{
+  node->next = head;
+  node->prev = head->prev;
+  head->prev->next = node;
+  head->prev = node;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : list_unlink                                                  */
+/*                                                                            */
+/* Description : Unlink node from its slot list.                              */
+/*                                                                            */
+/* Params      : node (IN/OUT)            - Timer node.                       */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static inline void list_unlink(tw_node *node)
+{
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  node->prev = node->next = NULL;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : place_node                                                   */
+/*                                                                            */
+/* Description : Put node in the slot its expiry falls in.                    */
+/*                                                                            */
+/* Params      : tw (IN/OUT)              - Timing wheel.                     */
+/*               node (IN/OUT)            - Timer node.                       */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void place_node(twheel *tw, tw_node *node)
+{
+  unsigned long expires = node->expires;
+  unsigned long delta = expires - tw->cur;
+  int shift;
+  int level;
+
+  /****************************************************************************/
+  /* Already due. Fire on the next tick.                                      */
+  /****************************************************************************/
+  if ((long)delta < 0)
+  {
+    list_append(&tw->l0[tw->cur & (TW_L0_SLOTS - 1)], node);
+    return;
+  }
+
+  if (delta < TW_L0_SLOTS)
+  {
+    list_append(&tw->l0[expires & (TW_L0_SLOTS - 1)], node);
+    return;
+  }
+
+  for (level = 0, shift = TW_L0_BITS; level < TW_LEVELS - 2; level++)
+  {
+    if (delta < (1UL << (shift + TW_LN_BITS)))
+    {
+      break;
+    }
+    shift += TW_LN_BITS;
+  }
+
+  list_append(&tw->ln[level][(expires >> shift) & (TW_LN_SLOTS - 1)], node);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : cascade                                                      */
+/*                                                                            */
+/* Description : Move the timers of an upper level slot down the wheel.       */
+/*                                                                            */
+/* Params      : tw (IN/OUT)              - Timing wheel.                     */
+/*               level (IN)               - Upper level (0 is the first       */
+/*                                          level above level 0).             */
+/*                                                                            */
+/* Returns     : index                    - Slot index cascaded.              */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static int cascade(twheel *tw, int level)
+{
+  tw_node *head;
+  tw_node *node;
+  int idx;
+
+  idx = (tw->cur >> (TW_L0_BITS + level * TW_LN_BITS)) & (TW_LN_SLOTS - 1);
+  head = &tw->ln[level][idx];
+
+  while ((node = head->next) != head)
+  {
+    list_unlink(node);
+    place_node(tw, node);
+  }
+
+  return(idx);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : tw_init                                                      */
+/*                                                                            */
+/* Description : Initialize an empty timing wheel.                            */
+/*                                                                            */
+/* Params      : tw (OUT)                 - Timing wheel.                     */
+/*               now (IN)                 - Current tick.                     */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void tw_init(twheel *tw, unsigned long now)
+{
+  int i;
+  int ii;
+
+  tw->cur = now;
+  tw->n_timers = 0;
+
+  for (i = 0; i < TW_L0_SLOTS; i++)
+  {
+    list_init(&tw->l0[i]);
+  }
+
+  for (i = 0; i < TW_LEVELS - 1; i++)
+  {
+    for (ii = 0; ii < TW_LN_SLOTS; ii++)
+    {
+      list_init(&tw->ln[i][ii]);
+    }
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : tw_add                                                       */
+/*                                                                            */
+/* Description : Add timer. The node must not be on the wheel.                */
+/*                                                                            */
+/* Params      : tw (IN/OUT)              - Timing wheel.                     */
+/*               node (IN/OUT)            - Timer node.                       */
+/*               expires (IN)             - Expiry tick.                      */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void tw_add(twheel *tw, tw_node *node, unsigned long expires)
+{
+  if (((long)(expires - tw->cur) > 0) && (expires - tw->cur > TW_MAX_TICKS))
+  {
+    expires = tw->cur + TW_MAX_TICKS;
+  }
+
+  node->expires = expires;
+  place_node(tw, node);
+  tw->n_timers++;
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : tw_del                                                       */
+/*                                                                            */
+/* Description : Remove timer. Removing a node not on the wheel is a no-op.   */
+/*                                                                            */
+/* Params      : tw (IN/OUT)              - Timing wheel.                     */
+/*               node (IN/OUT)            - Timer node.                       */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void tw_del(twheel *tw, tw_node *node)
+{
+  if (node->next)
+  {
+    list_unlink(node);
+    tw->n_timers--;
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : tw_advance                                                   */
+/*                                                                            */
+/* Description : Process ticks up to and including now, calling fn for every  */
+/*               timer that expires.                                          */
+/*                                                                            */
+/* Params      : tw (IN/OUT)              - Timing wheel.                     */
+/*               now (IN)                 - Current tick.                     */
+/*               fn (IN)                  - Expiry callback.                  */
+/*               arg (IN)                 - Callback argument.                */
+/*                                                                            */
+/* Returns     : count                    - Number of timers expired.         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int tw_advance(twheel *tw, unsigned long now, tw_expire_fn fn, void *arg)
+{
+  tw_node *head;
+  tw_node *node;
+  int level;
+  int count = 0;
+
+  while ((long)(now - tw->cur) >= 0)
+  {
+    /**************************************************************************/
+    /* A level 0 turn is complete. Pull the next slot of each level down,     */
+    /* going further up only when that level also wraps.                      */
+    /**************************************************************************/
+    if (!(tw->cur & (TW_L0_SLOTS - 1)))
+    {
+      for (level = 0; level < TW_LEVELS - 1; level++)
+      {
+        if (cascade(tw, level))
+        {
+          break;
+        }
+      }
+    }
+
+    head = &tw->l0[tw->cur & (TW_L0_SLOTS - 1)];
+    while ((node = head->next) != head)
+    {
+      list_unlink(node);
+      tw->n_timers--;
+      count++;
+      fn(node, arg);
+    }
+
+    tw->cur++;
+  }
+
+  return(count);
+}
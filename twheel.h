@@ -0,0 +1,67 @@
+/*INC+*************************************************************************/
+/* Filename    : twheel.h                                                     */
+/*                                                                            */
+/* Description : Hierarchical timing wheel header file.                       */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*INC+*************************************************************************/
+
+#ifndef _TWHEEL_H
+#define _TWHEEL_H
+
+/******************************************************************************/
+/* Constants.                                                                 */
+/* - Level 0 has one slot per tick. Each upper level slot spans a full turn   */
+/*   of the level below and is cascaded down when that turn completes.        */
+/* - Timers further out than TW_MAX_TICKS are clamped to it.                  */
+/******************************************************************************/
+#define TW_L0_BITS                                8
+#define TW_LN_BITS                                6
+#define TW_LEVELS                                 4
+#define TW_L0_SLOTS                               (1 << TW_L0_BITS)
+#define TW_LN_SLOTS                               (1 << TW_LN_BITS)
+#define TW_MAX_TICKS                              ((1UL << (TW_L0_BITS + (TW_LEVELS - 1) * TW_LN_BITS)) - 1)
+
+/******************************************************************************/
+/* Timer node. Embedded in the owner, which data points back to.              */
+/******************************************************************************/
+typedef struct _tw_node
+{
+  struct _tw_node *prev;
+  struct _tw_node *next;
+  unsigned long expires;
+  void *data;
+} tw_node;
+
+
+/******************************************************************************/
+/* Timing wheel. Slots are circular lists headed by a sentinel node. cur is   */
+/* the next tick to be processed.                                             */
+/******************************************************************************/
+typedef struct _twheel
+{
+  unsigned long cur;
+  unsigned int n_timers;
+  tw_node l0[TW_L0_SLOTS];
+  tw_node ln[TW_LEVELS - 1][TW_LN_SLOTS];
+} twheel;
+
+
+/******************************************************************************/
+/* Expiry callback. The node is already removed and may be freed.             */
+/******************************************************************************/
+typedef void (*tw_expire_fn)(tw_node *node, void *arg);
+
+
+/******************************************************************************/
+/* Forwards decls.                                                            */
+/******************************************************************************/
+extern void tw_init(twheel *tw, unsigned long now);
+extern void tw_add(twheel *tw, tw_node *node, unsigned long expires);
+extern void tw_del(twheel *tw, tw_node *node);
+extern int tw_advance(twheel *tw, unsigned long now, tw_expire_fn fn,
+                      void *arg);
+
+#endif
@@ -10,6 +10,7 @@
 
 #include <common.h>
 #include <ctype.h>
+#include <time.h>
 
 
 /*FUNC+************************************************************************/
@@ -132,3 +133,207 @@ void dump_labels(char labels[DNS_MAX_NUM_LABELS][DNS_MAX_LABEL_LEN + 1], int n)
   }
 }
 
+
+
+/*FUNC+************************************************************************/
+/* Function    : get_mono_usecs                                               */
+/*                                                                            */
+/* Description : Get monotonic clock in usecs.                                */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : usecs                    - Monotonic timestamp.              */
+/*                                                                            */
+/*FUNC-************************************************************************/
+unsigned long get_mono_usecs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return((unsigned long)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : dns_skip_name                                                */
+/*                                                                            */
+/* Description : Skip encoded DNS name. A compression pointer ends the name.  */
+/*                                                                            */
+/* Params      : pkt (IN)                 - DNS message.                      */
+/*               len (IN)                 - Length of message.                */
+/*               off (IN)                 - Offset of name.                   */
+/*                                                                            */
+/* Returns     : offset                   - Offset after name otherwise -1.   */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int dns_skip_name(unsigned char *pkt, int len, int off)
+{
+  int label_len;
+
+  while (off < len)
+  {
+    label_len = pkt[off];
+
+    if (DNS_IS_PTR(label_len))
+    {
+      return((off + 2 <= len) ? off + 2 : -1);
+    }
+
+    if (label_len > DNS_MAX_LABEL_LEN)
+    {
+      return(-1);
+    }
+
+    off += label_len + 1;
+
+    if (!label_len)
+    {
+      return(off);
+    }
+  }
+
+  return(-1);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : dns_name_equal                                               */
+/*                                                                            */
+/* Description : Compare encoded DNS name against a dotted name, ignoring     */
+/*               case. Compression pointers are followed if they point        */
+/*               strictly before the last one taken, so a loop can't be made. */
+/*                                                                            */
+/* Params      : pkt (IN)                 - DNS message.                      */
+/*               len (IN)                 - Length of message.                */
+/*               off (IN)                 - Offset of name.                   */
+/*               name (IN)                - Dotted name.                      */
+/*                                                                            */
+/* Returns     : TRUE                     - Names are equal otherwise FALSE.  */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int dns_name_equal(unsigned char *pkt, int len, int off, char *name)
+{
+  int label_len;
+  int limit = off;
+  int i;
+
+  while (off < len)
+  {
+    label_len = pkt[off];
+
+    if (DNS_IS_PTR(label_len))
+    {
+      if ((off + 2 > len) || (DNS_PTR_OFF(&pkt[off]) >= limit))
+      {
+        return(FALSE);
+      }
+
+      off = limit = DNS_PTR_OFF(&pkt[off]);
+      continue;
+    }
+
+    if ((label_len > DNS_MAX_LABEL_LEN) || (off + 1 + label_len > len))
+    {
+      return(FALSE);
+    }
+
+    if (!label_len)
+    {
+      return(*name == '\0');
+    }
+
+    /**************************************************************************/
+    /* Compare octet by octet. A NUL or dot octet can't match the dotted name */
+    /* and must not end the compare early.                                    */
+    /**************************************************************************/
+    for (i = 1; i <= label_len; i++, name++)
+    {
+      if ((*name == '\0') || (*name == '.') ||
+          (LOWER_CHAR(pkt[off + i]) != LOWER_CHAR((unsigned char)*name)))
+      {
+        return(FALSE);
+      }
+    }
+
+    if (*name == '.')
+    {
+      name++;
+    }
+    else if (*name != '\0')
+    {
+      return(FALSE);
+    }
+
+    off += label_len + 1;
+  }
+
+  return(FALSE);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : hash_name                                                    */
+/*                                                                            */
+/* Description : FNV-1a hash of a name, ignoring case.                        */
+/*                                                                            */
+/* Params      : name (IN)                - Name.                             */
+/*                                                                            */
+/* Returns     : hash                     - Hash value.                       */
+/*                                                                            */
+/*FUNC-************************************************************************/
+unsigned int hash_name(char *name)
+{
+  unsigned int hash = HASH_NAME_BASIS;
+
+  while (*name)
+  {
+    hash = HASH_NAME_STEP(hash, LOWER_CHAR(*name));
+    name++;
+  }
+
+  return(hash);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : dns_name_to_str                                              */
+/*                                                                            */
+/* Description : Convert an encoded DNS name validated by the question parser */
+/*               to a dotted name. The name is cut short if the buffer is too */
+/*               small.                                                       */
+/*                                                                            */
+/* Params      : msg (IN)                 - DNS message.                      */
+/*               name (IN)                - Encoded name in message.          */
+/*               buf (OUT)                - Dotted name.                      */
+/*               size (IN)                - Size of buffer.                   */
+/*                                                                            */
+/* Returns     : len                      - Length of dotted name.            */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int dns_name_to_str(unsigned char *msg, unsigned char *name, char *buf,
+                    int size)
+{
+  int label_len;
+  int n;
+  int len = 0;
+
+  for (name = DNS_LABEL(msg, name); *name;
+       name = DNS_LABEL(msg, name + label_len + 1))
+  {
+    label_len = *name;
+
+    if ((len) && (len + 1 < size))
+    {
+      buf[len++] = '.';
+    }
+
+    n = (len + label_len < size) ? label_len : size - len - 1;
+    memcpy(&buf[len], name + 1, n);
+    len += n;
+  }
+
+  buf[len] = '\0';
+
+  return(len);
+}
@@ -13,6 +13,14 @@
 
 #include <dns.h>
 
+/******************************************************************************/
+/* FNV-1a name hash, ignoring ASCII case. Exposed so a name can be hashed     */
+/* while it is parsed.                                                        */
+/******************************************************************************/
+#define HASH_NAME_BASIS                           2166136261U
+#define HASH_NAME_STEP(h,c)                       (((h) ^ (unsigned char)(c)) * 16777619U)
+#define LOWER_CHAR(c)                             ((((c) >= 'A') && ((c) <= 'Z')) ? ((c) | 0x20) : (c))
+
 /******************************************************************************/
 /* Forwards decls.                                                            */
 /******************************************************************************/
@@ -22,5 +30,11 @@ extern int dns_name_to_labels(char *name,
                          char label[DNS_MAX_NUM_LABELS][DNS_MAX_LABEL_LEN + 1]);
 extern void dump_labels(char labels[DNS_MAX_NUM_LABELS][DNS_MAX_LABEL_LEN + 1],
                         int n);
+extern unsigned long get_mono_usecs(void);
+extern int dns_skip_name(unsigned char *pkt, int len, int off);
+extern int dns_name_equal(unsigned char *pkt, int len, int off, char *name);
+extern unsigned int hash_name(char *name);
+extern int dns_name_to_str(unsigned char *msg, unsigned char *name, char *buf,
+                           int size);
 
 #endif
@@ -0,0 +1,279 @@
+/*FILE+************************************************************************/
+/* Filename    : worker.c                                                     */
+/*                                                                            */
+/* Description : DNS worker threads. Each worker owns an SO_REUSEPORT socket, */
+/*               an event loop, a packet ring and question scratch memory.    */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*FILE-************************************************************************/
+
+#include <common.h>
+#include <dnswldcb.h>
+#include <network.h>
+#include <worker.h>
+
+
+/*FUNC+************************************************************************/
+/* Function    : worker_main                                                  */
+/*                                                                            */
+/* Description : Worker thread processing loop.                               */
+/*                                                                            */
+/* Params      : param (IN)               - Worker CB.                        */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+static void *worker_main(void *param)
+{
+  worker_cb *worker = (worker_cb *)param;
+  int ret;
+
+  PUTS_OSYS(LOG_DEBUG, "DNS worker [%d]: Started", worker->id);
+
+  while (dnswld.proc.is_running)
+  {
+    ret = run_event_loop(&worker->evloop, EVLOOP_TIMEOUT_MS);
+    if (ret)
+    {
+      break;
+    }
+  }
+
+  PUTS_OSYS(LOG_DEBUG, "DNS worker [%d]: Done", worker->id);
+
+  return(NULL);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : create_worker_listeners                                      */
+/*                                                                            */
+/* Description : Create the DNS socket and event loop of every worker.        */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int create_worker_listeners(void)
+{
+  worker_cb *worker;
+  listeners_cb *listener;
+  int i;
+  int ret;
+
+  for (i = 0; i < dnswld.proc.n_workers; i++)
+  {
+    worker = &dnswld.workers[i];
+    listener = &worker->listener;
+
+    ret = create_event_loop(&worker->evloop);
+    if (ret)
+    {
+      goto EXIT;
+    }
+
+    listener->sock = create_udp_listener(PF_INET, DEF_DNSWLD_IP4,
+                                         DEF_DNSWLD_PORT, TRUE);
+    if (listener->sock < 0)
+    {
+      PUTS_OSYS(LOG_ERR, "Error creating UDP listener for worker [%d]: "
+                "[%s:%d]", i, DEF_DNSWLD_IP4, DEF_DNSWLD_PORT);
+      ret = RET_SOCK_OPEN_ERROR;
+      goto EXIT;
+    }
+
+    listener->port = DEF_DNSWLD_PORT;
+    strncpy(listener->addr4_str, DEF_DNSWLD_IP4,
+            sizeof(listener->addr4_str) - 1);
+    listener->sock_reader = dns_sock_reader;
+    listener->worker = worker;
+
+    ret = add_event_source(&worker->evloop, &listener->ev, listener->sock,
+                           listener->sock_reader, listener);
+    if (ret)
+    {
+      goto EXIT;
+    }
+
+    PUTS_OSYS(LOG_DEBUG, "Worker [%d] listener socket: [%d].", i,
+              listener->sock);
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : clean_worker_listeners                                       */
+/*                                                                            */
+/* Description : Close worker sockets and event loops.                        */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void clean_worker_listeners(void)
+{
+  worker_cb *worker;
+  int i;
+
+  if (!dnswld.workers)
+  {
+    return;
+  }
+
+  for (i = 0; i < dnswld.proc.n_workers; i++)
+  {
+    worker = &dnswld.workers[i];
+
+    if (worker->listener.sock >= 0)
+    {
+      PUTS_OSYS(LOG_DEBUG, "Closing socket: [%d].", worker->listener.sock);
+      close(worker->listener.sock);
+      worker->listener.sock = -1;
+    }
+
+    clean_event_loop(&worker->evloop);
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : create_resolvers                                             */
+/*                                                                            */
+/* Description : Give every worker its own upstream resolver on its own event */
+/*               loop, or the main loop when there are no worker threads.     */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int create_resolvers(void)
+{
+  worker_cb *worker;
+  int i;
+  int ret;
+
+  ret = load_resolv_conf();
+  if (ret)
+  {
+    goto EXIT;
+  }
+
+  for (i = 0; i < (dnswld.proc.n_workers ? dnswld.proc.n_workers : 1); i++)
+  {
+    worker = &dnswld.workers[i];
+
+    ret = create_resolver(&worker->rslv, dnswld.proc.n_workers ?
+                          &worker->evloop : &dnswld.evloop, worker);
+    if (ret)
+    {
+      goto EXIT;
+    }
+  }
+
+  ret = RET_OK;
+
+  EXIT:
+
+  return(ret);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : clean_resolvers                                              */
+/*                                                                            */
+/* Description : Clean up worker resolvers.                                   */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void clean_resolvers(void)
+{
+  int i;
+
+  if (!dnswld.workers)
+  {
+    return;
+  }
+
+  for (i = 0; i < (dnswld.proc.n_workers ? dnswld.proc.n_workers : 1); i++)
+  {
+    clean_resolver(&dnswld.workers[i].rslv);
+  }
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : start_workers                                                */
+/*                                                                            */
+/* Description : Launch worker threads. Must run after daemonizing.           */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : RET_OK                   - Success otherwise error.          */
+/*                                                                            */
+/*FUNC-************************************************************************/
+int start_workers(void)
+{
+  worker_cb *worker;
+  int i;
+  int ret;
+
+  for (i = 0; i < dnswld.proc.n_workers; i++)
+  {
+    worker = &dnswld.workers[i];
+
+    ret = pthread_create(&worker->thread, NULL, worker_main, worker);
+    if (ret)
+    {
+      PUTS_OSYS(LOG_ERR, "Failed to create DNS worker [%d] pthread!", i);
+      return(RET_SYS_ERROR);
+    }
+
+    worker->is_started = TRUE;
+  }
+
+  return(RET_OK);
+}
+
+
+/*FUNC+************************************************************************/
+/* Function    : wait_workers                                                 */
+/*                                                                            */
+/* Description : Wait for worker threads to end.                              */
+/*                                                                            */
+/* Params      : none                                                         */
+/*                                                                            */
+/* Returns     : none                                                         */
+/*                                                                            */
+/*FUNC-************************************************************************/
+void wait_workers(void)
+{
+  int i;
+
+  if (!dnswld.workers)
+  {
+    return;
+  }
+
+  for (i = 0; i < dnswld.proc.n_workers; i++)
+  {
+    if (dnswld.workers[i].is_started)
+    {
+      pthread_join(dnswld.workers[i].thread, NULL);
+      dnswld.workers[i].is_started = FALSE;
+    }
+  }
+}
@@ -0,0 +1,24 @@
+/*INC+*************************************************************************/
+/* Filename    : worker.h                                                     */
+/*                                                                            */
+/* Description : DNS worker threads header file.                              */
+/*                                                                            */
+/* Revisions   : 10/17/26  Sho                                                */
+/*                         - Creation.                                        */
+/*                                                                            */
+/*INC+*************************************************************************/
+
+#ifndef _WORKER_H
+#define _WORKER_H
+
+/******************************************************************************/
+/* Forwards decls.                                                            */
+/******************************************************************************/
+extern int create_worker_listeners(void);
+extern void clean_worker_listeners(void);
+extern int create_resolvers(void);
+extern void clean_resolvers(void);
+extern int start_workers(void);
+extern void wait_workers(void);
+
+#endif